@@ -0,0 +1,52 @@
+#ifndef CACHE_FILE_H_
+#define CACHE_FILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class MappedFile;
+
+// What every on-disk cache shares. A file is a header starting with a Prefix,
+// then a payload. Writes go to a .tmp next to the real name and get renamed over
+// it, so a crash never leaves half a file behind. Each cache has its own magic,
+// and a file from one cache is never mistaken for another's.
+namespace CacheFile {
+    const uint64_t HASH_SEED = 0xcbf29ce484222325ull;
+
+    // FNV-1a's constants, but mixing eight bytes per multiply rather than one, so
+    // it's quick over tens of megabytes. That makes it a different hash from FNV-1a.
+    // Good for keys and checksums, not for anything adversarial. Feed the previous
+    // result back in as seed to chain.
+    uint64_t Hash(const void* data, size_t size, uint64_t seed = HASH_SEED);
+    template <typename T>
+    uint64_t HashValue(const T& value, uint64_t seed) { return Hash(&value, sizeof(T), seed); }
+    uint64_t HashString(const std::string& s, uint64_t seed = HASH_SEED);
+
+    // size and last write time of a source file hashed together, 0 if it's missing
+    uint64_t SourceStamp(const std::string& path);
+
+    struct Prefix {
+        char magic[4];
+        uint32_t version;
+        uint64_t key;
+    };
+    Prefix MakePrefix(const char magic[4], uint32_t version, uint64_t key);
+
+    // CACHE_DIRECTORY/<dir>/<key as hex>.<ext>
+    std::string PathFor(const char* dir, uint64_t key, const char* ext);
+
+    // maps path and copies its header out, false if there's no file, it's shorter
+    // than a header or the prefix isn't magic, version and key. name goes in the log.
+    bool Open(MappedFile& file, const std::string& path, const Prefix& expected, void* header, size_t header_size, const char* name);
+    template <typename Header>
+    bool Open(MappedFile& file, const std::string& path, const Prefix& expected, Header& header, const char* name) {
+        return Open(file, path, expected, &header, sizeof(Header), name);
+    }
+    // checksum of size bytes of payload against the header's, logs a mismatch
+    bool Verify(const unsigned char* payload, size_t size, uint64_t checksum, const std::string& path, const char* name);
+
+    bool Write(const std::string& path, const void* header, size_t header_size, const void* payload, size_t payload_size, const char* name);
+}
+
+#endif // CACHE_FILE_H_
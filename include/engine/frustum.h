@@ -0,0 +1,34 @@
+#ifndef FRUSTUM_H_
+#define FRUSTUM_H_
+
+#include <glm/glm.hpp>
+
+// The six planes of a view projection, for throwing away boxes nobody can see.
+struct Frustum {
+    glm::vec4 planes[6];
+
+    // planes straight out of the matrix (Gribb/Hartmann), inside is positive
+    Frustum(const glm::mat4& m) {
+        glm::vec4 rows[4];
+        for (int i = 0; i < 4; i++) {
+            rows[i] = {m[0][i], m[1][i], m[2][i], m[3][i]};
+        }
+        for (int i = 0; i < 3; i++) {
+            planes[i * 2 + 0] = rows[3] + rows[i];
+            planes[i * 2 + 1] = rows[3] - rows[i];
+        }
+    }
+
+    // conservative, a box near a corner can pass without being in view
+    bool Visible(const glm::vec3& lo, const glm::vec3& hi) const {
+        for (const glm::vec4& p : planes) {
+            glm::vec3 v = {p.x > 0.0f ? hi.x : lo.x, p.y > 0.0f ? hi.y : lo.y, p.z > 0.0f ? hi.z : lo.z};
+            if (glm::dot(glm::vec3(p), v) + p.w < 0.0f) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+#endif // FRUSTUM_H_
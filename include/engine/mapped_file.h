@@ -0,0 +1,38 @@
+#ifndef MAPPED_FILE_H_
+#define MAPPED_FILE_H_
+
+#include <cstddef>
+#include <string>
+
+// Read only view of a whole file straight out of the page cache.
+// Nothing is copied until the bytes get touched, so checking a header
+// and bailing out is cheap even on big files.
+class MappedFile {
+
+    public:
+        MappedFile() = default;
+        ~MappedFile() { Close(); }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        // false if it doesn't exist, is empty or can't be mapped
+        bool Open(const std::string& path);
+        void Close();
+
+        bool IsOpen() const { return data != nullptr; }
+        const unsigned char* Data() const { return data; }
+        size_t Size() const { return size; }
+
+    private:
+        const unsigned char* data = nullptr;
+        size_t size = 0;
+#ifdef _WIN32
+        void* file = nullptr;
+        void* mapping = nullptr;
+#else
+        int fd = -1;
+#endif
+};
+
+#endif // MAPPED_FILE_H_
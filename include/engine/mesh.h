@@ -22,9 +22,21 @@ enum LAYOUT_TYPE {
 	FLOAT3,
 	FLOAT4,
 	UINT,
-	INT
+	INT,
+	// Packed, the CPU side still hands over floats (cnt() of them) and the
+	// entry squeezes them on the way to the GPU
+	QUANTIZED3,    // position as shorts over the mesh's bounds, shaders undo it with vertex_scale/vertex_offset
+	PACKED_NORMAL, // unit vector in 10-10-10-2
+	PACKED_COLOR,  // [0, 1] rgb in bytes
+	UNORM16x2,     // [0, 1] uv in shorts
+	HALF2,         // uv that tiles past 1
+	CONSTANT3      // same for every vertex, no bytes at all, set once per draw
 };
 
+// where shaders read the QUANTIZED3 decode, Mesh sets them to 1 and 0 for everything else
+#define VERTEX_SCALE_LOCATION 14
+#define VERTEX_OFFSET_LOCATION 15
+
 class LayoutEntry {
 public:
 	 LAYOUT_TYPE type;
@@ -36,18 +48,34 @@ public:
 	 size_t size();
 	 unsigned int cnt();
 	 unsigned int gltype();
+	 // what the GPU sees, same as size() * cnt() and cnt() unless packed
+	 unsigned int bytes();
+	 unsigned int glcnt();
+	 bool normalized();
 };
 
 class Layout {
 public:
 	std::vector<LayoutEntry> entries;
-	size_t size;
+	size_t size = 0;   // bytes per vertex on the GPU
+	size_t floats = 0; // floats per vertex in Mesh::vertices
 
 	Layout() = default;
 	Layout(std::initializer_list<LayoutEntry> ents);
+	Layout(const std::vector<LayoutEntry>& ents);
+
+	bool Packed() const { return size != floats * sizeof(float); }
 };
 
 
+// What packing a layout leaves besides the bytes: the QUANTIZED3 decode and the
+// CONSTANT3 values. Identity and empty for layouts that aren't packed.
+struct VertexPacking {
+	glm::vec3 scale = glm::vec3(1.0f);
+	glm::vec3 offset = glm::vec3(0.0f);
+	std::vector<std::pair<unsigned int, glm::vec3>> constants; // location, value
+};
+
 //classic position, normal, texture 
 static const Layout default_layout({
 		{FLOAT3, "position"}, 
@@ -55,6 +83,16 @@ static const Layout default_layout({
 		{FLOAT2, "uv"}
 		});
 
+// vertex, normal, color, uv, tangent at 20 bytes instead of 56, for meshes
+// whose color is the same everywhere and uvs stay in [0, 1]
+static const Layout packed_layout({
+		{QUANTIZED3, "vertex"},
+		{PACKED_NORMAL, "normal"},
+		{CONSTANT3, "color"},
+		{UNORM16x2, "uv"},
+		{PACKED_NORMAL, "tangent"}
+		});
+
 class Mesh {
 	public:
 		std::vector<float> vertices;
@@ -67,12 +105,44 @@ class Mesh {
         Mesh(std::vector<float> verts, std::vector<unsigned int> inds, Layout = default_layout);
 		// Mesh(std::vector<Vertex> verts, std::vector<unsigned int> inds, std::vector<Texture> textures, Layout = default_layout);
 		Mesh(const float* verts, size_t num_verts, const unsigned int* indices, size_t num_indices, Layout = default_layout);
+		// Vertices already packed for the GPU (gpu_size bytes, with what packing
+		// left over) and indices already in index_type (GL_UNSIGNED_SHORT or
+		// GL_UNSIGNED_INT), say straight out of a mapped MeshCache file. Both go to
+		// glBufferData as they are, verts and inds still get copied into vertices
+		// and indices for the CPU side.
+		Mesh(const float* verts, size_t num_verts, const void* gpu_verts, size_t gpu_size, const VertexPacking& packing,
+		     const void* inds, size_t num_indices, unsigned int index_type, Layout layout);
 		void Draw(int intances = 0);
+		// indices [first, first + count) only, for meshes drawn in pieces
+		void DrawRange(size_t first, size_t count, int instances = 0);
+		// frees the GL buffers, copies share them so only the last one standing should call it
+		void Release();
+		// Points attributes 0 up to the layout's size at this mesh's buffers in
+		// whatever VAO is bound, for VAOs that add their own per instance
+		// attributes after them. Returns how many attributes it used.
+		unsigned int BindAttributes();
+		// The QUANTIZED3 decode and CONSTANT3 values, generic attribute state
+		// isn't kept in the VAO so this goes before every draw. Draw and
+		// DrawRange do it themselves.
+		void SetConstantAttributes();
+		// GL_UNSIGNED_SHORT when every index fits, the EBO holds that type
+		// while indices above stays 32 bit for the CPU side
+		unsigned int IndexType() const { return index_type; }
+		size_t IndexSize() const { return index_type == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int); }
+		// furthest any vertex gets from the mesh's origin
+		float Radius() const { return radius; }
+		// vertices as the GPU gets them, the same floats unless the layout is packed
+		void PackVertices(std::vector<unsigned char>& out, VertexPacking& out_packing) const;
+		const VertexPacking& Packing() const { return packing; }
 
 	private:
 		unsigned int VBO, EBO, VAO;
+		unsigned int index_type = GL_UNSIGNED_INT;
+		float radius = 0.0f;
+		VertexPacking packing;
 
 		void SetupBuffers();
+		void CreateBuffers(const void* vertex_data, size_t vertex_size, const void* index_data);
 		static size_t sz(LayoutEntry t);
 		static unsigned int cnt(LayoutEntry t);
 		static unsigned int gltype(LayoutEntry t);
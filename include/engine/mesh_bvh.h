@@ -0,0 +1,78 @@
+#ifndef MESH_BVH_H_
+#define MESH_BVH_H_
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <glm/glm.hpp>
+
+class Mesh;
+
+// Bounding volume hierarchy over the triangles of a mesh, in mesh space.
+// Built top down with binned SAH, nodes are stored depth first and quantized
+// to 16 bits per bound against the mesh bounds (16 bytes a node).
+// Built once per mesh and shared by every collider that uses it.
+class MeshBVH {
+
+    public:
+        struct RayHit {
+            float t;
+            unsigned int triangle;
+            glm::vec3 normal; // geometric, not normalized into any space but mesh space
+        };
+
+        MeshBVH() = default;
+        MeshBVH(const Mesh& mesh);
+
+        // positions are the first 3 floats of every `stride` floats
+        void Build(const float* verts, size_t stride, size_t num_verts, const unsigned int* inds, size_t num_inds);
+
+        // Calls fn for every triangle whose node bounds overlap [lo, hi],
+        // stops early as soon as fn returns true. Returns whether it stopped.
+        bool QueryAABB(const glm::vec3& lo, const glm::vec3& hi, const std::function<bool(unsigned int)>& fn) const;
+
+        bool SphereIntersect(const glm::vec3& center, float radius) const;
+        bool Raycast(const glm::vec3& origin, const glm::vec3& dir, float max_t, RayHit& hit) const;
+
+        void GetTriangle(unsigned int tri, glm::vec3& a, glm::vec3& b, glm::vec3& c) const {
+            a = tri_verts[tri * 3 + 0];
+            b = tri_verts[tri * 3 + 1];
+            c = tri_verts[tri * 3 + 2];
+        }
+
+        size_t NumTriangles() const { return tri_verts.size() / 3; }
+        size_t NumNodes() const { return nodes.size(); }
+        bool Empty() const { return nodes.empty(); }
+        const glm::vec3& GetMin() const { return bounds_min; }
+        const glm::vec3& GetMax() const { return bounds_max; }
+
+        static glm::vec3 ClosestPointOnTriangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c);
+        static bool RayTriangle(const glm::vec3& origin, const glm::vec3& dir, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, float& t);
+
+    private:
+        // leaf: count > 0, first triangle at offset
+        // inner: count == 0, left child follows this node, right child at offset
+        struct Node {
+            uint16_t qmin[3];
+            uint16_t qmax[3];
+            uint32_t offset : 28;
+            uint32_t count : 4;
+        };
+
+        struct BuildTri {
+            glm::vec3 lo, hi, centroid;
+            unsigned int index;
+        };
+
+        unsigned int BuildRecursive(std::vector<BuildTri>& tris, size_t begin, size_t end, int depth, std::vector<unsigned int>& order);
+        void Quantize(const glm::vec3& lo, const glm::vec3& hi, Node& n) const;
+        void Dequantize(const Node& n, glm::vec3& lo, glm::vec3& hi) const;
+
+        std::vector<Node> nodes;
+        std::vector<glm::vec3> tri_verts; // reordered to match the leaves
+        glm::vec3 bounds_min = glm::vec3(0.0f);
+        glm::vec3 bounds_max = glm::vec3(0.0f);
+        glm::vec3 quant_scale = glm::vec3(0.0f);
+};
+
+#endif // MESH_BVH_H_
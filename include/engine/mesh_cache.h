@@ -0,0 +1,27 @@
+#ifndef MESH_CACHE_H_
+#define MESH_CACHE_H_
+
+#include <cstdint>
+#include <string>
+
+class Mesh;
+
+// Finished meshes on disk under CACHE_DIRECTORY/meshes, one file per key:
+// a header with the layout, bounds, packing and a checksum of what follows,
+// then the float vertices for the CPU side, the packed vertices for packed
+// layouts and the indices. Loading maps the file and uploads the GPU blobs
+// straight out of the mapping, nothing gets packed again.
+// Meshes from files are keyed by path and also carry a stamp of the source's
+// size and modification time, touching the file makes the entry stale.
+// Generated meshes key on the generator and its arguments with a stamp of 0.
+// Keys and stamps come from CacheFile's hashes.
+namespace MeshCache {
+    // bump whenever a loader, generator, OptimizeMesh or the file layout changes
+    const uint32_t VERSION = 4;
+
+    std::string PathFor(uint64_t key);
+    bool Load(uint64_t key, uint64_t source_stamp, Mesh& mesh);
+    bool Save(uint64_t key, uint64_t source_stamp, const Mesh& mesh);
+}
+
+#endif // MESH_CACHE_H_
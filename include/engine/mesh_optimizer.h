@@ -0,0 +1,29 @@
+#ifndef MESH_OPTIMIZER_H_
+#define MESH_OPTIMIZER_H_
+
+#include <cstddef>
+#include <vector>
+
+// entries in the post transform cache ACMR is measured against, FIFO like the hardware
+#define MESH_ACMR_CACHE_SIZE 16
+
+struct MeshOptimizeStats {
+    size_t vertices_before = 0;
+    size_t vertices_after = 0;
+    float acmr_before = 0.0f;  // vertex shader runs per triangle
+    float acmr_after = 0.0f;
+};
+
+// Gets an indexed triangle list ready for the GPU, stride is floats per vertex.
+//  - welds vertices whose floats are bit for bit the same
+//  - reorders triangles for the post transform cache (Forsyth's linear speed
+//    vertex cache optimisation)
+//  - renumbers vertices in the order the triangles first use them, so fetches
+//    walk forwards through the buffer
+// The triangles themselves, their winding and what each vertex holds don't change.
+MeshOptimizeStats OptimizeMesh(std::vector<float>& vertices, std::vector<unsigned int>& indices, size_t stride);
+
+// average cache misses per triangle for a FIFO of cache_size, 3 is no reuse at all
+float ComputeACMR(const std::vector<unsigned int>& indices, size_t vertex_count, int cache_size = MESH_ACMR_CACHE_SIZE);
+
+#endif // MESH_OPTIMIZER_H_
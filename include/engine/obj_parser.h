@@ -0,0 +1,26 @@
+#ifndef OBJ_PARSER_H_
+#define OBJ_PARSER_H_
+
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+// What an OBJ file describes, faces already cut into triangles.
+// Corner indices are resolved to 0 based, negative (relative) ones included,
+// and -1 where the corner left the uv or normal out.
+struct ObjGeometry {
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec2> uvs;
+    std::vector<glm::vec3> normals;
+    std::vector<glm::ivec3> corners; // position, uv, normal, three per triangle
+};
+
+// Parses the file straight out of a MappedFile with std::from_chars, nothing
+// gets allocated per line. N-gons are fanned into triangles. Files over
+// OBJ_PARALLEL_BYTES are cut into chunks at line breaks and parsed on the
+// ThreadPool, the result is the same as parsing it in one go.
+// Only geometry is read, groups, materials and the rest are skipped.
+#define OBJ_PARALLEL_BYTES (1 << 20)
+bool LoadObj(const std::string& path, ObjGeometry& out);
+
+#endif // OBJ_PARSER_H_
@@ -0,0 +1,31 @@
+#ifndef PROGRAM_CACHE_H_
+#define PROGRAM_CACHE_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Linked program binaries under CACHE_DIRECTORY/programs, one file per key.
+// The key hashes every stage's source together with the GL vendor, renderer
+// and version strings, so editing a shader or updating the driver just misses.
+// Drivers may still refuse a binary (the program doesn't link), callers check
+// GL_LINK_STATUS when they first need the program, compile from source then
+// and save over it.
+namespace ProgramCache {
+    // bump whenever the file layout changes
+    const uint32_t VERSION = 1;
+
+    // needs program binaries and at least one binary format, GL thread only
+    bool Supported();
+
+    uint64_t KeyFor(const std::vector<std::string>& sources);
+    std::string PathFor(uint64_t key);
+
+    // into a fresh program object, true if a binary was handed to the driver.
+    // Whether it took only shows in the program's link status.
+    bool Load(uint64_t key, unsigned int program);
+    // program has to be linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set
+    bool Save(uint64_t key, unsigned int program);
+}
+
+#endif // PROGRAM_CACHE_H_
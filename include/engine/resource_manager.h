@@ -2,6 +2,9 @@
 #define RESOURCE_MANAGER_H_
 
 #include "random.h"
+#include <chrono>
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 #include <unordered_map>
@@ -13,7 +16,10 @@
 
 #include "resource.h"
 #include "mesh.h"
+#include "mesh_bvh.h"
 #include "texture.h"
+#include "texture_loader.h"
+#include "texture_budget.h"
 #include "shader.h"
 #include "defines.h"
 
@@ -29,8 +35,12 @@ class ResourceManager {
         ~ResourceManager() = default;
 
         Mesh* GetMesh(const std::string& name);
+        bool HasMesh(const std::string& name) const { return meshes.count(name) > 0; }
         Shader* GetShader(const std::string& name);
         Texture* GetTexture(const std::string& name);
+        // built on first use and shared by everyone colliding against that mesh,
+        // reloading the mesh builds a new one without freeing what colliders hold
+        std::shared_ptr<const MeshBVH> GetMeshBVH(const std::string& name);
 
         Shader* GetScreenSpaceShader();
 
@@ -39,9 +49,20 @@ class ResourceManager {
         void LoadShader(const std::string& name, const std::string& vert_path, const std::string& frag_path, const std::string& geom_path = "", bool instaced = false);
         void LoadMesh(const std::string& name, const std::string& path);
         void AddMesh(const std::string& name, std::vector<float> verts, std::vector<unsigned int> inds, Layout layout);
-        void LoadTexture(const std::string& name, const std::string& path, int wrap_option = GL_REPEAT, int sample_option = GL_NEAREST);
+        // compressed textures are cooked to BC1/BC3, or BC5 for normal maps, with their mips on first load
+        void LoadTexture(const std::string& name, const std::string& path, int wrap_option = GL_REPEAT, int sample_option = GL_NEAREST, bool compress = true);
         void LoadCubemap(const std::string& name, const std::string& dir_path, bool legacyLoading = true);
 
+        // textures show a placeholder until their decode finishes, Update uploads a
+        // frame's worth and lets the TextureBudget drop or restore mip levels. It also
+        // finalizes shaders the driver is done compiling and reports once they all are
+        void Update();
+        // blocks until every texture requested so far is uploaded
+        void FinishLoading();
+        // pixels is how wide one repeat of the texture is on screen, see TextureBudget::Use
+        void UseTexture(const Texture* texture, float pixels) { texture_budget.Use(texture->id, pixels); }
+        void PrintTextureReport();
+
         void CreateTorus(std::string object_name, float loop_radius = 0.6, float circle_radius = 0.2, int num_loop_samples = 90, int num_circle_samples = 30);
         void CreateSphere(std::string object_name, float radius = 0.6, int num_samples_theta = 90, int num_samples_phi = 45);
         void CreateCylinder(std::string object_name, float height = 1.0, float radius = 0.6, int num_samples_theta = 90, int num_samples_phi = 45);
@@ -54,6 +75,7 @@ class ResourceManager {
         void CreateSimpleQuad(std::string object_name);
         void CreateSimpleCube(std::string object_name);
         void CreateSaplingQuad(std::string name);;
+        void CreateGrassTuft(std::string object_name, int num_blades = 7, float height = 1.0f, float blade_width = 0.08f);
         void CreateSnowParticles(std::string object_name, int num_particles = 500, float spread_range = 100, int density = 20, float yposition = 8);
 
         
@@ -62,11 +84,23 @@ class ResourceManager {
         std::unordered_map<std::string, Mesh>         meshes;
         std::unordered_map<std::string, Shader>       shaders;
         std::unordered_map<std::string, Texture>      textures;
+        // shared so a collider keeps its tree when the mesh under the name is replaced
+        std::unordered_map<std::string, std::shared_ptr<const MeshBVH>> mesh_bvhs;
+        TextureLoader                                 texture_loader;
+        TextureBudget                                 texture_budget{texture_loader};
 
         std::string screenSpaceShader = ""; 
+        // from the first LoadShader until every shader is ready
+        bool shaders_compiling = false;
+        std::chrono::steady_clock::time_point shaders_started;
         // std::unordered_map<std::string, Sound>     sounds;
 
         std::string LoadTextFile(const char *filename);
+        void UpdateShaders();
+
+        // generated meshes go through the MeshCache too, keyed on the generator and its arguments
+        bool LoadCachedMesh(const std::string& name, uint64_t key);
+        void AddCachedMesh(const std::string& name, uint64_t key, Mesh&& mesh);
 
 
 }; // class ResourceManager
@@ -71,7 +71,18 @@ public:
     // Update entire scene
     void Update(double dt);
 
+    // Scene queries, nearest hit first. Rays test terrain through its min/max
+    // quadtree and sweeps step the sphere over it, everything else goes through
+    // the collision manager's broadphase.
+    bool Raycast(const Ray& ray, QueryHit& hit, int filter = QUERY_DEFAULT);
+    bool SweepSphere(const Ray& ray, float radius, QueryHit& hit, int filter = QUERY_DEFAULT);
+    void Overlap(const glm::vec3& center, float radius, std::vector<QueryHit>& out, int filter = QUERY_DEFAULT);
+    // One hit per ray (check QueryHit::Hit), rays are spread over the thread pool
+    void RaycastBatch(const std::vector<Ray>& rays, std::vector<QueryHit>& hits, int filter = QUERY_DEFAULT);
+
 private:
+    bool CastInternal(const Ray& ray, float radius, QueryHit& hit, int filter);
+
     // Background color
     glm::vec3 background_color_;
     std::list<std::shared_ptr<SceneNode>> node_;
@@ -20,6 +20,12 @@
 
 class Collider;
 
+// Which pass of View is drawing
+enum class RenderPass {
+    COLOR,
+    DEPTH
+};
+
 // Class that manages one object in a scene 
 class SceneNode {
 
@@ -31,6 +37,9 @@ class SceneNode {
         float diffuse_strength  = 0.8f;
         float ambient_additive = 0.0f;
         float specular_coefficient = 1.0f;
+        // pick the shader variant, for shaders that declare these keywords
+        bool receive_shadows = true;
+        bool alpha_test = true;
     };
 
     public:
@@ -77,6 +86,11 @@ class SceneNode {
 
         virtual void HandleCollisionWith(SceneNode* collider) {};
 
+        // For nodes that draw their own geometry instead of one mesh (chunked terrain),
+        // return true once drawn. The view projection is the camera's for COLOR and the
+        // light's for DEPTH, the eye is always the camera's so both passes pick the same detail.
+        virtual bool CustomDraw(Shader*, const glm::mat4&, const glm::vec3&, RenderPass) { return false; }
+
         Transform transform;
         MaterialProperties material;
         bool active = true;
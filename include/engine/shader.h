@@ -12,6 +12,8 @@
 #include <iostream>
 #include <vector>
 #include <memory>
+#include <chrono>
+#include <unordered_map>
 #include "path_config.h"
 #include "transform.h"
 
@@ -42,6 +44,16 @@ struct LightsBlock {
     ShaderLight lights[MAX_LIGHTS];
 };
 
+// Features a shader source can be compiled with or without. A source lists the
+// ones it knows with "#pragma keywords INSTANCED SHADOWS ..." and each variant
+// gets a #define per keyword it was asked for.
+enum SHADER_KEYWORD {
+    KEYWORD_INSTANCED  = 1 << 0,  // per instance transforms from TransformsBlock
+    KEYWORD_SHADOWS    = 1 << 1,  // samples shadow_map
+    KEYWORD_NORMAL_MAP = 1 << 2,  // bumps the normal with normal_map
+    KEYWORD_ALPHA      = 1 << 3   // discards nearly transparent texels
+};
+
 class Light;
 
 class Shader {
@@ -52,13 +64,32 @@ public:
     LightsBlock lightsblock;
     TransformsBlock* transformsblock;
 	unsigned int id;
-	Shader(const char* vertex_path, const char* frag_path, const char* geom_path = "", bool instanced = false);
+	Shader(const char* vertex_path, const char* frag_path, const char* geom_path = "", bool instanced = false, unsigned int keywords = 0);
 	Shader() = default;
 	~Shader() = default;
 	bool Load();
 	void Reload();
-	void Use() const;
-    void Finalize(int num_lights);
+	// finalizes the program first if it's still compiling
+	void Use();
+    // waits for the driver to finish compiling and linking, reports errors and
+    // sets up the uniform blocks. With parallel compile the constructor only
+    // submits the work and this happens on first use, otherwise right away
+    void Finalize();
+    // true once the program is linked and finalized, never waits
+    bool Ready();
+    // main thread time spent loading, compiling and waiting on this program
+    double BlockedMs() const { return blocked_ms; }
+    std::chrono::steady_clock::time_point FinalizedAt() const { return finalized_at; }
+    // GL_KHR_parallel_shader_compile or the ARB version, GL thread only
+    static bool ParallelCompile();
+
+    // the program compiled with the declared ones of keywords, built the first
+    // time it's asked for and kept until this shader goes away
+    Shader* Variant(unsigned int keywords);
+    unsigned int Keywords() const { return keywords; }
+    unsigned int DeclaredKeywords() const { return declared_keywords; }
+    // the ones built so far
+    std::vector<Shader*> Variants() const;
 
     void SetupInstancing();
     void SetupLighting();
@@ -67,8 +98,10 @@ public:
     int SetInstances(std::vector<Transform>& transforms, const glm::mat4& view_matrix, bool cull = true);
     
 	void SetUniform1f(float u, const std::string& name);
+	void SetUniform2f(const glm::vec2& u, const std::string& name);
 	void SetUniform3f(const glm::vec3& u, const std::string& name);
 	void SetUniform4f(const glm::vec4& u, const std::string& name);
+	void SetUniform4fv(const glm::vec4* v, int len, const std::string& name);
 	void SetUniform2m(const glm::mat3& u, const std::string& name);
 	void SetUniform3m(const glm::mat3& u, const std::string& name);
 	void SetUniform4m(const glm::mat4& u, const std::string& name);
@@ -88,6 +121,21 @@ private:
     unsigned int lights_ubo;
     unsigned int instanced_ubo;
 
+    bool instanced = false;
+    unsigned int keywords = 0;
+    unsigned int declared_keywords = 0;
+    std::unordered_map<unsigned int, std::shared_ptr<Shader>> variants;
+
+    // submitted by Load and not finalized yet
+    bool pending = false;
+    unsigned int stages[3] = {0, 0, 0};
+    bool cacheable = false;
+    bool from_cache = false;  // id holds a cached binary, not checked yet
+    bool skip_cache = false;
+    uint64_t cache_key = 0;
+    double blocked_ms = 0.0;
+    std::chrono::steady_clock::time_point finalized_at;
+
 
 };
 
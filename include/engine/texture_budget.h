@@ -0,0 +1,74 @@
+#ifndef TEXTURE_BUDGET_H_
+#define TEXTURE_BUDGET_H_
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+#include "texture_loader.h"
+
+// resident texture memory Update tries to stay under
+#define TEXTURE_BUDGET_BYTES (256ull << 20)
+// how long a texture goes without being drawn that sharp before it may lose another level
+#define TEXTURE_RELAX_SECONDS 2.0
+// dropping levels stops once the largest side gets down to this
+#define TEXTURE_MIN_SIZE 128
+
+// Keeps track of what every texture holds on the GPU and how sharp it's been
+// drawn lately. View reports the mip each draw would sample, textures that
+// haven't needed their top levels for a while relax towards smaller ones. Only
+// when residency goes over the budget do the unneeded top levels of cooked
+// textures get dropped, biggest savings first, by reloading them from the
+// TextureCache with the top cut off. Textures drawn sharper than what they
+// hold get their levels back as soon as that fits. Uncompressed and never
+// drawn textures are counted but left alone.
+class TextureBudget {
+
+    public:
+        TextureBudget(TextureLoader& loader) : loader(loader) {}
+
+        // before asking the loader for it, with the same arguments
+        void Track(const std::string& name, unsigned int texture, const std::string& path, bool flip, TEXTURE_COOK cook);
+        // from the renderer for every draw, pixels is how wide one repeat of the texture is on screen
+        void Use(unsigned int texture, float pixels);
+
+        // once a frame after the loader's Update
+        void Update();
+
+        void SetBudget(size_t bytes) { budget = bytes; }
+        size_t Budget() const { return budget; }
+        size_t Resident() const;
+
+        // one line per texture, biggest first
+        void Report(std::ostream& out) const;
+
+    private:
+        struct Entry {
+            std::string name;
+            std::string path;
+            bool flip;
+            TEXTURE_COOK cook;
+
+            unsigned int format = 0;
+            int width = 1;
+            int height = 1;
+            int first_level = 0;  // dropped levels in the texture now
+            int requested = 0;    // what the last request asked for, first_level once it's done
+            size_t bytes = 3;     // the 1x1 placeholder to begin with
+
+            int wanted = 0;       // sharpest level drawn lately
+            bool seen = false;
+            double last_sharp = 0.0;
+        };
+
+        size_t BytesAt(const Entry& e, int first_level) const;
+        int MaxFirstLevel(const Entry& e) const;
+        void Reload(unsigned int texture, Entry& e, int first_level);
+
+        TextureLoader& loader;
+        std::unordered_map<unsigned int, Entry> entries;
+        size_t budget = TEXTURE_BUDGET_BYTES;
+};
+
+#endif // TEXTURE_BUDGET_H_
@@ -0,0 +1,48 @@
+#ifndef TEXTURE_CACHE_H_
+#define TEXTURE_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// what a texture gets cooked into
+enum TEXTURE_COOK {
+    COOK_NONE,    // uploaded as decoded, mipmapped by the driver
+    COOK_COLOR,   // BC1, or BC3 when the image has alpha
+    COOK_NORMAL   // BC5, x and y only, shaders rebuild z
+};
+
+// Block compressed textures with their whole mip chain, cooked the first time
+// an image is loaded and kept under CACHE_DIRECTORY/textures. A file is a header
+// followed by every level from the largest down to 1x1, each ready for
+// glCompressedTexImage2D. Entries are keyed like the MeshCache, by path and how
+// the image is loaded, and go stale when the source's size or mtime changes.
+namespace TextureCache {
+    // bump whenever the encoders, the mip filter or the file layout change
+    const uint32_t VERSION = 1;
+
+    // needs the s3tc and rgtc formats, GL thread only
+    bool Supported();
+
+    unsigned int FormatFor(TEXTURE_COOK cook, int channels);
+    int LevelCount(int width, int height);
+    size_t LevelSize(unsigned int format, int width, int height);
+    size_t ChainSize(unsigned int format, int width, int height);
+    // where level starts in the chain, ChainSize minus it is that level and everything below
+    size_t LevelOffset(unsigned int format, int width, int height, int level);
+
+    uint64_t KeyFor(const std::string& path, bool flip, TEXTURE_COOK cook);
+    std::string PathFor(uint64_t key);
+
+    // only reads the header, true if the entry is there and current
+    bool Peek(uint64_t key, uint64_t source_stamp, unsigned int& format, int& width, int& height);
+    // copies size bytes of the mip chain from offset on after checking the whole
+    // chain against the header's checksum
+    bool Read(uint64_t key, uint64_t source_stamp, unsigned char* dest, size_t size, size_t offset = 0);
+    bool Save(uint64_t key, uint64_t source_stamp, unsigned int format, int width, int height, const unsigned char* data, size_t size);
+
+    // rgba pixels in, ChainSize bytes out
+    void Cook(const unsigned char* rgba, int width, int height, unsigned int format, unsigned char* dest);
+}
+
+#endif // TEXTURE_CACHE_H_
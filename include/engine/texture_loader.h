@@ -0,0 +1,106 @@
+#ifndef TEXTURE_LOADER_H_
+#define TEXTURE_LOADER_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "texture_cache.h"
+
+// GL time Update may spend finishing textures each frame, one always gets done
+#define TEXTURE_UPLOAD_BUDGET_MS 4.0
+// pixel buffers mapped and waiting on a decode at once, at least one is
+#define TEXTURE_IN_FLIGHT_BYTES (256u << 20)
+
+// Fills textures that already exist (with a placeholder in them) from image
+// files without holding up the GL thread. Request reads the file headers and
+// maps a pixel buffer big enough, the ThreadPool decodes straight into it, and
+// Update hands finished buffers to glTexImage2D, which copies out of the PBO
+// asynchronously. Anything waiting on the in-flight limit starts as earlier
+// requests finish. 2D textures asked to be cooked come out of the TextureCache
+// block compressed with their mips, cooking them on the worker the first time.
+class TextureLoader {
+
+    public:
+        TextureLoader();
+        // waits for decodes still writing into mapped buffers, so before the GL context goes
+        ~TextureLoader();
+
+        TextureLoader(const TextureLoader&) = delete;
+        TextureLoader& operator=(const TextureLoader&) = delete;
+
+        // target is GL_TEXTURE_2D with one path or GL_TEXTURE_CUBE_MAP with six,
+        // in +X, -X, +Y, -Y, +Z, -Z order. cook only applies to GL_TEXTURE_2D with
+        // mipmaps, and so does first_level: the cooked chain's levels above it are
+        // left out and the rest moves up, for the TextureBudget to trade resolution for memory
+        void Request(unsigned int texture, unsigned int target, const std::vector<std::string>& paths, bool flip, bool mipmaps, TEXTURE_COOK cook = COOK_NONE, int first_level = 0);
+
+        // on the GL thread once a frame, a budget of 0 only starts waiting requests
+        void Update(double budget_ms = TEXTURE_UPLOAD_BUDGET_MS);
+        // blocks until everything requested is in its texture
+        void Finish();
+
+        size_t Pending() const { return waiting.size() + in_flight; }
+
+        // what each finished request left in its texture
+        struct Uploaded {
+            unsigned int texture;
+            bool ok;             // false kept whatever the texture had before
+            unsigned int format; // compressed format or 0
+            int width;           // of the source, level first_level is what's at level 0
+            int height;
+            int first_level;
+            size_t bytes;        // on the GPU, roughly for uncompressed ones
+        };
+        // everything finished since the last call
+        std::vector<Uploaded> TakeUploaded();
+
+    private:
+        struct Job {
+            unsigned int texture;
+            unsigned int target;
+            std::vector<std::string> paths;
+            bool flip;
+            bool mipmaps;
+            TEXTURE_COOK cook;
+            int first_level;
+
+            unsigned int format = 0;  // compressed format, 0 for plain rgb(a)
+            bool cached = false;      // the TextureCache had it at Start
+            uint64_t key = 0;
+            uint64_t stamp = 0;
+            int width = 0;
+            int height = 0;
+            int channels = 0;
+            size_t face_bytes = 0;
+            unsigned int pbo = 0;
+            unsigned char* mapped = nullptr;
+            bool ok = false;
+        };
+
+        struct Mailbox {
+            std::mutex mutex;
+            std::condition_variable arrived;
+            std::vector<std::shared_ptr<Job>> done;
+        };
+
+        bool Start(const std::shared_ptr<Job>& job);
+        static void Decode(const std::shared_ptr<Mailbox>& box, const std::shared_ptr<Job>& job);
+        // decodes as rgba and compresses into the mapping, saving to the TextureCache on the way
+        static bool Cook(Job& job);
+        void Upload(Job& job);
+        void Finished(const Job& job, bool ok);
+
+        std::shared_ptr<Mailbox> mailbox;
+        std::deque<std::shared_ptr<Job>> waiting;  // not started yet
+        std::deque<std::shared_ptr<Job>> decoded;  // taken from the mailbox, not uploaded yet
+        std::vector<Uploaded> uploaded;
+        size_t in_flight = 0;
+        size_t in_flight_bytes = 0;
+};
+
+#endif // TEXTURE_LOADER_H_
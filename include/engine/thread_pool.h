@@ -0,0 +1,68 @@
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Small fixed size worker pool shared by the engine and the game.
+// ParallelFor splits [0, count) into chunks of `grain` and hands them out to
+// the workers, the calling thread helps out too so nothing sits idle waiting.
+// The worker index passed to the callback is stable for the duration of one
+// call and is < NumSlots(), which makes per-thread scratch buffers easy.
+// Each index belongs to one thread: workers keep their own when they call
+// ParallelFor from a task, every thread outside the pool gets 0. Only the
+// main thread should call it from outside the pool, or two callers would share 0.
+class ThreadPool {
+
+    public:
+        typedef std::function<void(size_t begin, size_t end, unsigned worker)> RangeFunc;
+
+        explicit ThreadPool(unsigned num_threads = 0);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        // One pool for the whole process, sized to the hardware
+        static ThreadPool& Get();
+
+        // Runs fn over [0, count) and blocks until every chunk is done
+        void ParallelFor(size_t count, size_t grain, const RangeFunc& fn);
+
+        // Fire and forget
+        void Enqueue(std::function<void()> task);
+
+        // Number of background workers (not counting the caller)
+        unsigned NumWorkers() const { return static_cast<unsigned>(workers.size()); }
+        // Number of distinct worker indices ParallelFor can hand out
+        unsigned NumSlots() const { return NumWorkers() + 1; }
+
+    private:
+        struct Job {
+            const RangeFunc* fn;
+            size_t count;
+            size_t grain;
+            size_t num_chunks;
+            std::atomic<size_t> next_chunk{0};
+            std::atomic<size_t> done_chunks{0};
+        };
+
+        void WorkerLoop(unsigned index);
+        static void RunChunks(Job& job, unsigned worker);
+
+        std::vector<std::thread> workers;
+        std::deque<std::function<void(unsigned)>> tasks;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable finished;
+        bool stopping = false;
+};
+
+#endif // THREAD_POOL_H_
@@ -88,6 +88,8 @@ private:
     void RenderPostProcessing(SceneGraph& scene);
     void RenderDepthMap(SceneGraph& scene, std::shared_ptr<Light> l);
     void RenderNode(SceneNode *node, Camera &cam, std::vector<std::shared_ptr<Light>> &lights, const glm::mat4 &parent_matrix = glm::mat4(1.0f));
+    // for the TextureBudget, how wide the node's textures end up on screen
+    float TexturePixels(SceneNode *node, Camera &cam);
     void ResizeBuffers();
 
     static void KeyCallback(GLFWwindow *window, int key, int scancode, int action, int mods);
@@ -30,7 +30,7 @@ public:
     void UpCollision();
     void HorizontalCollision();
 
-    void SetTerrain(std::shared_ptr<Terrain> t) { terrain = t; }
+    void SetTerrain(std::shared_ptr<Terrain> t) { terrain = t; terrain_cell_ = Terrain::CellCache(); }
 
     void Jump(glm::vec3 v = glm::vec3(0.0f, 0.0f, 0.0f));
 
@@ -59,6 +59,12 @@ public:
     // Slope check for a jump (not totally vertical i.e dash) max angle can traverse
     float max_jumping_angle_ = 45.0f;
 
+    // Character controller mode: walking and dashing are split into steps no
+    // longer than max_substep_, each one probed against the terrain, so a long
+    // frame can't carry the agent over an impassable edge or up a wall
+    bool substep_movement_ = true;
+    float max_substep_ = 1.0f;
+
 protected:
     glm::vec3 up_ = glm::vec3(0.0f, 1.0f, 0.0f);
     glm::vec3 jump_axis_ = glm::vec3(0.0, 1.0, 0.0f);
@@ -74,10 +80,14 @@ protected:
     void UpMove(float dt);
     void DownMove(float dt);
     void WalkingMove(const glm::vec3 move, float dt);
+    void SubstepUpMove(const glm::vec3& displacement);
+    void SubstepWalkingMove(const glm::vec3& displacement);
+    bool WalkableStep(const glm::vec3& from, const glm::vec3& step);
 
 private:
     glm::vec3 tempPos;
     const float EPSILON = 1e-6; // For ground checking!
     std::shared_ptr<Terrain> terrain;
+    Terrain::CellCache terrain_cell_;
 };
 #endif
\ No newline at end of file
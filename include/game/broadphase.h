@@ -0,0 +1,66 @@
+#ifndef __DEEP_NATURE_ALLIANCE_INCLUDE_GAME_BROADPHASE_H_
+#define __DEEP_NATURE_ALLIANCE_INCLUDE_GAME_BROADPHASE_H_
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "transform.h"
+
+// Uniform spatial hash over the instances of one instanced node.
+// Instances are bucketed by the cell their centre lands in, buckets are kept
+// as one sorted array so a query is a couple of binary searches per cell.
+// Positions are in the node's instance space, callers offset queries themselves.
+class SpatialHash {
+
+    public:
+        SpatialHash() = default;
+
+        // radius <= 0 uses each instance's scale.x as its radius (asteroids)
+        void Build(const std::vector<Transform>& instances, float radius = 0.0f);
+        void Build(const std::vector<glm::vec3>& centers, const std::vector<float>& radii);
+        void Clear();
+
+        // Appends every instance whose bounding sphere could touch the query
+        // sphere, sorted ascending. Not exact, narrowphase still has to test.
+        void Query(const glm::vec3& center, float radius, std::vector<unsigned int>& out) const;
+        // Same idea along a segment, dir is normalized and radius fattens the segment (sphere sweeps)
+        void QuerySegment(const glm::vec3& origin, const glm::vec3& dir, float length, float radius, std::vector<unsigned int>& out) const;
+
+        size_t Size() const { return radii.size(); }
+        bool Empty() const { return radii.empty(); }
+        float GetRadius(unsigned int i) const { return radii[i]; }
+        const glm::vec3& GetPosition(unsigned int i) const { return positions[i]; }
+
+    private:
+        struct Entry {
+            uint64_t key;
+            unsigned int index;
+        };
+
+        glm::ivec3 CellOf(const glm::vec3& p) const;
+        static uint64_t Key(const glm::ivec3& c);
+
+        std::vector<Entry> entries;
+        std::vector<glm::vec3> positions;
+        std::vector<float> radii;
+        float cell_size = 1.0f;
+        float max_radius = 0.0f;
+};
+
+// Candidate pair between one instance of an instanced set and one query body
+// (player, rocket, ...). Ordering is set, then instance, then body, which is
+// the order the old nested loops visited them in.
+struct CandidatePair {
+    unsigned int set;
+    unsigned int instance;
+    unsigned int body;
+
+    bool operator<(const CandidatePair& o) const {
+        if (set != o.set) return set < o.set;
+        if (instance != o.instance) return instance < o.instance;
+        return body < o.body;
+    }
+};
+
+#endif // __DEEP_NATURE_ALLIANCE_INCLUDE_GAME_BROADPHASE_H_
@@ -5,7 +5,9 @@
 #include "terrain.h"
 #include "fp_player.h"
 #include "scene_node.h"
+#include "mesh_bvh.h"
 #include <functional>
+#include <memory>
 
 class Collider;
 class BoxCollider;
@@ -14,6 +16,7 @@ class TerrainCollider;
 class FPPlayerCollider;
 class CylinderCollider;
 class ScalingCylinderCollider;
+class MeshCollider;
 
 
 class Collider
@@ -29,6 +32,7 @@ public:
     virtual bool CollidesWithPlayer(FPPlayerCollider *other) { return false; }
     virtual bool CollidesWithCylinder(CylinderCollider *other) { return false; }
     virtual bool CollidesWithScalingCylinder(ScalingCylinderCollider *other) { return false; }
+    virtual bool CollidesWithMesh(MeshCollider *other) { return false; }
     void SetCallback(CallbackCollider f) { callback_col = std::move(f); };
     void SetCallback(CallbackNoCollider f) { callback_no = std::move(f); };
     void invokeCallback(SceneNode& collider) { 
@@ -85,6 +89,7 @@ public:
     bool CollidesWithSphere(SphereCollider *other) override;
     bool CollidesWithTerrain(TerrainCollider *other) override;
     bool CollidesWithPlayer(FPPlayerCollider *other) override;
+    bool CollidesWithMesh(MeshCollider *other) override;
 };
 
 class TerrainCollider : public Collider
@@ -118,6 +123,7 @@ public:
     bool CollidesWithPlayer(FPPlayerCollider *other) override;
     bool CollidesWithCylinder(CylinderCollider *other) override;
     bool CollidesWithScalingCylinder(ScalingCylinderCollider *other) override;
+    bool CollidesWithMesh(MeshCollider *other) override;
 };
 
 class CylinderCollider : public Collider
@@ -150,6 +156,31 @@ public:
     bool CollidesWithSphere(SphereCollider *other) override;
 };
 
+// Exact collision against the owner's triangles, the BVH comes from the resource
+// manager so every node using the same mesh shares it, and stays alive with the
+// collider if the mesh is reloaded. Tests happen in world
+// space through the owner's world matrix, so scale and rotation are respected.
+class MeshCollider : public Collider
+{
+private:
+    SceneNode& owner_;
+    std::shared_ptr<const MeshBVH> bvh_;
+
+public:
+    MeshCollider(SceneNode& node, std::shared_ptr<const MeshBVH> bvh) : owner_(node), bvh_(std::move(bvh)) {}
+    SceneNode& GetOwner() const { return owner_; }
+    const MeshBVH* GetBVH() const { return bvh_.get(); }
+
+    // contact gets the closest point on the first triangle found touching the sphere
+    bool SphereTest(const glm::vec3& center, float radius, glm::vec3* contact = nullptr) const;
+    void GetWorldBounds(glm::vec3& lo, glm::vec3& hi) const;
+    bool Raycast(const glm::vec3& origin, const glm::vec3& dir, float max_t, MeshBVH::RayHit& hit) const;
+
+    bool CollidesWith(Collider *other) override { return other->CollidesWithMesh(this); }
+    bool CollidesWithPlayer(FPPlayerCollider *other) override;
+    bool CollidesWithSphere(SphereCollider *other) override;
+};
+
 class InstancedColliders : public Collider {
 public:
     
@@ -2,6 +2,7 @@
 #define __DEEP_NATURE_ALLIANCE_INCLUDE_GAME_COLLISION_MANAGER_H_
 
 #include <memory>
+#include <unordered_map>
 
 #include "scene_node.h"
 #include "trigger.h"
@@ -9,6 +10,8 @@
 #include "item.h"
 #include "asteroid.h"
 #include "toggle.h"
+#include "broadphase.h"
+#include "scene_query.h"
 
 class Game;
 
@@ -32,8 +35,70 @@ class CollisionManager{
 
         void SetPlayer(std::shared_ptr<Player> newPlayer) { player = std::move(newPlayer); }
 
+        // Narrowphase over instanced sets runs on the thread pool by default,
+        // turning it off gives the exact same contacts on the calling thread
+        void SetParallel(bool p) { parallel = p; }
+        bool IsParallel() const { return parallel; }
+
+        // Scene queries against everything the manager knows about, the terrain
+        // is handled by SceneGraph. PrepareQueries brings the instance hashes up
+        // to date, after that the queries are read only and safe to run in parallel.
+        void PrepareQueries();
+        // radius > 0 sweeps a sphere along the ray instead
+        bool Raycast(const Ray& ray, float radius, QueryHit& hit, int filter = QUERY_DEFAULT) const;
+        void Overlap(const glm::vec3& center, float radius, std::vector<QueryHit>& out, int filter = QUERY_DEFAULT) const;
+
+        // Colliders that sit still far from the player and rockets get put to
+        // sleep and skipped until something comes near or they move.
+        // Turning it off wakes everything and tests every node every frame again.
+        void SetSleeping(bool s);
+        bool IsSleeping() const { return sleeping; }
+        // for anything that changes a node in a way the manager can't see
+        void Wake(const SceneNode* node);
+        void WakeAll();
+
+        struct Stats {
+            unsigned int pairs_tested = 0;
+            unsigned int awake = 0;
+            unsigned int asleep = 0;
+        };
+        // counts from the last CheckCollisions
+        const Stats& GetStats() const { return stats; }
+
     private:
+        struct Body {
+            glm::vec3 position;
+            float radius;
+        };
+
+        struct InstanceSet {
+            const SpatialHash* hash;
+            glm::vec3 offset;
+        };
+
+        struct Activity {
+            glm::vec3 rest_position;
+            float wake_radius = 0.0f; // < 0 never sleeps
+            const Item* item = nullptr; // drift is measured without its hover
+            int idle_frames = 0;
+            bool asleep = false;
+        };
+
+        const SpatialHash& GetInstanceHash(const std::shared_ptr<SceneNode>& node, float radius = 0.0f);
+        const SpatialHash* FindInstanceHash(const std::shared_ptr<SceneNode>& node) const;
+        int QueryClass(const SceneNode& node) const;
+        template <typename F>
+        void ForEachQueryNode(int filter, F fn) const;
+        template <typename F>
+        void ForEachQuerySet(int filter, F fn) const;
+        void GatherPairs(unsigned int set, const SpatialHash& hash, const glm::vec3& offset, const std::vector<Body>& bodies, std::vector<CandidatePair>& out);
+        void Narrowphase(const std::vector<CandidatePair>& pairs, const std::vector<InstanceSet>& sets, const std::vector<Body>& bodies, std::vector<unsigned int>& hits);
+
         void CleanupNodes();
+        void RebuildTracked();
+        void UpdateActivity();
+        float WakeRadius(SceneNode& node) const;
+        bool Asleep(const SceneNode& node) const;
         template <typename T>
         void RemoveDeletedNodes(std::vector<std::shared_ptr<T>>& v);
 
@@ -56,7 +121,22 @@ class CollisionManager{
 
         std::shared_ptr<Player> player;
         Game* game = nullptr;
-        
+
+        bool parallel = true;
+        std::unordered_map<std::shared_ptr<SceneNode>, SpatialHash> instance_hashes;
+        std::vector<CandidatePair> pairs;
+        std::vector<unsigned int> hits;
+        std::vector<unsigned int> query_scratch;
+        std::vector<std::vector<unsigned int>> contact_buffers;
+
+        bool sleeping = true;
+        bool tracked_dirty = true;
+        std::vector<SceneNode*> tracked;
+        std::unordered_map<const SceneNode*, Activity> activity;
+        SpatialHash wake_hash; // over tracked, same order
+        std::vector<unsigned char> near_body;
+        Stats stats;
+
 };
 
 #endif // __DEEP_NATURE_ALLIANCE_INCLUDE_GAME_COLLISION_MANAGER_H_
\ No newline at end of file
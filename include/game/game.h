@@ -35,6 +35,7 @@ using namespace irrklang;
 #include "mooneye.h"
 #include "mooncloud.h"
 #include "toggle.h"
+#include "heightmap.h"
 
 class Application;
 
@@ -114,7 +115,7 @@ class Game {
         bool GetBadEnd() { return bad_end_; }
         void UnlockDash();
 
-        const std::vector<std::vector<float>> readTerrain(const std::string& filePath);
+        Heightmap readTerrain(const std::string& filePath);
 
     private:
         SceneGraph* active_scene;
@@ -0,0 +1,117 @@
+#ifndef __DEEP_NATURE_ALLIANCE_INCLUDE_GAME_GROUND_COVER_H_
+#define __DEEP_NATURE_ALLIANCE_INCLUDE_GAME_GROUND_COVER_H_
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "scene_node.h"
+
+class Game;
+class Terrain;
+
+struct GroundCoverSettings {
+    float patch_size = 32.0f;           // side of the square instances are made and culled in
+    float density = 1.0f;               // instances per square unit where the mask is 1
+    float draw_distance = 120.0f;
+    float fade_distance = 40.0f;        // instances thin out and shrink over this last stretch
+    glm::vec2 scale = glm::vec2(0.7f, 1.3f);
+    float min_normal_y = 0.8f;          // anything steeper stays bare
+    int max_in_flight = 8;              // patches being generated at once
+    int uploads_per_frame = 4;
+    unsigned int seed = 0;
+
+    // chance in [0, 1] of something growing at (x, z), empty means everywhere.
+    // Runs on the workers so it can't touch anything that changes.
+    std::function<float(float, float)> mask;
+};
+
+// Grass, pebbles and the like scattered over a Terrain. Nothing is placed up
+// front: the ground is cut into patches and the ones within draw_distance of
+// the eye are scattered on the ThreadPool, sitting on the heightfield and
+// following the mask, then uploaded as a buffer of per instance attributes.
+// After that a patch is one instanced draw with no per instance work on the
+// CPU, and the vertex shader shrinks instances away towards draw_distance.
+// Positions are in the space Terrain::SampleHeight takes, so keep the node
+// where the rest of the scene puts things sampled off that terrain.
+// The shader takes the usual vertex/normal/color/uv layout plus
+// placement (location 5) and ground (location 6), see ground_cover_vp.
+class GroundCover : public SceneNode {
+
+    public:
+        GroundCover(const std::string name, const std::string& mesh_id, const std::string& shader_id, const std::string& texture_id,
+                    std::shared_ptr<Terrain> terrain, GroundCoverSettings settings, Game* game);
+        ~GroundCover();
+
+        // throws every patch away so it gets made again, after the terrain changes shape
+        void Invalidate();
+
+        bool CustomDraw(Shader* shader, const glm::mat4& view_proj, const glm::vec3& eye, RenderPass pass) override;
+
+        size_t NumInstancesDrawn() const { return instances_drawn; }
+        size_t NumPatchesLoaded() const { return loaded; }
+
+    private:
+        struct Instance {
+            glm::vec4 placement; // position, scale
+            glm::vec4 ground;    // terrain normal, yaw
+        };
+
+        struct PatchData {
+            int index;
+            unsigned int generation;
+            std::vector<Instance> instances;
+            glm::vec2 heights; // lowest and highest ground under it
+        };
+
+        enum class PatchState {
+            EMPTY,
+            PENDING,
+            LOADED
+        };
+
+        struct Patch {
+            PatchState state = PatchState::EMPTY;
+            unsigned int vao = 0;
+            unsigned int vbo = 0;
+            int count = 0;
+            glm::vec3 lo;
+            glm::vec3 hi;
+        };
+
+        // outlives the node while workers still hold it
+        struct Mailbox {
+            std::mutex mutex;
+            std::vector<std::unique_ptr<PatchData>> done;
+            std::atomic<bool> cancelled{false};
+        };
+
+        static std::unique_ptr<PatchData> Generate(const GroundCoverSettings& settings, Terrain& terrain, glm::vec2 lo, glm::vec2 hi, int index);
+
+        void Receive(Mesh* mesh);
+        void Request(const glm::vec3& eye);
+        void Release(Patch& patch);
+        glm::vec2 PatchOrigin(int i, int j) const;
+
+        std::shared_ptr<const GroundCoverSettings> shared_settings;
+        const GroundCoverSettings& settings;
+        std::shared_ptr<Terrain> terrain;
+        std::shared_ptr<Mailbox> mailbox;
+        Game* game;
+
+        glm::vec2 extent_lo;
+        glm::ivec2 dims;
+        std::vector<Patch> patches;
+        int in_flight = 0;
+        // bumped by Invalidate, anything made for an older one is dropped
+        unsigned int generation = 0;
+        float mesh_radius = -1.0f;
+
+        size_t loaded = 0;
+        size_t instances_drawn = 0;
+};
+
+#endif // __DEEP_NATURE_ALLIANCE_INCLUDE_GAME_GROUND_COVER_H_
@@ -0,0 +1,65 @@
+#ifndef __DEEP_NATURE_ALLIANCE_INCLUDE_GAME_HEIGHTFIELD_H_
+#define __DEEP_NATURE_ALLIANCE_INCLUDE_GAME_HEIGHTFIELD_H_
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Grid of terrain samples in one flat allocation per attribute.
+// Rows run along z and are contiguous in x, each row is padded out to a
+// power of two so an index is a shift and an add. The obstacle and
+// impassable flags are one bit a sample.
+class Heightfield {
+
+    public:
+        Heightfield() = default;
+
+        // everything starts flat, normals up, nothing blocked
+        void Resize(int width, int depth);
+
+        int Width() const { return width; }
+        int Depth() const { return depth; }
+        int Stride() const { return 1 << shift; }
+        bool Empty() const { return width == 0 || depth == 0; }
+
+        float& Height(int x, int z) { return heights[Index(x, z)]; }
+        float Height(int x, int z) const { return heights[Index(x, z)]; }
+        glm::vec3& Normal(int x, int z) { return normals[Index(x, z)]; }
+        const glm::vec3& Normal(int x, int z) const { return normals[Index(x, z)]; }
+
+        const float* HeightRow(int z) const { return &heights[Index(0, z)]; }
+        const glm::vec3* NormalRow(int z) const { return &normals[Index(0, z)]; }
+
+        bool Obstacle(int x, int z) const { return GetBit(obstacle_bits, Index(x, z)); }
+        void SetObstacle(int x, int z, bool b) { SetBit(obstacle_bits, Index(x, z), b); }
+        bool Impassable(int x, int z) const { return GetBit(impassable_bits, Index(x, z)); }
+        void SetImpassable(int x, int z, bool b) { SetBit(impassable_bits, Index(x, z), b); }
+
+        // bytes held, padding included
+        size_t MemoryUsage() const;
+
+        // Storage exactly as it sits in memory, for the bake cache. ReadRaw
+        // takes what WriteRaw produced for the same width and depth.
+        size_t RawSize() const;
+        void WriteRaw(std::vector<unsigned char>& out) const;
+        bool ReadRaw(int width, int depth, const unsigned char* data, size_t size);
+
+    private:
+        size_t Index(int x, int z) const { return (static_cast<size_t>(z) << shift) + x; }
+
+        static bool GetBit(const std::vector<uint64_t>& bits, size_t i) { return (bits[i >> 6] >> (i & 63)) & 1; }
+        static void SetBit(std::vector<uint64_t>& bits, size_t i, bool b) {
+            uint64_t m = uint64_t(1) << (i & 63);
+            bits[i >> 6] = b ? (bits[i >> 6] | m) : (bits[i >> 6] & ~m);
+        }
+
+        int width = 0;
+        int depth = 0;
+        int shift = 0;
+        std::vector<float> heights;
+        std::vector<glm::vec3> normals;
+        std::vector<uint64_t> obstacle_bits;
+        std::vector<uint64_t> impassable_bits;
+};
+
+#endif // __DEEP_NATURE_ALLIANCE_INCLUDE_GAME_HEIGHTFIELD_H_
@@ -0,0 +1,82 @@
+#ifndef __DEEP_NATURE_ALLIANCE_INCLUDE_GAME_HEIGHTMAP_H_
+#define __DEEP_NATURE_ALLIANCE_INCLUDE_GAME_HEIGHTMAP_H_
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "mapped_file.h"
+
+// Non owning look at a grid of heightmap samples in whatever format they
+// were stored, nothing gets converted up front. 8 and 16 bit samples read
+// back in [0, 1], floats as they are. Rows first, like the image they came from.
+class HeightmapView {
+
+    public:
+        enum class Format { U8, U16, F32 };
+
+        HeightmapView() = default;
+        HeightmapView(const void* data, size_t rows, size_t cols, Format format)
+            : data(static_cast<const unsigned char*>(data)), rows(rows), cols(cols), format(format) {}
+
+        bool Empty() const { return rows == 0 || cols == 0; }
+        size_t Rows() const { return rows; }
+        size_t Cols() const { return cols; }
+        Format GetFormat() const { return format; }
+
+        // the samples as stored, for hashing
+        const unsigned char* Data() const { return data; }
+        size_t SizeBytes() const { return rows * cols * SampleSize(); }
+
+        float At(size_t row, size_t col) const {
+            const unsigned char* p = data + (row * cols + col) * SampleSize();
+            switch (format) {
+                case Format::U8:
+                    return p[0] / 255.0f;
+                case Format::U16:
+                    // raw files are little endian, stb hands back native order which is the same on anything we run on
+                    return static_cast<uint16_t>(p[0] | (p[1] << 8)) / 65535.0f;
+                default: {
+                    float f;
+                    memcpy(&f, p, sizeof(float));
+                    return f;
+                }
+            }
+        }
+
+    private:
+        size_t SampleSize() const { return format == Format::U8 ? 1 : format == Format::U16 ? 2 : 4; }
+
+        const unsigned char* data = nullptr;
+        size_t rows = 0;
+        size_t cols = 0;
+        Format format = Format::U8;
+};
+
+// Owns the samples a HeightmapView looks at. Raw files (.r16 little endian
+// 16 bit, .r32 little endian float) are mapped straight from disk, anything
+// else goes through stb_image, as 16 bit when the file has it.
+class Heightmap {
+
+    public:
+        Heightmap() = default;
+        Heightmap(Heightmap&&) = default;
+        Heightmap& operator=(Heightmap&&) = default;
+
+        // Raw files have no header, cols = 0 takes them as square.
+        // On failure this prints why and leaves the heightmap empty.
+        bool Load(const std::string& path, size_t cols = 0);
+
+        const HeightmapView& View() const { return view; }
+        bool Empty() const { return view.Empty(); }
+
+    private:
+        bool LoadRaw(const std::string& path, HeightmapView::Format format, size_t cols);
+
+        std::unique_ptr<MappedFile> file;
+        std::unique_ptr<void, void(*)(void*)> pixels{nullptr, [](void*) {}};
+        HeightmapView view;
+};
+
+#endif // __DEEP_NATURE_ALLIANCE_INCLUDE_GAME_HEIGHTMAP_H_
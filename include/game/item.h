@@ -22,6 +22,8 @@ class Item : public SceneNode {
         virtual void Update(double dt) override;
         virtual void HandleCollisionWith(SceneNode* collider) override;
         void DeleteOnCollect(bool value) { del_on_collect_ = value; }
+        // where it would be without the hover bobbing
+        glm::vec3 AnchorPosition() const { return transform.GetPosition() - glm::vec3(0.0f, hover_height_, 0.0f); }
         
     protected:
         std::function<void()> callback;
@@ -30,6 +32,7 @@ class Item : public SceneNode {
         float hover_amplitude_ = 0.005f;
         float hover_speed_ = 2.0f;
         float hover_offset_ = 0.0f;
+        float hover_height_ = 0.0f;  // everything the hover has added to y so far
         bool del_on_collect_ = false;
 };
 
@@ -0,0 +1,157 @@
+#ifndef __DEEP_NATURE_ALLIANCE_INCLUDE_GAME_NAV_GRID_H_
+#define __DEEP_NATURE_ALLIANCE_INCLUDE_GAME_NAV_GRID_H_
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+
+class Heightfield;
+
+// cells along one side of a cluster
+#define NAV_CLUSTER_SIZE 32
+// steps per unit of cost in a node's field, the longest way across a cluster has to fit 16 bits
+#define NAV_FIELD_SCALE 32
+// nodes every other node knows its graph distance to, for the search's lower bounds
+#define NAV_LANDMARKS 8
+
+struct PathRequest {
+    glm::ivec2 start;
+    glm::ivec2 goal;
+    // false hands back just the waypoints, each within one cluster of the
+    // next, for walking towards while the cells in between are worked out later
+    bool refine = true;
+};
+
+struct PathResult {
+    bool found = false;
+    float cost = 0.0f;
+    std::vector<glm::ivec2> cells; // start to goal, both included
+};
+
+// Where things can walk on a Heightfield, one bit a cell, with an HPA*
+// graph on top. The grid is cut into NAV_CLUSTER_SIZE square clusters, every
+// stretch of open border between two clusters gets a node on each side and
+// the nodes of a cluster are joined by their shortest path inside it. A query
+// searches that graph and only goes down to cells inside the clusters the
+// route passes through, so paths come out within a few percent of the best.
+// Every node also keeps what it costs to reach it from each cell of its cluster,
+// so neither end of a query nor the refinement needs a search of its own.
+// The graph search is A* bounded by the distances to a few landmark nodes
+// spread over the map (ALT), which stays optimal and skips most of the graph.
+// Cells are 8-connected, diagonals can't cut a blocked corner.
+class NavGrid {
+
+    public:
+        NavGrid() = default;
+
+        // walkable is anything neither Obstacle nor Impassable. Builds the graph
+        // on the ThreadPool and forgets every cached route.
+        void Build(const Heightfield& field);
+
+        bool Empty() const { return width == 0 || depth == 0; }
+        int Width() const { return width; }
+        int Depth() const { return depth; }
+        bool Walkable(int x, int z) const;
+
+        // From the calling thread only, don't overlap with FindPaths
+        bool FindPath(const PathRequest& request, PathResult& result);
+        // count independent queries spread over the ThreadPool
+        void FindPaths(const PathRequest* requests, PathResult* results, size_t count);
+
+        // Routes through the graph are remembered per (start cluster, goal
+        // cluster) and reused when both ends can reach them, which skips the
+        // graph search entirely but can cost a little optimality.
+        void SetCacheCapacity(size_t capacity);
+        size_t CacheHits() const { return cache_hits; }
+        size_t CacheMisses() const { return cache_misses; }
+
+        size_t NumNodes() const { return nodes.size(); }
+        size_t NumEdges() const { return edges.size(); }
+        size_t MemoryUsage() const;
+
+    private:
+        struct Node {
+            glm::ivec2 cell;
+            int cluster;
+            unsigned int first_edge;
+            unsigned int num_edges;
+            size_t field; // where its costs start in fields, one per cell of the cluster
+        };
+
+        struct Edge {
+            int to;
+            float cost;
+        };
+
+        // Search state for one thread. Arrays are stamped rather than cleared,
+        // an entry only counts when its stamp matches the current search.
+        struct Scratch {
+            std::vector<float> g;
+            std::vector<int> parent;
+            std::vector<unsigned int> seen;
+            std::vector<unsigned int> closed;
+            unsigned int stamp = 0;
+            std::vector<std::pair<float, int>> open;
+
+            void Begin(size_t size);
+            bool Seen(int i) const { return seen[i] == stamp; }
+        };
+
+        struct CachedRoute {
+            std::vector<int> nodes;
+            std::list<uint64_t>::iterator lru;
+        };
+
+        int ClusterOf(glm::ivec2 cell) const { return (cell.y / NAV_CLUSTER_SIZE) * clusters.x + cell.x / NAV_CLUSTER_SIZE; }
+        void ClusterBounds(int cluster, glm::ivec2& lo, glm::ivec2& hi) const;
+        int AddNode(glm::ivec2 cell, std::unordered_map<uint64_t, int>& lookup, std::vector<std::vector<Edge>>& adjacency);
+        void AddEntrances(glm::ivec2 a, glm::ivec2 step, glm::ivec2 across, int length,
+                          std::unordered_map<uint64_t, int>& lookup, std::vector<std::vector<Edge>>& adjacency);
+
+        // A* between two cells without leaving [lo, hi). to < 0 floods the whole
+        // box instead, leaving every reachable cell's cost in scratch.g.
+        float LocalSearch(Scratch& s, glm::ivec2 lo, glm::ivec2 hi, glm::ivec2 from, glm::ivec2 to, std::vector<glm::ivec2>* path) const;
+        // cost from cell to node out of the node's field, INF if it can't get there
+        float FieldCost(int node, glm::ivec2 cell) const;
+        // Walks downhill through node's field from cell, appending the cells after
+        // it up to the node. backwards appends the same path the other way round,
+        // from the one after the node up to cell.
+        float Descend(int node, glm::ivec2 cell, std::vector<glm::ivec2>* path, bool backwards) const;
+        void BuildLandmarks(Scratch& s);
+        bool AbstractSearch(unsigned int slot, glm::ivec2 start, glm::ivec2 goal, std::vector<int>& route);
+        float EdgeCost(int from, int to) const;
+        bool Search(unsigned int slot, const PathRequest& request, PathResult& result);
+
+        bool LookupRoute(uint64_t key, std::vector<int>& route);
+        void StoreRoute(uint64_t key, const std::vector<int>& route);
+
+        int width = 0;
+        int depth = 0;
+        int row_words = 0;
+        std::vector<uint64_t> walkable;
+
+        glm::ivec2 clusters = glm::ivec2(0);
+        std::vector<Node> nodes;
+        std::vector<Edge> edges;
+        std::vector<std::vector<int>> cluster_nodes;
+        // fixed point, NAV_FIELD_SCALE per unit of cost
+        std::vector<uint16_t> fields;
+        // NAV_LANDMARKS per node, INF where they aren't connected
+        std::vector<float> landmarks;
+
+        // one of each per ThreadPool slot
+        std::vector<Scratch> local_scratch;
+        std::vector<Scratch> abstract_scratch;
+
+        std::mutex cache_mutex;
+        size_t cache_capacity = 1024;
+        std::unordered_map<uint64_t, CachedRoute> cache;
+        std::list<uint64_t> cache_lru; // most recently used at the front
+        size_t cache_hits = 0;
+        size_t cache_misses = 0;
+};
+
+#endif // __DEEP_NATURE_ALLIANCE_INCLUDE_GAME_NAV_GRID_H_
@@ -0,0 +1,35 @@
+#ifndef __DEEP_NATURE_ALLIANCE_INCLUDE_GAME_SCENE_QUERY_H_
+#define __DEEP_NATURE_ALLIANCE_INCLUDE_GAME_SCENE_QUERY_H_
+
+#include <glm/glm.hpp>
+
+class SceneNode;
+
+// What a scene query is allowed to hit
+enum QueryFilter {
+    QUERY_TERRAIN   = 1 << 0,
+    QUERY_STATIC    = 1 << 1, // anything with a collider or blocking volume that's drawn
+    QUERY_INSTANCES = 1 << 2, // instanced sets, asteroids and cacti
+    QUERY_ITEMS     = 1 << 3, // items and beacons
+    QUERY_TRIGGERS  = 1 << 4, // triggers and invisible volumes
+    QUERY_DEFAULT   = QUERY_TERRAIN | QUERY_STATIC | QUERY_INSTANCES,
+    QUERY_ALL       = 0xFF
+};
+
+struct Ray {
+    glm::vec3 origin;
+    glm::vec3 direction; // normalized by the query
+    float max_distance;
+};
+
+struct QueryHit {
+    SceneNode* node = nullptr;  // nullptr means nothing was hit
+    int instance = -1;          // index into node->GetInstances() for instanced hits
+    float distance = 0.0f;      // along the ray, 0 for overlaps
+    glm::vec3 point = glm::vec3(0.0f);
+    glm::vec3 normal = glm::vec3(0.0f, 1.0f, 0.0f);
+
+    bool Hit() const { return node != nullptr; }
+};
+
+#endif // __DEEP_NATURE_ALLIANCE_INCLUDE_GAME_SCENE_QUERY_H_
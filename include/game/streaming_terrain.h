@@ -0,0 +1,130 @@
+#ifndef __DEEP_NATURE_ALLIANCE_INCLUDE_GAME_STREAMING_TERRAIN_H_
+#define __DEEP_NATURE_ALLIANCE_INCLUDE_GAME_STREAMING_TERRAIN_H_
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "scene_node.h"
+#include "heightfield.h"
+
+class Mesh;
+
+// Where the heights come from and how much of it to keep around.
+// Heights are a pure function of the world (x, z): fractal noise plus an
+// optional heightmap repeated every heightmap_extent, so tiles can be made in
+// any order on any thread and still line up.
+struct StreamingTerrainSettings {
+    int tile_cells = 64;            // grid cells along one side of a tile
+    float cell_size = 5.0f;
+    int ring_radius = 4;            // tiles kept around the focus in each direction
+    size_t memory_budget = 256u << 20;
+    int uploads_per_frame = 2;      // finished tiles turned into meshes per Update
+    int max_in_flight = 8;          // tiles being generated at once
+
+    unsigned int seed = 0;
+    int noise_octaves = 5;
+    float noise_wavelength = 800.0f;
+    float noise_height = 120.0f;
+
+    std::vector<std::vector<float>> heightmap;
+    float heightmap_extent = 4000.0f;
+    float heightmap_height = 300.0f;
+
+    float texture_extent = 50.0f;   // world units one repeat of the texture covers
+
+    // local xz area another terrain covers, tiles entirely inside it are never made
+    glm::vec2 hole_min = glm::vec2(0.0f);
+    glm::vec2 hole_max = glm::vec2(0.0f);
+};
+
+// Terrain without edges. Square tiles are generated on the ThreadPool in a
+// ring around a focus transform, handed back to the main thread and uploaded a
+// few per frame, so Update never waits on generation. Tiles outside the ring
+// stay cached until memory_budget runs out, then the least recently used go first.
+// Vertices are baked in the node's local space, drawn with any shader taking
+// the usual vertex/normal/color/uv/tangent layout.
+class StreamingTerrain : public SceneNode {
+
+    public:
+        StreamingTerrain(const std::string name, const std::string& shader_id, const std::string& texture_id, StreamingTerrainSettings settings);
+        ~StreamingTerrain();
+
+        // tiles are kept around this transform's position
+        void SetFocus(const Transform* focus) { this->focus = focus; }
+
+        void Update(double dt) override;
+        bool CustomDraw(Shader* shader, const glm::mat4& view_proj, const glm::vec3&, RenderPass pass) override;
+
+        // height of the loaded surface under world (x, z), false if that tile isn't in yet
+        bool SampleHeight(float x, float z, float& height) const;
+        // straight from the generator, doesn't need the tile to be loaded
+        float GeneratedHeight(float x, float z) const;
+
+        float TileSize() const { return settings.tile_cells * settings.cell_size; }
+        size_t MemoryUsage() const { return memory_used; }
+        size_t NumTiles() const { return tiles.size(); }
+        size_t NumPending() const { return requested.size(); }
+
+    private:
+        struct TileKey {
+            int x;
+            int z;
+            bool operator==(const TileKey& o) const { return x == o.x && z == o.z; }
+        };
+        struct TileKeyHash {
+            size_t operator()(const TileKey& k) const { return std::hash<long long>()((static_cast<long long>(k.x) << 32) ^ static_cast<unsigned int>(k.z)); }
+        };
+
+        // what a worker hands back, everything but the GL side
+        struct TileData {
+            TileKey key;
+            Heightfield field;
+            std::vector<float> vertices;
+            std::vector<unsigned int> indices;
+        };
+
+        struct Tile {
+            TileKey key;
+            Heightfield field;
+            std::unique_ptr<Mesh> mesh;
+            size_t bytes;
+            std::list<TileKey>::iterator lru;
+        };
+
+        // outlives the terrain while workers still hold it
+        struct Mailbox {
+            std::mutex mutex;
+            std::vector<std::unique_ptr<TileData>> done;
+            std::atomic<bool> cancelled{false};
+        };
+
+        static std::unique_ptr<TileData> Generate(const StreamingTerrainSettings& settings, TileKey key);
+        static float GeneratedHeight(const StreamingTerrainSettings& settings, float x, float z);
+
+        TileKey KeyAt(float x, float z) const;
+        bool InRing(const TileKey& key, const TileKey& center) const;
+        bool InHole(const TileKey& key) const;
+        void Receive(const TileKey& center);
+        void Request(const TileKey& center);
+        void Evict(const TileKey& center);
+
+        // shared with the workers, never changes after construction
+        std::shared_ptr<const StreamingTerrainSettings> shared_settings;
+        const StreamingTerrainSettings& settings;
+        std::shared_ptr<Mailbox> mailbox;
+
+        const Transform* focus = nullptr;
+        std::unordered_map<TileKey, Tile, TileKeyHash> tiles;
+        std::unordered_set<TileKey, TileKeyHash> requested;
+        std::list<TileKey> lru;  // most recently used at the front
+        size_t memory_used = 0;
+        bool over_budget_reported = false;
+};
+
+#endif // __DEEP_NATURE_ALLIANCE_INCLUDE_GAME_STREAMING_TERRAIN_H_
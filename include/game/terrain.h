@@ -1,8 +1,17 @@
 #ifndef TERRAIN_H
 #define TERRAIN_H
 #include "scene_node.h"
+#include "heightfield.h"
+#include "heightmap.h"
+#include "terrain_lod.h"
+#include "nav_grid.h"
 #include "glm/gtc/random.hpp"
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TERRAIN_SIMD
+#endif
+
 class Game;
 
 enum class TerrainType {
@@ -14,8 +23,19 @@ enum class TerrainType {
 
 class Terrain : public SceneNode {
     public:
+        // Corners of the last grid cell sampled. Callers probing the same cell
+        // over and over (substepped movement) only pay for the lookups once.
+        struct CellCache {
+            int x0 = -1;
+            int z0 = -1;
+            unsigned int revision = 0;  // the terrain's when this was loaded
+            float h[4];
+            glm::vec3 n[4];
+        };
 
-        Terrain(const std::string name, const std::string& mesh_id, const std::string shader_id, const std::string& texture_id, TerrainType type, const std::vector<std::vector<float>> image, float xwidth, float zwidth, float density, Game* game);
+        // chunked terrains draw through TerrainLOD and want S_Terrain, otherwise
+        // it's one mesh under mesh_id for any shader that takes the usual layout
+        Terrain(const std::string name, const std::string& mesh_id, const std::string shader_id, const std::string& texture_id, TerrainType type, const HeightmapView& image, float xwidth, float zwidth, float density, Game* game, bool chunked = true);
 
         ~Terrain() {}
 
@@ -25,36 +45,94 @@ class Terrain : public SceneNode {
         float SampleAngle(float x, float z, glm::vec3 dir);
         bool SampleOn(float x , float z);
         glm::vec3 SampleNormal(float x, float z);
+        // Same results as the above, reusing cache while x, z stay in one cell
+        float SampleHeight(float x, float z, CellCache& cache);
+        glm::vec3 SampleNormal(float x, float z, CellCache& cache);
+        // Same results as calling the above on each of count (x, z) points,
+        // four at a time with SSE2 where it's available
+        void SampleHeights(const glm::vec2* xz, float* heights, size_t count);
+        void SampleNormals(const glm::vec2* xz, glm::vec3* normals, size_t count);
+
+        // Nearest hit of a world space ray with the surface SampleHeight describes.
+        // Walks a min/max quadtree over the heights so only cells near the ray get tested.
+        bool Raycast(const glm::vec3& origin, const glm::vec3& dir, float max_t, float& t);
+        // Nearest t at which a sphere moving from origin along the unit dir touches
+        // that surface, with the contact point and the surface normal there. The centre
+        // is stepped at most half a cell or half the radius at a time and measured
+        // against the plane tangent under it, the step that crosses is bisected.
+        bool SweepSphere(const glm::vec3& origin, const glm::vec3& dir, float radius, float max_t, float& t, glm::vec3& point, glm::vec3& normal);
+
+        // Pushes a smooth bowl of the given depth into the ground around center (world x, z).
+        // Only the samples under it get their normals, flags, bounds and texels redone.
+        void Deform(const glm::vec3& center, float radius, float depth);
+        // bumped by every Deform, CellCaches from an older one reload
+        unsigned int Revision() const { return revision; }
+
+        // Walkable cells off the obstacle and impassable flags with an HPA* graph
+        // over them, built the first time it's asked for and again after a Deform.
+        // Each build logs its size.
+        NavGrid& GetNavGrid();
+        // cell under (x, z) and the middle of a cell on the surface, same space as SampleHeight
+        glm::ivec2 NavCell(float x, float z);
+        glm::vec3 NavPoint(glm::ivec2 cell);
 
         float GetWidth() {return xwidth;}
         float GetDepth() {return zwidth;}
+        const TerrainLOD& GetLOD() const {return lod;}
+
+        bool CustomDraw(Shader* shader, const glm::mat4& view_proj, const glm::vec3& eye, RenderPass pass) override;
 
     protected:
-        void GenerateHeightmap(TerrainType type, const std::vector<std::vector<float>>& image);
-        void GenerateQMoon();
+        // Every random number the moon uses, drawn up front in the order they
+        // always came so they can go into the cache key before generating anything.
+        struct MoonDraws {
+            struct Crater {
+                glm::vec2 position;
+                float radius;
+                float base_height;
+            };
+            std::vector<Crater> craters;
+            glm::ivec4 platform_box = glm::ivec4(0, 0, -1, -1); // x0, z0, x1, z1
+            std::vector<float> platform; // heights of the platform cells in z then x order
+        };
+
+        // everything that goes into generating this terrain, hashed
+        uint64_t CacheKey(const HeightmapView& image, const MoonDraws& moon);
+        void GenerateHeightmap(TerrainType type, const HeightmapView& image, const MoonDraws& moon);
+        void DrawQMoon(MoonDraws& draws);
+        void GenerateQMoon(const MoonDraws& draws);
         void GenerateForest();
         void GenerateLava();
-        void GenerateNormals();
-        void GenerateObstacles();
-        void GenerateTangents();
-        void GenerateUV();
+        // normals over the box and obstacle flags from them, in one pass
+        void GenerateSurface();
+        void GenerateSurface(int x0, int z0, int x1, int z1);
         void GenerateMesh();
+        void GenerateChunks();
         void GenerateImPassable();
+        void GenerateHeightBounds();
+        void UpdateHeightBounds(int x0, int z0, int x1, int z1);
+        bool RaycastCell(int x, int z, const glm::vec3& o, const glm::vec3& d, float t0, float t1, float& t);
 
-        void SampleTerrainForHeight(const std::vector<std::vector<float>>& terrainArray, float heightMultiplier, int tileX = 1, int tileZ = 1);
+        void SampleTerrainForHeight(const HeightmapView& image, float heightMultiplier, int tileX = 1, int tileZ = 1);
 
         glm::vec2 IndexGrid(float x, float z);
+        void LoadCell(float x, float z, CellCache& cache, float& sx, float& sz);
         glm::vec3 InterpNormals(int x0, int z0, float sx, float sz);
+#ifdef TERRAIN_SIMD
+        void LoadCells(const glm::vec2* xz, int x0[4], int z0[4], __m128& sx, __m128& sz);
+        // eight at a time where the cpu has AVX2, how many were done. The rest
+        // go through the SSE2 loop.
+        size_t SampleHeightsAVX2(const glm::vec2* xz, float* heights, size_t count);
+        size_t SampleNormalsAVX2(const glm::vec2* xz, glm::vec3* normals, size_t count);
+#endif
 
-        std::vector<float> vertices;
-        std::vector<unsigned int> indices;
+        // heights, normals and the obstacle/impassable flags, uvs and
+        // tangents are cheap enough to work out while building the mesh
+        Heightfield field;
 
-        std::vector<std::vector<float>> heights;
-        std::vector<std::vector<glm::vec3>> normals;
-        std::vector<std::vector<glm::vec3>> tangents;
-        std::vector<std::vector<bool>> obstacles;
-        std::vector<std::vector<bool>> impassable;
-        std::vector<std::vector<glm::vec2>> uvs;
+        // min/max height per quadtree node, level 0 is a single grid cell, rows along z
+        std::vector<std::vector<glm::vec2>> height_bounds;
+        std::vector<glm::ivec2> height_bounds_dims;
 
         float xwidth;
         float zwidth;
@@ -66,6 +144,13 @@ class Terrain : public SceneNode {
 
         TerrainType type;
 
+        bool chunked;
+        TerrainLOD lod;
+
+        NavGrid nav;
+        bool nav_dirty = true;
+        unsigned int revision = 1;
+
         Game* game;
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,23 @@
+#ifndef __DEEP_NATURE_ALLIANCE_INCLUDE_GAME_TERRAIN_CACHE_H_
+#define __DEEP_NATURE_ALLIANCE_INCLUDE_GAME_TERRAIN_CACHE_H_
+
+#include <cstdint>
+#include <string>
+
+class Heightfield;
+
+// Baked heightfields on disk under CACHE_DIRECTORY/terrain, one file per key.
+// The key is whatever went into making the terrain hashed together, a file
+// only gets used if its version, key, size and payload checksum all check out,
+// anything else counts as a miss and the caller generates from scratch.
+// Keys are built with CacheFile's hashes.
+namespace TerrainCache {
+    // bump whenever generation or the file layout changes
+    const uint32_t VERSION = 1;
+
+    std::string PathFor(uint64_t key);
+    bool Load(uint64_t key, int width, int depth, Heightfield& field);
+    bool Save(uint64_t key, const Heightfield& field);
+}
+
+#endif // __DEEP_NATURE_ALLIANCE_INCLUDE_GAME_TERRAIN_CACHE_H_
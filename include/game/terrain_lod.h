@@ -0,0 +1,83 @@
+#ifndef __DEEP_NATURE_ALLIANCE_INCLUDE_GAME_TERRAIN_LOD_H_
+#define __DEEP_NATURE_ALLIANCE_INCLUDE_GAME_TERRAIN_LOD_H_
+
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "heightfield.h"
+#include "texture.h"
+
+class ResourceManager;
+class Shader;
+
+// Chunked level of detail for a heightfield, CDLOD style.
+// A chunk at level L covers TERRAIN_CHUNK_CELLS << L cells sampled every
+// 1 << L cells and the chunks form a quadtree. Nothing about the surface lives
+// in vertex buffers: every chunk is an instance of one small grid patch and
+// the vertex shader reads heights and normals out of two textures made from
+// the Heightfield. It also reads the next level's surface under each vertex
+// and slides towards it with distance, so a chunk has fully turned into its
+// parent by the time the parent takes over.
+// Everything here is in the terrain's local space.
+class TerrainLOD {
+
+    public:
+        TerrainLOD() = default;
+
+        // registers prefix_Patch with resman and uploads the textures
+        void Build(ResourceManager& resman, const std::string& prefix, const Heightfield& field, float xstep, float zstep,
+                   const std::vector<std::vector<glm::vec2>>& height_bounds, const std::vector<glm::ivec2>& bounds_dims);
+
+        // Samples [x0, x1] x [z0, z1] changed, re-uploads just those texels
+        // and picks up the new chunk bounds from height_bounds.
+        void UpdateRegion(const Heightfield& field, int x0, int z0, int x1, int z1,
+                          const std::vector<std::vector<glm::vec2>>& height_bounds, const std::vector<glm::ivec2>& bounds_dims);
+
+        // Draws what the eye needs, skipping chunks outside view_proj. The shader
+        // has to be in use, this sets the lod uniforms and binds texture units 3 and 4.
+        void Draw(ResourceManager& resman, Shader* shd, const glm::mat4& view_proj, const glm::vec3& eye);
+
+        bool Empty() const { return levels.empty(); }
+        int NumLevels() const { return static_cast<int>(levels.size()); }
+        // from the last Draw
+        unsigned int ChunksDrawn() const { return chunks_drawn; }
+        size_t TrianglesDrawn() const { return triangles_drawn; }
+
+    private:
+        struct Chunk {
+            glm::vec3 lo;
+            glm::vec3 hi;
+            glm::ivec2 origin; // first sample
+        };
+
+        struct Level {
+            glm::ivec2 dims;     // chunks across
+            std::vector<Chunk> chunks;
+            float range;         // chunks closer than this split into the level below
+            glm::vec2 morph;     // distances the morph to the level above starts and ends
+        };
+
+        struct Selected {
+            int level;
+            unsigned int chunk;
+        };
+
+        void Select(int level, int i, int j, const glm::vec3& eye, std::vector<Selected>& out) const;
+        void UpdateBounds(const std::vector<std::vector<glm::vec2>>& height_bounds, const std::vector<glm::ivec2>& bounds_dims);
+        void UploadNormals(const Heightfield& field, int x0, int z0, int x1, int z1);
+
+        std::string patch_id;
+        glm::ivec2 grid_dims = glm::ivec2(0);
+        glm::vec2 cell_size = glm::vec2(1.0f);
+        Texture height_tex;
+        Texture normal_tex;
+
+        std::vector<Level> levels;
+        std::vector<Selected> selection;
+        std::vector<glm::vec4> instances;
+        unsigned int chunks_drawn = 0;
+        size_t triangles_drawn = 0;
+};
+
+#endif // __DEEP_NATURE_ALLIANCE_INCLUDE_GAME_TERRAIN_LOD_H_
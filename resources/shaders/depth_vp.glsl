@@ -1,11 +1,25 @@
 #version 330 core
+#pragma keywords INSTANCED
 
-layout (location = 0) in vec3 vertex;
+layout (location = 0) in vec3 packed_vertex;
+
+// undoes Mesh's QUANTIZED3 positions, 1 and 0 for meshes stored as floats
+layout (location = 14) in vec3 vertex_scale;
+layout (location = 15) in vec3 vertex_offset;
 
 uniform mat4 world_mat;
 uniform mat4 light_mat;
 
+#ifdef INSTANCED
+#include "include/instancing.glsl"
+#endif
+
 void main()
 {
+    vec3 vertex = packed_vertex * vertex_scale + vertex_offset;
+#ifdef INSTANCED
+    gl_Position = light_mat * world_mat * instances[gl_InstanceID].transformation * vec4(vertex, 1.0);
+#else
     gl_Position = light_mat * world_mat * vec4(vertex, 1.0);
+#endif
 }  
\ No newline at end of file
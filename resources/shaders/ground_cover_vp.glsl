@@ -0,0 +1,65 @@
+#version 330
+
+layout (location = 0) in vec3 packed_vertex;
+layout (location = 1) in vec3 normal;
+layout (location = 2) in vec3 color;
+layout (location = 3) in vec2 uv;
+// per instance, see GroundCover
+layout (location = 5) in vec4 placement; // position on the terrain, scale
+layout (location = 6) in vec4 ground;    // terrain normal there, yaw
+
+// undoes Mesh's QUANTIZED3 positions, 1 and 0 for meshes stored as floats
+layout (location = 14) in vec3 vertex_scale;
+layout (location = 15) in vec3 vertex_offset;
+
+// Uniform (global) buffer
+uniform mat4 world_mat;
+uniform mat4 view_mat;
+uniform mat4 projection_mat;
+uniform vec3 cover_eye;   // in the node's space
+uniform vec2 cover_fade;  // distance instances start going, distance they're all gone
+
+// Attributes forwarded to the fragment shader
+out vec3 position_interp;
+out vec3 normal_interp;
+out vec4 color_interp;
+out vec2 uv_interp;
+out vec3 light_pos;
+
+#include "include/lights_block.glsl"
+
+out Light lights[3];
+flat out int num_lights;
+
+
+void main()
+{
+    vec3 vertex = packed_vertex * vertex_scale + vertex_offset;
+    // every instance picks its own point to go so the edge thins out instead of
+    // being a line, and shrinks to nothing rather than popping
+    float r = fract(sin(dot(placement.xz, vec2(12.9898, 78.233))) * 43758.5453);
+    float fade = 1.0 - smoothstep(cover_fade.x, cover_fade.y, distance(placement.xz, cover_eye.xz));
+    float grow = clamp((fade - r * 0.7) / 0.3, 0.0, 1.0);
+
+    float c = cos(ground.w);
+    float s = sin(ground.w);
+    mat3 yaw = mat3(c, 0.0, -s,  0.0, 1.0, 0.0,  s, 0.0, c);
+    vec3 local = placement.xyz + yaw * vertex * placement.w * grow;
+
+    position_interp = vec3(view_mat * world_mat * vec4(local, 1.0));
+    gl_Position = projection_mat * vec4(position_interp, 1.0f);
+
+    // lit mostly like the ground it stands on, so it sits in instead of on the terrain
+    vec3 n = normalize(mix(yaw * normal, ground.xyz, 0.7));
+    normal_interp = mat3(view_mat * world_mat) * n;
+    color_interp = vec4(color, 1.0);
+    uv_interp = uv;
+
+    for(int i = 0; i < num_world_lights; i++) {
+        lights[i].position         = vec3(view_mat * vec4(world_lights[i].position, 1.0));
+        lights[i].color            = world_lights[i].color;
+        lights[i].ambient_color    = world_lights[i].ambient_color;
+        lights[i].ambient_strength = world_lights[i].ambient_strength;
+    }
+    num_lights = num_world_lights;
+}
@@ -0,0 +1,10 @@
+// matches ShaderTransform in shader.h, filled by Shader::SetInstances, binding point 1
+struct Instance {
+    mat4 transformation;
+    mat4 normal_matrix;
+};
+
+uniform int num_instances;
+layout(std140) uniform TransformsBlock {
+    Instance instances[512];
+};
@@ -0,0 +1,9 @@
+// matches ShaderLight in shader.h, std140
+struct Light {
+    vec3 position;
+    float ambient_strength;
+    vec4 color;
+    vec4 ambient_color;
+    vec3 direction;
+    float spread;
+};
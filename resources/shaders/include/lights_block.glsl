@@ -0,0 +1,7 @@
+#include "light.glsl"
+
+// filled by Shader::SetLights, binding point 0
+layout(std140) uniform LightsBlock {
+    Light world_lights[3];
+};
+uniform int num_world_lights;
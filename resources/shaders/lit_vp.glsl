@@ -1,10 +1,14 @@
 #version 330
 
-layout (location = 0) in vec3 vertex;
+layout (location = 0) in vec3 packed_vertex;
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec3 color;
 layout (location = 3) in vec2 uv;
 
+// undoes Mesh's QUANTIZED3 positions, 1 and 0 for meshes stored as floats
+layout (location = 14) in vec3 vertex_scale;
+layout (location = 15) in vec3 vertex_offset;
+
 // in vec3 vertex;
 // in vec3 color;
 
@@ -22,26 +26,15 @@ out vec4 color_interp;
 out vec2 uv_interp;
 out vec3 light_pos;
 
-struct Light {
-    vec3 position;
-    float ambient_strength;
-    vec4 color;
-    vec4 ambient_color;
-    vec3 direction;
-    float spread;
-};
+#include "include/lights_block.glsl"
 
 out Light lights[3];
 flat out int num_lights;
 
-layout(std140) uniform LightsBlock {
-    Light world_lights[3];
-};
-uniform int num_world_lights;
-
 
 void main()
 {
+    vec3 vertex = packed_vertex * vertex_scale + vertex_offset;
     position_interp = vec3(view_mat * world_mat * vec4(vertex, 1.0));
     gl_Position = projection_mat * vec4(position_interp, 1.0f);
 
@@ -3,11 +3,15 @@
 #version 330 core
 
 // Vertex buffer
-layout (location = 0) in vec3 vertex;
+layout (location = 0) in vec3 packed_vertex;
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec3 color;
 layout (location = 3) in vec2 uv;
 
+// undoes Mesh's QUANTIZED3 positions, 1 and 0 for meshes stored as floats
+layout (location = 14) in vec3 vertex_scale;
+layout (location = 15) in vec3 vertex_offset;
+
 // in vec3 vertex;
 // in vec3 color;
 
@@ -22,6 +26,7 @@ out vec4 color_interp;
 
 void main()
 {
+    vec3 vertex = packed_vertex * vertex_scale + vertex_offset;
     gl_Position = projection_mat * view_mat * world_mat * vec4(vertex, 1.0);
 
     color_interp = vec4(color, 1.0);
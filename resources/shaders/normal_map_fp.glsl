@@ -1,5 +1,6 @@
 #version 330
 #pragma optionNV(unroll all)
+#pragma keywords SHADOWS NORMAL_MAP ALPHA
 
 // Attributes passed from the vertex shader
 in vec3 color_interp;
@@ -10,14 +11,7 @@ in vec3 light_pos;
 
 in vec4 shadow_space_pos;
 
-struct Light {
-    vec3 position;
-    float ambient_strength;
-    vec4 color;
-    vec4 ambient_color;
-    vec3 direction;
-    float spread;
-};
+#include "include/light.glsl"
 
 in Light lights[3];
 flat in int num_lights;
@@ -71,13 +65,19 @@ vec4 lighting(vec4 pixel, int i, vec3 lv, vec3 n, float shadow) {
     // float spec = phong_specular(lv, n);
     if(diffuse == 0.0 || specular_power == 0.0) {spec = 0.0;}
 
-    vec4 lit = (lights[i].ambient_strength+amb_add)*lights[i].ambient_color*pixel + (1.1 - shadow)*(
+#ifdef SHADOWS
+    float lit_factor = 1.1 - shadow;
+#else
+    float lit_factor = 1.0;
+#endif
+    vec4 lit = (lights[i].ambient_strength+amb_add)*lights[i].ambient_color*pixel + lit_factor*(
                diffuse_strength*diffuse*lights[i].color*pixel + 
                specular_coefficient*spec*lights[i].color);
 
     return lit;
 }
 
+#ifdef SHADOWS
 float PCSSShadowCalculation(vec4 fragPosLightSpace) {
    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
    projCoords = projCoords * 0.5 + 0.5;
@@ -163,7 +163,8 @@ float ShadowCalculation(vec4 fragPosLightSpace) {
             shadow = 0.0;
     }
     return shadow;
-}  
+}
+#endif
 
 
 
@@ -171,13 +172,25 @@ void main() {
     vec4 accumulator = vec4(0.0, 0.0, 0.0, 1.0);
     for(int i = 0; i < num_lights; i++) {
         vec3 light_vector = normalize(lights[i].position - position_interp);                                     // light direction, object position as origin
-        vec3 n_bump = normalize(texture(normal_map, uv_interp * normal_map_repetition).rgb*2.0 - 1.0);  // sample normal map
+#ifdef NORMAL_MAP
+        // normal maps are BC5, only x and y are stored
+        vec2 n_xy = texture(normal_map, uv_interp * normal_map_repetition).rg*2.0 - 1.0;  // sample normal map
+        vec3 n_bump = vec3(n_xy, sqrt(max(0.0, 1.0 - dot(n_xy, n_xy))));
         vec3 normal = normalize(normal_interp + n_bump) ;                                               // displace fragment normal by bump
+#else
+        vec3 normal = normalize(normal_interp);
+#endif
         vec4 pixel = texture(texture_map, uv_interp * texture_repetition);                              // sample color texture
+#ifdef ALPHA
         if(pixel.a < 0.1)
             discard;
+#endif
         // vec4 pixel = vec4(color_interp, 1.0);                                                                       // mix with underlying model color
+#ifdef SHADOWS
         float shadow = PCSSShadowCalculation(shadow_space_pos);
+#else
+        float shadow = 0.0;
+#endif
         // if(shadow > 0.0) {
         //     in_shadow = true;
         //     // accumulator = vec4(1.0, 0.0, 1.0, 1.0);
@@ -186,8 +199,11 @@ void main() {
         // lit_pixel.a = 1.0f;
         accumulator += lit_pixel;
     }
+#ifdef SHADOWS
     gl_FragColor = accumulator ;
-    // FragColor = vec3(accumulator);
+#else
+    FragColor = vec3(accumulator);
+#endif
     // float depth = gl_FragCoord.w * 4 + 0.1;
     // FragColor = vec3(depth, depth, depth);
 }
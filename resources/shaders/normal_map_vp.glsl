@@ -1,12 +1,17 @@
 #version 330 core
 #pragma optionNV(unroll all)
+#pragma keywords INSTANCED
 
-layout (location = 0) in vec3 vertex;
+layout (location = 0) in vec3 packed_vertex;
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec3 color;
 layout (location = 3) in vec2 uv;
 layout (location = 4) in vec3 tangent;
 
+// undoes Mesh's QUANTIZED3 positions, 1 and 0 for meshes stored as floats
+layout (location = 14) in vec3 vertex_scale;
+layout (location = 15) in vec3 vertex_offset;
+
 // Uniform (global) buffer
 uniform mat4 world_mat;
 uniform mat4 view_mat;
@@ -23,32 +28,32 @@ out vec3 normal_interp;
 
 out vec4 shadow_space_pos;
 
-struct Light {
-    vec3 position;
-    float ambient_strength;
-    vec4 color;
-    vec4 ambient_color;
-    vec3 direction;
-    float spread;
-};
+#include "include/lights_block.glsl"
 
 out Light lights[3];
 flat out int num_lights;
 
-layout(std140) uniform LightsBlock {
-    Light world_lights[3];
-};
-uniform int num_world_lights;
+#ifdef INSTANCED
+#include "include/instancing.glsl"
+#endif
 
 void main()
 {
-    vec4 position = view_mat * world_mat * vec4(vertex, 1.0);
+    vec3 vertex = packed_vertex * vertex_scale + vertex_offset;
+#ifdef INSTANCED
+    mat4 model = world_mat * instances[gl_InstanceID].transformation;
+    mat4 norm = instances[gl_InstanceID].normal_matrix;
+#else
+    mat4 model = world_mat;
+    mat4 norm = normal_mat;
+#endif
+    vec4 position = view_mat * model * vec4(vertex, 1.0);
     gl_Position = projection_mat * position;
 
     // Define vertex tangent, bitangent and normal (TBN)
     // These are used to create the tangent space transformation matrix
-    vec3 vertex_normal = vec3(normal_mat * vec4(normal, 0.0));
-    vec3 vertex_tangent_ts = vec3(normal_mat * vec4(tangent, 0.0));
+    vec3 vertex_normal = vec3(norm * vec4(normal, 0.0));
+    vec3 vertex_tangent_ts = vec3(norm * vec4(tangent, 0.0));
     vec3 vertex_bitangent_ts = cross(vertex_normal, vertex_tangent_ts);
 
     // Send tangent space transformation matrix to the fragment shader
@@ -65,7 +70,7 @@ void main()
     num_lights = num_world_lights;
 
     // shadow_space_pos = vec4(TBN_mat * vec3(shadow_light_mat * position), 1.0);
-    shadow_space_pos = shadow_light_mat * world_mat * vec4(vertex, 1.0f);
+    shadow_space_pos = shadow_light_mat * model * vec4(vertex, 1.0f);
 
     color_interp = color;
     uv_interp = uv; 
@@ -2,11 +2,15 @@
 
 #version 330 core
 
-layout (location = 0) in vec3 vertex;
+layout (location = 0) in vec3 packed_vertex;
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec3 color;
 layout (location = 3) in vec2 uv;
 
+// undoes Mesh's QUANTIZED3 positions, 1 and 0 for meshes stored as floats
+layout (location = 14) in vec3 vertex_scale;
+layout (location = 15) in vec3 vertex_offset;
+
 // in vec3 vertex;
 // in vec3 color;
 
@@ -24,6 +28,7 @@ out vec2 uv_interp;
 
 void main()
 {
+    vec3 vertex = packed_vertex * vertex_scale + vertex_offset;
     position_interp = vec3(world_mat * vec4(vertex, 1.0));
     gl_Position = projection_mat * view_mat * vec4(position_interp, 1.0f);
     normal_interp = vec3(world_mat * vec4(normal, 0.0f));
@@ -8,14 +8,7 @@ in vec4 color_interp;
 in vec2 uv_interp;
 in vec3 light_pos;
 
-struct Light {
-    vec3 position;
-    float ambient_strength;
-    vec4 color;
-    vec4 ambient_color;
-    vec3 direction;
-    float spread;
-};
+#include "include/light.glsl"
 
 in Light lights[3];
 flat in int num_lights;
@@ -0,0 +1,62 @@
+#version 330 core
+
+// depth_vp with the same displacement as terrain_vp
+layout (location = 0) in vec2 grid;
+
+uniform mat4 world_mat;
+uniform mat4 light_mat;
+
+uniform sampler2D height_map;
+uniform sampler2D terrain_normals;
+
+uniform vec4 chunks[128];   // first sample x, z and level of each instance
+uniform vec2 lod_morph[16]; // morph start and end distance per level
+uniform vec3 lod_eye;       // camera in terrain space
+uniform vec2 grid_dims;     // samples across
+uniform vec2 cell_size;
+
+vec4 Sample(ivec2 p)
+{
+    return vec4(texelFetch(height_map, p, 0).r, texelFetch(terrain_normals, p, 0).xyz);
+}
+
+// the surface of the level with samples every step cells, split along the
+// same diagonal as the patch
+vec4 Coarse(ivec2 p, int step, ivec2 last)
+{
+    ivec2 a0 = (p / step) * step;
+    ivec2 a1 = min(a0 + step, last);
+    vec2 f = vec2(a1.x > a0.x ? float(p.x - a0.x) / float(a1.x - a0.x) : 0.0,
+                  a1.y > a0.y ? float(p.y - a0.y) / float(a1.y - a0.y) : 0.0);
+    vec4 s00 = Sample(a0);
+    vec4 s11 = Sample(a1);
+    if (f.x >= f.y) {
+        vec4 s10 = Sample(ivec2(a1.x, a0.y));
+        return s00 + f.x * (s10 - s00) + f.y * (s11 - s10);
+    }
+    vec4 s01 = Sample(ivec2(a0.x, a1.y));
+    return s00 + f.y * (s01 - s00) + f.x * (s11 - s01);
+}
+
+// position in terrain space and its normal, already slid towards the level above
+vec3 Displace(out vec3 local_normal)
+{
+    vec4 chunk = chunks[gl_InstanceID];
+    int level = int(chunk.z);
+    int step = 1 << level;
+    ivec2 last = ivec2(grid_dims) - 1;
+    ivec2 p = min(ivec2(chunk.xy) + ivec2(grid) * step, last);
+
+    vec2 xz = vec2(p) * cell_size;
+    float k = clamp((distance(xz, lod_eye.xz) - lod_morph[level].x) / (lod_morph[level].y - lod_morph[level].x), 0.0, 1.0);
+    vec4 surface = mix(Sample(p), Coarse(p, step * 2, last), k);
+
+    local_normal = normalize(surface.yzw);
+    return vec3(xz.x, surface.x, xz.y);
+}
+
+void main()
+{
+    vec3 local_normal;
+    gl_Position = light_mat * world_mat * vec4(Displace(local_normal), 1.0);
+}
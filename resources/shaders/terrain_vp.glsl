@@ -0,0 +1,116 @@
+#version 330 core
+#pragma optionNV(unroll all)
+
+// normal_map_vp for TerrainLOD chunks. The patch only carries grid
+// coordinates, the surface comes out of height_map and terrain_normals and
+// every vertex slides towards the next level's surface with distance
+layout (location = 0) in vec2 grid;
+
+// Uniform (global) buffer
+uniform mat4 world_mat;
+uniform mat4 view_mat;
+uniform mat4 projection_mat;
+uniform mat4 normal_mat;
+uniform mat4 shadow_light_mat;
+
+uniform vec2 terrain_size;
+
+uniform sampler2D height_map;
+uniform sampler2D terrain_normals;
+
+uniform vec4 chunks[128];   // first sample x, z and level of each instance
+uniform vec2 lod_morph[16]; // morph start and end distance per level
+uniform vec3 lod_eye;       // camera in terrain space
+uniform vec2 grid_dims;     // samples across
+uniform vec2 cell_size;
+
+vec4 Sample(ivec2 p)
+{
+    return vec4(texelFetch(height_map, p, 0).r, texelFetch(terrain_normals, p, 0).xyz);
+}
+
+// the surface of the level with samples every step cells, split along the
+// same diagonal as the patch
+vec4 Coarse(ivec2 p, int step, ivec2 last)
+{
+    ivec2 a0 = (p / step) * step;
+    ivec2 a1 = min(a0 + step, last);
+    vec2 f = vec2(a1.x > a0.x ? float(p.x - a0.x) / float(a1.x - a0.x) : 0.0,
+                  a1.y > a0.y ? float(p.y - a0.y) / float(a1.y - a0.y) : 0.0);
+    vec4 s00 = Sample(a0);
+    vec4 s11 = Sample(a1);
+    if (f.x >= f.y) {
+        vec4 s10 = Sample(ivec2(a1.x, a0.y));
+        return s00 + f.x * (s10 - s00) + f.y * (s11 - s10);
+    }
+    vec4 s01 = Sample(ivec2(a0.x, a1.y));
+    return s00 + f.y * (s01 - s00) + f.x * (s11 - s01);
+}
+
+// position in terrain space and its normal, already slid towards the level above
+vec3 Displace(out vec3 local_normal)
+{
+    vec4 chunk = chunks[gl_InstanceID];
+    int level = int(chunk.z);
+    int step = 1 << level;
+    ivec2 last = ivec2(grid_dims) - 1;
+    ivec2 p = min(ivec2(chunk.xy) + ivec2(grid) * step, last);
+
+    vec2 xz = vec2(p) * cell_size;
+    float k = clamp((distance(xz, lod_eye.xz) - lod_morph[level].x) / (lod_morph[level].y - lod_morph[level].x), 0.0, 1.0);
+    vec4 surface = mix(Sample(p), Coarse(p, step * 2, last), k);
+
+    local_normal = normalize(surface.yzw);
+    return vec3(xz.x, surface.x, xz.y);
+}
+
+// Attributes forwarded to the fragment shader
+out vec3 position_interp;
+out vec2 uv_interp;
+out vec3 light_pos;
+out vec3 color_interp;
+out vec3 normal_interp;
+
+out vec4 shadow_space_pos;
+
+#include "include/lights_block.glsl"
+
+out Light lights[3];
+flat out int num_lights;
+
+void main()
+{
+    vec3 local_normal;
+    vec3 local = Displace(local_normal);
+
+    vec4 position = view_mat * world_mat * vec4(local, 1.0);
+    gl_Position = projection_mat * position;
+
+    // same tangent estimate the meshes bake in
+    vec3 estimate = cross(vec3(1.0, 0.0, 0.0), local_normal);
+    vec3 tangent = cross(estimate, local_normal);
+
+    // Define vertex tangent, bitangent and normal (TBN)
+    // These are used to create the tangent space transformation matrix
+    vec3 vertex_normal = vec3(normal_mat * vec4(local_normal, 0.0));
+    vec3 vertex_tangent_ts = vec3(normal_mat * vec4(tangent, 0.0));
+    vec3 vertex_bitangent_ts = cross(vertex_normal, vertex_tangent_ts);
+
+    // Send tangent space transformation matrix to the fragment shader
+    mat3 TBN_mat = transpose(mat3(vertex_tangent_ts, vertex_bitangent_ts, vertex_normal));
+
+    position_interp = TBN_mat * vec3(position);
+    normal_interp = TBN_mat * vertex_normal;
+    for(int i = 0; i < num_world_lights; i++) {
+        lights[i].position         = TBN_mat * vec3(view_mat * vec4(world_lights[i].position, 1.0));
+        lights[i].color            = world_lights[i].color;
+        lights[i].ambient_color    = world_lights[i].ambient_color;
+        lights[i].ambient_strength = world_lights[i].ambient_strength;
+    }
+    num_lights = num_world_lights;
+
+    shadow_space_pos = shadow_light_mat * world_mat * vec4(local, 1.0f);
+
+    color_interp = vec3(1.0);
+    uv_interp = local.xz / terrain_size;
+}
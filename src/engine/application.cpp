@@ -37,6 +37,7 @@ void Application::Start() {
 		}
 		last_time = current_time;
 
+        resman.Update();
         game.Update(dt, view.GetKeys());
         view.Render(game.ActiveScene());
     }
@@ -0,0 +1,112 @@
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#include "cache_file.h"
+#include "mapped_file.h"
+#include "path_config.h"
+
+namespace CacheFile {
+
+uint64_t Hash(const void* data, size_t size, uint64_t seed) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    uint64_t h = seed;
+    size_t words = size / 8;
+    for (size_t i = 0; i < words; i++) {
+        uint64_t w;
+        memcpy(&w, p + i * 8, 8);
+        h = (h ^ w) * 0x100000001b3ull;
+    }
+    for (size_t i = words * 8; i < size; i++) {
+        h = (h ^ p[i]) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+uint64_t HashString(const std::string& s, uint64_t seed) {
+    return Hash(s.data(), s.size(), seed);
+}
+
+uint64_t SourceStamp(const std::string& path) {
+    std::error_code ec;
+    uint64_t size = std::filesystem::file_size(path, ec);
+    if (ec) {
+        return 0;
+    }
+    auto time = std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+    if (ec) {
+        return 0;
+    }
+    return HashValue(time, HashValue(size, Hash(nullptr, 0)));
+}
+
+Prefix MakePrefix(const char magic[4], uint32_t version, uint64_t key) {
+    Prefix prefix;
+    memcpy(prefix.magic, magic, 4);
+    prefix.version = version;
+    prefix.key = key;
+    return prefix;
+}
+
+std::string PathFor(const char* dir, uint64_t key, const char* ext) {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.%s", static_cast<unsigned long long>(key), ext);
+    return std::string(CACHE_DIRECTORY) + "/" + dir + "/" + name;
+}
+
+bool Open(MappedFile& file, const std::string& path, const Prefix& expected, void* header, size_t header_size, const char* name) {
+    if (!file.Open(path)) {
+        return false;
+    }
+    if (file.Size() < header_size) {
+        std::cout << name << " cache: truncated " << path << std::endl;
+        return false;
+    }
+    memcpy(header, file.Data(), header_size);
+    Prefix prefix;
+    memcpy(&prefix, header, sizeof(Prefix));
+    if (memcmp(prefix.magic, expected.magic, 4) != 0 || prefix.version != expected.version || prefix.key != expected.key) {
+        std::cout << name << " cache: stale entry " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Verify(const unsigned char* payload, size_t size, uint64_t checksum, const std::string& path, const char* name) {
+    if (Hash(payload, size) != checksum) {
+        std::cout << name << " cache: corrupt entry " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Write(const std::string& path, const void* header, size_t header_size, const void* payload, size_t payload_size, const char* name) {
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+
+    // write next to it and rename so a crash never leaves half a file under the real name
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            std::cout << name << " cache: can't write " << tmp << std::endl;
+            return false;
+        }
+        out.write(static_cast<const char*>(header), header_size);
+        out.write(static_cast<const char*>(payload), payload_size);
+        if (!out) {
+            std::cout << name << " cache: can't write " << tmp << std::endl;
+            return false;
+        }
+    }
+    std::filesystem::rename(tmp, path, ec);
+    if (ec) {
+        std::filesystem::remove(tmp, ec);
+        return false;
+    }
+    return true;
+}
+
+}
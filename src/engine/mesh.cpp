@@ -1,9 +1,14 @@
 #include "mesh.h"
 #include "view.h"
-#include <sstream>
-#include <fstream>
+#include "obj_parser.h"
+#include "mesh_optimizer.h"
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
 #include <string>
-#include <array>
+#include <glm/gtc/packing.hpp>
 
 
 LayoutEntry::LayoutEntry(LAYOUT_TYPE t, std::string n) {
@@ -14,7 +19,16 @@ LayoutEntry::LayoutEntry(LAYOUT_TYPE t, std::string n) {
 Layout::Layout(std::initializer_list<LayoutEntry> ents) 
 	: entries(ents) {
 		for(auto e : entries){
-			size += e.size() * e.cnt();
+			size += e.bytes();
+			floats += e.cnt();
+		}
+	}
+
+Layout::Layout(const std::vector<LayoutEntry>& ents)
+	: entries(ents) {
+		for(auto e : entries){
+			size += e.bytes();
+			floats += e.cnt();
 		}
 	}
 
@@ -23,109 +37,78 @@ Layout::Layout(std::initializer_list<LayoutEntry> ents)
 // load obj from file
 Mesh::Mesh(const std::string& obj_file_path)
 {
+    ObjGeometry obj;
+    if (!LoadObj(obj_file_path, obj)) {
+        return;
+    }
 
-    std::vector<std::array<float, 3>> verts;
-    std::vector<std::array<float ,2>> uvs;
-    std::vector<std::array<float, 3>> normals;
-
-    std::ifstream obj_file (obj_file_path);
-	if (obj_file.fail()) {
-		std::cout << "Couldn't open object file " << obj_file_path << std::endl;
-		return;
-	}
-    std::string line;
-    unsigned int f_count = 0;
-    while(std::getline(obj_file, line)) {
-        std::stringstream l(line);
-        std::string word;
-        l >> word;
-        if(word == "v") {
-            std::array<float, 3> v = {};
-            l >> v[0];
-            l >> v[1];
-            l >> v[2];
-            verts.push_back(v);
-        }else if(word == "vt") {
-            std::array<float, 2> vt = {};
-            l >> vt[0];
-            l >> vt[1];
-            uvs.push_back(vt);
-        }else if(word == "vn") {
-            std::array<float, 3> n = {};
-            l >> n[0];
-            l >> n[1];
-            l >> n[2];
-            normals.push_back(n);
-        }else if(word == "f") {
-            int slash;
-            std::stringstream f(line);
-            char garbage;
-            f >> garbage;
-
-            for(int j = 0; j < 3; j++) {
-                std::string i1, i2, i3;
-                int v_ix, uv_ix, n_ix;
-                std::string e;
-                f >> e;
-
-                int pos = 0;
-                slash = e.find('/');
-                i1 = e.substr(pos, slash);
-                v_ix = std::stoi(i1) - 1;
-                pos = slash+1;
-
-                glm::vec2 uv_selected(0.0f);
-                slash = e.find('/', pos);
-                if(slash != pos) {
-                    i2 = e.substr(pos, slash);
-                    uv_ix = std::stoi(i2) - 1;
-                    uv_selected = glm::vec2(uvs[uv_ix][0], uvs[uv_ix][1]);
-                }
-                pos = slash+1;
-
-                slash = e.find('/', pos);
-                i3 = e.substr(pos, slash);
-                n_ix = std::stoi(i3) - 1;
-
-
-                vertices.push_back(verts[v_ix][0]);
-                vertices.push_back(verts[v_ix][1]);
-                vertices.push_back(verts[v_ix][2]);
-
-                vertices.push_back(normals[n_ix][0]);
-                vertices.push_back(normals[n_ix][1]);
-                vertices.push_back(normals[n_ix][2]);
-
-                vertices.push_back(0.77);
-                vertices.push_back(0.77);
-                vertices.push_back(0.77);
-
-                vertices.push_back(uv_selected.x);
-                vertices.push_back(uv_selected.y);
-
-
-                // calculate tangent
-                const glm::vec3 right = {1.0, 0.0, 0.0};
-                auto& n = normals[n_ix];
-                glm::vec3 norm = glm::vec3(n[0], n[1], n[2]);
-                glm::vec3 estimate = glm::cross(right, norm); //original estimate of tangent
-                glm::vec3 tan = glm::cross(estimate, norm); // get closer to the true tangent
-
-                vertices.push_back(tan.x);
-                vertices.push_back(tan.y);
-                vertices.push_back(tan.z);
-                indices.push_back(f_count++);
-            }
+    // every corner is its own vertex to begin with, OptimizeMesh welds them after
+    vertices.reserve(obj.corners.size() * 14);
+    indices.reserve(obj.corners.size());
+    const glm::vec3 right = {1.0, 0.0, 0.0};
+    size_t out_of_range = 0;
+    for (size_t t = 0; t + 2 < obj.corners.size(); t += 3) {
+        const glm::ivec3* tri = &obj.corners[t];
+        bool ok = true;
+        for (int j = 0; j < 3; j++) {
+            ok = ok && tri[j].x >= 0 && tri[j].x < static_cast<int>(obj.positions.size())
+                    && tri[j].y < static_cast<int>(obj.uvs.size())
+                    && tri[j].z < static_cast<int>(obj.normals.size());
+        }
+        if (!ok) {
+            out_of_range++;
+            continue;
         }
+        // corners without a normal get the face's
+        glm::vec3 face_normal = glm::cross(obj.positions[tri[1].x] - obj.positions[tri[0].x], obj.positions[tri[2].x] - obj.positions[tri[0].x]);
+        face_normal = glm::length(face_normal) > 0.0f ? glm::normalize(face_normal) : glm::vec3(0.0f, 1.0f, 0.0f);
+
+        for (int j = 0; j < 3; j++) {
+            const glm::vec3& pos = obj.positions[tri[j].x];
+            glm::vec2 uv_selected = tri[j].y >= 0 ? obj.uvs[tri[j].y] : glm::vec2(0.0f);
+            glm::vec3 norm = tri[j].z >= 0 ? obj.normals[tri[j].z] : face_normal;
+
+            vertices.push_back(pos.x);
+            vertices.push_back(pos.y);
+            vertices.push_back(pos.z);
+
+            vertices.push_back(norm.x);
+            vertices.push_back(norm.y);
+            vertices.push_back(norm.z);
+
+            vertices.push_back(0.77);
+            vertices.push_back(0.77);
+            vertices.push_back(0.77);
+
+            vertices.push_back(uv_selected.x);
+            vertices.push_back(uv_selected.y);
+
+            // calculate tangent
+            glm::vec3 estimate = glm::cross(right, norm); //original estimate of tangent
+            glm::vec3 tan = glm::cross(estimate, norm); // get closer to the true tangent
+
+            vertices.push_back(tan.x);
+            vertices.push_back(tan.y);
+            vertices.push_back(tan.z);
+            indices.push_back(indices.size());
+        }
+    }
+    if (out_of_range > 0) {
+        std::cout << "Object file " << obj_file_path << ": skipped " << out_of_range << " triangles pointing past the end" << std::endl;
     }
 
-    layout = Layout({
-        {FLOAT3, "vertex"},
-        {FLOAT3, "normal"},
-        {FLOAT3, "color"},
-        {FLOAT2, "uv"},
-        {FLOAT3, "tangent"},
-    });
+    MeshOptimizeStats stats = OptimizeMesh(vertices, indices, 14);
+    std::cout << "Mesh " << obj_file_path << ": " << stats.vertices_before << " -> " << stats.vertices_after
+              << " vertices, ACMR " << stats.acmr_before << " -> " << stats.acmr_after << std::endl;
+
+    // the color is always the same, uvs get halves instead of shorts if any tile past [0, 1]
+    layout = packed_layout;
+    for (size_t v = 9; v + 1 < vertices.size(); v += 14) {
+        if (vertices[v] < 0.0f || vertices[v] > 1.0f || vertices[v + 1] < 0.0f || vertices[v + 1] > 1.0f) {
+            layout.entries[3].type = HALF2;
+            break;
+        }
+    }
 
     SetupBuffers();
 }
@@ -150,7 +133,49 @@ Mesh::Mesh(const float* verts, size_t num_verts, const unsigned int* inds, size_
 	SetupBuffers();
 }
 
+Mesh::Mesh(const float* verts, size_t num_verts, const void* gpu_verts, size_t gpu_size, const VertexPacking& pack,
+           const void* inds, size_t num_inds, unsigned int type, Layout lay)
+: vertices(verts, verts + num_verts), layout(lay), index_type(type), packing(pack) {
+	if(type == GL_UNSIGNED_SHORT) {
+		const unsigned short* short_indices = static_cast<const unsigned short*>(inds);
+		indices.assign(short_indices, short_indices + num_inds);
+	} else {
+		const unsigned int* int_indices = static_cast<const unsigned int*>(inds);
+		indices.assign(int_indices, int_indices + num_inds);
+	}
+	CreateBuffers(gpu_verts, gpu_size, inds);
+}
+
 void Mesh::SetupBuffers() {
+	const void* vertex_data = vertices.data();
+	size_t vertex_size = vertices.size() * sizeof(float);
+	std::vector<unsigned char> packed;
+	if(layout.Packed() && layout.floats > 0) {
+		PackVertices(packed, packing);
+		vertex_data = packed.data();
+		vertex_size = packed.size();
+	}
+
+	// half the index bandwidth whenever every index fits in 16 bits
+	if(indices.size() > 0 && *std::max_element(indices.begin(), indices.end()) <= 0xFFFF) {
+		std::vector<unsigned short> short_indices(indices.begin(), indices.end());
+		index_type = GL_UNSIGNED_SHORT;
+		CreateBuffers(vertex_data, vertex_size, short_indices.data());
+	} else {
+		index_type = GL_UNSIGNED_INT;
+		CreateBuffers(vertex_data, vertex_size, indices.data());
+	}
+}
+
+void Mesh::CreateBuffers(const void* vertex_data, size_t vertex_size, const void* index_data) {
+	// positions come first in every layout
+	if(layout.floats >= 3 && layout.entries[0].cnt() >= 3) {
+		const float* v = vertices.data();
+		for(size_t i = 0; i + 3 <= vertices.size(); i += layout.floats) {
+			radius = std::max(radius, glm::length(glm::vec3(v[i], v[i + 1], v[i + 2])));
+		}
+	}
+
 	glGenVertexArrays(1, &VAO);
 	glGenBuffers(1, &VBO);
 	glGenBuffers(1, &EBO);
@@ -158,31 +183,109 @@ void Mesh::SetupBuffers() {
 	glBindVertexArray(VAO);
 
 	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices[0], GL_STATIC_DRAW); 
+	glBufferData(GL_ARRAY_BUFFER, vertex_size, vertex_data, GL_STATIC_DRAW);
+
+	if(indices.size() > 0) {
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * IndexSize(), index_data, GL_STATIC_DRAW);
+	}
+
+	BindAttributes();
+
+	glBindBuffer(GL_VERTEX_ARRAY, 0);
+	glBindVertexArray(0);
+
+}
 
+unsigned int Mesh::BindAttributes() {
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);
 	if(indices.size() > 0) {
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
 	}
 
 	size_t total_size = 0;
 	for(auto e : layout.entries) {
-		total_size += e.cnt() * e.size();
+		total_size += e.bytes();
 	}
 
 	size_t offset = 0;
 	int i = 0;
 	for(LayoutEntry e : layout.entries) {
-		glEnableVertexAttribArray(i);
-		glVertexAttribPointer(i, e.cnt(), e.gltype(), GL_FALSE, total_size, (void*)(offset));
+		// constants come from SetConstantAttributes while the array stays off
+		if(e.type != CONSTANT3) {
+			glEnableVertexAttribArray(i);
+			glVertexAttribPointer(i, e.glcnt(), e.gltype(), e.normalized() ? GL_TRUE : GL_FALSE, total_size, (void*)(offset));
+		}
 
-		offset += e.size() * e.cnt();
+		offset += e.bytes();
 		i++;
 	}
+	return i;
+}
 
-	glBindBuffer(GL_VERTEX_ARRAY, 0);
-	glBindVertexArray(0);
+void Mesh::SetConstantAttributes() {
+	glVertexAttrib3fv(VERTEX_SCALE_LOCATION, &packing.scale[0]);
+	glVertexAttrib3fv(VERTEX_OFFSET_LOCATION, &packing.offset[0]);
+	for(const auto& c : packing.constants) {
+		glVertexAttrib3fv(c.first, &c.second[0]);
+	}
+}
 
+void Mesh::PackVertices(std::vector<unsigned char>& out, VertexPacking& out_packing) const {
+	out_packing = VertexPacking();
+	if(!layout.Packed() || layout.floats == 0) {
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(vertices.data());
+		out.assign(bytes, bytes + vertices.size() * sizeof(float));
+		return;
+	}
+	const float* src = vertices.data();
+	size_t count = vertices.size() / layout.floats;
+	out.assign(count * layout.size, 0);
+
+	size_t src_offset = 0, dst_offset = 0;
+	for(size_t a = 0; a < layout.entries.size(); a++) {
+		LayoutEntry e = layout.entries[a];
+		const float* in = src + src_offset;
+		unsigned char* dst = out.data() + dst_offset;
+		if(e.type == QUANTIZED3) {
+			glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+			for(size_t v = 0; v < count; v++) {
+				glm::vec3 p(in[v * layout.floats], in[v * layout.floats + 1], in[v * layout.floats + 2]);
+				lo = glm::min(lo, p);
+				hi = glm::max(hi, p);
+			}
+			// plain shorts rather than normalized, the int to float conversion is exact everywhere
+			out_packing.offset = (lo + hi) * 0.5f;
+			out_packing.scale = glm::max((hi - lo) * 0.5f / 32767.0f, glm::vec3(1e-30f));
+			for(size_t v = 0; v < count; v++) {
+				glm::vec3 p(in[v * layout.floats], in[v * layout.floats + 1], in[v * layout.floats + 2]);
+				glm::vec3 q = glm::clamp(glm::round((p - out_packing.offset) / out_packing.scale), -32767.0f, 32767.0f);
+				short s[4] = {static_cast<short>(q.x), static_cast<short>(q.y), static_cast<short>(q.z), 0};
+				memcpy(dst + v * layout.size, s, sizeof(s));
+			}
+		} else if(e.type == CONSTANT3) {
+			out_packing.constants.emplace_back(static_cast<unsigned int>(a), count > 0 ? glm::vec3(in[0], in[1], in[2]) : glm::vec3(0.0f));
+		} else {
+			for(size_t v = 0; v < count; v++) {
+				const float* f = in + v * layout.floats;
+				unsigned char* d = dst + v * layout.size;
+				uint32_t packed;
+				switch(e.type) {
+					case PACKED_NORMAL: packed = glm::packSnorm3x10_1x2(glm::vec4(f[0], f[1], f[2], 0.0f)); break;
+					case PACKED_COLOR: packed = glm::packUnorm4x8(glm::vec4(f[0], f[1], f[2], 1.0f)); break;
+					case UNORM16x2: packed = glm::packUnorm2x16(glm::vec2(f[0], f[1])); break;
+					case HALF2: packed = glm::packHalf2x16(glm::vec2(f[0], f[1])); break;
+					default:
+						// plain floats next to packed ones
+						memcpy(d, f, e.bytes());
+						continue;
+				}
+				memcpy(d, &packed, sizeof(packed));
+			}
+		}
+		src_offset += e.cnt();
+		dst_offset += e.bytes();
+	}
 }
 
 void Mesh::Draw(int instances) {
@@ -190,11 +293,12 @@ void Mesh::Draw(int instances) {
 	// shader.use();
 
     glBindVertexArray(VAO);
+    SetConstantAttributes();
     if(instances > 0) {
-        glDrawElementsInstanced(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0, instances);
+        glDrawElementsInstanced(GL_TRIANGLES, indices.size(), index_type, 0, instances);
     }
 	if(indices.size() > 0) {
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+        glDrawElements(GL_TRIANGLES, indices.size(), index_type, 0);
 	} else {
 		glDrawArrays(GL_POINTS, 0, vertices.size());
 	}
@@ -202,12 +306,36 @@ void Mesh::Draw(int instances) {
 	glBindVertexArray(0);
 }
 
+void Mesh::DrawRange(size_t first, size_t count, int instances) {
+    glBindVertexArray(VAO);
+    SetConstantAttributes();
+    if (instances > 0) {
+        glDrawElementsInstanced(GL_TRIANGLES, count, index_type, (void*)(first * IndexSize()), instances);
+    } else {
+        glDrawElements(GL_TRIANGLES, count, index_type, (void*)(first * IndexSize()));
+    }
+    glBindVertexArray(0);
+}
+
+void Mesh::Release() {
+    glDeleteVertexArrays(1, &VAO);
+    glDeleteBuffers(1, &VBO);
+    glDeleteBuffers(1, &EBO);
+    VAO = VBO = EBO = 0;
+}
+
 size_t LayoutEntry::size() {
 	switch(type) {
 		case FLOAT1: 
 		case FLOAT2:
 		case FLOAT3:
 		case FLOAT4:
+		case QUANTIZED3:
+		case PACKED_NORMAL:
+		case PACKED_COLOR:
+		case UNORM16x2:
+		case HALF2:
+		case CONSTANT3:
 			return sizeof(float);
 		case UINT: return sizeof(unsigned int);
 		case INT: return sizeof(int);
@@ -223,6 +351,14 @@ unsigned int LayoutEntry::cnt() {
 		case FLOAT4: return 4;
 		case UINT: return sizeof(unsigned int);
 		case INT: return sizeof(int);
+		case QUANTIZED3:
+		case PACKED_NORMAL:
+		case PACKED_COLOR:
+		case CONSTANT3:
+			return 3;
+		case UNORM16x2:
+		case HALF2:
+			return 2;
 		default: return 0;
 	}
 }
@@ -233,10 +369,37 @@ unsigned int LayoutEntry::gltype() {
 		case FLOAT2:
 		case FLOAT3:
 		case FLOAT4:
+		case CONSTANT3:
 			return GL_FLOAT;
 		case UINT: return GL_UNSIGNED_INT;
 		case INT: return GL_INT;
+		case QUANTIZED3: return GL_SHORT;
+		case PACKED_NORMAL: return GL_INT_2_10_10_10_REV;
+		case PACKED_COLOR: return GL_UNSIGNED_BYTE;
+		case UNORM16x2: return GL_UNSIGNED_SHORT;
+		case HALF2: return GL_HALF_FLOAT;
 		default: return 0;
 	}
 }
 
+unsigned int LayoutEntry::bytes() {
+	switch(type) {
+		case QUANTIZED3: return 4 * sizeof(short); // padded to keep attributes 4 byte aligned
+		case PACKED_NORMAL:
+		case PACKED_COLOR:
+		case UNORM16x2:
+		case HALF2:
+			return 4;
+		case CONSTANT3: return 0;
+		default: return size() * cnt();
+	}
+}
+
+unsigned int LayoutEntry::glcnt() {
+	// 2-10-10-10 only comes in fours
+	return type == PACKED_NORMAL ? 4 : cnt();
+}
+
+bool LayoutEntry::normalized() {
+	return type == PACKED_NORMAL || type == PACKED_COLOR || type == UNORM16x2;
+}
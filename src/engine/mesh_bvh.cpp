@@ -0,0 +1,381 @@
+#include "mesh_bvh.h"
+#include "mesh.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// triangles per leaf, has to fit in the 4 bit count
+#define BVH_MAX_LEAF 4
+#define BVH_FORCE_SPLIT 15
+#define BVH_BINS 12
+#define BVH_STACK 64
+// past this depth splits go to the median so the traversal stack can't overflow
+#define BVH_MAX_SAH_DEPTH 40
+
+MeshBVH::MeshBVH(const Mesh& mesh) {
+    size_t stride = 0;
+    for (auto e : mesh.layout.entries) {
+        stride += e.cnt();
+    }
+    if (stride < 3 || mesh.vertices.empty()) {
+        return;
+    }
+    Build(mesh.vertices.data(), stride, mesh.vertices.size() / stride, mesh.indices.data(), mesh.indices.size());
+}
+
+void MeshBVH::Build(const float* verts, size_t stride, size_t num_verts, const unsigned int* inds, size_t num_inds) {
+    nodes.clear();
+    tri_verts.clear();
+
+    auto vert = [&](size_t i) {
+        const float* v = verts + i * stride;
+        return glm::vec3(v[0], v[1], v[2]);
+    };
+
+    // no index buffer means every 3 vertices are a triangle
+    size_t num_tris = inds && num_inds > 0 ? num_inds / 3 : num_verts / 3;
+    std::vector<BuildTri> tris;
+    std::vector<glm::vec3> source;
+    tris.reserve(num_tris);
+    source.reserve(num_tris * 3);
+
+    bounds_min = glm::vec3(FLT_MAX);
+    bounds_max = glm::vec3(-FLT_MAX);
+    for (size_t t = 0; t < num_tris; t++) {
+        glm::vec3 p[3];
+        for (int k = 0; k < 3; k++) {
+            size_t i = inds && num_inds > 0 ? inds[t * 3 + k] : t * 3 + k;
+            p[k] = i < num_verts ? vert(i) : glm::vec3(0.0f);
+            source.push_back(p[k]);
+        }
+        BuildTri bt;
+        bt.lo = glm::min(p[0], glm::min(p[1], p[2]));
+        bt.hi = glm::max(p[0], glm::max(p[1], p[2]));
+        bt.centroid = (bt.lo + bt.hi) * 0.5f;
+        bt.index = static_cast<unsigned int>(t);
+        tris.push_back(bt);
+        bounds_min = glm::min(bounds_min, bt.lo);
+        bounds_max = glm::max(bounds_max, bt.hi);
+    }
+    if (tris.empty()) {
+        bounds_min = bounds_max = glm::vec3(0.0f);
+        return;
+    }
+
+    glm::vec3 extent = glm::max(bounds_max - bounds_min, glm::vec3(1e-6f));
+    quant_scale = glm::vec3(65535.0f) / extent;
+
+    nodes.reserve(num_tris * 2 / BVH_MAX_LEAF + 1);
+    std::vector<unsigned int> order;
+    order.reserve(num_tris);
+    BuildRecursive(tris, 0, tris.size(), 0, order);
+
+    // leaves reference triangles by their new slot
+    tri_verts.resize(order.size() * 3);
+    for (size_t i = 0; i < order.size(); i++) {
+        tri_verts[i * 3 + 0] = source[order[i] * 3 + 0];
+        tri_verts[i * 3 + 1] = source[order[i] * 3 + 1];
+        tri_verts[i * 3 + 2] = source[order[i] * 3 + 2];
+    }
+}
+
+unsigned int MeshBVH::BuildRecursive(std::vector<BuildTri>& tris, size_t begin, size_t end, int depth, std::vector<unsigned int>& order) {
+    unsigned int index = static_cast<unsigned int>(nodes.size());
+    nodes.emplace_back();
+
+    glm::vec3 lo(FLT_MAX), hi(-FLT_MAX), clo(FLT_MAX), chi(-FLT_MAX);
+    for (size_t i = begin; i < end; i++) {
+        lo = glm::min(lo, tris[i].lo);
+        hi = glm::max(hi, tris[i].hi);
+        clo = glm::min(clo, tris[i].centroid);
+        chi = glm::max(chi, tris[i].centroid);
+    }
+    Quantize(lo, hi, nodes[index]);
+
+    size_t count = end - begin;
+    auto make_leaf = [&]() {
+        nodes[index].offset = static_cast<uint32_t>(order.size());
+        nodes[index].count = static_cast<uint32_t>(count);
+        for (size_t i = begin; i < end; i++) {
+            order.push_back(tris[i].index);
+        }
+        return index;
+    };
+
+    if (count <= BVH_MAX_LEAF) {
+        return make_leaf();
+    }
+
+    glm::vec3 cext = chi - clo;
+    int axis = 0;
+    if (cext.y > cext[axis]) axis = 1;
+    if (cext.z > cext[axis]) axis = 2;
+
+    size_t mid = begin;
+    if (cext[axis] > 0.0f && depth < BVH_MAX_SAH_DEPTH) {
+        struct Bin {
+            glm::vec3 lo = glm::vec3(FLT_MAX);
+            glm::vec3 hi = glm::vec3(-FLT_MAX);
+            unsigned int count = 0;
+        };
+        Bin bins[BVH_BINS];
+        float k = BVH_BINS / cext[axis];
+        auto bin_of = [&](const BuildTri& t) {
+            int b = static_cast<int>((t.centroid[axis] - clo[axis]) * k);
+            return std::min(std::max(b, 0), BVH_BINS - 1);
+        };
+        for (size_t i = begin; i < end; i++) {
+            Bin& b = bins[bin_of(tris[i])];
+            b.lo = glm::min(b.lo, tris[i].lo);
+            b.hi = glm::max(b.hi, tris[i].hi);
+            b.count++;
+        }
+
+        auto area = [](const glm::vec3& l, const glm::vec3& h) {
+            glm::vec3 d = glm::max(h - l, glm::vec3(0.0f));
+            return d.x * d.y + d.y * d.z + d.z * d.x;
+        };
+
+        // sweep from the right so each split costs O(1)
+        float right_area[BVH_BINS];
+        unsigned int right_count[BVH_BINS];
+        glm::vec3 rlo(FLT_MAX), rhi(-FLT_MAX);
+        unsigned int rc = 0;
+        for (int i = BVH_BINS - 1; i > 0; i--) {
+            rlo = glm::min(rlo, bins[i].lo);
+            rhi = glm::max(rhi, bins[i].hi);
+            rc += bins[i].count;
+            right_area[i] = area(rlo, rhi);
+            right_count[i] = rc;
+        }
+
+        float best_cost = FLT_MAX;
+        int best_split = -1;
+        glm::vec3 llo(FLT_MAX), lhi(-FLT_MAX);
+        unsigned int lc = 0;
+        for (int i = 0; i < BVH_BINS - 1; i++) {
+            llo = glm::min(llo, bins[i].lo);
+            lhi = glm::max(lhi, bins[i].hi);
+            lc += bins[i].count;
+            if (lc == 0 || right_count[i + 1] == 0) {
+                continue;
+            }
+            float cost = lc * area(llo, lhi) + right_count[i + 1] * right_area[i + 1];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_split = i;
+            }
+        }
+
+        float leaf_cost = count * area(lo, hi);
+        if (best_split >= 0 && best_cost >= leaf_cost && count <= BVH_FORCE_SPLIT) {
+            return make_leaf();
+        }
+        if (best_split >= 0) {
+            auto it = std::partition(tris.begin() + begin, tris.begin() + end,
+                [&](const BuildTri& t) { return bin_of(t) <= best_split; });
+            mid = it - tris.begin();
+        }
+    }
+
+    // everything landed on one side (or all centroids coincide), fall back to a median split
+    if (mid == begin || mid == end) {
+        mid = begin + count / 2;
+        std::nth_element(tris.begin() + begin, tris.begin() + mid, tris.begin() + end,
+            [axis](const BuildTri& a, const BuildTri& b) { return a.centroid[axis] < b.centroid[axis]; });
+    }
+
+    BuildRecursive(tris, begin, mid, depth + 1, order);
+    unsigned int right = BuildRecursive(tris, mid, end, depth + 1, order);
+    nodes[index].offset = right;
+    nodes[index].count = 0;
+    return index;
+}
+
+void MeshBVH::Quantize(const glm::vec3& lo, const glm::vec3& hi, Node& n) const {
+    for (int i = 0; i < 3; i++) {
+        // round outwards with a unit of slack so dequantized bounds always contain the real ones
+        float l = std::floor((lo[i] - bounds_min[i]) * quant_scale[i]) - 1.0f;
+        float h = std::ceil((hi[i] - bounds_min[i]) * quant_scale[i]) + 1.0f;
+        n.qmin[i] = static_cast<uint16_t>(glm::clamp(l, 0.0f, 65535.0f));
+        n.qmax[i] = static_cast<uint16_t>(glm::clamp(h, 0.0f, 65535.0f));
+    }
+}
+
+void MeshBVH::Dequantize(const Node& n, glm::vec3& lo, glm::vec3& hi) const {
+    for (int i = 0; i < 3; i++) {
+        lo[i] = bounds_min[i] + n.qmin[i] / quant_scale[i];
+        hi[i] = bounds_min[i] + n.qmax[i] / quant_scale[i];
+    }
+    // clamped nodes sit right on the mesh bounds, give float error some room
+    glm::vec3 pad = (bounds_max - bounds_min) * 1e-5f;
+    lo -= pad;
+    hi += pad;
+}
+
+bool MeshBVH::QueryAABB(const glm::vec3& lo, const glm::vec3& hi, const std::function<bool(unsigned int)>& fn) const {
+    if (nodes.empty()) {
+        return false;
+    }
+    unsigned int stack[BVH_STACK];
+    int sp = 0;
+    stack[sp++] = 0;
+    while (sp > 0) {
+        const Node& n = nodes[stack[--sp]];
+        unsigned int self = static_cast<unsigned int>(&n - nodes.data());
+        glm::vec3 nlo, nhi;
+        Dequantize(n, nlo, nhi);
+        if (glm::any(glm::lessThan(hi, nlo)) || glm::any(glm::greaterThan(lo, nhi))) {
+            continue;
+        }
+        if (n.count > 0) {
+            // the bitfields promote to int, keep the bound unsigned
+            unsigned int first = n.offset;
+            unsigned int end = first + n.count;
+            for (unsigned int t = first; t < end; t++) {
+                if (fn(t)) {
+                    return true;
+                }
+            }
+        } else if (sp + 2 <= BVH_STACK) {
+            stack[sp++] = n.offset;
+            stack[sp++] = self + 1;
+        }
+    }
+    return false;
+}
+
+bool MeshBVH::SphereIntersect(const glm::vec3& center, float radius) const {
+    float r2 = radius * radius;
+    return QueryAABB(center - glm::vec3(radius), center + glm::vec3(radius), [&](unsigned int t) {
+        glm::vec3 a, b, c;
+        GetTriangle(t, a, b, c);
+        glm::vec3 d = ClosestPointOnTriangle(center, a, b, c) - center;
+        return glm::dot(d, d) <= r2;
+    });
+}
+
+bool MeshBVH::Raycast(const glm::vec3& origin, const glm::vec3& dir, float max_t, RayHit& hit) const {
+    if (nodes.empty()) {
+        return false;
+    }
+    glm::vec3 inv_dir = 1.0f / dir;
+    auto slab = [&](const Node& n, float& tnear) {
+        glm::vec3 lo, hi;
+        Dequantize(n, lo, hi);
+        glm::vec3 t0 = (lo - origin) * inv_dir;
+        glm::vec3 t1 = (hi - origin) * inv_dir;
+        glm::vec3 tmin = glm::min(t0, t1);
+        glm::vec3 tmax = glm::max(t0, t1);
+        tnear = std::max(std::max(tmin.x, tmin.y), std::max(tmin.z, 0.0f));
+        float tfar = std::min(std::min(tmax.x, tmax.y), std::min(tmax.z, max_t));
+        return tnear <= tfar;
+    };
+
+    bool found = false;
+    float best = max_t;
+    unsigned int stack[BVH_STACK];
+    int sp = 0;
+    float tn;
+    if (!slab(nodes[0], tn)) {
+        return false;
+    }
+    stack[sp++] = 0;
+    while (sp > 0) {
+        unsigned int ni = stack[--sp];
+        const Node& n = nodes[ni];
+        if (n.count > 0) {
+            // the bitfields promote to int, keep the bound unsigned
+            unsigned int first = n.offset;
+            unsigned int end = first + n.count;
+            for (unsigned int t = first; t < end; t++) {
+                glm::vec3 a, b, c;
+                GetTriangle(t, a, b, c);
+                float th;
+                if (RayTriangle(origin, dir, a, b, c, th) && th < best) {
+                    best = th;
+                    found = true;
+                    hit.t = th;
+                    hit.triangle = t;
+                    hit.normal = glm::cross(b - a, c - a);
+                }
+            }
+            continue;
+        }
+        unsigned int l = ni + 1, r = n.offset;
+        float tl, tr;
+        bool hl = slab(nodes[l], tl) && tl < best;
+        bool hr = slab(nodes[r], tr) && tr < best;
+        if (sp + 2 > BVH_STACK) {
+            continue;
+        }
+        // push the far child first so the near one is popped next
+        if (hl && hr) {
+            if (tl < tr) {
+                stack[sp++] = r;
+                stack[sp++] = l;
+            } else {
+                stack[sp++] = l;
+                stack[sp++] = r;
+            }
+        } else if (hl) {
+            stack[sp++] = l;
+        } else if (hr) {
+            stack[sp++] = r;
+        }
+    }
+    return found;
+}
+
+// Real-Time Collision Detection, 5.1.5
+glm::vec3 MeshBVH::ClosestPointOnTriangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+    glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+    float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+    if (d1 <= 0.0f && d2 <= 0.0f) return a;
+
+    glm::vec3 bp = p - b;
+    float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+    if (d3 >= 0.0f && d4 <= d3) return b;
+
+    float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+        return a + ab * (d1 / (d1 - d3));
+    }
+
+    glm::vec3 cp = p - c;
+    float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+    if (d6 >= 0.0f && d5 <= d6) return c;
+
+    float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+        return a + ac * (d2 / (d2 - d6));
+    }
+
+    float va = d3 * d6 - d5 * d4;
+    if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) {
+        return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+    }
+
+    float denom = 1.0f / (va + vb + vc);
+    return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+// Moller-Trumbore, double sided
+bool MeshBVH::RayTriangle(const glm::vec3& origin, const glm::vec3& dir, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, float& t) {
+    glm::vec3 e1 = b - a, e2 = c - a;
+    glm::vec3 p = glm::cross(dir, e2);
+    float det = glm::dot(e1, p);
+    if (std::fabs(det) < 1e-12f) {
+        return false;
+    }
+    float inv = 1.0f / det;
+    glm::vec3 s = origin - a;
+    float u = glm::dot(s, p) * inv;
+    if (u < 0.0f || u > 1.0f) return false;
+    glm::vec3 q = glm::cross(s, e1);
+    float v = glm::dot(dir, q) * inv;
+    if (v < 0.0f || u + v > 1.0f) return false;
+    t = glm::dot(e2, q) * inv;
+    return t >= 0.0f;
+}
@@ -0,0 +1,172 @@
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "mesh_cache.h"
+#include "mesh.h"
+#include "cache_file.h"
+#include "mapped_file.h"
+
+namespace {
+    const int MAX_LAYOUT_ENTRIES = 8;
+
+    struct LayoutDescriptor {
+        uint32_t type;
+        char name[28];
+    };
+
+    struct ConstantDescriptor {
+        uint32_t location;
+        float value[3];
+    };
+
+    struct Header {
+        CacheFile::Prefix prefix;
+        uint64_t source_stamp;
+        uint32_t num_layout_entries;
+        uint32_t index_type;
+        LayoutDescriptor layout[MAX_LAYOUT_ENTRIES];
+        float bounds_min[3];
+        float bounds_max[3];
+        float vertex_scale[3];
+        float vertex_offset[3];
+        uint32_t num_constants;
+        uint32_t reserved;
+        ConstantDescriptor constants[MAX_LAYOUT_ENTRIES];
+        uint64_t num_floats;
+        uint64_t num_gpu_bytes; // 0 when the layout isn't packed and the floats go up as they are
+        uint64_t num_indices;
+        uint64_t checksum; // of the vertex, packed vertex and index blobs together
+    };
+
+    // keeps the blobs right behind it aligned in the mapping
+    static_assert(sizeof(Header) % 8 == 0, "mesh cache header needs padding");
+
+    const char MAGIC[4] = {'D', 'N', 'A', 'M'};
+
+    size_t IndexSize(uint32_t index_type) {
+        return index_type == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+    }
+}
+
+namespace MeshCache {
+
+std::string PathFor(uint64_t key) {
+    return CacheFile::PathFor("meshes", key, "mesh");
+}
+
+bool Load(uint64_t key, uint64_t source_stamp, Mesh& mesh) {
+    MappedFile file;
+    Header header;
+    if (!CacheFile::Open(file, PathFor(key), CacheFile::MakePrefix(MAGIC, VERSION, key), header, "Mesh")) {
+        return false;
+    }
+    const unsigned char* payload = file.Data() + sizeof(Header);
+    size_t payload_size = file.Size() - sizeof(Header);
+    if (header.source_stamp != source_stamp || header.num_layout_entries > MAX_LAYOUT_ENTRIES
+        || (header.index_type != GL_UNSIGNED_SHORT && header.index_type != GL_UNSIGNED_INT)
+        || header.num_constants > MAX_LAYOUT_ENTRIES || header.num_gpu_bytes % sizeof(float) != 0
+        || header.num_floats * sizeof(float) + header.num_gpu_bytes + header.num_indices * IndexSize(header.index_type) != payload_size) {
+        std::cout << "Mesh cache: stale entry " << PathFor(key) << std::endl;
+        return false;
+    }
+    if (!CacheFile::Verify(payload, payload_size, header.checksum, PathFor(key), "Mesh")) {
+        return false;
+    }
+
+    std::vector<LayoutEntry> entries;
+    for (uint32_t i = 0; i < header.num_layout_entries; i++) {
+        const LayoutDescriptor& d = header.layout[i];
+        entries.emplace_back(static_cast<LAYOUT_TYPE>(d.type), std::string(d.name, strnlen(d.name, sizeof(d.name))));
+    }
+    VertexPacking packing;
+    memcpy(&packing.scale[0], header.vertex_scale, sizeof(header.vertex_scale));
+    memcpy(&packing.offset[0], header.vertex_offset, sizeof(header.vertex_offset));
+    for (uint32_t i = 0; i < header.num_constants; i++) {
+        const ConstantDescriptor& d = header.constants[i];
+        packing.constants.emplace_back(d.location, glm::vec3(d.value[0], d.value[1], d.value[2]));
+    }
+
+    // the header keeps the blobs 8 byte aligned, what follows the floats is whole words
+    const float* vertices = reinterpret_cast<const float*>(payload);
+    const unsigned char* gpu_vertices = payload + header.num_floats * sizeof(float);
+    size_t gpu_size = header.num_gpu_bytes;
+    if (gpu_size == 0) {
+        gpu_vertices = payload;
+        gpu_size = header.num_floats * sizeof(float);
+    }
+    const void* indices = payload + header.num_floats * sizeof(float) + header.num_gpu_bytes;
+    mesh = Mesh(vertices, header.num_floats, gpu_vertices, gpu_size, packing, indices, header.num_indices, header.index_type, Layout(entries));
+    return true;
+}
+
+bool Save(uint64_t key, uint64_t source_stamp, const Mesh& mesh) {
+    if (mesh.vertices.empty() || mesh.layout.entries.size() > MAX_LAYOUT_ENTRIES) {
+        return false;
+    }
+
+    Header header;
+    memset(&header, 0, sizeof(header));
+    header.prefix = CacheFile::MakePrefix(MAGIC, VERSION, key);
+    header.source_stamp = source_stamp;
+    header.num_layout_entries = mesh.layout.entries.size();
+    header.index_type = mesh.IndexType();
+    size_t stride = 0;
+    for (size_t i = 0; i < mesh.layout.entries.size(); i++) {
+        LayoutEntry e = mesh.layout.entries[i];
+        header.layout[i].type = e.type;
+        strncpy(header.layout[i].name, e.name.c_str(), sizeof(header.layout[i].name) - 1);
+        stride += e.cnt();
+    }
+    header.num_floats = mesh.vertices.size();
+    header.num_indices = mesh.indices.size();
+
+    // bounds of the first attribute, the position in every layout we have
+    glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+    if (stride >= 3) {
+        for (size_t v = 0; v + stride <= mesh.vertices.size(); v += stride) {
+            glm::vec3 p(mesh.vertices[v], mesh.vertices[v + 1], mesh.vertices[v + 2]);
+            lo = glm::min(lo, p);
+            hi = glm::max(hi, p);
+        }
+    }
+    memcpy(header.bounds_min, &lo[0], sizeof(header.bounds_min));
+    memcpy(header.bounds_max, &hi[0], sizeof(header.bounds_max));
+
+    // packed layouts store what the GPU gets too, so loading never packs again
+    std::vector<unsigned char> gpu_vertices;
+    if (mesh.layout.Packed()) {
+        VertexPacking packing;
+        mesh.PackVertices(gpu_vertices, packing);
+        memcpy(header.vertex_scale, &packing.scale[0], sizeof(header.vertex_scale));
+        memcpy(header.vertex_offset, &packing.offset[0], sizeof(header.vertex_offset));
+        header.num_constants = packing.constants.size();
+        for (size_t i = 0; i < packing.constants.size(); i++) {
+            header.constants[i].location = packing.constants[i].first;
+            memcpy(header.constants[i].value, &packing.constants[i].second[0], sizeof(header.constants[i].value));
+        }
+    } else {
+        header.vertex_scale[0] = header.vertex_scale[1] = header.vertex_scale[2] = 1.0f;
+    }
+    header.num_gpu_bytes = gpu_vertices.size();
+
+    size_t float_size = mesh.vertices.size() * sizeof(float);
+    std::vector<unsigned char> payload(float_size + gpu_vertices.size() + mesh.indices.size() * IndexSize(header.index_type));
+    memcpy(payload.data(), mesh.vertices.data(), float_size);
+    if (!gpu_vertices.empty()) {
+        memcpy(payload.data() + float_size, gpu_vertices.data(), gpu_vertices.size());
+    }
+    unsigned char* index_data = payload.data() + float_size + gpu_vertices.size();
+    if (header.index_type == GL_UNSIGNED_SHORT) {
+        std::vector<unsigned short> short_indices(mesh.indices.begin(), mesh.indices.end());
+        memcpy(index_data, short_indices.data(), short_indices.size() * sizeof(unsigned short));
+    } else {
+        memcpy(index_data, mesh.indices.data(), mesh.indices.size() * sizeof(unsigned int));
+    }
+    header.checksum = CacheFile::Hash(payload.data(), payload.size());
+    return CacheFile::Write(PathFor(key), &header, sizeof(header), payload.data(), payload.size(), "Mesh");
+}
+
+}
@@ -0,0 +1,238 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "mesh_optimizer.h"
+
+namespace {
+    // Forsyth's tuning, the cache he scores against is bigger than the one we
+    // measure with so vertices still near the front keep some pull
+    const int SCORE_CACHE_SIZE = 32;
+    const float CACHE_DECAY_POWER = 1.5f;
+    const float LAST_TRIANGLE_SCORE = 0.75f;
+    const float VALENCE_BOOST_SCALE = 2.0f;
+    const float VALENCE_BOOST_POWER = 0.5f;
+
+    float VertexScore(int cache_position, int remaining) {
+        if (remaining == 0) {
+            // nothing left to draw with it
+            return -1.0f;
+        }
+        float score = 0.0f;
+        if (cache_position >= 0) {
+            if (cache_position < 3) {
+                // just used by the last triangle, any order of those is as good
+                score = LAST_TRIANGLE_SCORE;
+            } else {
+                float scaler = 1.0f / (SCORE_CACHE_SIZE - 3);
+                score = std::pow(1.0f - (cache_position - 3) * scaler, CACHE_DECAY_POWER);
+            }
+        }
+        // few triangles left, get it done with before it goes cold
+        return score + VALENCE_BOOST_SCALE * std::pow(static_cast<float>(remaining), -VALENCE_BOOST_POWER);
+    }
+
+    uint64_t HashVertex(const float* v, size_t stride) {
+        uint64_t h = 1469598103934665603ull;
+        for (size_t i = 0; i < stride; i++) {
+            uint32_t bits;
+            std::memcpy(&bits, &v[i], sizeof(bits));
+            h = (h ^ bits) * 1099511628211ull;
+        }
+        return h ^ (h >> 29);
+    }
+
+    // returns how many unique vertices are left, indices point at them afterwards
+    size_t Weld(std::vector<float>& vertices, std::vector<unsigned int>& indices, size_t stride) {
+        size_t count = vertices.size() / stride;
+        size_t table_size = 1;
+        while (table_size < count * 2) {
+            table_size <<= 1;
+        }
+        // open addressing, each slot holds an index into the welded vertices
+        std::vector<unsigned int> table(table_size, UINT32_MAX);
+        std::vector<unsigned int> remap(count);
+        size_t unique = 0;
+        for (size_t v = 0; v < count; v++) {
+            const float* data = &vertices[v * stride];
+            size_t slot = HashVertex(data, stride) & (table_size - 1);
+            while (table[slot] != UINT32_MAX && std::memcmp(&vertices[table[slot] * stride], data, stride * sizeof(float)) != 0) {
+                slot = (slot + 1) & (table_size - 1);
+            }
+            if (table[slot] == UINT32_MAX) {
+                // first time seen, slides down into the welded part of the buffer
+                if (unique != v) {
+                    std::memmove(&vertices[unique * stride], data, stride * sizeof(float));
+                }
+                table[slot] = static_cast<unsigned int>(unique++);
+            }
+            remap[v] = table[slot];
+        }
+        vertices.resize(unique * stride);
+        for (unsigned int& i : indices) {
+            i = remap[i];
+        }
+        return unique;
+    }
+
+    void ReorderTriangles(std::vector<unsigned int>& indices, size_t vertex_count) {
+        size_t num_triangles = indices.size() / 3;
+        if (num_triangles == 0) {
+            return;
+        }
+
+        // triangles touching each vertex
+        std::vector<unsigned int> remaining(vertex_count, 0);
+        for (unsigned int i : indices) {
+            remaining[i]++;
+        }
+        std::vector<unsigned int> first(vertex_count + 1, 0);
+        for (size_t v = 0; v < vertex_count; v++) {
+            first[v + 1] = first[v] + remaining[v];
+        }
+        std::vector<unsigned int> adjacency(indices.size());
+        std::vector<unsigned int> fill(first.begin(), first.end() - 1);
+        for (size_t t = 0; t < num_triangles; t++) {
+            for (int k = 0; k < 3; k++) {
+                adjacency[fill[indices[t * 3 + k]]++] = static_cast<unsigned int>(t);
+            }
+        }
+
+        std::vector<int> cache_position(vertex_count, -1);
+        std::vector<float> vertex_score(vertex_count);
+        for (size_t v = 0; v < vertex_count; v++) {
+            vertex_score[v] = VertexScore(-1, remaining[v]);
+        }
+        std::vector<float> triangle_score(num_triangles);
+        std::vector<char> emitted(num_triangles, 0);
+        for (size_t t = 0; t < num_triangles; t++) {
+            triangle_score[t] = vertex_score[indices[t * 3]] + vertex_score[indices[t * 3 + 1]] + vertex_score[indices[t * 3 + 2]];
+        }
+
+        std::vector<unsigned int> out;
+        out.reserve(indices.size());
+        // one bigger than the scoring cache so the vertex pushed out gets rescored too
+        std::vector<unsigned int> cache;
+        cache.reserve(SCORE_CACHE_SIZE + 3);
+        std::vector<unsigned int> next_cache;
+        next_cache.reserve(SCORE_CACHE_SIZE + 3);
+
+        size_t best = 0;
+        for (size_t t = 1; t < num_triangles; t++) {
+            if (triangle_score[t] > triangle_score[best]) {
+                best = t;
+            }
+        }
+        size_t scan = 0;
+
+        for (size_t n = 0; n < num_triangles; n++) {
+            if (best == SIZE_MAX) {
+                // Nothing in the cache touches anything left, carry on from
+                // the first triangle not out yet. Scanning for the best score
+                // would be right but quadratic on meshes in lots of pieces.
+                while (emitted[scan]) {
+                    scan++;
+                }
+                best = scan;
+            }
+            emitted[best] = 1;
+            const unsigned int* tri = &indices[best * 3];
+            out.insert(out.end(), tri, tri + 3);
+
+            // the three just used go to the front, everything else shifts back
+            next_cache.assign(tri, tri + 3);
+            for (int k = 0; k < 3; k++) {
+                unsigned int v = tri[k];
+                // this triangle is done with the vertex
+                unsigned int* begin = &adjacency[first[v]];
+                unsigned int* end = begin + remaining[v];
+                std::iter_swap(std::find(begin, end, static_cast<unsigned int>(best)), end - 1);
+                remaining[v]--;
+            }
+            for (unsigned int v : cache) {
+                if (v != tri[0] && v != tri[1] && v != tri[2]) {
+                    next_cache.push_back(v);
+                }
+            }
+            cache.swap(next_cache);
+
+            for (size_t i = 0; i < cache.size(); i++) {
+                unsigned int v = cache[i];
+                cache_position[v] = i < SCORE_CACHE_SIZE ? static_cast<int>(i) : -1;
+                float score = VertexScore(cache_position[v], remaining[v]);
+                float delta = score - vertex_score[v];
+                vertex_score[v] = score;
+                for (unsigned int a = first[v]; a < first[v] + remaining[v]; a++) {
+                    triangle_score[adjacency[a]] += delta;
+                }
+            }
+            if (cache.size() > SCORE_CACHE_SIZE) {
+                cache.resize(SCORE_CACHE_SIZE);
+            }
+
+            // the next one is whichever triangle next to the cache scores best now
+            best = SIZE_MAX;
+            float best_score = -1e30f;
+            for (unsigned int v : cache) {
+                for (unsigned int a = first[v]; a < first[v] + remaining[v]; a++) {
+                    unsigned int t = adjacency[a];
+                    if (triangle_score[t] > best_score) {
+                        best_score = triangle_score[t];
+                        best = t;
+                    }
+                }
+            }
+        }
+        indices.swap(out);
+    }
+
+    void ReorderVertices(std::vector<float>& vertices, std::vector<unsigned int>& indices, size_t stride) {
+        size_t count = vertices.size() / stride;
+        std::vector<unsigned int> remap(count, UINT32_MAX);
+        std::vector<float> out(vertices.size());
+        unsigned int next = 0;
+        for (unsigned int& i : indices) {
+            if (remap[i] == UINT32_MAX) {
+                std::memcpy(&out[next * stride], &vertices[i * stride], stride * sizeof(float));
+                remap[i] = next++;
+            }
+            i = remap[i];
+        }
+        // anything no triangle uses is dropped
+        out.resize(next * stride);
+        vertices.swap(out);
+    }
+}
+
+float ComputeACMR(const std::vector<unsigned int>& indices, size_t vertex_count, int cache_size) {
+    if (indices.size() < 3) {
+        return 0.0f;
+    }
+    // when each vertex went in, counted in misses, it's still there while misses - in < cache_size
+    std::vector<size_t> inserted(vertex_count, SIZE_MAX);
+    size_t misses = 0;
+    for (unsigned int i : indices) {
+        if (inserted[i] == SIZE_MAX || misses - inserted[i] >= static_cast<size_t>(cache_size)) {
+            inserted[i] = misses++;
+        }
+    }
+    return static_cast<float>(misses) / (indices.size() / 3);
+}
+
+MeshOptimizeStats OptimizeMesh(std::vector<float>& vertices, std::vector<unsigned int>& indices, size_t stride) {
+    MeshOptimizeStats stats;
+    if (stride == 0 || indices.size() < 3) {
+        return stats;
+    }
+    stats.vertices_before = vertices.size() / stride;
+    stats.acmr_before = ComputeACMR(indices, stats.vertices_before);
+
+    size_t unique = Weld(vertices, indices, stride);
+    ReorderTriangles(indices, unique);
+    ReorderVertices(vertices, indices, stride);
+
+    stats.vertices_after = vertices.size() / stride;
+    stats.acmr_after = ComputeACMR(indices, stats.vertices_after);
+    return stats;
+}
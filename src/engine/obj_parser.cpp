@@ -0,0 +1,226 @@
+#include <algorithm>
+#include <charconv>
+#include <iostream>
+
+#include "obj_parser.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+
+namespace {
+    // flags for corner components counted back from the end of their own chunk
+    const unsigned char RELATIVE_V = 1;
+    const unsigned char RELATIVE_VT = 2;
+    const unsigned char RELATIVE_VN = 4;
+
+    struct Chunk {
+        ObjGeometry geometry;
+        std::vector<unsigned char> relative; // one per corner
+        std::vector<glm::ivec3> face;        // reused for every f line
+        std::vector<unsigned char> face_relative;
+        size_t bad_faces = 0;
+        size_t first_bad_line = 0;           // byte offset, for the message
+    };
+
+    bool IsSpace(char c) {
+        return c == ' ' || c == '\t';
+    }
+
+    void SkipSpaces(const char*& p, const char* end) {
+        while (p < end && IsSpace(*p)) {
+            p++;
+        }
+    }
+
+    bool ParseFloat(const char*& p, const char* end, float& out) {
+        SkipSpaces(p, end);
+        // from_chars won't take a leading plus
+        if (p < end && *p == '+') {
+            p++;
+        }
+        std::from_chars_result r = std::from_chars(p, end, out);
+        if (r.ec != std::errc()) {
+            return false;
+        }
+        p = r.ptr;
+        return true;
+    }
+
+    // 1 based or negative on disk, 0 based (possibly relative) out, false on 0 or garbage
+    bool ParseIndex(const char*& p, const char* end, size_t count, int& out, bool& relative) {
+        int i;
+        std::from_chars_result r = std::from_chars(p, end, i);
+        if (r.ec != std::errc() || i == 0) {
+            return false;
+        }
+        p = r.ptr;
+        relative = i < 0;
+        out = relative ? static_cast<int>(count) + i : i - 1;
+        return true;
+    }
+
+    // one "v", "v/vt", "v//vn" or "v/vt/vn"
+    bool ParseCorner(const char*& p, const char* end, const ObjGeometry& g, glm::ivec3& corner, unsigned char& relative) {
+        corner = glm::ivec3(-1);
+        relative = 0;
+        bool rel;
+        if (!ParseIndex(p, end, g.positions.size(), corner.x, rel)) {
+            return false;
+        }
+        relative |= rel ? RELATIVE_V : 0;
+        if (p < end && *p == '/') {
+            p++;
+            if (p < end && *p != '/') {
+                if (!ParseIndex(p, end, g.uvs.size(), corner.y, rel)) {
+                    return false;
+                }
+                relative |= rel ? RELATIVE_VT : 0;
+            }
+            if (p < end && *p == '/') {
+                p++;
+                if (!ParseIndex(p, end, g.normals.size(), corner.z, rel)) {
+                    return false;
+                }
+                relative |= rel ? RELATIVE_VN : 0;
+            }
+        }
+        return true;
+    }
+
+    void ParseRange(const char* p, const char* end, const char* file_start, Chunk& c) {
+        ObjGeometry& g = c.geometry;
+        while (p < end) {
+            const char* eol = std::find(p, end, '\n');
+            const char* line = p;
+            p = eol + (eol < end ? 1 : 0);
+            SkipSpaces(line, eol);
+            // windows line endings
+            const char* stop = (eol > line && eol[-1] == '\r') ? eol - 1 : eol;
+            if (stop - line < 2) {
+                continue;
+            }
+
+            if (line[0] == 'v' && IsSpace(line[1])) {
+                glm::vec3 v(0.0f);
+                const char* q = line + 1;
+                ParseFloat(q, stop, v.x) && ParseFloat(q, stop, v.y) && ParseFloat(q, stop, v.z);
+                g.positions.push_back(v);
+            } else if (line[0] == 'v' && line[1] == 't') {
+                glm::vec2 vt(0.0f);
+                const char* q = line + 2;
+                ParseFloat(q, stop, vt.x) && ParseFloat(q, stop, vt.y);
+                g.uvs.push_back(vt);
+            } else if (line[0] == 'v' && line[1] == 'n') {
+                glm::vec3 vn(0.0f);
+                const char* q = line + 2;
+                ParseFloat(q, stop, vn.x) && ParseFloat(q, stop, vn.y) && ParseFloat(q, stop, vn.z);
+                g.normals.push_back(vn);
+            } else if (line[0] == 'f' && IsSpace(line[1])) {
+                c.face.clear();
+                c.face_relative.clear();
+                const char* q = line + 1;
+                bool ok = true;
+                while (true) {
+                    SkipSpaces(q, stop);
+                    if (q >= stop) {
+                        break;
+                    }
+                    glm::ivec3 corner;
+                    unsigned char rel;
+                    if (!ParseCorner(q, stop, g, corner, rel)) {
+                        ok = false;
+                        break;
+                    }
+                    c.face.push_back(corner);
+                    c.face_relative.push_back(rel);
+                }
+                if (!ok || c.face.size() < 3) {
+                    if (c.bad_faces++ == 0) {
+                        c.first_bad_line = line - file_start;
+                    }
+                    continue;
+                }
+                // fan, same winding as the polygon
+                for (size_t i = 1; i + 1 < c.face.size(); i++) {
+                    size_t tri[3] = {0, i, i + 1};
+                    for (size_t k : tri) {
+                        g.corners.push_back(c.face[k]);
+                        c.relative.push_back(c.face_relative[k]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+bool LoadObj(const std::string& path, ObjGeometry& out) {
+    out = ObjGeometry();
+    MappedFile file;
+    if (!file.Open(path)) {
+        std::cout << "Couldn't open object file " << path << std::endl;
+        return false;
+    }
+    const char* begin = reinterpret_cast<const char*>(file.Data());
+    const char* end = begin + file.Size();
+
+    // cut at line breaks so every line is whole in exactly one chunk
+    ThreadPool& pool = ThreadPool::Get();
+    size_t num_chunks = file.Size() > OBJ_PARALLEL_BYTES ? std::min<size_t>(pool.NumSlots() * 2, file.Size() / (OBJ_PARALLEL_BYTES / 4)) : 1;
+    num_chunks = std::max<size_t>(num_chunks, 1);
+    std::vector<const char*> cuts(num_chunks + 1, end);
+    cuts[0] = begin;
+    for (size_t i = 1; i < num_chunks; i++) {
+        const char* guess = std::max(begin + file.Size() * i / num_chunks, cuts[i - 1]);
+        const char* eol = std::find(guess, end, '\n');
+        cuts[i] = eol < end ? eol + 1 : end;
+    }
+
+    std::vector<Chunk> chunks(num_chunks);
+    pool.ParallelFor(num_chunks, 1, [&](size_t first, size_t last, unsigned) {
+        for (size_t i = first; i < last; i++) {
+            ParseRange(cuts[i], cuts[i + 1], begin, chunks[i]);
+        }
+    });
+
+    size_t positions = 0, uvs = 0, normals = 0, corners = 0, bad_faces = 0;
+    for (const Chunk& c : chunks) {
+        positions += c.geometry.positions.size();
+        uvs += c.geometry.uvs.size();
+        normals += c.geometry.normals.size();
+        corners += c.geometry.corners.size();
+        bad_faces += c.bad_faces;
+    }
+    if (num_chunks == 1) {
+        out = std::move(chunks[0].geometry);
+    } else {
+        out.positions.reserve(positions);
+        out.uvs.reserve(uvs);
+        out.normals.reserve(normals);
+        out.corners.reserve(corners);
+    }
+
+    // relative indices were counted within their own chunk, shift them by everything before it
+    glm::ivec3 offset(0);
+    for (Chunk& c : chunks) {
+        ObjGeometry& g = c.geometry;
+        if (num_chunks > 1) {
+            out.positions.insert(out.positions.end(), g.positions.begin(), g.positions.end());
+            out.uvs.insert(out.uvs.end(), g.uvs.begin(), g.uvs.end());
+            out.normals.insert(out.normals.end(), g.normals.begin(), g.normals.end());
+            for (size_t i = 0; i < g.corners.size(); i++) {
+                glm::ivec3 corner = g.corners[i];
+                unsigned char rel = c.relative[i];
+                corner.x += (rel & RELATIVE_V) ? offset.x : 0;
+                corner.y += (rel & RELATIVE_VT) ? offset.y : 0;
+                corner.z += (rel & RELATIVE_VN) ? offset.z : 0;
+                out.corners.push_back(corner);
+            }
+        }
+        offset += glm::ivec3(g.positions.size(), g.uvs.size(), g.normals.size());
+    }
+
+    if (bad_faces > 0) {
+        const Chunk& c = *std::find_if(chunks.begin(), chunks.end(), [](const Chunk& c) { return c.bad_faces > 0; });
+        std::cout << "Object file " << path << ": skipped " << bad_faces << " bad faces, the first at byte " << c.first_bad_line << std::endl;
+    }
+    return true;
+}
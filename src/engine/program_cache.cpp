@@ -0,0 +1,99 @@
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "program_cache.h"
+#include "cache_file.h"
+#include "mapped_file.h"
+
+namespace {
+    struct Header {
+        CacheFile::Prefix prefix;
+        uint32_t binary_format;
+        uint32_t size;
+        uint64_t checksum; // of the binary
+    };
+
+    static_assert(sizeof(Header) % 8 == 0, "program cache header needs padding");
+
+    const char MAGIC[4] = {'D', 'N', 'A', 'P'};
+
+    std::string GLString(GLenum name) {
+        const GLubyte* s = glGetString(name);
+        return s ? reinterpret_cast<const char*>(s) : "";
+    }
+}
+
+namespace ProgramCache {
+
+bool Supported() {
+    if (!GLEW_VERSION_4_1 && !GLEW_ARB_get_program_binary) {
+        return false;
+    }
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+}
+
+uint64_t KeyFor(const std::vector<std::string>& sources) {
+    // the driver is in the key, a binary from another one is never even tried
+    uint64_t key = CacheFile::HashString(GLString(GL_VENDOR));
+    key = CacheFile::HashString(GLString(GL_RENDERER), key);
+    key = CacheFile::HashString(GLString(GL_VERSION), key);
+    for (const std::string& source : sources) {
+        key = CacheFile::HashValue(source.size(), key);
+        key = CacheFile::HashString(source, key);
+    }
+    return key;
+}
+
+std::string PathFor(uint64_t key) {
+    return CacheFile::PathFor("programs", key, "bin");
+}
+
+bool Load(uint64_t key, unsigned int program) {
+    MappedFile file;
+    Header header;
+    if (!CacheFile::Open(file, PathFor(key), CacheFile::MakePrefix(MAGIC, VERSION, key), header, "Program")) {
+        return false;
+    }
+    const unsigned char* binary = file.Data() + sizeof(Header);
+    if (file.Size() - sizeof(Header) != header.size) {
+        std::cout << "Program cache: stale entry " << PathFor(key) << std::endl;
+        return false;
+    }
+    if (!CacheFile::Verify(binary, header.size, header.checksum, PathFor(key), "Program")) {
+        return false;
+    }
+
+    // asking for the link status here would wait on the driver, the caller does it on first use
+    glProgramBinary(program, header.binary_format, binary, header.size);
+    return true;
+}
+
+bool Save(uint64_t key, unsigned int program) {
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+        return false;
+    }
+    std::vector<unsigned char> binary(length);
+    GLenum binary_format = 0;
+    GLsizei written = 0;
+    glGetProgramBinary(program, length, &written, &binary_format, binary.data());
+    if (written <= 0) {
+        return false;
+    }
+
+    Header header;
+    memset(&header, 0, sizeof(header));
+    header.prefix = CacheFile::MakePrefix(MAGIC, VERSION, key);
+    header.binary_format = binary_format;
+    header.size = written;
+    header.checksum = CacheFile::Hash(binary.data(), written);
+    return CacheFile::Write(PathFor(key), &header, sizeof(header), binary.data(), written, "Program");
+}
+
+}
@@ -4,6 +4,8 @@
 #include <glm/gtx/rotate_vector.hpp>
 #include <glm/gtc/random.hpp>
 #include <glm/gtx/string_cast.hpp>
+#include <algorithm>
+#include <random>
 #include <stdexcept>
 #include <fstream>
 #include <sstream>
@@ -11,6 +13,8 @@
 
 #include "defines.h"
 #include "mesh.h"
+#include "mesh_cache.h"
+#include "cache_file.h"
 #include "resource.h"
 #include "resource_manager.h"
 
@@ -25,6 +29,10 @@
 const Layout generator_layout = Layout(
 	{{FLOAT3, "vertex"},{FLOAT3, "normal"}, {FLOAT3, "color"}, {FLOAT2, "uv"}});
 
+// same thing at 20 bytes for generators whose colors and uvs stay in [0, 1]
+const Layout packed_generator_layout = Layout(
+	{{QUANTIZED3, "vertex"},{PACKED_NORMAL, "normal"}, {PACKED_COLOR, "color"}, {UNORM16x2, "uv"}});
+
 
 void ResourceManager::SetScreenSpaceShader(const std::string& name) {
 	screenSpaceShader = name;
@@ -35,15 +43,44 @@ Shader* ResourceManager::GetScreenSpaceShader(){
 }
 
 void ResourceManager::LoadShader(const std::string& name, const std::string& vert_path, const std::string& frag_path, const std::string& geom_path, bool instanced) {
+    if(!shaders_compiling) {
+        shaders_compiling = true;
+        shaders_started = std::chrono::steady_clock::now();
+    }
     overwrite_emplace(shaders, name, Shader(vert_path.c_str(), frag_path.c_str(), geom_path.c_str(), instanced));
 }
 
 void ResourceManager::LoadMesh(const std::string& name, const std::string& path) {
-	overwrite_emplace(meshes, name, Mesh(path));
+	uint64_t key = CacheFile::HashString(path);
+	uint64_t stamp = CacheFile::SourceStamp(path);
+	Mesh mesh;
+	if(!MeshCache::Load(key, stamp, mesh)) {
+		mesh = Mesh(path);
+		MeshCache::Save(key, stamp, mesh);
+	}
+	overwrite_emplace(meshes, name, std::move(mesh));
+	mesh_bvhs.erase(name);
+}
+
+bool ResourceManager::LoadCachedMesh(const std::string& name, uint64_t key) {
+	Mesh mesh;
+	if(!MeshCache::Load(key, 0, mesh)) {
+		return false;
+	}
+	overwrite_emplace(meshes, name, std::move(mesh));
+	mesh_bvhs.erase(name);
+	return true;
+}
+
+void ResourceManager::AddCachedMesh(const std::string& name, uint64_t key, Mesh&& mesh) {
+	MeshCache::Save(key, 0, mesh);
+	overwrite_emplace(meshes, name, std::move(mesh));
+	mesh_bvhs.erase(name);
 }
 
 void ResourceManager::AddMesh(const std::string& name, std::vector<float> verts, std::vector<unsigned int> inds, Layout layout) {
 	overwrite_emplace(meshes, name, Mesh(verts, inds, layout));
+	mesh_bvhs.erase(name);
 }
 
 Shader* ResourceManager::GetShader(const std::string &name) {
@@ -66,6 +103,18 @@ Mesh* ResourceManager::GetMesh(const std::string &name) {
 	return &it->second;
 }
 
+std::shared_ptr<const MeshBVH> ResourceManager::GetMeshBVH(const std::string &name) {
+	auto it = mesh_bvhs.find(name);
+	if(it != mesh_bvhs.end()) {
+		return it->second;
+	}
+	Mesh* mesh = GetMesh(name);
+	if(!mesh) {
+		return nullptr;
+	}
+	return mesh_bvhs.emplace(name, std::make_shared<const MeshBVH>(*mesh)).first->second;
+}
+
 Texture* ResourceManager::GetTexture(const std::string &name) {
 	auto it = textures.find(name);
 	if(it == textures.end()) {
@@ -75,19 +124,19 @@ Texture* ResourceManager::GetTexture(const std::string &name) {
 	return &it->second;
 }
 
-void ResourceManager::LoadTexture(const std::string& name, const std::string& file_path, int wrap_option, int sample_option) {
- 	stbi_set_flip_vertically_on_load(1);
-	//Texture
-	int width, height, n_channels;
-	unsigned char* data = stbi_load(file_path.c_str(), &width, &height, &n_channels, 0);
-	if (!data) {
-		printf("ERROR: failed to load image %s\n", file_path.c_str());
-		return;
+void ResourceManager::LoadTexture(const std::string& name, const std::string& file_path, int wrap_option, int sample_option, bool compress) {
+	// 1x1 stand in until the texture loader fills in the real thing, flat for normal maps
+	bool normal_map = name.find("Normal") != std::string::npos
+		|| (name.size() > 2 && name.compare(name.size() - 2, 2, "_n") == 0);
+	unsigned char placeholder[3] = {128, 128, 128};
+	if (normal_map) {
+		placeholder[2] = 255;
 	}
 
-	overwrite_emplace(textures, name, Texture(data, width, height, n_channels, wrap_option, sample_option));
-	stbi_image_free(data);
-
+	overwrite_emplace(textures, name, Texture(placeholder, 1, 1, 3, wrap_option, sample_option));
+	TEXTURE_COOK cook = !compress ? COOK_NONE : normal_map ? COOK_NORMAL : COOK_COLOR;
+	texture_budget.Track(name, textures[name].id, file_path, true, cook);
+	texture_loader.Request(textures[name].id, GL_TEXTURE_2D, {file_path}, true, true, cook);
 }
 
 void ResourceManager::LoadCubemap(const std::string &name, const std::string &dir_path, bool legacyLoading) {
@@ -100,22 +149,54 @@ void ResourceManager::LoadCubemap(const std::string &name, const std::string &di
         dir_path + "/back.png"
     };
 
-    stbi_set_flip_vertically_on_load(legacyLoading ? 1 : 0);
+    unsigned char grey[3] = {128, 128, 128};
+    unsigned char* placeholder[6] = {grey, grey, grey, grey, grey, grey};
+    overwrite_emplace(textures, name, Texture(placeholder, 1, 1, 3, GL_CLAMP_TO_EDGE, GL_LINEAR));
+    texture_budget.Track(name, textures[name].id, faces[0], legacyLoading, COOK_NONE);
+    texture_loader.Request(textures[name].id, GL_TEXTURE_CUBE_MAP, faces, legacyLoading, false);
+}
 
-    int w, h, n_channels;
-    unsigned char* data[6];
-    for(int i = 0; i < faces.size(); i++) {
-        data[i] = stbi_load(faces[i].c_str(), &w, &h, &n_channels, 0);
-        if(!data[i]) {
-            std::cout << "RESMAN ERROR Cube map face " << faces[i] << " failed to load" << std::endl;
-        }
+void ResourceManager::Update() {
+    texture_loader.Update();
+    texture_budget.Update();
+    if(shaders_compiling) {
+        UpdateShaders();
     }
+}
 
-    overwrite_emplace(textures, name, Texture(data, w, h, n_channels, GL_CLAMP_TO_EDGE, GL_LINEAR));
-    
-    for(int i = 0; i < faces.size(); i++) {
-        stbi_image_free(data[i]); // Free individual face data
+void ResourceManager::UpdateShaders() {
+    double blocked = 0.0;
+    size_t programs = 0;
+    size_t variants = 0;
+    auto last = shaders_started;
+    for(auto& [name, shader] : shaders) {
+        std::vector<Shader*> all = shader.Variants();
+        variants += all.size();
+        all.push_back(&shader);
+        for(Shader* s : all) {
+            if(!s->Ready()) {
+                return;
+            }
+            blocked += s->BlockedMs();
+            last = std::max(last, s->FinalizedAt());
+            programs++;
+        }
     }
+    shaders_compiling = false;
+    double total = std::chrono::duration<double, std::milli>(last - shaders_started).count();
+    // keyword variants are built on first use, the ones asked for after this aren't in it
+    std::cout << "Shaders: " << programs << " programs (" << variants << " keyword variants) ready after " << total << " ms, "
+              << blocked << " ms of it on the main thread"
+              << (Shader::ParallelCompile() ? "" : " (no parallel compile)")
+              << ", variants built later aren't counted" << std::endl;
+}
+
+void ResourceManager::FinishLoading() {
+    texture_loader.Finish();
+}
+
+void ResourceManager::PrintTextureReport() {
+    texture_budget.Report(std::cout);
 }
 
 
@@ -767,6 +848,14 @@ void ResourceManager::CreateTorus(std::string object_name, float loop_radius, fl
 
 void ResourceManager::CreateSphere(std::string object_name, float radius, int num_samples_theta, int num_samples_phi){
 
+	uint64_t key = CacheFile::HashString("sphere");
+	key = CacheFile::HashValue(radius, key);
+	key = CacheFile::HashValue(num_samples_theta, key);
+	key = CacheFile::HashValue(num_samples_phi, key);
+	if(LoadCachedMesh(object_name, key)) {
+		return;
+	}
+
 	// Create a sphere using a well-known parameterization
 
 	// Number of vertices and faces to be created
@@ -847,20 +936,37 @@ void ResourceManager::CreateSphere(std::string object_name, float radius, int nu
 		}
 	}
 
-	overwrite_emplace(meshes, object_name, Mesh(vertex, vertex_num * vertex_att, face, face_num * face_att, generator_layout));
+	AddCachedMesh(object_name, key, Mesh(vertex, vertex_num * vertex_att, face, face_num * face_att, packed_generator_layout));
 
 	delete [] vertex;
 	delete [] face;
 }
 
 void ResourceManager::CreatePointCloud(std::string object_name, int num_points, float size, glm::vec4 col) {
+	uint64_t key = CacheFile::HashString("point cloud");
+	key = CacheFile::HashValue(num_points, key);
+	key = CacheFile::HashValue(size, key);
+	key = CacheFile::HashValue(col, key);
+	if(LoadCachedMesh(object_name, key)) {
+		return;
+	}
+
+	// own generator seeded by the key, a cache hit mustn't shift the global rand() stream
+	std::mt19937 gen(static_cast<uint32_t>(key ^ (key >> 32)));
+	std::uniform_real_distribution<float> spread(-size, size);
+	std::uniform_int_distribution<int> six(0, 5);
+
 	std::vector<float> vertices;
 	std::vector<unsigned int> inds;
 	for(int i = 0 ; i < num_points; i++ ) {
-		glm::vec3 pos = glm::ballRand(size);
+		// same as glm::ballRand, which would draw from rand()
+		glm::vec3 pos;
+		do {
+			pos = glm::vec3(spread(gen), spread(gen), spread(gen));
+		} while(glm::length(pos) > size);
 		glm::vec3 color = {};
 		if(col == glm::vec4(0.0f, 0.0f, 0.0f, 0.0f)) {
-            float b = rand() % 6 == 0 ? 1.0 : 0.0;
+            float b = six(gen) == 0 ? 1.0 : 0.0;
 			color = glm::vec4(i, b, 0.0, 0.0); // encode id in red channel
 		}
 		
@@ -871,13 +977,25 @@ void ResourceManager::CreatePointCloud(std::string object_name, int num_points,
 		APPEND_VEC2(vertices, glm::vec2(1.0, 1.0));
 	}
 
-	overwrite_emplace(meshes, object_name, Mesh(vertices, inds, generator_layout));
+	AddCachedMesh(object_name, key, Mesh(vertices, inds, generator_layout));
 }
 
 // Winter wonderland
 // y value sets the height where to spawn the particles needless to say u want this above the player
 void ResourceManager::CreateSnowParticles(std::string object_name, int num_particles, float spread_range, int density, float yposition){
 
+	uint64_t key = CacheFile::HashString("snow");
+	key = CacheFile::HashValue(num_particles, key);
+	key = CacheFile::HashValue(spread_range, key);
+	key = CacheFile::HashValue(density, key);
+	key = CacheFile::HashValue(yposition, key);
+	if(LoadCachedMesh(object_name, key)) {
+		return;
+	}
+	// own generator seeded by the key, a cache hit mustn't shift the global rand() stream
+	std::mt19937 gen(static_cast<uint32_t>(key ^ (key >> 32)));
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
     // Create a set of points which will be the particles
     // This is similar to drawing a sphere: we will sample points on a sphere, but will allow them to also deviate a bit from the sphere along the normal (change of radius)
 	std::vector<float> vertices;
@@ -888,15 +1006,15 @@ void ResourceManager::CreateSnowParticles(std::string object_name, int num_parti
     // We want to cluster the snow flakes so they can be together like they have been deposited by some cloud
     for (int i = 0; i < num_clusters; i++) {
         // Pick random spot to put cluster of snow particles (think of this like a cloud)
-        float x_center = static_cast<float>(rand()) / static_cast<float>(RAND_MAX) * spread_range - (spread_range / 2.0f);
-        float z_center = static_cast<float>(rand()) / static_cast<float>(RAND_MAX) * spread_range - (spread_range / 2.0f);
+        float x_center = unit(gen) * spread_range - (spread_range / 2.0f);
+        float z_center = unit(gen) * spread_range - (spread_range / 2.0f);
 
         // Spawn particles in specified radius and spawn how many dense particles
         for (int j = 0; j < density; j++) {
             int index = i * density + j;
             
             float radius = 10; // just a good area to spawn the particles
-            float angle = static_cast<float>(rand()) / static_cast<float>(RAND_MAX) * glm::two_pi<float>();
+            float angle = unit(gen) * glm::two_pi<float>();
             float x_offset = radius * cos(angle);
             float z_offset = radius * sin(angle);
 
@@ -909,8 +1027,8 @@ void ResourceManager::CreateSnowParticles(std::string object_name, int num_parti
             // Add position and color to the data buffer
             // Note: we randomize everything that is unused so the shader can use it
             // as a seed for its random function!
-			glm::vec3 normals = glm::vec3(static_cast<float>(rand()) / static_cast<float>(RAND_MAX), static_cast<float>(rand()) / static_cast<float>(RAND_MAX), static_cast<float>(rand()) / static_cast<float>(RAND_MAX));
-			glm::vec3 colours = glm::vec3(static_cast<float>(rand()) / static_cast<float>(RAND_MAX), static_cast<float>(rand()) / static_cast<float>(RAND_MAX), static_cast<float>(rand()) / static_cast<float>(RAND_MAX));
+			glm::vec3 normals = glm::vec3(unit(gen), unit(gen), unit(gen));
+			glm::vec3 colours = glm::vec3(unit(gen), unit(gen), unit(gen));
 			APPEND_VEC3(vertices, position);
 			APPEND_VEC3(vertices, normals);
 			APPEND_VEC3(vertices, colours);
@@ -918,7 +1036,7 @@ void ResourceManager::CreateSnowParticles(std::string object_name, int num_parti
         }
     }
 
-	overwrite_emplace(meshes, object_name, Mesh(vertices, inds, generator_layout));
+	AddCachedMesh(object_name, key, Mesh(vertices, inds, generator_layout));
 }
 
 void ResourceManager::CreateQuad(std::string name) {
@@ -1008,6 +1126,52 @@ void ResourceManager::CreateSaplingQuad(std::string name) {
     overwrite_emplace(meshes, name, Mesh(vertices, indices, generator_layout));
 }
 
+// A handful of tapered blades leaning out from one spot, for ground cover.
+// Both windings are in there since nothing turns culling off for it.
+void ResourceManager::CreateGrassTuft(std::string object_name, int num_blades, float height, float blade_width) {
+    const int segments = 3;
+    std::vector<float> vertices;
+    std::vector<unsigned int> indices;
+    const glm::vec3 color = {0.4f, 0.7f, 0.3f};
+
+    for (int b = 0; b < num_blades; b++) {
+        // golden angle so the blades never line up
+        float angle = b * 2.39996f;
+        glm::vec3 out = {cos(angle), 0.0f, sin(angle)};
+        glm::vec3 side = {-out.z, 0.0f, out.x};
+        float lean = 0.15f + 0.25f * ((b * 7) % num_blades) / num_blades;
+        float h = height * (0.7f + 0.3f * ((b * 3) % num_blades) / num_blades);
+        unsigned int base = vertices.size() / 11;
+
+        for (int s = 0; s <= segments; s++) {
+            float t = float(s) / segments;
+            // bends more the higher it gets
+            glm::vec3 center = out * (0.05f + lean * t * t) * height + glm::vec3(0.0f, h * t, 0.0f);
+            float w = blade_width * (1.0f - t) * 0.5f;
+            glm::vec3 normal = glm::normalize(glm::cross(side, glm::vec3(0.0f, 1.0f, 0.0f) + out * (2.0f * lean * t)));
+            glm::vec3 left = center - side * w;
+            glm::vec3 right = center + side * w;
+            glm::vec2 left_uv = {0.45f, t};
+            glm::vec2 right_uv = {0.55f, t};
+            APPEND_VEC3(vertices, left);
+            APPEND_VEC3(vertices, normal);
+            APPEND_VEC3(vertices, color);
+            APPEND_VEC2(vertices, left_uv);
+            APPEND_VEC3(vertices, right);
+            APPEND_VEC3(vertices, normal);
+            APPEND_VEC3(vertices, color);
+            APPEND_VEC2(vertices, right_uv);
+        }
+        for (int s = 0; s < segments; s++) {
+            unsigned int i = base + s * 2;
+            indices.insert(indices.end(), {i, i + 1, i + 2,  i + 2, i + 1, i + 3});
+            indices.insert(indices.end(), {i, i + 2, i + 1,  i + 2, i + 3, i + 1});
+        }
+    }
+
+    overwrite_emplace(meshes, object_name, Mesh(vertices, indices, generator_layout));
+}
+
 void ResourceManager::CreateSimpleCube(std::string object_name) {
 const std::vector<float> cube_vertices = {
 	// Vertices
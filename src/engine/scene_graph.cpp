@@ -1,4 +1,5 @@
 #include "scene_graph.h"
+#include "thread_pool.h"
 
 SceneGraph::~SceneGraph() {
     Reset();
@@ -122,3 +123,75 @@ std::vector<std::shared_ptr<SceneNode>> SceneGraph::GetScreenSpaceNodes() {
     }
     return nodes;
 }
+
+bool SceneGraph::CastInternal(const Ray& ray, float radius, QueryHit& hit, int filter) {
+    Ray r = ray;
+    r.direction = glm::normalize(ray.direction);
+    bool found = colman.Raycast(r, radius, hit, filter);
+
+    if ((filter & QUERY_TERRAIN) && terrain) {
+        float max_t = found ? hit.distance : r.max_distance;
+        float t;
+        glm::vec3 p, n;
+        bool touched = false;
+        if (radius > 0.0f) {
+            touched = terrain->SweepSphere(r.origin, r.direction, radius, max_t, t, p, n);
+        } else if (terrain->Raycast(r.origin, r.direction, max_t, t)) {
+            p = r.origin + r.direction * t;
+            n = terrain->SampleNormal(p.x, p.z);
+            touched = true;
+        }
+        if (touched && (!found || t < hit.distance)) {
+            hit.node = terrain.get();
+            hit.instance = -1;
+            hit.distance = t;
+            hit.point = p;
+            hit.normal = n;
+            found = true;
+        }
+    }
+    return found;
+}
+
+bool SceneGraph::Raycast(const Ray& ray, QueryHit& hit, int filter) {
+    colman.PrepareQueries();
+    hit = QueryHit();
+    return CastInternal(ray, 0.0f, hit, filter);
+}
+
+bool SceneGraph::SweepSphere(const Ray& ray, float radius, QueryHit& hit, int filter) {
+    colman.PrepareQueries();
+    hit = QueryHit();
+    return CastInternal(ray, radius, hit, filter);
+}
+
+void SceneGraph::Overlap(const glm::vec3& center, float radius, std::vector<QueryHit>& out, int filter) {
+    colman.PrepareQueries();
+    out.clear();
+    colman.Overlap(center, radius, out, filter);
+
+    if ((filter & QUERY_TERRAIN) && terrain && terrain->SampleOn(center.x, center.z)) {
+        float h = terrain->SampleHeight(center.x, center.z);
+        if (h > center.y - radius) {
+            QueryHit hit;
+            hit.node = terrain.get();
+            hit.point = {center.x, h, center.z};
+            hit.normal = terrain->SampleNormal(center.x, center.z);
+            out.push_back(hit);
+            std::stable_sort(out.begin(), out.end(), [&center](const QueryHit& a, const QueryHit& b) {
+                return glm::distance(a.point, center) < glm::distance(b.point, center);
+            });
+        }
+    }
+}
+
+void SceneGraph::RaycastBatch(const std::vector<Ray>& rays, std::vector<QueryHit>& hits, int filter) {
+    // hashes are brought up to date once, after that every cast is read only
+    colman.PrepareQueries();
+    hits.assign(rays.size(), QueryHit());
+    ThreadPool::Get().ParallelFor(rays.size(), 16, [&](size_t begin, size_t end, unsigned) {
+        for (size_t i = begin; i < end; i++) {
+            CastInternal(rays[i], 0.0f, hits[i], filter);
+        }
+    });
+}
@@ -1,24 +1,48 @@
 #include "shader.h"
 #include "light.h"
 #include <GL/glext.h>
+#include <algorithm>
 #include <exception>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <glm/gtx/string_cast.hpp>
 #include "defines.h"
+#include "program_cache.h"
 
-Shader::Shader(const char* vertex_path, const char* fragment_path, const char* geometry_path, bool instanced) {
+Shader::Shader(const char* vertex_path, const char* fragment_path, const char* geometry_path, bool instanced, unsigned int keywords) {
 	vert_path = vertex_path;
 	frag_path = fragment_path;
     geom_path = geometry_path;
+    this->instanced = instanced;
+    this->keywords = keywords;
     memset(lightsblock.lights, 0, MAX_LIGHTS * sizeof(ShaderLight));
     Load();
-    SetupLighting();
-    if(instanced) {
-        SetupInstancing();
+    if(!ParallelCompile()) {
+        // nothing to overlap with, ready when the constructor returns like it's always been
+        Finalize();
     }
 }
 
+static double ms_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool Shader::ParallelCompile() {
+    static int parallel = -1;
+    if(parallel < 0) {
+        parallel = 0;
+        if(GLEW_KHR_parallel_shader_compile) {
+            glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+            parallel = 1;
+        } else if(GLEW_ARB_parallel_shader_compile) {
+            glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+            parallel = 1;
+        }
+    }
+    return parallel;
+}
+
 static bool read_file(std::string path, std::string& dest) {
 	std::ifstream file_stream;
 	file_stream.exceptions(std::ifstream::failbit | std::ifstream::badbit);
@@ -40,69 +64,238 @@ static bool read_file(std::string path, std::string& dest) {
     return true;
 }
 
-static int compile_shader(std::string code, GLuint type, std::string path) {
-	int success = 0;
-	char infolog[512];
+static const std::pair<const char*, unsigned int> keyword_names[] = {
+    {"INSTANCED",  KEYWORD_INSTANCED},
+    {"SHADOWS",    KEYWORD_SHADOWS},
+    {"NORMAL_MAP", KEYWORD_NORMAL_MAP},
+    {"ALPHA",      KEYWORD_ALPHA},
+};
+
+// pulls in #include "file" (relative to the file it's in, each file once per stage)
+// and takes out the "#pragma keywords" lines, adding what they list to declared
+static bool preprocess(const std::string& path, std::string& dest, std::vector<std::string>& included, unsigned int& declared) {
+    std::string code;
+    if(!read_file(path, code)) {
+        return false;
+    }
+    std::filesystem::path dir = std::filesystem::path(path).parent_path();
+
+    std::istringstream lines(code);
+    std::string line;
+    while(std::getline(lines, line)) {
+        std::string text = line;
+        if(!text.empty() && text.back() == '\r') {
+            text.pop_back();
+        }
+        size_t start = text.find_first_not_of(" \t");
+        if(start != std::string::npos && text.compare(start, 8, "#include") == 0) {
+            size_t open = text.find('"', start);
+            size_t close = open == std::string::npos ? open : text.find('"', open + 1);
+            if(close == std::string::npos) {
+                std::cout << "[ERROR][SHADER] bad include in " << path << ": " << text << std::endl;
+                return false;
+            }
+            std::string file = (dir / text.substr(open + 1, close - open - 1)).lexically_normal().string();
+            if(std::find(included.begin(), included.end(), file) != included.end()) {
+                continue;
+            }
+            included.push_back(file);
+            if(!preprocess(file, dest, included, declared)) {
+                return false;
+            }
+            continue;
+        }
+        if(start != std::string::npos && text.compare(start, 16, "#pragma keywords") == 0) {
+            std::istringstream names(text.substr(start + 16));
+            std::string name;
+            while(names >> name) {
+                bool known = false;
+                for(const auto& [keyword, bit] : keyword_names) {
+                    if(name == keyword) {
+                        declared |= bit;
+                        known = true;
+                    }
+                }
+                if(!known) {
+                    std::cout << "[ERROR][SHADER] unknown keyword " << name << " in " << path << std::endl;
+                }
+            }
+            continue;
+        }
+        dest += line;
+        dest += '\n';
+    }
+    return true;
+}
+
+// a #define for each keyword, right after #version which has to come first
+static void add_defines(std::string& code, unsigned int keywords) {
+    std::string defines;
+    for(const auto& [keyword, bit] : keyword_names) {
+        if(keywords & bit) {
+            defines += std::string("#define ") + keyword + "\n";
+        }
+    }
+    if(defines.empty()) {
+        return;
+    }
+    size_t after = 0;
+    size_t version = code.find("#version");
+    if(version != std::string::npos) {
+        size_t eol = code.find('\n', version);
+        after = eol == std::string::npos ? code.size() : eol + 1;
+    }
+    code.insert(after, defines);
+}
+
+// only submits, the status is checked by check_shader once the program is finalized
+static int compile_shader(std::string code, GLuint type) {
     int shader_id = 0;
     const char* source = code.c_str();
 	shader_id = glCreateShader(type);
 	glShaderSource(shader_id, 1, &source, NULL);
 	glCompileShader(shader_id);
+    return shader_id;
+}
+
+static bool check_shader(unsigned int shader_id, const std::string& path) {
+	int success = 0;
+	char infolog[512];
 	glGetShaderiv(shader_id, GL_COMPILE_STATUS, &success);
 	if (!success) {
 		glGetShaderInfoLog(shader_id, 512, NULL, infolog);
 		std::cout << "[ERROR][SHADER] shader compilation failed " << path << ":\n"
         << infolog << std::endl;
 	}
-    return shader_id;
+    return success;
 }
 
 
 bool Shader::Load() {
+    auto start = std::chrono::steady_clock::now();
 	//Read Files
 	std::string vertex_code = "";
 	std::string frag_code   = "";
 	std::string geom_code   = "";
 
-    read_file(vert_path, vertex_code);
-    read_file(frag_path, frag_code);
+    // keywords may be declared in any stage, every stage gets all the defines
+    std::vector<std::string> included;
+    declared_keywords = 0;
+    preprocess(vert_path, vertex_code, included, declared_keywords);
+    included.clear();
+    preprocess(frag_path, frag_code, included, declared_keywords);
     if(!geom_path.empty()) {
-        read_file(geom_path, geom_code);
+        included.clear();
+        preprocess(geom_path, geom_code, included, declared_keywords);
     }
+    keywords &= declared_keywords;
+    add_defines(vertex_code, keywords);
+    add_defines(frag_code, keywords);
+    if(!geom_code.empty()) {
+        add_defines(geom_code, keywords);
+    }
+
+	// a binary linked on an earlier run skips compiling altogether
+	cacheable = ProgramCache::Supported();
+	cache_key = cacheable ? ProgramCache::KeyFor({vertex_code, frag_code, geom_code}) : 0;
+	id = glCreateProgram();
+	pending = true;
+	stages[0] = stages[1] = stages[2] = 0;
+	from_cache = cacheable && !skip_cache && ProgramCache::Load(cache_key, id);
+	if(from_cache) {
+		blocked_ms += ms_since(start);
+		return true;
+	}
 
 	//Compile and link shaders
 	unsigned int vertex_shader, frag_shader, geom_shader;
 
-    vertex_shader = compile_shader(vertex_code, GL_VERTEX_SHADER, vert_path);
-    frag_shader = compile_shader(frag_code, GL_FRAGMENT_SHADER, frag_path);
+    vertex_shader = compile_shader(vertex_code, GL_VERTEX_SHADER);
+    frag_shader = compile_shader(frag_code, GL_FRAGMENT_SHADER);
     if(!geom_code.empty()) {
-        geom_shader = compile_shader(geom_code, GL_GEOMETRY_SHADER, geom_path);
+        geom_shader = compile_shader(geom_code, GL_GEOMETRY_SHADER);
     }
 
-	id = glCreateProgram();
 	glAttachShader(id, vertex_shader);
 	glAttachShader(id, frag_shader);
     if(!geom_code.empty()) {
         glAttachShader(id, geom_shader);
     }
+	if(cacheable) {
+		glProgramParameteri(id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
 	glLinkProgram(id);
 
+	// status checks wait on the driver, Finalize does them
+	stages[0] = vertex_shader;
+	stages[1] = frag_shader;
+	stages[2] = geom_code.empty() ? 0 : geom_shader;
+	blocked_ms += ms_since(start);
+	return true;
+}
+
+void Shader::Finalize() {
+    if(!pending) {
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    if(from_cache) {
+        // drivers may refuse a binary after an update, build it from source again
+        int linked = GL_FALSE;
+        glGetProgramiv(id, GL_LINK_STATUS, &linked);
+        if(!linked) {
+            std::cout << "Program cache: driver rejected " << ProgramCache::PathFor(cache_key) << std::endl;
+            glDeleteProgram(id);
+            skip_cache = true;
+            Load();
+            skip_cache = false;
+        }
+    }
+    pending = false;
+
+    const std::string* paths[3] = {&vert_path, &frag_path, &geom_path};
+    for(int i = 0; i < 3; i++) {
+        if(stages[i]) {
+            check_shader(stages[i], *paths[i]);
+        }
+    }
+
 	int success;
 	char infolog[512];
 	glGetProgramiv(id, GL_LINK_STATUS, &success);
 	if (!success) {
 		glGetProgramInfoLog(id, 512, NULL, infolog);
 		std::cout << "[ERROR][SHADER] program linking failed\n" << infolog << std::endl;
-		return false;
-	}
+	} else if(stages[0]) {
+        for(int i = 0; i < 3; i++) {
+            if(stages[i]) {
+                glDeleteShader(stages[i]);
+            }
+        }
+        if(cacheable) {
+            ProgramCache::Save(cache_key, id);
+        }
+    }
+    stages[0] = stages[1] = stages[2] = 0;
 
-	glDeleteShader(vertex_shader);
-	glDeleteShader(frag_shader);
-    if(!geom_code.empty()) {
-        glDeleteShader(geom_shader);
+    SetupLighting();
+    if(instanced || (keywords & KEYWORD_INSTANCED)) {
+        SetupInstancing();
     }
+    blocked_ms += ms_since(start);
+    finalized_at = std::chrono::steady_clock::now();
+}
 
-	return true;
+bool Shader::Ready() {
+    if(!pending) {
+        return true;
+    }
+    GLint done = GL_FALSE;
+    glGetProgramiv(id, GL_COMPLETION_STATUS_KHR, &done);
+    if(done) {
+        Finalize();
+    }
+    return !pending;
 }
 
 void Shader::SetupLighting() {
@@ -129,7 +322,8 @@ void Shader::SetupInstancing() {
     SetUniform1i(1, "TransformsBlock");
 }
 
-void Shader::Use() const{
+void Shader::Use() {
+	Finalize();
 	glUseProgram(id);
 }
 
@@ -171,7 +365,24 @@ int Shader::SetInstances(std::vector<Transform> &transforms, const glm::mat4& vi
     return j;
 }
 
-void Shader::Finalize(int num_lights) {
+Shader* Shader::Variant(unsigned int wanted) {
+    wanted &= declared_keywords;
+    if(wanted == keywords) {
+        return this;
+    }
+    auto it = variants.find(wanted);
+    if(it == variants.end()) {
+        it = variants.emplace(wanted, std::make_shared<Shader>(vert_path.c_str(), frag_path.c_str(), geom_path.c_str(), instanced, wanted)).first;
+    }
+    return it->second.get();
+}
+
+std::vector<Shader*> Shader::Variants() const {
+    std::vector<Shader*> built;
+    for(const auto& [mask, variant] : variants) {
+        built.push_back(variant.get());
+    }
+    return built;
 }
 
 void Shader::SetUniform1f(float u, const std::string& name) {
@@ -179,6 +390,11 @@ void Shader::SetUniform1f(float u, const std::string& name) {
 	glUniform1f(location, u);
 }
 
+void Shader::SetUniform2f(const glm::vec2& u, const std::string& name) {
+	int location = glGetUniformLocation(id, name.c_str());
+	glUniform2f(location, u.x, u.y);
+}
+
 void Shader::SetUniform3f(const glm::vec3& u, const std::string& name) {
 	int location = glGetUniformLocation(id, name.c_str());
 	glUniform3f(location, u.x, u.y, u.z);
@@ -213,3 +429,8 @@ void Shader::SetUniform1iv(int *v, int len, const std::string &name) {
     int location = glGetUniformLocation(id, name.c_str());
     glUniform1iv(location, len, v);
 }
+
+void Shader::SetUniform4fv(const glm::vec4* v, int len, const std::string& name) {
+    int location = glGetUniformLocation(id, name.c_str());
+    glUniform4fv(location, len, glm::value_ptr(*v));
+}
@@ -0,0 +1,181 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "texture_budget.h"
+
+namespace {
+    double Now() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+}
+
+void TextureBudget::Track(const std::string& name, unsigned int texture, const std::string& path, bool flip, TEXTURE_COOK cook) {
+    // loading over a name leaves the old texture behind, stop counting it
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        if (it->second.name == name) {
+            entries.erase(it);
+            break;
+        }
+    }
+    Entry e;
+    e.name = name;
+    e.path = path;
+    e.flip = flip;
+    e.cook = cook;
+    entries[texture] = e;
+}
+
+void TextureBudget::Use(unsigned int texture, float pixels) {
+    auto it = entries.find(texture);
+    if (it == entries.end()) {
+        return;
+    }
+    Entry& e = it->second;
+    int size = std::max(e.width, e.height);
+    int level = pixels > 0.0f && size > pixels ? static_cast<int>(std::floor(std::log2(size / pixels))) : 0;
+    level = std::min(level, MaxFirstLevel(e));
+    if (!e.seen || level <= e.wanted) {
+        e.wanted = level;
+        e.last_sharp = Now();
+    }
+    e.seen = true;
+}
+
+size_t TextureBudget::BytesAt(const Entry& e, int first_level) const {
+    if (!e.format) {
+        return e.bytes;
+    }
+    return TextureCache::ChainSize(e.format, e.width, e.height) - TextureCache::LevelOffset(e.format, e.width, e.height, first_level);
+}
+
+int TextureBudget::MaxFirstLevel(const Entry& e) const {
+    if (!e.format) {
+        return 0;
+    }
+    int level = 0;
+    while ((std::max(e.width, e.height) >> (level + 1)) >= TEXTURE_MIN_SIZE) {
+        level++;
+    }
+    return level;
+}
+
+void TextureBudget::Reload(unsigned int texture, Entry& e, int first_level) {
+    e.requested = first_level;
+    loader.Request(texture, GL_TEXTURE_2D, {e.path}, e.flip, true, e.cook, first_level);
+}
+
+size_t TextureBudget::Resident() const {
+    size_t total = 0;
+    for (const auto& [texture, e] : entries) {
+        total += e.bytes;
+    }
+    return total;
+}
+
+void TextureBudget::Update() {
+    for (const TextureLoader::Uploaded& u : loader.TakeUploaded()) {
+        auto it = entries.find(u.texture);
+        if (it == entries.end()) {
+            continue;
+        }
+        Entry& e = it->second;
+        if (u.ok) {
+            e.format = u.format;
+            e.width = u.width;
+            e.height = u.height;
+            e.first_level = u.first_level;
+            e.bytes = u.bytes;
+        } else {
+            // don't keep retrying a reload that can't work, it stays as it is
+            e.format = 0;
+        }
+        e.requested = e.first_level;
+    }
+
+    double now = Now();
+    // counted as if every request in flight had landed so nothing gets asked for twice
+    size_t resident = 0;
+    std::vector<std::pair<unsigned int, Entry*>> restores, drops;
+    for (auto& [texture, e] : entries) {
+        if (e.seen && e.wanted < MaxFirstLevel(e) && now - e.last_sharp > TEXTURE_RELAX_SECONDS) {
+            e.wanted++;
+            e.last_sharp = now;
+        }
+        resident += BytesAt(e, e.requested);
+        if (!e.format || !e.seen || e.requested != e.first_level) {
+            continue;
+        }
+        if (e.wanted < e.first_level) {
+            restores.push_back({texture, &e});
+        } else if (e.wanted > e.first_level) {
+            drops.push_back({texture, &e});
+        }
+    }
+
+    size_t restore_bytes = 0;
+    for (auto& [texture, e] : restores) {
+        restore_bytes += BytesAt(*e, e->wanted) - e->bytes;
+    }
+    if (resident + restore_bytes > budget) {
+        std::sort(drops.begin(), drops.end(), [this](const auto& a, const auto& b) {
+            return a.second->bytes - BytesAt(*a.second, a.second->wanted) > b.second->bytes - BytesAt(*b.second, b.second->wanted);
+        });
+        for (auto& [texture, e] : drops) {
+            if (resident + restore_bytes <= budget) {
+                break;
+            }
+            resident -= e->bytes - BytesAt(*e, e->wanted);
+            Reload(texture, *e, e->wanted);
+        }
+    }
+
+    // the most visibly blurry first
+    std::sort(restores.begin(), restores.end(), [](const auto& a, const auto& b) {
+        return a.second->first_level - a.second->wanted > b.second->first_level - b.second->wanted;
+    });
+    for (auto& [texture, e] : restores) {
+        size_t extra = BytesAt(*e, e->wanted) - e->bytes;
+        if (resident + extra <= budget) {
+            resident += extra;
+            Reload(texture, *e, e->wanted);
+        }
+    }
+}
+
+void TextureBudget::Report(std::ostream& out) const {
+    std::vector<const Entry*> sorted;
+    for (const auto& [texture, e] : entries) {
+        sorted.push_back(&e);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const Entry* a, const Entry* b) { return a->bytes > b->bytes; });
+
+    auto mb = [](size_t bytes) { return bytes / (1024.0 * 1024.0); };
+    out << "Textures: " << std::fixed << std::setprecision(1) << mb(Resident()) << " of " << mb(budget) << " MB" << std::endl;
+    for (const Entry* e : sorted) {
+        const char* format = "rgba8";
+        if (e->format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT) {
+            format = "bc1";
+        } else if (e->format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT) {
+            format = "bc3";
+        } else if (e->format == GL_COMPRESSED_RG_RGTC2) {
+            format = "bc5";
+        }
+        out << "  " << std::setw(24) << std::left << e->name << std::right
+            << std::setw(8) << mb(e->bytes) << " MB  " << format << " "
+            << std::max(1, e->width >> e->first_level) << "x" << std::max(1, e->height >> e->first_level)
+            << " of " << e->width << "x" << e->height;
+        if (e->seen) {
+            out << ", drawn at level " << e->wanted;
+        }
+        if (e->requested != e->first_level) {
+            out << ", reloading at level " << e->requested;
+        }
+        out << std::endl;
+    }
+    out << std::defaultfloat;
+}
@@ -0,0 +1,336 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "texture_cache.h"
+#include "cache_file.h"
+#include "mapped_file.h"
+
+namespace {
+    struct Header {
+        CacheFile::Prefix prefix;
+        uint64_t source_stamp;
+        uint32_t format;
+        int32_t width;
+        int32_t height;
+        uint32_t num_levels;
+        uint64_t checksum; // of the whole mip chain
+    };
+
+    static_assert(sizeof(Header) % 8 == 0, "texture cache header needs padding");
+
+    const char MAGIC[4] = {'D', 'N', 'A', 'T'};
+
+    unsigned short To565(const float c[3]) {
+        int r = std::clamp(static_cast<int>(c[0] * 31.0f / 255.0f + 0.5f), 0, 31);
+        int g = std::clamp(static_cast<int>(c[1] * 63.0f / 255.0f + 0.5f), 0, 63);
+        int b = std::clamp(static_cast<int>(c[2] * 31.0f / 255.0f + 0.5f), 0, 31);
+        return static_cast<unsigned short>((r << 11) | (g << 5) | b);
+    }
+
+    void From565(unsigned short v, float c[3]) {
+        int r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+        c[0] = static_cast<float>((r << 3) | (r >> 2));
+        c[1] = static_cast<float>((g << 2) | (g >> 4));
+        c[2] = static_cast<float>((b << 3) | (b >> 2));
+    }
+
+    // 4x4 rgba in, a BC1 block out. The endpoints are the extremes of the
+    // pixels along their principal axis, every pixel takes the closest of the four.
+    void EncodeColorBlock(const unsigned char* block, unsigned char* out) {
+        float mean[3] = {0.0f, 0.0f, 0.0f};
+        for (int i = 0; i < 16; i++) {
+            for (int c = 0; c < 3; c++) {
+                mean[c] += block[i * 4 + c];
+            }
+        }
+        for (int c = 0; c < 3; c++) {
+            mean[c] /= 16.0f;
+        }
+
+        // xx xy xz yy yz zz
+        float cov[6] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+        for (int i = 0; i < 16; i++) {
+            float d[3] = {block[i * 4] - mean[0], block[i * 4 + 1] - mean[1], block[i * 4 + 2] - mean[2]};
+            cov[0] += d[0] * d[0]; cov[1] += d[0] * d[1]; cov[2] += d[0] * d[2];
+            cov[3] += d[1] * d[1]; cov[4] += d[1] * d[2]; cov[5] += d[2] * d[2];
+        }
+
+        // a few rounds of power iteration is plenty for 16 points
+        float axis[3] = {1.0f, 1.0f, 1.0f};
+        for (int it = 0; it < 4; it++) {
+            float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+            float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+            float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+            float m = std::max({std::fabs(x), std::fabs(y), std::fabs(z)});
+            if (m < 1e-6f) {
+                break;
+            }
+            axis[0] = x / m; axis[1] = y / m; axis[2] = z / m;
+        }
+        float len = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+        for (int c = 0; c < 3; c++) {
+            axis[c] /= len;
+        }
+
+        float lo = FLT_MAX, hi = -FLT_MAX;
+        for (int i = 0; i < 16; i++) {
+            float t = (block[i * 4] - mean[0]) * axis[0] + (block[i * 4 + 1] - mean[1]) * axis[1] + (block[i * 4 + 2] - mean[2]) * axis[2];
+            lo = std::min(lo, t);
+            hi = std::max(hi, t);
+        }
+        float c0[3], c1[3];
+        for (int c = 0; c < 3; c++) {
+            c0[c] = mean[c] + axis[c] * hi;
+            c1[c] = mean[c] + axis[c] * lo;
+        }
+
+        // color0 > color1 keeps the block in four color mode
+        unsigned short e0 = To565(c0), e1 = To565(c1);
+        if (e0 < e1) {
+            std::swap(e0, e1);
+        }
+        uint32_t indices = 0;
+        if (e0 != e1) {
+            float palette[4][3];
+            From565(e0, palette[0]);
+            From565(e1, palette[1]);
+            for (int c = 0; c < 3; c++) {
+                palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+                palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+            }
+            for (int i = 0; i < 16; i++) {
+                int best = 0;
+                float best_dist = FLT_MAX;
+                for (int p = 0; p < 4; p++) {
+                    float dist = 0.0f;
+                    for (int c = 0; c < 3; c++) {
+                        float d = block[i * 4 + c] - palette[p][c];
+                        dist += d * d;
+                    }
+                    if (dist < best_dist) {
+                        best_dist = dist;
+                        best = p;
+                    }
+                }
+                indices |= static_cast<uint32_t>(best) << (2 * i);
+            }
+        }
+
+        out[0] = e0 & 0xFF; out[1] = e0 >> 8;
+        out[2] = e1 & 0xFF; out[3] = e1 >> 8;
+        for (int b = 0; b < 4; b++) {
+            out[4 + b] = (indices >> (8 * b)) & 0xFF;
+        }
+    }
+
+    // one channel of a 4x4 rgba block as a BC4 block, the alpha half of BC3 and both halves of BC5
+    void EncodeChannelBlock(const unsigned char* block, int channel, unsigned char* out) {
+        int lo = 255, hi = 0;
+        for (int i = 0; i < 16; i++) {
+            lo = std::min(lo, static_cast<int>(block[i * 4 + channel]));
+            hi = std::max(hi, static_cast<int>(block[i * 4 + channel]));
+        }
+        out[0] = static_cast<unsigned char>(hi);
+        out[1] = static_cast<unsigned char>(lo);
+
+        // with hi > lo the palette runs hi, lo, then six steps from hi towards lo
+        static const int REMAP[8] = {0, 2, 3, 4, 5, 6, 7, 1};
+        uint64_t bits = 0;
+        if (hi > lo) {
+            for (int i = 0; i < 16; i++) {
+                int t = ((hi - block[i * 4 + channel]) * 7 + (hi - lo) / 2) / (hi - lo);
+                bits |= static_cast<uint64_t>(REMAP[t]) << (3 * i);
+            }
+        }
+        for (int b = 0; b < 6; b++) {
+            out[2 + b] = (bits >> (8 * b)) & 0xFF;
+        }
+    }
+
+    size_t BlockBytes(unsigned int format) {
+        return format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ? 8 : 16;
+    }
+
+    void CompressLevel(const unsigned char* rgba, int width, int height, unsigned int format, unsigned char* out) {
+        unsigned char block[64];
+        for (int by = 0; by < height; by += 4) {
+            for (int bx = 0; bx < width; bx += 4) {
+                // levels smaller than a block repeat their edge
+                for (int y = 0; y < 4; y++) {
+                    for (int x = 0; x < 4; x++) {
+                        int sx = std::min(bx + x, width - 1), sy = std::min(by + y, height - 1);
+                        memcpy(block + (y * 4 + x) * 4, rgba + (static_cast<size_t>(sy) * width + sx) * 4, 4);
+                    }
+                }
+                if (format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT) {
+                    EncodeColorBlock(block, out);
+                } else if (format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT) {
+                    EncodeChannelBlock(block, 3, out);
+                    EncodeColorBlock(block, out + 8);
+                } else {
+                    EncodeChannelBlock(block, 0, out);
+                    EncodeChannelBlock(block, 1, out + 8);
+                }
+                out += BlockBytes(format);
+            }
+        }
+    }
+
+    // 2x2 box filter, normal maps average the vectors and renormalise
+    void Downsample(const std::vector<unsigned char>& src, int width, int height, bool normals, std::vector<unsigned char>& dst) {
+        int dw = std::max(1, width / 2), dh = std::max(1, height / 2);
+        dst.resize(static_cast<size_t>(dw) * dh * 4);
+        for (int y = 0; y < dh; y++) {
+            for (int x = 0; x < dw; x++) {
+                const unsigned char* p[4];
+                for (int s = 0; s < 4; s++) {
+                    int sx = std::min(2 * x + (s & 1), width - 1), sy = std::min(2 * y + (s >> 1), height - 1);
+                    p[s] = src.data() + (static_cast<size_t>(sy) * width + sx) * 4;
+                }
+                unsigned char* d = dst.data() + (static_cast<size_t>(y) * dw + x) * 4;
+                if (normals) {
+                    float n[3] = {0.0f, 0.0f, 0.0f};
+                    for (int s = 0; s < 4; s++) {
+                        for (int c = 0; c < 3; c++) {
+                            n[c] += p[s][c] / 127.5f - 1.0f;
+                        }
+                    }
+                    float len = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+                    for (int c = 0; c < 3; c++) {
+                        float v = len > 1e-6f ? n[c] / len : (c == 2 ? 1.0f : 0.0f);
+                        d[c] = static_cast<unsigned char>(std::clamp((v * 0.5f + 0.5f) * 255.0f + 0.5f, 0.0f, 255.0f));
+                    }
+                } else {
+                    for (int c = 0; c < 3; c++) {
+                        d[c] = (p[0][c] + p[1][c] + p[2][c] + p[3][c] + 2) >> 2;
+                    }
+                }
+                d[3] = (p[0][3] + p[1][3] + p[2][3] + p[3][3] + 2) >> 2;
+            }
+        }
+    }
+
+    // maps the entry, true if it's there and current for source_stamp
+    bool OpenEntry(MappedFile& file, uint64_t key, uint64_t source_stamp, Header& header) {
+        if (!CacheFile::Open(file, TextureCache::PathFor(key), CacheFile::MakePrefix(MAGIC, TextureCache::VERSION, key), header, "Texture")) {
+            return false;
+        }
+        return header.source_stamp == source_stamp && header.width > 0 && header.height > 0
+            && (header.format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || header.format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+                || header.format == GL_COMPRESSED_RG_RGTC2)
+            && header.num_levels == static_cast<uint32_t>(TextureCache::LevelCount(header.width, header.height))
+            && file.Size() - sizeof(Header) == TextureCache::ChainSize(header.format, header.width, header.height);
+    }
+}
+
+namespace TextureCache {
+
+bool Supported() {
+    return GLEW_EXT_texture_compression_s3tc && (GLEW_VERSION_3_0 || GLEW_ARB_texture_compression_rgtc);
+}
+
+unsigned int FormatFor(TEXTURE_COOK cook, int channels) {
+    if (cook == COOK_NORMAL) {
+        return GL_COMPRESSED_RG_RGTC2;
+    }
+    // grey + alpha has alpha too
+    return channels == 2 || channels == 4 ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+}
+
+int LevelCount(int width, int height) {
+    int levels = 1;
+    for (int size = std::max(width, height); size > 1; size /= 2) {
+        levels++;
+    }
+    return levels;
+}
+
+size_t LevelSize(unsigned int format, int width, int height) {
+    return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * BlockBytes(format);
+}
+
+size_t ChainSize(unsigned int format, int width, int height) {
+    return LevelOffset(format, width, height, LevelCount(width, height));
+}
+
+size_t LevelOffset(unsigned int format, int width, int height, int level) {
+    size_t offset = 0;
+    for (int i = 0; i < level; i++) {
+        offset += LevelSize(format, std::max(1, width >> i), std::max(1, height >> i));
+    }
+    return offset;
+}
+
+uint64_t KeyFor(const std::string& path, bool flip, TEXTURE_COOK cook) {
+    uint64_t key = CacheFile::HashString(path);
+    key = CacheFile::HashValue(flip, key);
+    return CacheFile::HashValue(cook, key);
+}
+
+std::string PathFor(uint64_t key) {
+    return CacheFile::PathFor("textures", key, "tex");
+}
+
+bool Peek(uint64_t key, uint64_t source_stamp, unsigned int& format, int& width, int& height) {
+    MappedFile file;
+    Header header;
+    if (!OpenEntry(file, key, source_stamp, header)) {
+        return false;
+    }
+    format = header.format;
+    width = header.width;
+    height = header.height;
+    return true;
+}
+
+bool Read(uint64_t key, uint64_t source_stamp, unsigned char* dest, size_t size, size_t offset) {
+    MappedFile file;
+    Header header;
+    if (!OpenEntry(file, key, source_stamp, header) || file.Size() - sizeof(Header) != offset + size) {
+        std::cout << "Texture cache: stale entry " << PathFor(key) << std::endl;
+        return false;
+    }
+    const unsigned char* payload = file.Data() + sizeof(Header);
+    if (!CacheFile::Verify(payload, offset + size, header.checksum, PathFor(key), "Texture")) {
+        return false;
+    }
+    memcpy(dest, payload + offset, size);
+    return true;
+}
+
+bool Save(uint64_t key, uint64_t source_stamp, unsigned int format, int width, int height, const unsigned char* data, size_t size) {
+    Header header;
+    memset(&header, 0, sizeof(header));
+    header.prefix = CacheFile::MakePrefix(MAGIC, VERSION, key);
+    header.source_stamp = source_stamp;
+    header.format = format;
+    header.width = width;
+    header.height = height;
+    header.num_levels = LevelCount(width, height);
+    header.checksum = CacheFile::Hash(data, size);
+    return CacheFile::Write(PathFor(key), &header, sizeof(header), data, size, "Texture");
+}
+
+void Cook(const unsigned char* rgba, int width, int height, unsigned int format, unsigned char* dest) {
+    bool normals = format == GL_COMPRESSED_RG_RGTC2;
+    std::vector<unsigned char> level(rgba, rgba + static_cast<size_t>(width) * height * 4), next;
+    int w = width, h = height;
+    for (int i = 0; i < LevelCount(width, height); i++) {
+        CompressLevel(level.data(), w, h, format, dest);
+        dest += LevelSize(format, w, h);
+        if (w > 1 || h > 1) {
+            Downsample(level, w, h, normals, next);
+            level.swap(next);
+            w = std::max(1, w / 2);
+            h = std::max(1, h / 2);
+        }
+    }
+}
+
+}
@@ -0,0 +1,228 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#include "texture_loader.h"
+#include "shader.h"
+#include "thread_pool.h"
+#include "cache_file.h"
+#include "stb_image.h"
+
+TextureLoader::TextureLoader() : mailbox(std::make_shared<Mailbox>()) {}
+
+TextureLoader::~TextureLoader() {
+    // only the decodes matter, unmapping is up to the context going away
+    std::unique_lock<std::mutex> lock(mailbox->mutex);
+    mailbox->arrived.wait(lock, [this] { return mailbox->done.size() + decoded.size() == in_flight; });
+}
+
+void TextureLoader::Request(unsigned int texture, unsigned int target, const std::vector<std::string>& paths, bool flip, bool mipmaps, TEXTURE_COOK cook, int first_level) {
+    std::shared_ptr<Job> job = std::make_shared<Job>();
+    job->texture = texture;
+    job->target = target;
+    job->paths = paths;
+    job->flip = flip;
+    job->mipmaps = mipmaps;
+    job->cook = target == GL_TEXTURE_2D && mipmaps && TextureCache::Supported() ? cook : COOK_NONE;
+    job->first_level = job->cook != COOK_NONE ? first_level : 0;
+    waiting.push_back(std::move(job));
+    // get the decodes going now rather than at the first frame
+    Update(0.0);
+}
+
+bool TextureLoader::Start(const std::shared_ptr<Job>& job) {
+    if (job->cook != COOK_NONE) {
+        job->key = TextureCache::KeyFor(job->paths[0], job->flip, job->cook);
+        job->stamp = CacheFile::SourceStamp(job->paths[0]);
+        job->cached = TextureCache::Peek(job->key, job->stamp, job->format, job->width, job->height);
+    }
+    // just the headers here, they say how big a buffer to map
+    for (size_t i = 0; i < job->paths.size() && !job->cached; i++) {
+        int w, h, n;
+        if (!stbi_info(job->paths[i].c_str(), &w, &h, &n)) {
+            std::cout << "ERROR: failed to load image " << job->paths[i] << ": " << stbi_failure_reason() << std::endl;
+            return false;
+        }
+        if (i > 0 && (w != job->width || h != job->height)) {
+            std::cout << "ERROR: cube map face " << job->paths[i] << " isn't the same size as the others" << std::endl;
+            return false;
+        }
+        job->width = w;
+        job->height = h;
+        // anything that isn't rgba gets expanded to rgb
+        job->channels = (i > 0 && job->channels == 4) || (i == 0 && n == 4) ? 4 : 3;
+    }
+    if (job->cook != COOK_NONE && !job->cached) {
+        job->format = TextureCache::FormatFor(job->cook, job->channels);
+    }
+    if (job->format) {
+        job->first_level = std::clamp(job->first_level, 0, TextureCache::LevelCount(job->width, job->height) - 1);
+        job->face_bytes = TextureCache::ChainSize(job->format, job->width, job->height)
+            - TextureCache::LevelOffset(job->format, job->width, job->height, job->first_level);
+    } else {
+        job->face_bytes = static_cast<size_t>(job->width) * job->height * job->channels;
+    }
+    size_t bytes = job->face_bytes * job->paths.size();
+
+    glGenBuffers(1, &job->pbo);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, job->pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+    job->mapped = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+    // left bound it would turn every other glTexImage2D into a read from it
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (!job->mapped) {
+        glDeleteBuffers(1, &job->pbo);
+        std::cout << "ERROR: couldn't map a pixel buffer for " << job->paths[0] << std::endl;
+        return false;
+    }
+
+    in_flight++;
+    in_flight_bytes += bytes;
+    std::shared_ptr<Mailbox> box = mailbox;
+    if (ThreadPool::Get().NumWorkers() == 0) {
+        // nobody to hand it to
+        Decode(box, job);
+    } else {
+        ThreadPool::Get().Enqueue([box, job]() { Decode(box, job); });
+    }
+    return true;
+}
+
+void TextureLoader::Decode(const std::shared_ptr<Mailbox>& box, const std::shared_ptr<Job>& job) {
+    stbi_set_flip_vertically_on_load_thread(job->flip ? 1 : 0);
+    job->ok = true;
+    if (job->format) {
+        size_t offset = TextureCache::LevelOffset(job->format, job->width, job->height, job->first_level);
+        job->ok = (job->cached && TextureCache::Read(job->key, job->stamp, job->mapped, job->face_bytes, offset)) || Cook(*job);
+    }
+    for (size_t i = 0; i < job->paths.size() && job->ok && !job->format; i++) {
+        int w, h, n;
+        unsigned char* data = stbi_load(job->paths[i].c_str(), &w, &h, &n, job->channels);
+        job->ok = data && w == job->width && h == job->height;
+        if (job->ok) {
+            memcpy(job->mapped + i * job->face_bytes, data, job->face_bytes);
+        }
+        stbi_image_free(data);
+    }
+    // the flag is per thread and this may be the main thread, whose other
+    // stbi_load callers (heightmaps) expect images the right way up
+    stbi_set_flip_vertically_on_load_thread(0);
+    std::lock_guard<std::mutex> lock(box->mutex);
+    box->done.push_back(job);
+    box->arrived.notify_all();
+}
+
+bool TextureLoader::Cook(Job& job) {
+    int w, h, n;
+    unsigned char* data = stbi_load(job.paths[0].c_str(), &w, &h, &n, 4);
+    if (!data || w != job.width || h != job.height) {
+        stbi_image_free(data);
+        return false;
+    }
+    // the mapping is write only, reading it back to save would crawl
+    std::vector<unsigned char> chain(job.face_bytes);
+    TextureCache::Cook(data, w, h, job.format, chain.data());
+    stbi_image_free(data);
+    TextureCache::Save(job.key, job.stamp, job.format, w, h, chain.data(), chain.size());
+    memcpy(job.mapped, chain.data() + chain.size() - job.face_bytes, job.face_bytes);
+
+    std::string line = "Texture " + job.paths[0] + ": cooked " + std::to_string(w) + "x" + std::to_string(h) + ", "
+        + std::to_string(static_cast<size_t>(w) * h * 4 * 4 / 3 / 1024) + " -> " + std::to_string(chain.size() / 1024) + " KB\n";
+    std::cout << line << std::flush;
+    return true;
+}
+
+void TextureLoader::Upload(Job& job) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, job.pbo);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    if (job.ok && job.format) {
+        glBindTexture(job.target, job.texture);
+        int levels = TextureCache::LevelCount(job.width, job.height);
+        size_t offset = 0;
+        for (int i = job.first_level; i < levels; i++) {
+            int w = std::max(1, job.width >> i), h = std::max(1, job.height >> i);
+            size_t size = TextureCache::LevelSize(job.format, w, h);
+            glCompressedTexImage2D(job.target, i - job.first_level, job.format, w, h, 0, size, (void*)offset);
+            offset += size;
+        }
+        // levels past the end from a longer chain before are left alone, this keeps them out of sampling
+        glTexParameteri(job.target, GL_TEXTURE_MAX_LEVEL, levels - 1 - job.first_level);
+    } else if (job.ok) {
+        GLenum format = job.channels == 4 ? GL_RGBA : GL_RGB;
+        glBindTexture(job.target, job.texture);
+        // rgb rows aren't always a multiple of 4 bytes
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (size_t i = 0; i < job.paths.size(); i++) {
+            GLenum face = job.target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + i : job.target;
+            glTexImage2D(face, 0, format, job.width, job.height, 0, format, GL_UNSIGNED_BYTE, (void*)(i * job.face_bytes));
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        if (job.mipmaps) {
+            glGenerateMipmap(job.target);
+        }
+    } else {
+        std::cout << "ERROR: failed to decode image " << job.paths[0] << ", keeping the placeholder" << std::endl;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(1, &job.pbo);
+
+    in_flight--;
+    in_flight_bytes -= job.face_bytes * job.paths.size();
+    Finished(job, job.ok);
+}
+
+void TextureLoader::Finished(const Job& job, bool ok) {
+    size_t bytes = job.face_bytes * job.paths.size();
+    if (!job.format) {
+        // drivers keep rgb as rgba, mips add a third
+        bytes = static_cast<size_t>(job.width) * job.height * 4 * job.paths.size();
+        bytes = job.mipmaps ? bytes * 4 / 3 : bytes;
+    }
+    uploaded.push_back({job.texture, ok, job.format, job.width, job.height, job.first_level, bytes});
+}
+
+std::vector<TextureLoader::Uploaded> TextureLoader::TakeUploaded() {
+    std::vector<Uploaded> taken;
+    taken.swap(uploaded);
+    return taken;
+}
+
+void TextureLoader::Update(double budget_ms) {
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(mailbox->mutex);
+        decoded.insert(decoded.end(), mailbox->done.begin(), mailbox->done.end());
+        mailbox->done.clear();
+    }
+
+    int uploaded = 0;
+    while (!decoded.empty() && budget_ms > 0.0) {
+        double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (uploaded > 0 && elapsed >= budget_ms) {
+            break;
+        }
+        std::shared_ptr<Job> job = std::move(decoded.front());
+        decoded.pop_front();
+        Upload(*job);
+        uploaded++;
+    }
+
+    while (!waiting.empty() && (in_flight == 0 || in_flight_bytes < TEXTURE_IN_FLIGHT_BYTES)) {
+        std::shared_ptr<Job> job = std::move(waiting.front());
+        waiting.pop_front();
+        if (!Start(job)) {
+            Finished(*job, false);
+        }
+    }
+}
+
+void TextureLoader::Finish() {
+    while (Pending() > 0) {
+        {
+            std::unique_lock<std::mutex> lock(mailbox->mutex);
+            mailbox->arrived.wait(lock, [this] { return !mailbox->done.empty() || in_flight == decoded.size(); });
+        }
+        Update(1e30);
+    }
+}
@@ -0,0 +1,115 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace {
+    thread_local unsigned current_slot = 0;
+}
+
+ThreadPool::ThreadPool(unsigned num_threads) {
+    if (num_threads == 0) {
+        unsigned hw = std::thread::hardware_concurrency();
+        // leave the main thread its own core, it joins in on ParallelFor anyway
+        num_threads = hw > 1 ? hw - 1 : 0;
+    }
+    for (unsigned i = 0; i < num_threads; i++) {
+        workers.emplace_back(&ThreadPool::WorkerLoop, this, i + 1);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& w : workers) {
+        w.join();
+    }
+}
+
+ThreadPool& ThreadPool::Get() {
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::WorkerLoop(unsigned index) {
+    current_slot = index;
+    for (;;) {
+        std::function<void(unsigned)> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this]() { return stopping || !tasks.empty(); });
+            if (stopping && tasks.empty()) {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task(index);
+    }
+}
+
+void ThreadPool::RunChunks(Job& job, unsigned worker) {
+    for (;;) {
+        size_t chunk = job.next_chunk.fetch_add(1);
+        if (chunk >= job.num_chunks) {
+            return;
+        }
+        size_t begin = chunk * job.grain;
+        size_t end = std::min(job.count, begin + job.grain);
+        (*job.fn)(begin, end, worker);
+        job.done_chunks.fetch_add(1);
+    }
+}
+
+void ThreadPool::ParallelFor(size_t count, size_t grain, const RangeFunc& fn) {
+    if (count == 0) {
+        return;
+    }
+    grain = std::max<size_t>(grain, 1);
+    size_t num_chunks = (count + grain - 1) / grain;
+
+    // a worker calling in keeps its own slot, nobody else runs under it meanwhile
+    unsigned slot = current_slot;
+
+    // not worth waking anyone up
+    if (num_chunks == 1 || workers.empty()) {
+        fn(0, count, slot);
+        return;
+    }
+
+    auto job = std::make_shared<Job>();
+    job->fn = &fn;
+    job->count = count;
+    job->grain = grain;
+    job->num_chunks = num_chunks;
+
+    size_t helpers = std::min<size_t>(workers.size(), num_chunks - 1);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < helpers; i++) {
+            tasks.emplace_back([this, job](unsigned worker) {
+                RunChunks(*job, worker);
+                if (job->done_chunks.load() == job->num_chunks) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    finished.notify_all();
+                }
+            });
+        }
+    }
+    wake.notify_all();
+
+    RunChunks(*job, slot);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [&job]() { return job->done_chunks.load() == job->num_chunks; });
+}
+
+void ThreadPool::Enqueue(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.emplace_back([task = std::move(task)](unsigned) { task(); });
+    }
+    wake.notify_one();
+}
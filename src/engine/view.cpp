@@ -4,6 +4,8 @@
 #include "glm/ext/matrix_transform.hpp"
 #include "resource_manager.h"
 #include "scene_graph.h"
+#include <algorithm>
+#include <cfloat>
 #include <cmath>
 #include <stdexcept>
 
@@ -111,15 +113,22 @@ void View::RenderDepthMap(SceneGraph& scene, std::shared_ptr<Light> light) {
     // glAlphaFunc(GL_GREATER, 0.5f);
 
     Shader* shd = resman.GetShader("S_Depth");
-    Shader* shdinst = resman.GetShader("S_InstancedDepth");
+    Shader* shdinst = shd->Variant(KEYWORD_INSTANCED);
     shd->Use();
 
     glm::mat4 view_mat = light->CalculateViewMatrix();
     glm::mat4 proj_mat = light->GetProjMatrix();
+    glm::vec3 eye = glm::vec3(glm::inverse(scene.GetCamera().GetViewMatrix())[3]);
 
 
-    std::function<void(SceneNode*)> render_depth = [&render_depth, &shdinst, &scene, &proj_mat, &view_mat, &shd, this](SceneNode* node) {
-        Mesh* mesh = resman.GetMesh(node->GetMeshID());
+    std::function<void(SceneNode*)> render_depth = [&render_depth, &shdinst, &scene, &proj_mat, &view_mat, &eye, &shd, this](SceneNode* node) {
+        Mesh* mesh = nullptr;
+        if(node->CustomDraw(shd, proj_mat * view_mat, eye, RenderPass::DEPTH)) {
+            // it's allowed to switch programs
+            shd->Use();
+        } else {
+            mesh = resman.GetMesh(node->GetMeshID());
+        }
         if(mesh){
             std::vector<Transform>& instances = node->GetInstances();
             if(instances.size() > 0) {
@@ -148,6 +157,27 @@ void View::RenderDepthMap(SceneGraph& scene, std::shared_ptr<Light> light) {
     }
 }
 
+// Rough screen size of a texture wrapped once around the node's mesh: the
+// circumference of its bounding sphere in pixels, which is what a sphere shows
+// across its middle. Nodes the camera is inside of, instanced ones and ones
+// without a mesh say they need every pixel.
+float View::TexturePixels(SceneNode* node, Camera& cam) {
+    // custom drawn nodes may not have a mesh under their id
+    Mesh* mesh = resman.HasMesh(node->GetMeshID()) ? resman.GetMesh(node->GetMeshID()) : nullptr;
+    if(!mesh || mesh->Radius() <= 0.0f || node->GetInstances().size() > 0) {
+        return FLT_MAX;
+    }
+    const glm::mat4& world = node->transform.GetWorldMatrix();
+    float scale = std::max({glm::length(glm::vec3(world[0])), glm::length(glm::vec3(world[1])), glm::length(glm::vec3(world[2]))});
+    float radius = mesh->Radius() * scale;
+    float distance = glm::length(glm::vec3(cam.GetViewMatrix() * world[3]));
+    if(distance <= radius) {
+        return FLT_MAX;
+    }
+    float radius_pixels = radius / distance * cam.GetPerspectiveMatrix()[1][1] * win.height * 0.5f;
+    return 2.0f * glm::pi<float>() * radius_pixels;
+}
+
 void View::RenderNode(SceneNode* node, Camera& cam, std::vector<std::shared_ptr<Light>>& lights, const glm::mat4& parent_matrix) {
 
     if (!node->visible) {
@@ -161,7 +191,20 @@ void View::RenderNode(SceneNode* node, Camera& cam, std::vector<std::shared_ptr<
 
     glDisable(GL_BLEND);
     // SHADER
-    Shader* shd = resman.GetShader(shd_id);
+    unsigned int keywords = 0;
+    if(node->GetInstances().size() > 0) {
+        keywords |= KEYWORD_INSTANCED;
+    }
+    if(node->material.receive_shadows) {
+        keywords |= KEYWORD_SHADOWS;
+    }
+    if(!norm_id.empty()) {
+        keywords |= KEYWORD_NORMAL_MAP;
+    }
+    if(node->material.alpha_test) {
+        keywords |= KEYWORD_ALPHA;
+    }
+    Shader* shd = resman.GetShader(shd_id)->Variant(keywords);
 
     shd->Use();
     // if(active_shader != shd->id) {
@@ -177,14 +220,18 @@ void View::RenderNode(SceneNode* node, Camera& cam, std::vector<std::shared_ptr<
     node->SetUniforms(shd, cam.GetViewMatrix(), parent_matrix);
 
     // TEXTURE
+    float pixels = TexturePixels(node, cam);
     if(!tex_id.empty()) {
-        resman.GetTexture(tex_id)->Bind(shd, 0, "texture_map");
+        Texture* tex = resman.GetTexture(tex_id);
+        tex->Bind(shd, 0, "texture_map");
+        resman.UseTexture(tex, pixels / node->material.texture_repetition);
     }
     if(!norm_id.empty()) {
-        resman.GetTexture(norm_id)->Bind(shd, 1, "normal_map");
+        Texture* tex = resman.GetTexture(norm_id);
+        tex->Bind(shd, 1, "normal_map");
+        resman.UseTexture(tex, pixels / node->material.normal_map_repetition);
     }
-    // disgusting
-    if(shd_id == "S_NormalMap" || shd_id == "S_InstancedShadow") {
+    if(shd->Keywords() & KEYWORD_SHADOWS) {
         glActiveTexture(GL_TEXTURE0 + 2);
         glBindTexture(GL_TEXTURE_2D, depth_tex);
         shd->SetUniform1i(2, "shadow_map");
@@ -204,7 +251,10 @@ void View::RenderNode(SceneNode* node, Camera& cam, std::vector<std::shared_ptr<
     
     // check if there is anything to render
     if(!mesh_id.empty()) {
-        resman.GetMesh(mesh_id)->Draw(node->GetNumInstances());
+        glm::vec3 eye = glm::vec3(glm::inverse(cam.GetViewMatrix())[3]);
+        if(!node->CustomDraw(shd, cam.GetPerspectiveMatrix() * cam.GetViewMatrix(), eye, RenderPass::COLOR)) {
+            resman.GetMesh(mesh_id)->Draw(node->GetNumInstances());
+        }
     }
 
     // HIERARCHY
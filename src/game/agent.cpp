@@ -13,6 +13,12 @@ void Agent::UpMove(float dt)
         step_height = step_height_;
         return;
     }
+    if (substep_movement_) {
+        SubstepUpMove(up_ * (step_height_) + jump_axis_ * ((vertical_offset_ > 0.f ? vertical_offset_ : 0.f)));
+        step_offset_ = step_height;
+        return;
+    }
+
     glm::vec3 up_position_ = transform.GetPosition() + up_ * (step_height_) + jump_axis_ * ((vertical_offset_ > 0.f ? vertical_offset_ : 0.f));
     // CHECK FOR VERTICAL COLLISION
     // VERTICAL COLLISION RESPONSE
@@ -48,6 +54,7 @@ void Agent::WalkingMove(const glm::vec3 move, float dt)
     if (glm::length(move) > 0.001)
     {
         glm::vec3 forward = glm::normalize(glm::vec3(transform.GetOrientation() * glm::vec4(glm::normalize(move), 0.0)));
+        // the look ahead decides whether to move at all in both modes, substeps then guard the path itself
         glm::vec3 target_step_ = target_position_ + forward * speed_;
         if (terrain->SamplePassable(target_step_.x, target_step_.z)) {
             return;
@@ -57,7 +64,11 @@ void Agent::WalkingMove(const glm::vec3 move, float dt)
         float slope_angle = glm::degrees(glm::acos(glm::dot(sample_normal, forward))) - 90;
         //printf("Slope forward angle %f \n", slope_angle);
         if (slope_angle < max_walking_angle_ || target_position_.y > terrain_nextY + height_ * 4) { 
-            target_position_ += forward * speed_ * dt * 100.0f;
+            if (substep_movement_) {
+                SubstepWalkingMove(forward * speed_ * dt * 100.0f);
+            } else {
+                target_position_ += forward * speed_ * dt * 100.0f;
+            }
             // transform.SetPosition(target_position_);
         }
     }
@@ -81,12 +92,12 @@ void Agent::DownMove(float dt)
 
     glm::vec3 position = transform.GetPosition();
 
-    float terrainY = terrain->SampleHeight(target_position_.x, target_position_.z);
+    float terrainY = terrain->SampleHeight(target_position_.x, target_position_.z, terrain_cell_);
     
     if (target_position_.y < terrainY + height_ || (!jumping_ && target_position_.y < terrainY + height_ + vertical_step_height_)) {
         //We are touching terrain!
 
-        glm::vec3 sample_normal = terrain->SampleNormal(target_position_.x, target_position_.z);
+        glm::vec3 sample_normal = terrain->SampleNormal(target_position_.x, target_position_.z, terrain_cell_);
         glm::vec3 ground_parallel = glm::cross(up_, sample_normal);
         glm::vec3 down_slope = glm::cross(ground_parallel, sample_normal);
         float slope_angle = glm::degrees(glm::acos(glm::dot(sample_normal, up_)));
@@ -107,6 +118,78 @@ void Agent::DownMove(float dt)
     }
 }
 
+void Agent::SubstepUpMove(const glm::vec3& displacement)
+{
+    int steps = glm::max(1, static_cast<int>(glm::ceil(glm::length(displacement) / max_substep_)));
+    glm::vec3 step = displacement / static_cast<float>(steps);
+    bool raw_up = jump_axis_.x == 0.0f && jump_axis_.z == 0.0f;
+
+    // walk the jump/dash path and stop at the last spot that was fine
+    glm::vec3 position = target_position_;
+    for (int i = 0; i < steps; i++) {
+        glm::vec3 next = position + step;
+        if (terrain->SamplePassable(next.x, next.z)) {
+            break;
+        }
+        if (!raw_up) {
+            glm::vec3 sample_normal = terrain->SampleNormal(next.x, next.z, terrain_cell_);
+            float sample_height = terrain->SampleHeight(next.x, next.z, terrain_cell_);
+            float slope_angle = glm::degrees(glm::acos(glm::dot(sample_normal, up_)));
+            if (slope_angle > max_jumping_angle_ && next.y < sample_height) {
+                vertical_velocity_ = 0.0f;
+                vertical_offset_ = 0.0f;
+                jumping_ = false;
+                break;
+            }
+        }
+        position = next;
+    }
+    target_position_ = position;
+}
+
+bool Agent::WalkableStep(const glm::vec3& from, const glm::vec3& step)
+{
+    glm::vec3 next = from + step;
+    if (terrain->SamplePassable(next.x, next.z)) {
+        return false;
+    }
+    float terrain_nextY = terrain->SampleHeight(next.x, next.z, terrain_cell_);
+    glm::vec3 sample_normal = terrain->SampleNormal(next.x, next.z, terrain_cell_);
+    float slope_angle = glm::degrees(glm::acos(glm::dot(sample_normal, glm::normalize(step)))) - 90;
+    return slope_angle < max_walking_angle_ || from.y > terrain_nextY + height_ * 4;
+}
+
+void Agent::SubstepWalkingMove(const glm::vec3& displacement)
+{
+    int steps = glm::max(1, static_cast<int>(glm::ceil(glm::length(displacement) / max_substep_)));
+    glm::vec3 step = displacement / static_cast<float>(steps);
+
+    for (int i = 0; i < steps; i++) {
+        if (WalkableStep(target_position_, step)) {
+            target_position_ += step;
+            continue;
+        }
+        // too steep, drop the part of the step that pushes into the slope and
+        // slide along it instead of stopping dead
+        glm::vec3 next = target_position_ + step;
+        glm::vec3 normal = terrain->SampleNormal(next.x, next.z, terrain_cell_);
+        glm::vec3 across = glm::vec3(normal.x, 0.0f, normal.z);
+        if (glm::length(across) < 1e-4f) {
+            break;
+        }
+        across = glm::normalize(across);
+        float into = glm::dot(step, across);
+        if (into >= 0.0f) {
+            break;
+        }
+        glm::vec3 slide = step - across * into;
+        if (glm::length(slide) < 1e-4f || !WalkableStep(target_position_, slide)) {
+            break;
+        }
+        target_position_ += slide;
+    }
+}
+
 void Agent::Update(double dt)
 {
     prev_position_ = transform.GetPosition();
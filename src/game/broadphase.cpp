@@ -0,0 +1,119 @@
+#include "broadphase.h"
+
+#include <algorithm>
+#include <cmath>
+
+void SpatialHash::Clear() {
+    entries.clear();
+    positions.clear();
+    radii.clear();
+    max_radius = 0.0f;
+}
+
+void SpatialHash::Build(const std::vector<Transform>& instances, float radius) {
+    std::vector<glm::vec3> centers;
+    std::vector<float> rs;
+    centers.reserve(instances.size());
+    rs.reserve(instances.size());
+    for (const Transform& t : instances) {
+        centers.push_back(t.GetPosition());
+        rs.push_back(radius > 0.0f ? radius : t.GetScale().x);
+    }
+    Build(centers, rs);
+}
+
+void SpatialHash::Build(const std::vector<glm::vec3>& centers, const std::vector<float>& rs) {
+    Clear();
+    positions = centers;
+    radii = rs;
+    for (float r : radii) {
+        max_radius = std::max(max_radius, r);
+    }
+
+    // a cell about one instance across keeps buckets small without
+    // making queries walk a huge block of empty cells
+    cell_size = std::max(2.0f * max_radius, 1.0f);
+
+    entries.resize(positions.size());
+    for (unsigned int i = 0; i < positions.size(); i++) {
+        entries[i] = {Key(CellOf(positions[i])), i};
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.key != b.key ? a.key < b.key : a.index < b.index;
+    });
+}
+
+glm::ivec3 SpatialHash::CellOf(const glm::vec3& p) const {
+    return glm::ivec3(glm::floor(p / cell_size));
+}
+
+uint64_t SpatialHash::Key(const glm::ivec3& c) {
+    // 21 bits per axis is plenty, the worlds here are a few hundred cells wide
+    const uint64_t mask = (1ull << 21) - 1;
+    return ((uint64_t(c.x) & mask) << 42) | ((uint64_t(c.y) & mask) << 21) | (uint64_t(c.z) & mask);
+}
+
+void SpatialHash::Query(const glm::vec3& center, float radius, std::vector<unsigned int>& out) const {
+    if (entries.empty()) {
+        return;
+    }
+    size_t first = out.size();
+    float reach = radius + max_radius;
+    glm::ivec3 lo = CellOf(center - glm::vec3(reach));
+    glm::ivec3 hi = CellOf(center + glm::vec3(reach));
+
+    double cells = double(hi.x - lo.x + 1) * double(hi.y - lo.y + 1) * double(hi.z - lo.z + 1);
+    if (cells > double(entries.size())) {
+        // query is bigger than the whole set, just sweep it
+        for (unsigned int i = 0; i < positions.size(); i++) {
+            if (glm::length(positions[i] - center) < reach) {
+                out.push_back(i);
+            }
+        }
+        return;
+    }
+
+    auto by_key = [](const Entry& e, uint64_t k) { return e.key < k; };
+    for (int x = lo.x; x <= hi.x; x++) {
+        for (int y = lo.y; y <= hi.y; y++) {
+            for (int z = lo.z; z <= hi.z; z++) {
+                uint64_t key = Key({x, y, z});
+                auto it = std::lower_bound(entries.begin(), entries.end(), key, by_key);
+                for (; it != entries.end() && it->key == key; ++it) {
+                    out.push_back(it->index);
+                }
+            }
+        }
+    }
+    std::sort(out.begin() + first, out.end());
+}
+
+void SpatialHash::QuerySegment(const glm::vec3& origin, const glm::vec3& dir, float length, float radius, std::vector<unsigned int>& out) const {
+    if (entries.empty()) {
+        return;
+    }
+    size_t first = out.size();
+    size_t pieces = static_cast<size_t>(std::ceil(length / cell_size));
+    pieces = std::max<size_t>(pieces, 1);
+
+    if (pieces * 8 > entries.size()) {
+        // long ray over a small set, cheaper to test them all against the segment
+        float reach = radius + max_radius;
+        for (unsigned int i = 0; i < positions.size(); i++) {
+            float s = glm::clamp(glm::dot(positions[i] - origin, dir), 0.0f, length);
+            if (glm::length(positions[i] - (origin + dir * s)) < reach) {
+                out.push_back(i);
+            }
+        }
+        return;
+    }
+
+    // cover the segment with spheres one cell long each
+    float piece = length / pieces;
+    for (size_t p = 0; p < pieces; p++) {
+        glm::vec3 mid = origin + dir * (piece * (p + 0.5f));
+        Query(mid, piece * 0.5f + radius, out);
+    }
+    std::sort(out.begin() + first, out.end());
+    out.erase(std::unique(out.begin() + first, out.end()), out.end());
+}
@@ -1,5 +1,7 @@
 #include "colliders/colliders.h"
 
+#include <cfloat>
+
 // BOX COLLIDER
 bool BoxCollider::CollidesWithBox(BoxCollider* other) {
     return false;
@@ -57,6 +59,10 @@ bool SphereCollider::CollidesWithPlayer(FPPlayerCollider* other) {
     return glm::distance(pos1, pos2) < GetRadius() + other->GetRadius();
 }
 
+bool SphereCollider::CollidesWithMesh(MeshCollider* other) {
+    return other->SphereTest(owner_.transform.GetPosition(), GetRadius());
+}
+
 // TERRAIN COLLIDER
 
 // PLAYER COLLIDER
@@ -102,6 +108,10 @@ bool FPPlayerCollider::CollidesWithScalingCylinder(ScalingCylinderCollider* othe
     return distanceSquared <= (radius + radius_) * (radius + radius_);
 }
 
+bool FPPlayerCollider::CollidesWithMesh(MeshCollider* other) {
+    return other->SphereTest(player_.transform.GetPosition(), radius_);
+}
+
 //CYLINDER COLLIDER
 bool CylinderCollider::CollidesWithPlayer(FPPlayerCollider* other) {
     glm::vec3 sphere_position = other->GetPlayer().transform.GetPosition();
@@ -139,3 +149,81 @@ bool ScalingCylinderCollider::CollidesWithSphere(SphereCollider* other) {
     float distanceSquared = glm::distance2(glm::vec3(cylinder_position.x, closestPointOnAxis, cylinder_position.z), sphere_position);
     return distanceSquared <= (radius + other->GetRadius()) * (radius + other->GetRadius());
 }
+
+// MESH COLLIDER
+bool MeshCollider::SphereTest(const glm::vec3& center, float radius, glm::vec3* contact) const {
+    if (!bvh_ || bvh_->Empty()) {
+        return false;
+    }
+    const glm::mat4& world = owner_.transform.GetWorldMatrix();
+    glm::mat4 inv = glm::inverse(world);
+
+    // the sphere's world box taken into mesh space is a conservative box there too
+    glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+    for (int i = 0; i < 8; i++) {
+        glm::vec3 corner = center + glm::vec3(i & 1 ? radius : -radius, i & 2 ? radius : -radius, i & 4 ? radius : -radius);
+        glm::vec3 local = glm::vec3(inv * glm::vec4(corner, 1.0f));
+        lo = glm::min(lo, local);
+        hi = glm::max(hi, local);
+    }
+
+    float r2 = radius * radius;
+    return bvh_->QueryAABB(lo, hi, [&](unsigned int t) {
+        glm::vec3 a, b, c;
+        bvh_->GetTriangle(t, a, b, c);
+        a = glm::vec3(world * glm::vec4(a, 1.0f));
+        b = glm::vec3(world * glm::vec4(b, 1.0f));
+        c = glm::vec3(world * glm::vec4(c, 1.0f));
+        glm::vec3 closest = MeshBVH::ClosestPointOnTriangle(center, a, b, c);
+        glm::vec3 d = closest - center;
+        if (glm::dot(d, d) > r2) {
+            return false;
+        }
+        if (contact) {
+            *contact = closest;
+        }
+        return true;
+    });
+}
+
+void MeshCollider::GetWorldBounds(glm::vec3& lo, glm::vec3& hi) const {
+    lo = glm::vec3(FLT_MAX);
+    hi = glm::vec3(-FLT_MAX);
+    if (!bvh_ || bvh_->Empty()) {
+        lo = hi = owner_.transform.GetPosition();
+        return;
+    }
+    const glm::mat4& world = owner_.transform.GetWorldMatrix();
+    glm::vec3 bmin = bvh_->GetMin(), bmax = bvh_->GetMax();
+    for (int i = 0; i < 8; i++) {
+        glm::vec3 corner = {i & 1 ? bmax.x : bmin.x, i & 2 ? bmax.y : bmin.y, i & 4 ? bmax.z : bmin.z};
+        glm::vec3 w = glm::vec3(world * glm::vec4(corner, 1.0f));
+        lo = glm::min(lo, w);
+        hi = glm::max(hi, w);
+    }
+}
+
+bool MeshCollider::Raycast(const glm::vec3& origin, const glm::vec3& dir, float max_t, MeshBVH::RayHit& hit) const {
+    if (!bvh_ || bvh_->Empty()) {
+        return false;
+    }
+    const glm::mat4& world = owner_.transform.GetWorldMatrix();
+    glm::mat4 inv = glm::inverse(world);
+    // affine maps keep the ray parameter, so t comes back out in world units of dir
+    glm::vec3 lorigin = glm::vec3(inv * glm::vec4(origin, 1.0f));
+    glm::vec3 ldir = glm::vec3(inv * glm::vec4(dir, 0.0f));
+    if (!bvh_->Raycast(lorigin, ldir, max_t, hit)) {
+        return false;
+    }
+    glm::mat3 normal_mat = glm::transpose(glm::mat3(inv));
+    hit.normal = glm::normalize(normal_mat * hit.normal);
+    return true;
+}
+
+bool MeshCollider::CollidesWithPlayer(FPPlayerCollider* other) {
+    return SphereTest(other->GetPlayer().transform.GetPosition(), other->GetRadius());
+}
+
+bool MeshCollider::CollidesWithSphere(SphereCollider* other) {
+    return SphereTest(other->GetOwner().transform.GetPosition(), other->GetRadius());
+}
@@ -3,34 +3,85 @@
 #include "fp_player.h"
 #include "colliders/colliders.h"
 #include "game.h"
+#include "thread_pool.h"
 
 #include <glm/glm.hpp>
+#include <algorithm>
 #include <memory>
 
+// pairs per chunk handed to a worker, the tests are tiny so keep it chunky
+#define NARROWPHASE_GRAIN 256
+// frames a collider has to sit still and alone before it sleeps
+#define SLEEP_FRAMES 30
+// how far past touching a body has to be before it stops keeping things awake,
+// about a frame of the ship at full speed
+#define WAKE_MARGIN 25.0f
+// moving further than this from where it went to sleep counts as moving
+#define REST_DRIFT 0.5f
+
 
 void CollisionManager::CleanupNodes() {
+    size_t before = items.size() + othercollideables.size();
     RemoveDeletedNodes(rockets);
     RemoveDeletedNodes(asteroids);
     RemoveDeletedNodes(items);
     RemoveDeletedNodes(othercollideables);
+    if (items.size() + othercollideables.size() != before) {
+        tracked_dirty = true;
+    }
+
+    for (auto it = instance_hashes.begin(); it != instance_hashes.end();) {
+        if (it->first->deleted) {
+            it = instance_hashes.erase(it);
+        } else {
+            ++it;
+        }
+    }
 }
 
 void CollisionManager::CheckCollisions() {
     CleanupNodes();
+    UpdateActivity();
+    stats.pairs_tested = 0;
 
     for (const auto& trig : triggers) {
+        if (Asleep(*trig)) {
+            continue;
+        }
+        stats.pairs_tested++;
         if (sphereToSphere(*player, *trig)) {
             trig->ActivateTrigger();
         }
     }
 
     for (const auto& n : blockingCollision) {
-        if (sphereToSphere(*player, *n)) {
+        if (n->GetInstances().empty()) {
+            if (Asleep(*n)) {
+                continue;
+            }
+            stats.pairs_tested++;
+            if (sphereToSphere(*player, *n)) {
+                player->ResetPosition();
+            }
+            continue;
+        }
+        // one node at a time, a reset moves the player before the next one is tested
+        std::vector<Body> bodies = {{player->transform.GetPosition(), player->GetCollision().GetSphereRadius()}};
+        std::vector<InstanceSet> sets = {{&GetInstanceHash(n, n->GetCollision().GetSphereRadius()), glm::vec3(0.0f)}};
+        pairs.clear();
+        GatherPairs(0, *sets[0].hash, sets[0].offset, bodies, pairs);
+        Narrowphase(pairs, sets, bodies, hits);
+        stats.pairs_tested += pairs.size();
+        if (!hits.empty()) {
             player->ResetPosition();
         }
     }
 
     for (const auto& toggle : toggles) {
+        if (Asleep(*toggle)) {
+            continue;
+        }
+        stats.pairs_tested++;
         if (GetCollisionRaw(*toggle, *player)) {
             if (!toggle->GetToggle()) {
                 toggle->ToggleOn(*player);
@@ -41,48 +92,70 @@ void CollisionManager::CheckCollisions() {
     }
 
 
-    for (const auto& asteroid : asteroids) {
-        int i = 0;
-        for (const Transform& a : asteroid->GetInstances()) {
-            float rad = a.GetScale().x;
-            float player_rad = glm::length(player->transform.GetScale());
-            glm::vec3 apos = asteroid->transform.GetPosition() + a.GetPosition();
-            if (glm::length(player->transform.GetPosition() - apos) < rad + player_rad) {
-                game->SpawnExplosion(apos, glm::vec3(4.0f));
-                game->ShipHitPlanet({ 0.0f,0.0f,0.0f });
-                asteroid->DeleteInstance(i);
-            }
+    // body 0 is the player, the rest are the rockets in order
+    std::vector<Body> bodies;
+    bodies.reserve(rockets.size() + 1);
+    bodies.push_back({player->transform.GetPosition(), glm::length(player->transform.GetScale())});
+    for (const auto& rocket : rockets) {
+        bodies.push_back({rocket->transform.GetPosition(), rocket->transform.GetScale().x});
+    }
 
-            for (auto it = rockets.begin(); it != rockets.end();) {
-                auto rocket = *it;
-                float rocket_rad = rocket->transform.GetScale().x;
-                if (glm::length(rocket->transform.GetPosition() - apos) < rad + rocket_rad) {
-                    game->SpawnExplosion(rocket->transform.GetPosition(), glm::vec3(1.0f));
-                    game->SpawnExplosion(apos, glm::vec3(4.0f));
-                    rocket->deleted = true;
-                    asteroid->DeleteInstance(i);
-                }
-                ++it;
-            }
-            i++;
+    std::vector<InstanceSet> sets;
+    pairs.clear();
+    for (const auto& asteroid : asteroids) {
+        InstanceSet set = {&GetInstanceHash(asteroid), asteroid->transform.GetPosition()};
+        GatherPairs(sets.size(), *set.hash, set.offset, bodies, pairs);
+        sets.push_back(set);
+    }
+    Narrowphase(pairs, sets, bodies, hits);
+    stats.pairs_tested += pairs.size();
+
+    // responses stay serial and in pair order so the outcome never depends on threading
+    for (unsigned int h : hits) {
+        const CandidatePair& p = pairs[h];
+        const std::shared_ptr<SceneNode>& asteroid = asteroids[p.set];
+        glm::vec3 apos = sets[p.set].offset + sets[p.set].hash->GetPosition(p.instance);
+        if (p.body == 0) {
+            game->SpawnExplosion(apos, glm::vec3(4.0f));
+            game->ShipHitPlanet({ 0.0f,0.0f,0.0f });
+            asteroid->DeleteInstance(p.instance);
+        } else {
+            auto rocket = rockets[p.body - 1];
+            game->SpawnExplosion(rocket->transform.GetPosition(), glm::vec3(1.0f));
+            game->SpawnExplosion(apos, glm::vec3(4.0f));
+            rocket->deleted = true;
+            asteroid->DeleteInstance(p.instance);
         }
     }
 
     for (const auto& item : items) {
+        if (Asleep(*item)) {
+            continue;
+        }
+        stats.pairs_tested++;
         GetCollision(*item, *player);
     }
 
     for (const auto& beacon : beacons) {
+        if (Asleep(*beacon)) {
+            continue;
+        }
+        stats.pairs_tested++;
         GetCollision(*beacon, *player);
     }
 
     for (auto other : othercollideables) {
         if(!other) {continue;}
+        if (Asleep(*other)) {
+            continue;
+        }
+        stats.pairs_tested++;
         if (GetCollision(*other, *player) && other->GetCollider()->oneoff) {
             continue;
         }
 
         for (auto rocket : rockets) {
+            stats.pairs_tested++;
 
             float other_rad = other->transform.GetScale().x;
             float rocket_rad = glm::length(rocket->transform.GetScale());
@@ -96,6 +169,223 @@ void CollisionManager::CheckCollisions() {
     }
 }
 
+void CollisionManager::SetSleeping(bool s) {
+    sleeping = s;
+    if (!sleeping) {
+        WakeAll();
+    }
+}
+
+void CollisionManager::Wake(const SceneNode* node) {
+    auto it = activity.find(node);
+    if (it != activity.end()) {
+        it->second.idle_frames = 0;
+        it->second.asleep = false;
+    }
+}
+
+void CollisionManager::WakeAll() {
+    for (auto& a : activity) {
+        a.second.idle_frames = 0;
+        a.second.asleep = false;
+    }
+}
+
+bool CollisionManager::Asleep(const SceneNode& node) const {
+    if (!sleeping) {
+        return false;
+    }
+    auto it = activity.find(&node);
+    return it != activity.end() && it->second.asleep;
+}
+
+float CollisionManager::WakeRadius(SceneNode& node) const {
+    Collider* col = node.GetCollider();
+    glm::vec3 pos = node.transform.GetPosition();
+    glm::vec3 scale = node.transform.GetScale();
+    // the rocket test only looks at scale.x so never go below that
+    float r = glm::max(node.GetCollision().GetSphereRadius(), scale.x);
+    if (!col) {
+        return r;
+    }
+    if (auto mesh = dynamic_cast<MeshCollider*>(col)) {
+        glm::vec3 lo, hi;
+        mesh->GetWorldBounds(lo, hi);
+        glm::vec3 corner = glm::max(glm::abs(lo - pos), glm::abs(hi - pos));
+        return glm::max(r, glm::length(corner));
+    }
+    if (auto sphere = dynamic_cast<SphereCollider*>(col)) {
+        return glm::max(r, sphere->GetRadius());
+    }
+    if (auto cyl = dynamic_cast<CylinderCollider*>(col)) {
+        return glm::max(r, cyl->GetRadius() + cyl->GetHeight());
+    }
+    if (dynamic_cast<ScalingCylinderCollider*>(col)) {
+        return glm::max(r, scale.x * 0.5f + scale.y);
+    }
+    // boxes and anything else without a sane bound stay awake
+    return -1.0f;
+}
+
+void CollisionManager::RebuildTracked() {
+    tracked.clear();
+    auto track = [&](const std::shared_ptr<SceneNode>& n) {
+        // instanced sets already go through their own hash
+        if (n && !n->deleted && n->GetInstances().empty()) {
+            tracked.push_back(n.get());
+        }
+    };
+    for (const auto& n : triggers) track(n);
+    // toggles are in othercollideables as well
+    for (const auto& n : items) track(n);
+    for (const auto& n : beacons) track(n);
+    for (const auto& n : othercollideables) track(n);
+    for (const auto& n : blockingCollision) track(n);
+
+    // keep what we knew about nodes that are still around, drop the rest
+    std::unordered_map<const SceneNode*, Activity> kept;
+    std::vector<glm::vec3> centers;
+    std::vector<float> radii;
+    centers.reserve(tracked.size());
+    radii.reserve(tracked.size());
+    for (SceneNode* n : tracked) {
+        Activity a;
+        auto it = activity.find(n);
+        if (it != activity.end()) {
+            a = it->second;
+        }
+        a.item = dynamic_cast<const Item*>(n);
+        a.rest_position = a.item ? a.item->AnchorPosition() : n->transform.GetPosition();
+        a.wake_radius = WakeRadius(*n);
+        if (a.wake_radius < 0.0f) {
+            a.asleep = false;
+        }
+        centers.push_back(a.rest_position);
+        radii.push_back(glm::max(a.wake_radius, 0.0f));
+        kept[n] = a;
+    }
+    activity.swap(kept);
+    wake_hash.Build(centers, radii);
+    tracked_dirty = false;
+}
+
+void CollisionManager::UpdateActivity() {
+    if (!tracked_dirty) {
+        // anything that wandered off from where it was hashed wakes up and gets rehashed
+        for (SceneNode* n : tracked) {
+            Activity& a = activity[n];
+            glm::vec3 position = a.item ? a.item->AnchorPosition() : n->transform.GetPosition();
+            if (glm::distance(position, a.rest_position) > REST_DRIFT) {
+                a.idle_frames = 0;
+                a.asleep = false;
+                tracked_dirty = true;
+            }
+        }
+    }
+    if (tracked_dirty) {
+        RebuildTracked();
+    }
+
+    near_body.assign(tracked.size(), 0);
+    auto wake_near = [this](const glm::vec3& pos, float r) {
+        query_scratch.clear();
+        wake_hash.Query(pos, r + WAKE_MARGIN, query_scratch);
+        // the hash reaches out by the biggest radius in the set (the sun), check each for real
+        for (unsigned int i : query_scratch) {
+            if (glm::distance(wake_hash.GetPosition(i), pos) <= wake_hash.GetRadius(i) + r + WAKE_MARGIN) {
+                near_body[i] = 1;
+            }
+        }
+    };
+    if (player) {
+        float r = glm::max(player->GetCollision().GetSphereRadius(), glm::length(player->transform.GetScale()));
+        wake_near(player->transform.GetPosition(), r);
+    }
+    for (const auto& rocket : rockets) {
+        wake_near(rocket->transform.GetPosition(), glm::length(rocket->transform.GetScale()));
+    }
+
+    stats.awake = 0;
+    stats.asleep = 0;
+    for (unsigned int i = 0; i < tracked.size(); i++) {
+        Activity& a = activity[tracked[i]];
+        if (near_body[i] || a.wake_radius < 0.0f) {
+            a.idle_frames = 0;
+            a.asleep = false;
+        } else if (++a.idle_frames >= SLEEP_FRAMES) {
+            a.asleep = true;
+        }
+    }
+    // a toggle that's on has to see the player leave to switch off
+    for (const auto& toggle : toggles) {
+        if (toggle->GetToggle()) {
+            Wake(toggle.get());
+        }
+    }
+    for (SceneNode* n : tracked) {
+        if (Asleep(*n)) {
+            stats.asleep++;
+        } else {
+            stats.awake++;
+        }
+    }
+}
+
+const SpatialHash& CollisionManager::GetInstanceHash(const std::shared_ptr<SceneNode>& node, float radius) {
+    SpatialHash& hash = instance_hashes[node];
+    // instances only ever get removed, so a changed count means a stale hash
+    if (hash.Size() != node->GetInstances().size()) {
+        hash.Build(node->GetInstances(), radius);
+    }
+    return hash;
+}
+
+void CollisionManager::GatherPairs(unsigned int set, const SpatialHash& hash, const glm::vec3& offset, const std::vector<Body>& bodies, std::vector<CandidatePair>& out) {
+    size_t first = out.size();
+    for (unsigned int b = 0; b < bodies.size(); b++) {
+        query_scratch.clear();
+        hash.Query(bodies[b].position - offset, bodies[b].radius, query_scratch);
+        for (unsigned int i : query_scratch) {
+            out.push_back({set, i, b});
+        }
+    }
+    std::sort(out.begin() + first, out.end());
+}
+
+void CollisionManager::Narrowphase(const std::vector<CandidatePair>& pairs, const std::vector<InstanceSet>& sets, const std::vector<Body>& bodies, std::vector<unsigned int>& hits) {
+    ThreadPool& pool = ThreadPool::Get();
+    contact_buffers.resize(pool.NumSlots());
+    for (auto& buf : contact_buffers) {
+        buf.clear();
+    }
+
+    auto test = [&](size_t begin, size_t end, unsigned worker) {
+        std::vector<unsigned int>& contacts = contact_buffers[worker];
+        for (size_t i = begin; i < end; i++) {
+            const CandidatePair& p = pairs[i];
+            const InstanceSet& set = sets[p.set];
+            const Body& body = bodies[p.body];
+            glm::vec3 ipos = set.offset + set.hash->GetPosition(p.instance);
+            if (glm::length(body.position - ipos) < set.hash->GetRadius(p.instance) + body.radius) {
+                contacts.push_back(i);
+            }
+        }
+    };
+
+    if (parallel) {
+        pool.ParallelFor(pairs.size(), NARROWPHASE_GRAIN, test);
+    } else {
+        test(0, pairs.size(), 0);
+    }
+
+    // each buffer is ascending already, merging by pair index gives the single threaded order
+    hits.clear();
+    for (auto& buf : contact_buffers) {
+        hits.insert(hits.end(), buf.begin(), buf.end());
+    }
+    std::sort(hits.begin(), hits.end());
+}
+
 bool CollisionManager::GetCollision(SceneNode& obj1, SceneNode& obj2) {
     if (obj1.deleted || obj2.deleted) {
         // probably should delete here weird glitch
@@ -139,6 +429,7 @@ bool CollisionManager::GetCollisionRaw(SceneNode& obj1, SceneNode& obj2) {
 }
 
 void CollisionManager::AddNode(std::shared_ptr<SceneNode> node) {
+    tracked_dirty = true;
     switch (node->GetNodeType()) {
         case TTRIGGER:
             triggers.push_back(std::dynamic_pointer_cast<Trigger>(node));
@@ -251,6 +542,11 @@ void CollisionManager::Reset()
     othercollideables.clear();
     rockets.clear();
     blockingCollision.clear();
+    instance_hashes.clear();
+    tracked.clear();
+    activity.clear();
+    wake_hash.Clear();
+    tracked_dirty = true;
     player = nullptr;
     // delete player;
 }
@@ -265,4 +561,332 @@ void CollisionManager::RemoveDeletedNodes(std::vector<std::shared_ptr<T>>& v) {
         ),
         v.end()
     );
-}
\ No newline at end of file
+}
+// SCENE QUERIES
+
+namespace {
+    // nearest t >= 0 where the ray enters the sphere, 0 if it starts inside
+    bool RaySphere(const glm::vec3& o, const glm::vec3& d, const glm::vec3& c, float r, float max_t, float& t) {
+        glm::vec3 m = o - c;
+        float b = glm::dot(m, d);
+        float k = glm::dot(m, m) - r * r;
+        if (k <= 0.0f) {
+            t = 0.0f;
+            return true;
+        }
+        if (b > 0.0f) {
+            return false;
+        }
+        float disc = b * b - k;
+        if (disc < 0.0f) {
+            return false;
+        }
+        t = -b - glm::sqrt(disc);
+        return t <= max_t;
+    }
+
+    // vertical cylinder standing on base, caps included
+    bool RayCylinder(const glm::vec3& o, const glm::vec3& d, const glm::vec3& base, float height, float r, float max_t, float& t, glm::vec3& normal) {
+        float best = max_t;
+        bool found = false;
+        glm::vec2 oc = {o.x - base.x, o.z - base.z};
+        glm::vec2 dd = {d.x, d.z};
+        float a = glm::dot(dd, dd);
+        float c = glm::dot(oc, oc) - r * r;
+        if (c <= 0.0f && o.y >= base.y && o.y <= base.y + height) {
+            t = 0.0f;
+            normal = -d;
+            return true;
+        }
+        if (a > 1e-12f) {
+            float b = glm::dot(oc, dd);
+            float disc = b * b - a * c;
+            if (disc >= 0.0f) {
+                float s = (-b - glm::sqrt(disc)) / a;
+                float y = o.y + d.y * s;
+                if (s >= 0.0f && s <= best && y >= base.y && y <= base.y + height) {
+                    best = s;
+                    found = true;
+                    glm::vec2 n = oc + dd * s;
+                    normal = glm::normalize(glm::vec3(n.x, 0.0f, n.y));
+                }
+            }
+        }
+        if (glm::abs(d.y) > 1e-12f) {
+            float caps[2] = {base.y, base.y + height};
+            for (float cy : caps) {
+                float s = (cy - o.y) / d.y;
+                glm::vec2 p = oc + dd * s;
+                if (s >= 0.0f && s <= best && glm::dot(p, p) <= r * r) {
+                    best = s;
+                    found = true;
+                    normal = glm::vec3(0.0f, cy == base.y ? -1.0f : 1.0f, 0.0f);
+                }
+            }
+        }
+        if (found) {
+            t = best;
+        }
+        return found;
+    }
+
+    // Ray or sphere sweep against a single node's collision shape
+    bool ShapeCast(SceneNode& node, const glm::vec3& o, const glm::vec3& d, float radius, float max_t, float& t, glm::vec3& normal) {
+        Collider* col = node.GetCollider();
+        if (auto mesh = dynamic_cast<MeshCollider*>(col)) {
+            if (radius <= 0.0f) {
+                MeshBVH::RayHit hit;
+                if (!mesh->Raycast(o, d, max_t, hit)) {
+                    return false;
+                }
+                t = hit.t;
+                normal = glm::dot(hit.normal, d) > 0.0f ? -hit.normal : hit.normal;
+                return true;
+            }
+            // no closed form for sphere vs triangle soup, step along inside the
+            // inflated bounds with half radius steps then bisect the first contact
+            glm::vec3 lo, hi;
+            mesh->GetWorldBounds(lo, hi);
+            lo -= glm::vec3(radius);
+            hi += glm::vec3(radius);
+            glm::vec3 inv = 1.0f / d;
+            glm::vec3 ta = (lo - o) * inv, tb = (hi - o) * inv;
+            glm::vec3 tmin = glm::min(ta, tb), tmax = glm::max(ta, tb);
+            float t0 = glm::max(glm::max(tmin.x, tmin.y), glm::max(tmin.z, 0.0f));
+            float t1 = glm::min(glm::min(tmax.x, tmax.y), glm::min(tmax.z, max_t));
+            if (t0 > t1) {
+                return false;
+            }
+            float step = glm::max(radius * 0.5f, 0.01f);
+            float prev = t0;
+            glm::vec3 contact;
+            for (float s = t0; ; s = glm::min(s + step, t1)) {
+                if (mesh->SphereTest(o + d * s, radius, &contact)) {
+                    float a = prev, b = s;
+                    for (int i = 0; i < 8 && s > t0; i++) {
+                        float m = (a + b) * 0.5f;
+                        if (mesh->SphereTest(o + d * m, radius, &contact)) {
+                            b = m;
+                        } else {
+                            a = m;
+                        }
+                    }
+                    t = b;
+                    glm::vec3 n = o + d * b - contact;
+                    normal = glm::length(n) > 0.0f ? glm::normalize(n) : -d;
+                    return true;
+                }
+                if (s >= t1) {
+                    return false;
+                }
+                prev = s;
+            }
+        }
+
+        if (auto cyl = dynamic_cast<CylinderCollider*>(col)) {
+            glm::vec3 base = node.transform.GetPosition() - glm::vec3(0.0f, radius, 0.0f);
+            return RayCylinder(o, d, base, cyl->GetHeight() + 2.0f * radius, cyl->GetRadius() + radius, max_t, t, normal);
+        }
+        if (dynamic_cast<ScalingCylinderCollider*>(col)) {
+            glm::vec3 scale = node.transform.GetScale();
+            glm::vec3 base = node.transform.GetPosition() - glm::vec3(0.0f, radius, 0.0f);
+            return RayCylinder(o, d, base, scale.y + 2.0f * radius, scale.x * 0.5f + radius, max_t, t, normal);
+        }
+
+        glm::vec3 center = node.transform.GetPosition();
+        float r = node.GetCollision().GetSphereRadius();
+        if (auto sphere = dynamic_cast<SphereCollider*>(col)) {
+            r = sphere->GetRadius();
+        }
+        if (!RaySphere(o, d, center, r + radius, max_t, t)) {
+            return false;
+        }
+        glm::vec3 n = o + d * t - center;
+        normal = glm::length(n) > 0.0f ? glm::normalize(n) : -d;
+        return true;
+    }
+
+    bool ShapeOverlap(SceneNode& node, const glm::vec3& c, float radius, glm::vec3& point) {
+        Collider* col = node.GetCollider();
+        if (auto mesh = dynamic_cast<MeshCollider*>(col)) {
+            return mesh->SphereTest(c, radius, &point);
+        }
+        if (dynamic_cast<CylinderCollider*>(col) || dynamic_cast<ScalingCylinderCollider*>(col)) {
+            float height, r;
+            if (auto cyl = dynamic_cast<CylinderCollider*>(col)) {
+                height = cyl->GetHeight();
+                r = cyl->GetRadius();
+            } else {
+                height = node.transform.GetScale().y;
+                r = node.transform.GetScale().x * 0.5f;
+            }
+            glm::vec3 base = node.transform.GetPosition();
+            glm::vec2 off = {c.x - base.x, c.z - base.z};
+            if (glm::length(off) > r) {
+                off = glm::normalize(off) * r;
+            }
+            point = {base.x + off.x, glm::clamp(c.y, base.y, base.y + height), base.z + off.y};
+            return glm::distance(point, c) <= radius;
+        }
+        glm::vec3 center = node.transform.GetPosition();
+        float r = node.GetCollision().GetSphereRadius();
+        if (auto sphere = dynamic_cast<SphereCollider*>(col)) {
+            r = sphere->GetRadius();
+        }
+        float dist = glm::distance(center, c);
+        if (dist >= r + radius) {
+            return false;
+        }
+        point = dist > 0.0f ? center + (c - center) * (r / dist) : center;
+        return true;
+    }
+}
+
+const SpatialHash* CollisionManager::FindInstanceHash(const std::shared_ptr<SceneNode>& node) const {
+    auto it = instance_hashes.find(node);
+    if (it == instance_hashes.end() || it->second.Size() != node->GetInstances().size()) {
+        return nullptr;
+    }
+    return &it->second;
+}
+
+void CollisionManager::PrepareQueries() {
+    for (const auto& asteroid : asteroids) {
+        GetInstanceHash(asteroid);
+    }
+    for (const auto& n : blockingCollision) {
+        if (!n->GetInstances().empty()) {
+            GetInstanceHash(n, n->GetCollision().GetSphereRadius());
+        }
+    }
+}
+
+int CollisionManager::QueryClass(const SceneNode& node) const {
+    switch (node.GetNodeType()) {
+        case TITEM:
+        case TBEACON:
+            return QUERY_ITEMS;
+        case TTRIGGER:
+            return QUERY_TRIGGERS;
+        default:
+            break;
+    }
+    // vision spheres and the like have nothing to draw
+    return node.GetMeshID().empty() ? QUERY_TRIGGERS : QUERY_STATIC;
+}
+
+template <typename F>
+void CollisionManager::ForEachQueryNode(int filter, F fn) const {
+    auto visit = [&](const std::shared_ptr<SceneNode>& n) {
+        if (n && !n->deleted && (QueryClass(*n) & filter)) {
+            fn(*n);
+        }
+    };
+    for (const auto& n : othercollideables) visit(n);
+    for (const auto& n : items) visit(n);
+    for (const auto& n : beacons) visit(n);
+    for (const auto& n : triggers) visit(n);
+    for (const auto& n : blockingCollision) {
+        if (n->GetInstances().empty()) visit(n);
+    }
+}
+
+template <typename F>
+void CollisionManager::ForEachQuerySet(int filter, F fn) const {
+    if (!(filter & QUERY_INSTANCES)) {
+        return;
+    }
+    // same offsets CheckCollisions uses
+    for (const auto& a : asteroids) {
+        if (const SpatialHash* h = FindInstanceHash(a)) {
+            fn(*a, *h, a->transform.GetPosition());
+        }
+    }
+    for (const auto& n : blockingCollision) {
+        if (const SpatialHash* h = FindInstanceHash(n)) {
+            fn(*n, *h, glm::vec3(0.0f));
+        }
+    }
+}
+
+bool CollisionManager::Raycast(const Ray& ray, float radius, QueryHit& hit, int filter) const {
+    glm::vec3 o = ray.origin;
+    glm::vec3 d = glm::normalize(ray.direction);
+    float best = ray.max_distance;
+    bool found = false;
+
+    std::vector<unsigned int> candidates;
+    ForEachQuerySet(filter, [&](SceneNode& node, const SpatialHash& hash, const glm::vec3& offset) {
+        candidates.clear();
+        hash.QuerySegment(o - offset, d, best, radius, candidates);
+        for (unsigned int i : candidates) {
+            glm::vec3 c = offset + hash.GetPosition(i);
+            float t;
+            if (RaySphere(o, d, c, hash.GetRadius(i) + radius, best, t) && t < best) {
+                best = t;
+                found = true;
+                hit.node = &node;
+                hit.instance = static_cast<int>(i);
+                glm::vec3 n = o + d * t - c;
+                hit.normal = glm::length(n) > 0.0f ? glm::normalize(n) : -d;
+            }
+        }
+    });
+
+    ForEachQueryNode(filter, [&](SceneNode& node) {
+        float t;
+        glm::vec3 n;
+        if (ShapeCast(node, o, d, radius, best, t, n) && t < best) {
+            best = t;
+            found = true;
+            hit.node = &node;
+            hit.instance = -1;
+            hit.normal = n;
+        }
+    });
+
+    if (found) {
+        hit.distance = best;
+        // for sweeps this is the contact, not where the sphere's centre stopped
+        hit.point = o + d * best - hit.normal * radius;
+    }
+    return found;
+}
+
+void CollisionManager::Overlap(const glm::vec3& center, float radius, std::vector<QueryHit>& out, int filter) const {
+    size_t first = out.size();
+    std::vector<unsigned int> candidates;
+    ForEachQuerySet(filter, [&](SceneNode& node, const SpatialHash& hash, const glm::vec3& offset) {
+        candidates.clear();
+        hash.Query(center - offset, radius, candidates);
+        for (unsigned int i : candidates) {
+            glm::vec3 c = offset + hash.GetPosition(i);
+            float r = hash.GetRadius(i);
+            float dist = glm::distance(c, center);
+            if (dist < r + radius) {
+                QueryHit h;
+                h.node = &node;
+                h.instance = static_cast<int>(i);
+                h.normal = dist > 0.0f ? (center - c) / dist : glm::vec3(0.0f, 1.0f, 0.0f);
+                h.point = c + h.normal * r;
+                out.push_back(h);
+            }
+        }
+    });
+
+    ForEachQueryNode(filter, [&](SceneNode& node) {
+        glm::vec3 p;
+        if (ShapeOverlap(node, center, radius, p)) {
+            QueryHit h;
+            h.node = &node;
+            h.point = p;
+            glm::vec3 n = center - p;
+            h.normal = glm::length(n) > 0.0f ? glm::normalize(n) : glm::vec3(0.0f, 1.0f, 0.0f);
+            out.push_back(h);
+        }
+    });
+
+    std::stable_sort(out.begin() + first, out.end(), [&center](const QueryHit& a, const QueryHit& b) {
+        return glm::distance(a.point, center) < glm::distance(b.point, center);
+    });
+}
@@ -15,6 +15,7 @@
 #include <glm/ext/quaternion_trigonometric.hpp>
 #include <glm/fwd.hpp>
 #include <glm/gtx/transform.hpp>
+#include <glm/gtc/noise.hpp>
 #include <iostream>
 #include <time.h>
 #include <sstream>
@@ -30,6 +31,8 @@
 #include "thrust.h"
 #include "text.h"
 #include "terrain.h"
+#include "streaming_terrain.h"
+#include "ground_cover.h"
 #include "menu_controller.h"
 #include "colliders/colliders.h"
 #include "rocket.h"
@@ -121,6 +124,8 @@ void Game::LoadMeshes() {
     resman.CreateCone("M_Rocket", 1.0, 0.5, 4, 4);
 
     resman.CreateSaplingQuad("M_Sapling");
+    resman.CreateGrassTuft("M_GrassTuft", 7, 1.6f, 0.12f);
+    resman.CreateSphere   ("M_Pebble", 1.0, 7, 5);
     //resman.CreateCone2       ("M_MoonObject", 10, 3, 4, 4);
     resman.CreateSphere   ("M_Beacon", 1.0, 20, 10);
 
@@ -136,24 +141,18 @@ void Game::LoadShaders() {
     resman.LoadShader("S_Text", SHADER_DIRECTORY"/text_vp.glsl", SHADER_DIRECTORY"/text_fp.glsl");
     resman.LoadShader("S_Planet", SHADER_DIRECTORY"/ship_vp.glsl", SHADER_DIRECTORY"/textured_fp.glsl");
     resman.LoadShader("S_NormalMap", SHADER_DIRECTORY"/normal_map_vp.glsl", SHADER_DIRECTORY"/normal_map_fp.glsl");
-    resman.LoadShader("S_NormalMapNoShadow", SHADER_DIRECTORY"/normal_map_vp.glsl", SHADER_DIRECTORY"/normal_map_noshadows_fp.glsl");
-    resman.LoadShader("S_Instanced", SHADER_DIRECTORY"/instanced_normal_map_vp.glsl", SHADER_DIRECTORY"/normal_map_noshadows_fp.glsl", "", true);
+    resman.LoadShader("S_Terrain", SHADER_DIRECTORY"/terrain_vp.glsl", SHADER_DIRECTORY"/normal_map_fp.glsl");
     resman.LoadShader("S_Lava", SHADER_DIRECTORY"/lit_vp.glsl", SHADER_DIRECTORY"/lit_lava_fp.glsl");
+    resman.LoadShader("S_GroundCover", SHADER_DIRECTORY"/ground_cover_vp.glsl", SHADER_DIRECTORY"/lit_fp.glsl");
     resman.LoadShader("S_Sun", SHADER_DIRECTORY"/lit_vp.glsl", SHADER_DIRECTORY"/sun_fp.glsl");
     resman.LoadShader("S_Skybox", SHADER_DIRECTORY"/skybox_vp.glsl", SHADER_DIRECTORY"/skybox_fp.glsl");
     resman.LoadShader("S_Texture", SHADER_DIRECTORY"/passthrough_vp.glsl", SHADER_DIRECTORY"/passthrough_fp.glsl");
 
     resman.LoadShader("S_Heatstroke", SHADER_DIRECTORY"/passthrough_vp.glsl", SHADER_DIRECTORY"/desert_heat_vision_fp.glsl");
-    //big bodge but needed
-    Shader* s = resman.GetShader("S_Heatstroke");
-    s->Use();
-    s->SetUniform1f(0.0f, "lastInShade");
-
     resman.LoadShader("S_TextureWithTransform", SHADER_DIRECTORY"/passthrough_with_transform_vp.glsl", SHADER_DIRECTORY"/passthrough_fp.glsl");
     resman.LoadShader("S_ShowDepth", SHADER_DIRECTORY"/passthrough_vp.glsl", SHADER_DIRECTORY"/show_depth_fp.glsl");
     resman.LoadShader("S_Depth", SHADER_DIRECTORY"/depth_vp.glsl", SHADER_DIRECTORY"/depth_fp.glsl");
-    resman.LoadShader("S_InstancedDepth", SHADER_DIRECTORY"/depth_instanced_vp.glsl", SHADER_DIRECTORY"/depth_fp.glsl", "", true);
-    resman.LoadShader("S_InstancedShadow", SHADER_DIRECTORY"/instanced_normal_map_vp.glsl", SHADER_DIRECTORY"/normal_map_fp.glsl", "", true);
+    resman.LoadShader("S_TerrainDepth", SHADER_DIRECTORY"/terrain_depth_vp.glsl", SHADER_DIRECTORY"/depth_fp.glsl");
     resman.LoadShader("S_Thrust", SHADER_DIRECTORY"/thrust_vp.glsl", SHADER_DIRECTORY"/thrust_fp.glsl", SHADER_DIRECTORY"/thrust_gp.glsl");
     resman.LoadShader("S_MoonSnow", SHADER_DIRECTORY"/snow_vp.glsl", SHADER_DIRECTORY"/snow_fp.glsl", SHADER_DIRECTORY"/snow_gp.glsl");
     resman.LoadShader("S_MoonSpiral", SHADER_DIRECTORY"/spiral_vp.glsl", SHADER_DIRECTORY"/spiral_fp.glsl", SHADER_DIRECTORY"/spiral_gp.glsl");
@@ -162,13 +161,20 @@ void Game::LoadShaders() {
     resman.LoadShader("S_Violence", SHADER_DIRECTORY"/red_vision_vp.glsl", SHADER_DIRECTORY"/red_vision_fp.glsl");
     resman.LoadShader("S_SSDither", SHADER_DIRECTORY"/passthrough_vp.glsl", SHADER_DIRECTORY"/dither_fp.glsl");
 
+    //big bodge but needed
+    // Use waits for the program, so only after everything else is submitted
+    Shader* s = resman.GetShader("S_Heatstroke");
+    s->Use();
+    s->SetUniform1f(0.0f, "lastInShade");
+
     resman.SetScreenSpaceShader("S_Texture");
 }
 
 void Game::LoadTextures() {
     std::cout << "loading textures..." << std::endl;
     // load textures
-    resman.LoadTexture("T_Charmap", TEXTURE_DIRECTORY"/fixedsys_alpha.png", GL_CLAMP_TO_EDGE);
+    // glyph edges don't survive block compression
+    resman.LoadTexture("T_Charmap", TEXTURE_DIRECTORY"/fixedsys_alpha.png", GL_CLAMP_TO_EDGE, GL_NEAREST, false);
     resman.LoadTexture("T_LavaPlanet", TEXTURE_DIRECTORY"/lava_planet.png", GL_REPEAT, GL_NEAREST);
     resman.LoadTexture("T_Ship", TEXTURE_DIRECTORY"/dnafighter-combo.png", GL_REPEAT);
     resman.LoadTexture("T_H2", TEXTURE_DIRECTORY"/shiptex.png", GL_REPEAT);
@@ -288,34 +294,40 @@ void Game::SetupSpaceScene() {
     auto stars = std::make_shared<SceneNode>("Obj_Starcloud", "M_StarCloud", "S_Default", "");
     // scn->AddNode(stars);
 
-    auto planet = std::make_shared<SceneNode>("Obj_Planet", "M_Planet", "S_NormalMapNoShadow", "T_ForestPlanet");
+    auto planet = std::make_shared<SceneNode>("Obj_Planet", "M_Planet", "S_NormalMap", "T_ForestPlanet");
     planet->transform.SetPosition({0.0, 0.0, -2000.0});
     planet->transform.SetScale({800, 800, 800});
     planet->transform.SetOrientation(glm::angleAxis(PI/1.5f, glm::vec3(1.0, 0.0, 0.0)));
     planet->SetNormalMap("T_RockNormalMap", 4.0f);
     planet->material.specular_coefficient = 0.0f;
+    planet->material.receive_shadows = false;
+    planet->material.alpha_test = false;
     SphereCollider* col = new SphereCollider(*planet, 800);
     col->SetCallback([this]() { this->ShipHitPlanet({0.0f,0.0f,0.0f}); });
     planet->SetCollider(col);
     AddColliderToScene(SPACE, planet);
 
-    auto planet2 = std::make_shared<SceneNode>("Obj_Planet", "M_Planet", "S_NormalMapNoShadow", "T_DesertPlanet");
+    auto planet2 = std::make_shared<SceneNode>("Obj_Planet", "M_Planet", "S_NormalMap", "T_DesertPlanet");
     planet2->transform.SetPosition({-3500, 3000, -6000.0});
     planet2->transform.SetScale({1100, 1100, 1100});
     planet2->transform.SetOrientation(glm::angleAxis(PI/-1.5f, glm::vec3(1.0, 0.0, 0.0)));
     planet2->SetNormalMap("T_RockNormalMap", 4.0f);
     planet2->material.specular_coefficient = 0.0f;
+    planet2->material.receive_shadows = false;
+    planet2->material.alpha_test = false;
     SphereCollider* p2col = new SphereCollider(*planet2, 1100);
     p2col->SetCallback([this]() { this->ShipHitPlanet({-3000, 3000, -3500.0}); });
     planet2->SetCollider(p2col);
     AddColliderToScene(SPACE, planet2);
 
-    auto planet3 = std::make_shared<SceneNode>("Obj_Planet", "M_Planet", "S_NormalMapNoShadow", "T_MoonPlanet");
+    auto planet3 = std::make_shared<SceneNode>("Obj_Planet", "M_Planet", "S_NormalMap", "T_MoonPlanet");
     planet3->transform.SetPosition({-5500, 5000, -15000.0});
     planet3->transform.SetScale({500, 500, 500});
     planet3->transform.SetOrientation(glm::angleAxis(PI/1.8f, glm::normalize(glm::vec3(0.9, 0.2, 0.0))));
     planet3->SetNormalMap("T_RockNormalMap", 4.0f);
     planet3->material.specular_coefficient = 0.0f;
+    planet3->material.receive_shadows = false;
+    planet3->material.alpha_test = false;
     SphereCollider* p3col = new SphereCollider(*planet3, 500);
     p3col->SetCallback([this]() { this->ShipHitPlanet({-5500, 4000, -14000.0}); });
     planet3->SetCollider(p3col);
@@ -346,10 +358,12 @@ void Game::SetupSpaceScene() {
     skybox->transform.SetScale({2000, 2000, 2000});
     scenes[SPACE]->SetSkybox(skybox);
 
-    auto astr = std::make_shared<SceneNode>("Obj_Forest", "M_Asteroid", "S_Instanced", "T_LavaPlanet");
+    auto astr = std::make_shared<SceneNode>("Obj_Forest", "M_Asteroid", "S_NormalMap", "T_LavaPlanet");
     astr->SetNodeType(NodeType::TASTEROID);
     astr->material.specular_power = 3000.0f;
     astr->material.specular_coefficient = 0.0f;
+    astr->material.receive_shadows = false;
+    astr->material.alpha_test = false;
     astr->SetNormalMap("T_RockNormalMap", 4.0f);
 
     for(int i = 0; i < 3; i++) {
@@ -436,23 +450,11 @@ void Game::SetupSpaceScene() {
 }
 
 
-const std::vector<std::vector<float>> Game::readTerrain(const std::string& filePath) {
-    int width, height, channels;
-    unsigned char* image = stbi_load(filePath.c_str(), &width, &height, &channels, STBI_grey);
-
-    if (!image) {
-        std::cout << "Error: Unable to read terrain" << filePath << std::endl;
-        return {};
-    }
-
-    std::vector<std::vector<float>> floatImage(height, std::vector<float>(width));
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            floatImage[i][j] = (image[i * width + j]) / 255.0f;
-        }
-    }
-    stbi_image_free(image);
-    return floatImage;
+Heightmap Game::readTerrain(const std::string& filePath) {
+    // 16 bit pngs and .r16/.r32 raws keep their precision, raws are mapped straight from disk
+    Heightmap heightmap;
+    heightmap.Load(filePath);
+    return heightmap;
 }
 
 void Game::SetupFPScene(void) {
@@ -485,22 +487,22 @@ void Game::SetupFPScene(void) {
     skybox->transform.SetScale({2000, 2000, 2000});
     scenes[FPTEST]->SetSkybox(skybox);
 
-    const std::vector<std::vector <float>>& gangAintNunOfThatSquad = readTerrain(RESOURCES_DIRECTORY"/terrain/moon.png");
+    Heightmap gangAintNunOfThatSquad = readTerrain(RESOURCES_DIRECTORY"/terrain/moon.png");
     int terrain_size = 1500;
-    auto t = std::make_shared<Terrain>("Obj_MoonTerrain", "M_MoonTerrain", "S_NormalMap", "T_MoonPlanet", TerrainType::MOON, gangAintNunOfThatSquad, terrain_size, terrain_size, 0.2, this);
+    auto t = std::make_shared<Terrain>("Obj_MoonTerrain", "M_MoonTerrain", "S_Terrain", "T_MoonPlanet", TerrainType::MOON, gangAintNunOfThatSquad.View(), terrain_size, terrain_size, 0.2, this);
     t->transform.Translate({-terrain_size / 2.0, -30.0, -terrain_size / 2.0});
     t->SetNormalMap("T_RockNormalMap", 40.0f);
     AddToScene(FPTEST, t);
     p->SetTerrain(t);
 
-    auto lt = std::make_shared<Terrain>("Obj_MoonLava", "M_MoonLava", "S_Lava", "T_MoonPlanet", TerrainType::LAVA, std::vector<std::vector<float>>{}, 400, 400, 0.1, this);
+    auto lt = std::make_shared<Terrain>("Obj_MoonLava", "M_MoonLava", "S_Lava", "T_MoonPlanet", TerrainType::LAVA, HeightmapView(), 400, 400, 0.1, this, false);
     lt->transform.Translate({-200.0f, -65.0f, -200.0f});
     lt->material.texture_repetition = 6.0f;
     lt->material.diffuse_strength = 1.5f;
     lt->SetNodeType(TLAVA);
     AddColliderToScene(FPTEST, lt);
 
-    auto moonobj = std::make_shared<SceneNode>("Obj_MoonObject", "M_MoonObject", "S_InstancedShadow", "T_MoonObj1");
+    auto moonobj = std::make_shared<SceneNode>("Obj_MoonObject", "M_MoonObject", "S_NormalMap", "T_MoonObj1");
     moonobj->SetNormalMap("T_WallNormalMap", 0.005f);
     moonobj->material.specular_power = 0.0f;
     for(int i = 0; i < 500; i++) {
@@ -523,7 +525,7 @@ void Game::SetupFPScene(void) {
     }
     scenes[FPTEST]->AddNode(moonobj);
 
-    auto moonobj2 = std::make_shared<SceneNode>("Obj_MoonObject", "M_MoonObject", "S_InstancedShadow", "T_MoonObj2");
+    auto moonobj2 = std::make_shared<SceneNode>("Obj_MoonObject", "M_MoonObject", "S_NormalMap", "T_MoonObj2");
     moonobj2->SetNormalMap("T_WallNormalMap", 0.005f);
     moonobj2->material.specular_power = 0.0f;
     for(int i = 0; i < 500; i++) {
@@ -546,15 +548,21 @@ void Game::SetupFPScene(void) {
     }
     scenes[FPTEST]->AddNode(moonobj2);
 
-    auto tree = std::make_shared<SceneNode>("Obj_MoonTree", "M_MoonTree", "S_InstancedShadow", "T_MoonTree");
+    auto tree = std::make_shared<SceneNode>("Obj_MoonTree", "M_MoonTree", "S_NormalMap", "T_MoonTree");
     tree->SetNormalMap("T_WallNormalMap", 1.0f);
     tree->material.specular_power = 150.0;
     std::vector<glm::vec3> tree_points = rng.generateUniqueRandomPoints(100, 10.0f, 750.0f);
+    std::vector<glm::vec2> tree_xz;
+    for (const glm::vec3& point : tree_points) {
+        tree_xz.push_back({point.x, point.z});
+    }
+    std::vector<float> tree_heights(tree_xz.size());
+    t->SampleHeights(tree_xz.data(), tree_heights.data(), tree_xz.size());
     for(int i = 0; i < tree_points.size(); i++) {
         bool instanced = true;
         float x = tree_points[i].x;
         float z = tree_points[i].z;
-        float y = t->SampleHeight(x, z);
+        float y = tree_heights[i];
         float s = rng.randfloat(2, 5);
         float r = rng.randfloat(0, 2*PI);
         if(instanced) {
@@ -567,20 +575,33 @@ void Game::SetupFPScene(void) {
     }
     scenes[FPTEST]->AddNode(tree);
 
-    auto mooneyes = std::make_shared<SceneNode>("Obj_MoonEyes", "M_MoonObject", "S_InstancedShadow", "T_MoonEyes");
+    auto mooneyes = std::make_shared<SceneNode>("Obj_MoonEyes", "M_MoonObject", "S_NormalMap", "T_MoonEyes");
     mooneyes->material.specular_power = 0.0;
     mooneyes->material.texture_repetition = 3.0f;
     mooneyes->material.ambient_additive = 0.2f;
     mooneyes->SetNormalMap("T_WallNormalMap", 0.005f);
     //mooneyes->material.diffuse_strength = 10.0f;
-    for(int i = 0; i < 350; i++) {
+    // draw everything first, in the same order as before, so the heights can go in one batch
+    const int num_eyes = 350;
+    std::vector<glm::vec2> eye_xz(num_eyes);
+    std::vector<glm::vec3> eye_params(num_eyes);
+    for(int i = 0; i < num_eyes; i++) {
+        eye_xz[i].x = rng.randfloat(-750, 750);
+        eye_xz[i].y = rng.randfloat(-750, 750);
+        eye_params[i].x = rng.randfloat(2, 6);
+        eye_params[i].y = rng.randfloat(0, 2*PI);
+        eye_params[i].z = rng.randfloat(-0.3f, 0.3f);
+    }
+    std::vector<float> eye_heights(num_eyes);
+    t->SampleHeights(eye_xz.data(), eye_heights.data(), num_eyes);
+    for(int i = 0; i < num_eyes; i++) {
         bool instanced = true;
-        float x = rng.randfloat(-750, 750);
-        float z = rng.randfloat(-750, 750);
-        float y = t->SampleHeight(x, z);
-        float s = rng.randfloat(2, 6);
-        float r1 = rng.randfloat(0, 2*PI);
-        float r2 = rng.randfloat(-0.3f, 0.3f);
+        float x = eye_xz[i].x;
+        float z = eye_xz[i].y;
+        float y = eye_heights[i];
+        float s = eye_params[i].x;
+        float r1 = eye_params[i].y;
+        float r2 = eye_params[i].z;
         if(instanced) {
             Transform tra;
             tra.SetPosition({x, y + s, z});
@@ -592,15 +613,21 @@ void Game::SetupFPScene(void) {
     }
     scenes[FPTEST]->AddNode(mooneyes);
 
-    auto tower = std::make_shared<SceneNode>("Obj_SpaceTower", "M_SELTower", "S_InstancedShadow", "T_SpaceMetal");
+    auto tower = std::make_shared<SceneNode>("Obj_SpaceTower", "M_SELTower", "S_NormalMap", "T_SpaceMetal");
     tower->SetNormalMap("T_MetalNormalMap", 1.0f);
     tower->material.specular_power = 15000.0;
     std::vector<glm::vec3> points = rng.generateUniqueRandomPoints(12, 200.0f, 700.0f);
+    std::vector<glm::vec2> tower_xz;
+    for (const glm::vec3& point : points) {
+        tower_xz.push_back({point.x, point.z});
+    }
+    std::vector<float> tower_heights(tower_xz.size());
+    t->SampleHeights(tower_xz.data(), tower_heights.data(), tower_xz.size());
     for (int i = 0; i < points.size(); ++i) {
         bool instanced = true;
         float x = points[i].x;
         float z = points[i].z;
-        float y = t->SampleHeight(x, z);
+        float y = tower_heights[i];
         float s = rng.randfloat(15, 16);
         float r = rng.randfloat(0, 2*PI);
         if(instanced) {
@@ -648,7 +675,7 @@ void Game::SetupFPScene(void) {
     ship->transform.SetOrientation({0.4, 0.0, 0.0, 0.0});
     ship->transform.SetScale({11.0, 11.0, 9.5});
     ship->material.specular_power = 169.0f;
-    SphereCollider* col = new SphereCollider(*ship, 9.0f);
+    MeshCollider* col = new MeshCollider(*ship, resman.GetMeshBVH("M_Ship"));
     col->SetCallback([this]() { PlayerHitShip({-5500, 5550, -15000.0}); });
     ship->SetCollider(col);
     AddColliderToScene(FPTEST, ship);
@@ -659,10 +686,14 @@ void Game::SetupFPScene(void) {
     comp->transform.SetOrientation({0.4, 0.3, 0.0, 0.0});
     comp->transform.SetScale({300.0, 300.0, 300.0});
     comp->material.specular_power = 169.0f;
-    //SphereCollider* col = new SphereCollider(*comp, 9.0f);
-    //col->SetCallback([this]() { PlayerHitShip({-5500, 5550, -15000.0}); });
-    //comp->SetCollider(col);
-    scenes[FPTEST]->AddNode(comp);
+    MeshCollider* comp_col = new MeshCollider(*comp, resman.GetMeshBVH("M_Comp"));
+    comp_col->SetCallback([](SceneNode& other) {
+        if (auto player = dynamic_cast<Player*>(&other)) {
+            player->ResetPosition();
+        }
+    });
+    comp->SetCollider(comp_col);
+    AddColliderToScene(FPTEST, comp);
 
     auto pill_tower = std::make_shared<SceneNode>("Obj_PillTower", "M_SELTower", "S_NormalMap", "T_SpaceMetal");
     pill_tower->SetNormalMap("T_MetalNormalMap", 1.0f);
@@ -746,15 +777,15 @@ void Game::SetupForestScene() {
     ship->transform.SetOrientation({0.334468, 0.000000, 0.942407, 0.000000});
     ship->transform.SetScale({11.0, 11.0, 9.5});
     ship->material.specular_power = 169.0f;
-    SphereCollider* col = new SphereCollider(*ship, 9.0f);
+    MeshCollider* col = new MeshCollider(*ship, resman.GetMeshBVH("M_Ship"));
     col->SetCallback([this]() { PlayerHitShip({0.0f, 850.0f, -2100.0f}); });
     ship->SetCollider(col);
     AddColliderToScene(FOREST, ship);
     
-    const std::vector<std::vector <float>> gangAintNunOfThatSquad = readTerrain(RESOURCES_DIRECTORY"/terrain/mountain_hm_n.png");
+    Heightmap gangAintNunOfThatSquad = readTerrain(RESOURCES_DIRECTORY"/terrain/mountain_hm_n.png");
     // ENV
     int terrain_size = 1000;
-    auto terr = std::make_shared<Terrain>("Obj_ForestTerrain", "M_ForestTerain", "S_NormalMap", "T_Grass", TerrainType::FOREST, gangAintNunOfThatSquad, terrain_size, terrain_size, 0.2, this);
+    auto terr = std::make_shared<Terrain>("Obj_ForestTerrain", "M_ForestTerain", "S_Terrain", "T_Grass", TerrainType::FOREST, gangAintNunOfThatSquad.View(), terrain_size, terrain_size, 0.2, this);
     terr->transform.Translate({-terrain_size / 2.0, -30.0, -terrain_size / 2.0});
     terr->material.specular_power = 0.0f;
     terr->material.texture_repetition = 10.0f;
@@ -763,6 +794,15 @@ void Game::SetupForestScene() {
     p->SetTerrain(terr);
     scenes[FOREST]->AddTerrain(terr);
 
+    GroundCoverSettings grass_settings;
+    grass_settings.density = 0.6f;
+    grass_settings.draw_distance = 140.0f;
+    // clumps and clearings instead of a lawn
+    grass_settings.mask = [](float x, float z) { return glm::clamp(glm::perlin(glm::vec2(x, z) / 60.0f) * 1.5f + 0.6f, 0.0f, 1.0f); };
+    auto grass = std::make_shared<GroundCover>("Obj_ForestGrass", "M_GrassTuft", "S_GroundCover", "T_Grass", terr, grass_settings, this);
+    grass->material.specular_coefficient = 0.0f;
+    scenes[FOREST]->AddNode(grass);
+
     auto hilight = std::make_shared<Light>(Colors::Goldish);
     // light->transform.SetPosition({1000.0, 1000.0, -2000.0});
     hilight->transform.SetPosition({300.0, 600.0, 0.0});
@@ -784,16 +824,23 @@ void Game::SetupForestScene() {
 
     // TRANSPARENT
     // SceneNode* forest = new SceneNode("Obj_Forest", "M_Tree", "S_Instanced", "T_Tree");
-    auto forest = std::make_shared<SceneNode>("Obj_Forest", "M_BirchTree", "S_InstancedShadow", "T_BirchTree");
+    auto forest = std::make_shared<SceneNode>("Obj_Forest", "M_BirchTree", "S_NormalMap", "T_BirchTree");
     // forest->transform.SetScale({5, 5, 5});
     forest->SetNormalMap("T_WallNormalMap", 0.005f);
     forest->material.specular_power = 150.0;
     forest->SetCullInstances(true);
-    for(int i = 0; i < sizeof(forest_trees)/sizeof(forest_trees[0]); i++) {
+    const int num_forest_trees = sizeof(forest_trees)/sizeof(forest_trees[0]);
+    std::vector<glm::vec2> forest_xz(num_forest_trees);
+    for(int i = 0; i < num_forest_trees; i++) {
+        forest_xz[i] = {forest_trees[i][0], forest_trees[i][2]};
+    }
+    std::vector<float> forest_heights(num_forest_trees);
+    terr->SampleHeights(forest_xz.data(), forest_heights.data(), num_forest_trees);
+    for(int i = 0; i < num_forest_trees; i++) {
         bool instanced = true;
         float x = forest_trees[i][0];
         float z = forest_trees[i][2];
-        float y = terr->SampleHeight(x, z);
+        float y = forest_heights[i];
         float s = forest_trees[i][3];
         float r = forest_trees[i][4];
         if(instanced) {
@@ -920,7 +967,7 @@ void Game::SetupDesertScene() {
     ship->transform.SetOrientation({0.334468, 0.0, 0.0, 0.0});
     ship->transform.SetScale({11.0, 11.0, 9.5});
     ship->material.specular_power = 169.0f;
-    SphereCollider* col = new SphereCollider(*ship, 9.0f);
+    MeshCollider* col = new MeshCollider(*ship, resman.GetMeshBVH("M_Ship"));
     col->SetCallback([this]() { PlayerHitShip({-3500.0f, 4200.0f, -6000.0f}); });
     ship->SetCollider(col);
     AddColliderToScene(DESERT, ship);
@@ -967,15 +1014,20 @@ void Game::SetupDesertScene() {
         tower->transform.SetScale(glm::vec3(4));
         tower->transform.SetPosition(std::get<0>(towerInfo[i]));
         tower->material.specular_coefficient = 0;
-        tower->SetNodeType(NodeType::TDONTUSECOLLIDER);
-        tower->SetCollision(CollisionData(100));
+        MeshCollider* tower_col = new MeshCollider(*tower, resman.GetMeshBVH("M_Tower_" + materialType));
+        tower_col->SetCallback([](SceneNode& other) {
+            if (auto player = dynamic_cast<Player*>(&other)) {
+                player->ResetPosition();
+            }
+        });
+        tower->SetCollider(tower_col);
         AddColliderToScene(DESERT, tower);
     }
 
-    const std::vector<std::vector <float>>& gangAintNunOfThatSquad = readTerrain(RESOURCES_DIRECTORY"/terrain/dunes.jpg");
+    Heightmap gangAintNunOfThatSquad = readTerrain(RESOURCES_DIRECTORY"/terrain/dunes.jpg");
 
     int terrain_size = 10000;
-    auto terr = std::make_shared<Terrain>("Obj_DesertTerrain", "M_DesertTerain", "S_NormalMap", "T_Sand", TerrainType::DUNES, gangAintNunOfThatSquad, terrain_size, terrain_size, 0.2, this);
+    auto terr = std::make_shared<Terrain>("Obj_DesertTerrain", "M_DesertTerain", "S_Terrain", "T_Sand", TerrainType::DUNES, gangAintNunOfThatSquad.View(), terrain_size, terrain_size, 0.2, this);
     terr->transform.Translate({-terrain_size / 2.0, -30.0, -terrain_size / 2.0});
     terr->material.specular_power = 0.0f;
     terr->material.texture_repetition = 50.0f;
@@ -983,6 +1035,45 @@ void Game::SetupDesertScene() {
     p->SetTerrain(terr);
     scenes[DESERT]->AddTerrain(terr);
 
+    // dunes past the impassable border out to the far clip, the same heightmap
+    // repeated around the playable rectangle which is left as a hole
+    StreamingTerrainSettings horizon_settings;
+    horizon_settings.tile_cells = 40;
+    horizon_settings.cell_size = 25.0f;
+    horizon_settings.ring_radius = 10;
+    horizon_settings.memory_budget = 96u << 20;
+    horizon_settings.noise_height = 60.0f;
+    horizon_settings.heightmap_extent = terrain_size;
+    horizon_settings.heightmap_height = 500.0f;
+    horizon_settings.texture_extent = terrain_size / 50.0f;
+    horizon_settings.hole_max = glm::vec2(terrain_size);
+    const HeightmapView& dunes = gangAintNunOfThatSquad.View();
+    const size_t horizon_samples = 256;
+    horizon_settings.heightmap.assign(horizon_samples, std::vector<float>(horizon_samples));
+    for (size_t x = 0; x < horizon_samples; x++) {
+        for (size_t z = 0; z < horizon_samples; z++) {
+            horizon_settings.heightmap[x][z] = dunes.At(z * dunes.Rows() / horizon_samples, x * dunes.Cols() / horizon_samples);
+        }
+    }
+    auto horizon = std::make_shared<StreamingTerrain>("Obj_DesertHorizon", "S_NormalMap", "T_Sand", std::move(horizon_settings));
+    horizon->transform.SetPosition({-terrain_size / 2.0, -30.0, -terrain_size / 2.0});
+    horizon->material.specular_power = 0.0f;
+    horizon->material.receive_shadows = false;
+    horizon->material.alpha_test = false;
+    horizon->SetFocus(&p->transform);
+    scenes[DESERT]->AddNode(horizon);
+
+    GroundCoverSettings pebble_settings;
+    pebble_settings.patch_size = 64.0f;
+    pebble_settings.density = 0.02f;
+    pebble_settings.draw_distance = 250.0f;
+    pebble_settings.fade_distance = 80.0f;
+    pebble_settings.scale = {0.3f, 1.2f};
+    pebble_settings.min_normal_y = 0.9f;
+    auto pebbles = std::make_shared<GroundCover>("Obj_DesertPebbles", "M_Pebble", "S_GroundCover", "T_Stone", terr, pebble_settings, this);
+    pebbles->material.specular_coefficient = 0.0f;
+    scenes[DESERT]->AddNode(pebbles);
+
     auto light = std::make_shared<Light>(Colors::SunLight);
     light->transform.SetPosition({-100.0, 400.0, 300.0});
     light->Attach(&p->transform);
@@ -994,9 +1085,9 @@ void Game::SetupDesertScene() {
     skybox->transform.SetOrientation(glm::angleAxis(PI_2, glm::vec3(1.0, 0.0, 0.0)));
     scenes[DESERT]->SetSkybox(skybox);
 
-    auto cactus1 = std::make_shared<SceneNode>("Obj_Cactus9", "M_Cactus9", "S_InstancedShadow", "T_Cactus9");
-    auto cactus2 = std::make_shared<SceneNode>("Obj_Cactus2", "M_Cactus2", "S_InstancedShadow", "T_Cactus2");
-    auto cactus3 = std::make_shared<SceneNode>("Obj_Cactus8", "M_Cactus8", "S_InstancedShadow", "T_Cactus8");
+    auto cactus1 = std::make_shared<SceneNode>("Obj_Cactus9", "M_Cactus9", "S_NormalMap", "T_Cactus9");
+    auto cactus2 = std::make_shared<SceneNode>("Obj_Cactus2", "M_Cactus2", "S_NormalMap", "T_Cactus2");
+    auto cactus3 = std::make_shared<SceneNode>("Obj_Cactus8", "M_Cactus8", "S_NormalMap", "T_Cactus8");
 
     cactus1->SetNodeType(NodeType::TDONTUSECOLLIDER);
     cactus1->SetCollision(CollisionData(2.5));
@@ -1019,47 +1110,36 @@ void Game::SetupDesertScene() {
     float CACTUS_SPAWN_X = 5000.0;
     float CACTUS_SPAWN_Z = 5000.0;
 
-    float x, y, z, s, r;
+    // every cactus draws x, z, scale, yaw in that order, cactus2 then cactus1 then cactus3,
+    // all the draws go first so the heights come out of one batch
+    const int num_cacti = 3000;
+    std::vector<glm::vec2> cactus_xz(num_cacti);
+    std::vector<glm::vec2> cactus_sr(num_cacti);
+    for (int i = 0; i < num_cacti; i++) {
+        cactus_xz[i].x = rng.randfloat(-CACTUS_SPAWN_X, CACTUS_SPAWN_X);
+        cactus_xz[i].y = rng.randfloat(-CACTUS_SPAWN_Z, CACTUS_SPAWN_Z);
+        cactus_sr[i].x = rng.randfloat(8, 14);
+        cactus_sr[i].y = rng.randfloat(0, 2 * PI);
+    }
+    std::vector<float> cactus_heights(num_cacti);
+    terr->SampleHeights(cactus_xz.data(), cactus_heights.data(), num_cacti);
 
+    SceneNode* cactus_kinds[3] = {cactus2.get(), cactus1.get(), cactus3.get()};
     Transform cactusTransform;
 
-    for (int i = 0; i < 1000; i++) {
-        x = rng.randfloat(-CACTUS_SPAWN_X, CACTUS_SPAWN_X);
-        z = rng.randfloat(-CACTUS_SPAWN_Z, CACTUS_SPAWN_Z);
-        y = terr->SampleHeight(x, z) - 0.02;
-        s = rng.randfloat(8, 14);
-        r = rng.randfloat(0, 2 * PI);
-
-        cactusTransform.SetPosition({x, y, z});
-        cactusTransform.SetScale({s, s, s});
-        cactusTransform.SetOrientation(glm::angleAxis(r, glm::vec3(0, 1, 0)));
-
-        cactus2->AddInstance(cactusTransform);
-
-        x = rng.randfloat(-CACTUS_SPAWN_X, CACTUS_SPAWN_X);
-        z = rng.randfloat(-CACTUS_SPAWN_Z, CACTUS_SPAWN_Z);
-        y = terr->SampleHeight(x, z) - 0.02;
-        s = rng.randfloat(8, 14);
-        r = rng.randfloat(0, 2 * PI);
+    for (int i = 0; i < num_cacti; i++) {
+        float x = cactus_xz[i].x;
+        float z = cactus_xz[i].y;
+        float y = cactus_heights[i] - 0.02;
+        float s = cactus_sr[i].x;
+        float r = cactus_sr[i].y;
 
         cactusTransform.SetPosition({x, y, z});
         cactusTransform.SetScale({s, s, s});
         cactusTransform.SetOrientation(glm::angleAxis(r, glm::vec3(0, 1, 0)));
 
         //should probably use another transform but is copied on pass so this works
-        cactus1->AddInstance(cactusTransform);
-
-        x = rng.randfloat(-CACTUS_SPAWN_X, CACTUS_SPAWN_X);
-        z = rng.randfloat(-CACTUS_SPAWN_Z, CACTUS_SPAWN_Z);
-        y = terr->SampleHeight(x, z) - 0.02;
-        s = rng.randfloat(8, 14);
-        r = rng.randfloat(0, 2 * PI);
-
-        cactusTransform.SetPosition({x, y, z});
-        cactusTransform.SetScale({s, s, s});
-        cactusTransform.SetOrientation(glm::angleAxis(r, glm::vec3(0, 1, 0)));
-
-        cactus3->AddInstance(cactusTransform);
+        cactus_kinds[i % 3]->AddInstance(cactusTransform);
     }
     AddColliderToScene(DESERT, cactus1);
     AddColliderToScene(DESERT, cactus2);
@@ -1114,7 +1194,7 @@ void Game::SetupMainMenuScene() {
 
     float radius = 600.0f;
     // glm::vec3 base_pos = {radius*i, 0.0, 0.0};
-    auto astr = std::make_shared<SceneNode>("Obj_Forest", "M_Asteroid", "S_InstancedShadow", "T_LavaPlanet");
+    auto astr = std::make_shared<SceneNode>("Obj_Forest", "M_Asteroid", "S_NormalMap", "T_LavaPlanet");
     astr->SetNormalMap("T_WallNormalMap", 4.0f);
     astr->material.texture_repetition = 5.0f;
     for (int i = 0; i < 512; i++) {
@@ -1333,6 +1413,12 @@ void Game::CheckControls(KeyMap& keys, float dt) {
         keys[GLFW_KEY_RIGHT_BRACKET] = false;
     }
 
+    // texture memory report
+    if(keys[GLFW_KEY_LEFT_BRACKET]) {
+        resman.PrintTextureReport();
+        keys[GLFW_KEY_LEFT_BRACKET] = false;
+    }
+
     if(keys[GLFW_KEY_LEFT_SHIFT]) {
         player->Control(Player::Controls::SHIFT, dt);
     };
@@ -0,0 +1,245 @@
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <random>
+#include <glm/gtc/constants.hpp>
+
+#include "ground_cover.h"
+#include "terrain.h"
+#include "game.h"
+#include "frustum.h"
+#include "thread_pool.h"
+
+GroundCover::GroundCover(const std::string name, const std::string& mesh_id, const std::string& shader_id, const std::string& texture_id,
+                         std::shared_ptr<Terrain> terrain, GroundCoverSettings s, Game* game)
+    : SceneNode(name, mesh_id, shader_id, texture_id),
+      shared_settings(std::make_shared<const GroundCoverSettings>(std::move(s))),
+      settings(*shared_settings),
+      terrain(terrain),
+      mailbox(std::make_shared<Mailbox>()),
+      game(game) {
+
+    // same extent SampleHeight covers, centered on zero
+    glm::vec2 size = glm::vec2(terrain->GetWidth(), terrain->GetDepth());
+    extent_lo = -size / 2.0f;
+    dims = glm::max(glm::ivec2(glm::ceil(size / settings.patch_size)), glm::ivec2(1));
+    patches.resize(dims.x * dims.y);
+}
+
+GroundCover::~GroundCover() {
+    // workers still running drop their patch on the floor
+    mailbox->cancelled = true;
+    for (Patch& p : patches) {
+        Release(p);
+    }
+}
+
+glm::vec2 GroundCover::PatchOrigin(int i, int j) const {
+    return extent_lo + glm::vec2(i, j) * settings.patch_size;
+}
+
+void GroundCover::Invalidate() {
+    for (Patch& p : patches) {
+        Release(p);
+    }
+    generation++;
+}
+
+void GroundCover::Release(Patch& p) {
+    if (p.state == PatchState::LOADED) {
+        glDeleteVertexArrays(1, &p.vao);
+        glDeleteBuffers(1, &p.vbo);
+        loaded--;
+    }
+    // a pending patch stays counted in in_flight until it comes back
+    p = Patch();
+}
+
+std::unique_ptr<GroundCover::PatchData> GroundCover::Generate(const GroundCoverSettings& s, Terrain& terrain, glm::vec2 lo, glm::vec2 hi, int index) {
+    std::unique_ptr<PatchData> data = std::make_unique<PatchData>();
+    data->index = index;
+    data->heights = glm::vec2(0.0f);
+
+    // seeded per patch so a patch comes out the same every time it's made
+    std::mt19937 rng(s.seed * 2654435761u ^ static_cast<unsigned int>(index) * 40503u);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    glm::vec2 size = hi - lo;
+    size_t count = static_cast<size_t>(s.density * size.x * size.y);
+    if (count == 0) {
+        return data;
+    }
+
+    // draw everything first so the batched sampling gets to see all of it
+    std::vector<glm::vec2> xz(count);
+    std::vector<glm::vec3> rolls(count);
+    for (size_t i = 0; i < count; i++) {
+        xz[i] = lo + glm::vec2(unit(rng), unit(rng)) * size;
+        rolls[i] = glm::vec3(unit(rng), unit(rng), unit(rng));
+    }
+    std::vector<float> heights(count);
+    std::vector<glm::vec3> normals(count);
+    terrain.SampleHeights(xz.data(), heights.data(), count);
+    terrain.SampleNormals(xz.data(), normals.data(), count);
+
+    data->instances.reserve(count);
+    data->heights = glm::vec2(std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest());
+    for (size_t i = 0; i < count; i++) {
+        if (normals[i].y < s.min_normal_y) {
+            continue;
+        }
+        if (s.mask && rolls[i].x >= s.mask(xz[i].x, xz[i].y)) {
+            continue;
+        }
+        float scale = glm::mix(s.scale.x, s.scale.y, rolls[i].y);
+        float yaw = rolls[i].z * glm::two_pi<float>();
+        data->instances.push_back({glm::vec4(xz[i].x, heights[i], xz[i].y, scale), glm::vec4(normals[i], yaw)});
+        data->heights.x = std::min(data->heights.x, heights[i]);
+        data->heights.y = std::max(data->heights.y, heights[i]);
+    }
+    return data;
+}
+
+void GroundCover::Receive(Mesh* mesh) {
+    std::vector<std::unique_ptr<PatchData>> arrived;
+    {
+        std::lock_guard<std::mutex> lock(mailbox->mutex);
+        size_t take = std::min(mailbox->done.size(), static_cast<size_t>(std::max(settings.uploads_per_frame, 1)));
+        std::move(mailbox->done.begin(), mailbox->done.begin() + take, std::back_inserter(arrived));
+        mailbox->done.erase(mailbox->done.begin(), mailbox->done.begin() + take);
+    }
+
+    for (std::unique_ptr<PatchData>& data : arrived) {
+        in_flight--;
+        Patch& p = patches[data->index];
+        // invalidated or walked away from while it was being made
+        if (data->generation != generation || p.state != PatchState::PENDING) {
+            continue;
+        }
+        p.state = PatchState::LOADED;
+        p.count = static_cast<int>(data->instances.size());
+        loaded++;
+        glm::vec2 origin = PatchOrigin(data->index % dims.x, data->index / dims.x);
+        p.lo = glm::vec3(origin.x - mesh_radius, data->heights.x - mesh_radius, origin.y - mesh_radius);
+        p.hi = glm::vec3(origin.x + settings.patch_size + mesh_radius, data->heights.y + mesh_radius, origin.y + settings.patch_size + mesh_radius);
+        if (p.count == 0) {
+            continue;
+        }
+
+        glGenVertexArrays(1, &p.vao);
+        glGenBuffers(1, &p.vbo);
+        glBindVertexArray(p.vao);
+        unsigned int first = mesh->BindAttributes();
+        // the shader expects the instance attributes at 5 and 6 whatever the mesh used
+        first = std::max(first, 5u);
+        glBindBuffer(GL_ARRAY_BUFFER, p.vbo);
+        glBufferData(GL_ARRAY_BUFFER, data->instances.size() * sizeof(Instance), data->instances.data(), GL_STATIC_DRAW);
+        glEnableVertexAttribArray(first);
+        glVertexAttribPointer(first, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)offsetof(Instance, placement));
+        glVertexAttribDivisor(first, 1);
+        glEnableVertexAttribArray(first + 1);
+        glVertexAttribPointer(first + 1, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)offsetof(Instance, ground));
+        glVertexAttribDivisor(first + 1, 1);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+}
+
+void GroundCover::Request(const glm::vec3& eye) {
+    float reach = settings.draw_distance + settings.patch_size;
+    glm::ivec2 lo = glm::ivec2(glm::floor((glm::vec2(eye.x, eye.z) - reach - extent_lo) / settings.patch_size));
+    glm::ivec2 hi = glm::ivec2(glm::floor((glm::vec2(eye.x, eye.z) + reach - extent_lo) / settings.patch_size));
+    lo = glm::clamp(lo, glm::ivec2(0), dims - 1);
+    hi = glm::clamp(hi, glm::ivec2(0), dims - 1);
+
+    auto distance = [&](int i, int j) {
+        glm::vec2 o = PatchOrigin(i, j);
+        glm::vec2 d = glm::max(glm::max(o - glm::vec2(eye.x, eye.z), glm::vec2(eye.x, eye.z) - o - settings.patch_size), glm::vec2(0.0f));
+        return glm::length(d);
+    };
+
+    // Loaded patches a patch beyond the draw distance go, so walking along
+    // the edge doesn't keep making and dropping the same ones. Patches off the
+    // box around the eye are checked too, the eye could have jumped.
+    for (int index = 0; index < static_cast<int>(patches.size()); index++) {
+        Patch& p = patches[index];
+        if (p.state == PatchState::LOADED && distance(index % dims.x, index / dims.x) > reach) {
+            Release(p);
+        }
+    }
+
+    std::vector<std::pair<float, int>> missing;
+    for (int j = lo.y; j <= hi.y; j++) {
+        for (int i = lo.x; i <= hi.x; i++) {
+            float d = distance(i, j);
+            if (patches[j * dims.x + i].state == PatchState::EMPTY && d <= settings.draw_distance) {
+                missing.push_back({d, j * dims.x + i});
+            }
+        }
+    }
+    std::sort(missing.begin(), missing.end());
+
+    for (const std::pair<float, int>& m : missing) {
+        if (in_flight >= settings.max_in_flight) {
+            break;
+        }
+        int index = m.second;
+        patches[index].state = PatchState::PENDING;
+        in_flight++;
+
+        glm::vec2 plo = PatchOrigin(index % dims.x, index / dims.x);
+        glm::vec2 phi = glm::min(plo + settings.patch_size, -extent_lo);
+        unsigned int gen = generation;
+        std::shared_ptr<const GroundCoverSettings> s = shared_settings;
+        std::shared_ptr<Terrain> t = terrain;
+        std::shared_ptr<Mailbox> box = mailbox;
+        ThreadPool::Get().Enqueue([s, t, box, plo, phi, index, gen]() {
+            if (box->cancelled) {
+                return;
+            }
+            std::unique_ptr<PatchData> data = Generate(*s, *t, plo, phi, index);
+            data->generation = gen;
+            std::lock_guard<std::mutex> lock(box->mutex);
+            box->done.push_back(std::move(data));
+        });
+    }
+}
+
+bool GroundCover::CustomDraw(Shader* shd, const glm::mat4& view_proj, const glm::vec3& eye, RenderPass pass) {
+    // too small and too many to be worth a place in the shadow map
+    if (pass == RenderPass::DEPTH) {
+        return true;
+    }
+    instances_drawn = 0;
+    Mesh* mesh = game->resman.GetMesh(mesh_id);
+    if (!mesh) {
+        return true;
+    }
+    if (mesh_radius < 0.0f) {
+        // furthest any vertex gets from the instance's origin, at the largest scale
+        mesh_radius = mesh->Radius() * settings.scale.y;
+    }
+
+    // what SetUniforms gave world_mat
+    const glm::mat4& world = transform.GetWorldMatrixNoScale();
+    glm::vec3 local_eye = glm::vec3(glm::inverse(world) * glm::vec4(eye, 1.0f));
+    Receive(mesh);
+    Request(local_eye);
+
+    shd->SetUniform3f(local_eye, "cover_eye");
+    shd->SetUniform2f(glm::vec2(settings.draw_distance - settings.fade_distance, settings.draw_distance), "cover_fade");
+
+    Frustum frustum(view_proj * world);
+    size_t index_count = mesh->indices.size();
+    mesh->SetConstantAttributes();
+    for (const Patch& p : patches) {
+        if (p.state != PatchState::LOADED || p.count == 0 || !frustum.Visible(p.lo, p.hi)) {
+            continue;
+        }
+        glBindVertexArray(p.vao);
+        glDrawElementsInstanced(GL_TRIANGLES, index_count, mesh->IndexType(), 0, p.count);
+        instances_drawn += p.count;
+    }
+    glBindVertexArray(0);
+    return true;
+}
@@ -0,0 +1,57 @@
+#include <cstring>
+
+#include "heightfield.h"
+
+void Heightfield::Resize(int w, int d) {
+    width = w < 0 ? 0 : w;
+    depth = d < 0 ? 0 : d;
+    shift = 0;
+    while ((1 << shift) < width) {
+        shift++;
+    }
+
+    size_t count = static_cast<size_t>(depth) << shift;
+    heights.assign(count, 0.0f);
+    normals.assign(count, glm::vec3(0.0f, 1.0f, 0.0f));
+    obstacle_bits.assign((count + 63) / 64, 0);
+    impassable_bits.assign((count + 63) / 64, 0);
+}
+
+size_t Heightfield::RawSize() const {
+    return heights.size() * sizeof(float)
+         + normals.size() * sizeof(glm::vec3)
+         + (obstacle_bits.size() + impassable_bits.size()) * sizeof(uint64_t);
+}
+
+void Heightfield::WriteRaw(std::vector<unsigned char>& out) const {
+    auto append = [&out](const void* p, size_t bytes) {
+        const unsigned char* b = static_cast<const unsigned char*>(p);
+        out.insert(out.end(), b, b + bytes);
+    };
+    append(heights.data(), heights.size() * sizeof(float));
+    append(normals.data(), normals.size() * sizeof(glm::vec3));
+    append(obstacle_bits.data(), obstacle_bits.size() * sizeof(uint64_t));
+    append(impassable_bits.data(), impassable_bits.size() * sizeof(uint64_t));
+}
+
+bool Heightfield::ReadRaw(int w, int d, const unsigned char* data, size_t size) {
+    Resize(w, d);
+    if (size != RawSize()) {
+        return false;
+    }
+    auto take = [&data](void* p, size_t bytes) {
+        memcpy(p, data, bytes);
+        data += bytes;
+    };
+    take(heights.data(), heights.size() * sizeof(float));
+    take(normals.data(), normals.size() * sizeof(glm::vec3));
+    take(obstacle_bits.data(), obstacle_bits.size() * sizeof(uint64_t));
+    take(impassable_bits.data(), impassable_bits.size() * sizeof(uint64_t));
+    return true;
+}
+
+size_t Heightfield::MemoryUsage() const {
+    return heights.capacity() * sizeof(float)
+         + normals.capacity() * sizeof(glm::vec3)
+         + (obstacle_bits.capacity() + impassable_bits.capacity()) * sizeof(uint64_t);
+}
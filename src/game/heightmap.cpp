@@ -0,0 +1,68 @@
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <iostream>
+
+#include "heightmap.h"
+#include "stb_image.h"
+
+namespace {
+    bool EndsWith(const std::string& s, const std::string& suffix) {
+        if (s.size() < suffix.size()) {
+            return false;
+        }
+        return std::equal(suffix.rbegin(), suffix.rend(), s.rbegin(), [](char a, char b) { return std::tolower(a) == b; });
+    }
+}
+
+bool Heightmap::Load(const std::string& path, size_t cols) {
+    view = HeightmapView();
+    file.reset();
+    pixels.reset();
+
+    if (EndsWith(path, ".r16") || EndsWith(path, ".raw16")) {
+        return LoadRaw(path, HeightmapView::Format::U16, cols);
+    }
+    if (EndsWith(path, ".r32") || EndsWith(path, ".raw32")) {
+        return LoadRaw(path, HeightmapView::Format::F32, cols);
+    }
+
+    int width, height, channels;
+    void* data;
+    HeightmapView::Format format;
+    // 8 bits is what makes the dunes look terraced once it's scaled up 500 times
+    if (stbi_is_16_bit(path.c_str())) {
+        data = stbi_load_16(path.c_str(), &width, &height, &channels, STBI_grey);
+        format = HeightmapView::Format::U16;
+    } else {
+        data = stbi_load(path.c_str(), &width, &height, &channels, STBI_grey);
+        format = HeightmapView::Format::U8;
+    }
+    if (!data) {
+        std::cout << "Error: Unable to read terrain" << path << std::endl;
+        return false;
+    }
+    pixels = std::unique_ptr<void, void(*)(void*)>(data, stbi_image_free);
+    view = HeightmapView(data, height, width, format);
+    return true;
+}
+
+bool Heightmap::LoadRaw(const std::string& path, HeightmapView::Format format, size_t cols) {
+    std::unique_ptr<MappedFile> f = std::make_unique<MappedFile>();
+    if (!f->Open(path)) {
+        std::cout << "Error: Unable to read terrain" << path << std::endl;
+        return false;
+    }
+    size_t sample = format == HeightmapView::Format::U16 ? 2 : 4;
+    size_t count = f->Size() / sample;
+    if (cols == 0) {
+        cols = static_cast<size_t>(std::sqrt(static_cast<double>(count)) + 0.5);
+    }
+    if (cols == 0 || f->Size() % sample != 0 || count % cols != 0) {
+        std::cout << "Error: raw terrain " << path << " isn't a whole number of " << cols << " sample rows" << std::endl;
+        return false;
+    }
+    view = HeightmapView(f->Data(), count / cols, cols, format);
+    file = std::move(f);
+    return true;
+}
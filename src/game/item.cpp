@@ -14,7 +14,9 @@ void Item::Update(double dt){
 
     current_time_ = fmod((current_time_ + static_cast<float>(dt)), 2.0f * glm::pi<float>());
     
-    float new_y = transform.GetPosition().y + (hover_amplitude_ * sin(hover_speed_ * current_time_ + hover_offset_));
+    float hover = hover_amplitude_ * sin(hover_speed_ * current_time_ + hover_offset_);
+    hover_height_ += hover;
+    float new_y = transform.GetPosition().y + hover;
     transform.SetPosition({transform.GetPosition().x, new_y, transform.GetPosition().z});
 
     SceneNode::Update(dt);
@@ -0,0 +1,622 @@
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+
+#include "nav_grid.h"
+#include "heightfield.h"
+#include "thread_pool.h"
+
+namespace {
+    const float INF = std::numeric_limits<float>::infinity();
+    const float DIAGONAL = 1.41421356f;
+    // open border longer than this gets a node at each end instead of one in the middle
+    const int LONG_ENTRANCE = 6;
+    const uint16_t UNREACHED = 0xFFFF;
+    const glm::ivec2 DIRS[8] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}, {1, 1}, {1, -1}, {-1, 1}, {-1, -1}};
+
+    static_assert(NAV_CLUSTER_SIZE * NAV_CLUSTER_SIZE * 1.5 * NAV_FIELD_SCALE < UNREACHED, "nav fields overflow, lower NAV_FIELD_SCALE");
+
+    float Octile(glm::ivec2 a, glm::ivec2 b) {
+        glm::ivec2 d = glm::abs(a - b);
+        return (DIAGONAL - 1.0f) * std::min(d.x, d.y) + std::max(d.x, d.y);
+    }
+
+    uint64_t CellKey(glm::ivec2 c) {
+        return (static_cast<uint64_t>(static_cast<uint32_t>(c.y)) << 32) | static_cast<uint32_t>(c.x);
+    }
+
+    void Push(std::vector<std::pair<float, int>>& open, float f, int i) {
+        open.push_back({f, i});
+        std::push_heap(open.begin(), open.end(), std::greater<std::pair<float, int>>());
+    }
+
+    std::pair<float, int> Pop(std::vector<std::pair<float, int>>& open) {
+        std::pop_heap(open.begin(), open.end(), std::greater<std::pair<float, int>>());
+        std::pair<float, int> top = open.back();
+        open.pop_back();
+        return top;
+    }
+}
+
+void NavGrid::Scratch::Begin(size_t size) {
+    if (g.size() < size) {
+        g.resize(size);
+        parent.resize(size);
+        seen.assign(size, 0);
+        closed.assign(size, 0);
+        stamp = 0;
+    }
+    if (++stamp == 0) {
+        // wrapped, old stamps could match again
+        std::fill(seen.begin(), seen.end(), 0);
+        std::fill(closed.begin(), closed.end(), 0);
+        stamp = 1;
+    }
+    open.clear();
+}
+
+bool NavGrid::Walkable(int x, int z) const {
+    if (x < 0 || z < 0 || x >= width || z >= depth) {
+        return false;
+    }
+    return (walkable[static_cast<size_t>(z) * row_words + (x >> 6)] >> (x & 63)) & 1;
+}
+
+void NavGrid::ClusterBounds(int cluster, glm::ivec2& lo, glm::ivec2& hi) const {
+    lo = glm::ivec2(cluster % clusters.x, cluster / clusters.x) * NAV_CLUSTER_SIZE;
+    hi = glm::min(lo + NAV_CLUSTER_SIZE, glm::ivec2(width, depth));
+}
+
+size_t NavGrid::MemoryUsage() const {
+    size_t bytes = walkable.capacity() * sizeof(uint64_t) + nodes.capacity() * sizeof(Node) + edges.capacity() * sizeof(Edge)
+        + fields.capacity() * sizeof(uint16_t) + landmarks.capacity() * sizeof(float);
+    for (const std::vector<int>& c : cluster_nodes) {
+        bytes += c.capacity() * sizeof(int);
+    }
+    return bytes;
+}
+
+int NavGrid::AddNode(glm::ivec2 cell, std::unordered_map<uint64_t, int>& lookup, std::vector<std::vector<Edge>>& adjacency) {
+    auto it = lookup.find(CellKey(cell));
+    if (it != lookup.end()) {
+        return it->second;
+    }
+    int id = static_cast<int>(nodes.size());
+    int cluster = ClusterOf(cell);
+    nodes.push_back({cell, cluster, 0, 0, 0});
+    adjacency.emplace_back();
+    cluster_nodes[cluster].push_back(id);
+    lookup.emplace(CellKey(cell), id);
+    return id;
+}
+
+void NavGrid::AddEntrances(glm::ivec2 a, glm::ivec2 step, glm::ivec2 across, int length,
+                           std::unordered_map<uint64_t, int>& lookup, std::vector<std::vector<Edge>>& adjacency) {
+    auto link = [&](int i) {
+        glm::ivec2 p = a + step * i;
+        int u = AddNode(p, lookup, adjacency);
+        int v = AddNode(p + across, lookup, adjacency);
+        adjacency[u].push_back({v, 1.0f});
+        adjacency[v].push_back({u, 1.0f});
+    };
+
+    int run = 0;
+    for (int i = 0; i <= length; i++) {
+        glm::ivec2 p = a + step * i;
+        if (i < length && Walkable(p.x, p.y) && Walkable(p.x + across.x, p.y + across.y)) {
+            run++;
+            continue;
+        }
+        if (run > 0) {
+            int first = i - run;
+            if (run >= LONG_ENTRANCE) {
+                link(first);
+                link(i - 1);
+            } else {
+                link(first + run / 2);
+            }
+        }
+        run = 0;
+    }
+}
+
+void NavGrid::Build(const Heightfield& field) {
+    width = field.Width();
+    depth = field.Depth();
+    row_words = (width + 63) / 64;
+    walkable.assign(static_cast<size_t>(row_words) * depth, 0);
+    for (int z = 0; z < depth; z++) {
+        for (int x = 0; x < width; x++) {
+            if (!field.Obstacle(x, z) && !field.Impassable(x, z)) {
+                walkable[static_cast<size_t>(z) * row_words + (x >> 6)] |= uint64_t(1) << (x & 63);
+            }
+        }
+    }
+
+    clusters = (glm::ivec2(width, depth) + NAV_CLUSTER_SIZE - 1) / NAV_CLUSTER_SIZE;
+    nodes.clear();
+    edges.clear();
+    cluster_nodes.assign(clusters.x * clusters.y, std::vector<int>());
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        cache.clear();
+        cache_lru.clear();
+    }
+
+    // entrances and the edges across them, walking every border between two clusters
+    std::unordered_map<uint64_t, int> lookup;
+    std::vector<std::vector<Edge>> adjacency;
+    for (int cz = 0; cz < clusters.y; cz++) {
+        for (int cx = 0; cx < clusters.x; cx++) {
+            glm::ivec2 lo, hi;
+            ClusterBounds(cz * clusters.x + cx, lo, hi);
+            if (cx + 1 < clusters.x) {
+                AddEntrances({hi.x - 1, lo.y}, {0, 1}, {1, 0}, hi.y - lo.y, lookup, adjacency);
+            }
+            if (cz + 1 < clusters.y) {
+                AddEntrances({lo.x, hi.y - 1}, {1, 0}, {0, 1}, hi.x - lo.x, lookup, adjacency);
+            }
+        }
+    }
+
+    // every node's field covers its whole cluster
+    size_t field_size = 0;
+    for (Node& n : nodes) {
+        glm::ivec2 lo, hi;
+        ClusterBounds(n.cluster, lo, hi);
+        n.field = field_size;
+        field_size += static_cast<size_t>(hi.x - lo.x) * (hi.y - lo.y);
+    }
+    fields.assign(field_size, UNREACHED);
+
+    unsigned int slots = ThreadPool::Get().NumSlots();
+    local_scratch.assign(slots, Scratch());
+    abstract_scratch.assign(slots, Scratch());
+
+    // Shortest paths between the nodes inside each cluster, and each node's field
+    // out of the same flood. A node only belongs to one cluster so the workers
+    // never touch the same adjacency list or field.
+    ThreadPool::Get().ParallelFor(cluster_nodes.size(), 4, [&](size_t begin, size_t end, unsigned worker) {
+        Scratch& s = local_scratch[worker];
+        for (size_t c = begin; c < end; c++) {
+            const std::vector<int>& members = cluster_nodes[c];
+            glm::ivec2 lo, hi;
+            ClusterBounds(static_cast<int>(c), lo, hi);
+            int w = hi.x - lo.x;
+            int area = w * (hi.y - lo.y);
+            for (size_t i = 0; i < members.size(); i++) {
+                LocalSearch(s, lo, hi, nodes[members[i]].cell, glm::ivec2(-1), nullptr);
+                uint16_t* field = fields.data() + nodes[members[i]].field;
+                for (int k = 0; k < area; k++) {
+                    if (s.Seen(k)) {
+                        field[k] = static_cast<uint16_t>(std::lround(s.g[k] * NAV_FIELD_SCALE));
+                    }
+                }
+                for (size_t j = 0; j < members.size(); j++) {
+                    glm::ivec2 p = nodes[members[j]].cell - lo;
+                    int k = p.y * w + p.x;
+                    if (i != j && s.Seen(k)) {
+                        adjacency[members[i]].push_back({members[j], s.g[k]});
+                    }
+                }
+            }
+        }
+    });
+
+    size_t total = 0;
+    for (const std::vector<Edge>& a : adjacency) {
+        total += a.size();
+    }
+    edges.reserve(total);
+    for (size_t i = 0; i < nodes.size(); i++) {
+        nodes[i].first_edge = static_cast<unsigned int>(edges.size());
+        nodes[i].num_edges = static_cast<unsigned int>(adjacency[i].size());
+        edges.insert(edges.end(), adjacency[i].begin(), adjacency[i].end());
+    }
+    BuildLandmarks(abstract_scratch[0]);
+}
+
+void NavGrid::BuildLandmarks(Scratch& s) {
+    landmarks.assign(nodes.size() * NAV_LANDMARKS, INF);
+    if (nodes.empty()) {
+        return;
+    }
+
+    // The first sits in a corner, every one after is the node furthest from
+    // those picked so far. Islands nothing reaches count as furthest of all.
+    std::vector<float> nearest(nodes.size(), INF);
+    int landmark = 0;
+    for (int l = 0; l < NAV_LANDMARKS; l++) {
+        s.Begin(nodes.size());
+        s.g[landmark] = 0.0f;
+        s.seen[landmark] = s.stamp;
+        Push(s.open, 0.0f, landmark);
+        while (!s.open.empty()) {
+            int i = Pop(s.open).second;
+            if (s.closed[i] == s.stamp) {
+                continue;
+            }
+            s.closed[i] = s.stamp;
+            landmarks[static_cast<size_t>(i) * NAV_LANDMARKS + l] = s.g[i];
+            nearest[i] = std::min(nearest[i], s.g[i]);
+            const Node& n = nodes[i];
+            for (unsigned int e = n.first_edge; e < n.first_edge + n.num_edges; e++) {
+                int k = edges[e].to;
+                float g = s.g[i] + edges[e].cost;
+                if (s.Seen(k) && g >= s.g[k]) {
+                    continue;
+                }
+                s.g[k] = g;
+                s.seen[k] = s.stamp;
+                Push(s.open, g, k);
+            }
+        }
+        landmark = static_cast<int>(std::max_element(nearest.begin(), nearest.end()) - nearest.begin());
+    }
+}
+
+float NavGrid::LocalSearch(Scratch& s, glm::ivec2 lo, glm::ivec2 hi, glm::ivec2 from, glm::ivec2 to, std::vector<glm::ivec2>* path) const {
+    bool flood = to.x < 0;
+    int w = hi.x - lo.x;
+    s.Begin(static_cast<size_t>(w) * (hi.y - lo.y));
+
+    auto index = [&](glm::ivec2 c) { return (c.y - lo.y) * w + (c.x - lo.x); };
+    int start = index(from);
+    s.g[start] = 0.0f;
+    s.parent[start] = -1;
+    s.seen[start] = s.stamp;
+    Push(s.open, flood ? 0.0f : Octile(from, to), start);
+
+    while (!s.open.empty()) {
+        int i = Pop(s.open).second;
+        if (s.closed[i] == s.stamp) {
+            continue;
+        }
+        s.closed[i] = s.stamp;
+        glm::ivec2 c = lo + glm::ivec2(i % w, i / w);
+        if (!flood && c == to) {
+            if (path) {
+                size_t mark = path->size();
+                for (int k = i; k != start; k = s.parent[k]) {
+                    path->push_back(lo + glm::ivec2(k % w, k / w));
+                }
+                std::reverse(path->begin() + mark, path->end());
+            }
+            return s.g[i];
+        }
+        for (int d = 0; d < 8; d++) {
+            glm::ivec2 n = c + DIRS[d];
+            if (n.x < lo.x || n.y < lo.y || n.x >= hi.x || n.y >= hi.y || !Walkable(n.x, n.y)) {
+                continue;
+            }
+            // no squeezing between two blocked cells
+            if (d >= 4 && (!Walkable(c.x + DIRS[d].x, c.y) || !Walkable(c.x, c.y + DIRS[d].y))) {
+                continue;
+            }
+            int k = index(n);
+            float g = s.g[i] + (d >= 4 ? DIAGONAL : 1.0f);
+            if (s.Seen(k) && g >= s.g[k]) {
+                continue;
+            }
+            s.g[k] = g;
+            s.parent[k] = i;
+            s.seen[k] = s.stamp;
+            Push(s.open, flood ? g : g + Octile(n, to), k);
+        }
+    }
+    return INF;
+}
+
+float NavGrid::FieldCost(int node, glm::ivec2 cell) const {
+    const Node& n = nodes[node];
+    glm::ivec2 lo, hi;
+    ClusterBounds(n.cluster, lo, hi);
+    uint16_t v = fields[n.field + static_cast<size_t>(cell.y - lo.y) * (hi.x - lo.x) + (cell.x - lo.x)];
+    return v == UNREACHED ? INF : static_cast<float>(v) / NAV_FIELD_SCALE;
+}
+
+float NavGrid::Descend(int node, glm::ivec2 cell, std::vector<glm::ivec2>* path, bool backwards) const {
+    const Node& n = nodes[node];
+    glm::ivec2 lo, hi;
+    ClusterBounds(n.cluster, lo, hi);
+    int w = hi.x - lo.x;
+    const uint16_t* field = fields.data() + n.field;
+    auto at = [&](glm::ivec2 c) { return field[(c.y - lo.y) * w + (c.x - lo.x)]; };
+    if (at(cell) == UNREACHED) {
+        return INF;
+    }
+
+    // The neighbour it's cheapest to go through. The flood's own parent is
+    // always a whole step lower, so whichever wins is lower too and it gets there.
+    size_t mark = path ? path->size() : 0;
+    float cost = 0.0f;
+    glm::ivec2 c = cell;
+    while (c != n.cell) {
+        glm::ivec2 best = c;
+        float best_score = INF, best_step = 0.0f;
+        for (int d = 0; d < 8; d++) {
+            glm::ivec2 m = c + DIRS[d];
+            if (m.x < lo.x || m.y < lo.y || m.x >= hi.x || m.y >= hi.y || !Walkable(m.x, m.y) || at(m) == UNREACHED) {
+                continue;
+            }
+            if (d >= 4 && (!Walkable(c.x + DIRS[d].x, c.y) || !Walkable(c.x, c.y + DIRS[d].y))) {
+                continue;
+            }
+            float step = d >= 4 ? DIAGONAL : 1.0f;
+            float score = at(m) + step * NAV_FIELD_SCALE;
+            if (score < best_score) {
+                best = m;
+                best_score = score;
+                best_step = step;
+            }
+        }
+        if (best == c) {
+            return INF;
+        }
+        c = best;
+        cost += best_step;
+        if (path) {
+            path->push_back(c);
+        }
+    }
+    if (path && backwards && cell != n.cell) {
+        // cell in front and the node off the end, then the whole lot turned round
+        path->pop_back();
+        path->insert(path->begin() + mark, cell);
+        std::reverse(path->begin() + mark, path->end());
+    }
+    return cost;
+}
+
+bool NavGrid::AbstractSearch(unsigned int slot, glm::ivec2 start, glm::ivec2 goal, std::vector<int>& route) {
+    Scratch& s = abstract_scratch[slot];
+    int cs = ClusterOf(start), cg = ClusterOf(goal);
+
+    // what it costs to get from the start to each node of its cluster and from
+    // each node of the goal's cluster to the goal, paths run both ways the same
+    std::vector<std::pair<int, float>> from_start, to_goal;
+    for (int n : cluster_nodes[cs]) {
+        float cost = FieldCost(n, start);
+        if (cost < INF) {
+            from_start.push_back({n, cost});
+        }
+    }
+    for (int n : cluster_nodes[cg]) {
+        float cost = FieldCost(n, goal);
+        if (cost < INF) {
+            to_goal.push_back({n, cost});
+        }
+    }
+    if (from_start.empty() || to_goal.empty()) {
+        return false;
+    }
+
+    // Landmark distances to the goal go through whichever of its cluster's nodes
+    // is cheapest. Any node is at least the difference of the two from the goal,
+    // and at least as far as the grid would make it.
+    float goal_landmarks[NAV_LANDMARKS];
+    for (int l = 0; l < NAV_LANDMARKS; l++) {
+        goal_landmarks[l] = INF;
+        for (const std::pair<int, float>& e : to_goal) {
+            goal_landmarks[l] = std::min(goal_landmarks[l], landmarks[static_cast<size_t>(e.first) * NAV_LANDMARKS + l] + e.second);
+        }
+    }
+    auto heuristic = [&](int i) {
+        float h = Octile(nodes[i].cell, goal);
+        const float* d = &landmarks[static_cast<size_t>(i) * NAV_LANDMARKS];
+        for (int l = 0; l < NAV_LANDMARKS; l++) {
+            if (d[l] < INF && goal_landmarks[l] < INF) {
+                h = std::max(h, std::fabs(d[l] - goal_landmarks[l]));
+            }
+        }
+        return h;
+    };
+
+    // the goal itself is one past the last node
+    int target = static_cast<int>(nodes.size());
+    s.Begin(nodes.size() + 1);
+    for (const std::pair<int, float>& e : from_start) {
+        s.g[e.first] = e.second;
+        s.parent[e.first] = -1;
+        s.seen[e.first] = s.stamp;
+        Push(s.open, e.second + heuristic(e.first), e.first);
+    }
+
+    while (!s.open.empty()) {
+        int i = Pop(s.open).second;
+        if (s.closed[i] == s.stamp) {
+            continue;
+        }
+        s.closed[i] = s.stamp;
+        if (i == target) {
+            route.clear();
+            for (int k = s.parent[target]; k != -1; k = s.parent[k]) {
+                route.push_back(k);
+            }
+            std::reverse(route.begin(), route.end());
+            return true;
+        }
+
+        auto relax = [&](int k, float g, float h) {
+            if (s.Seen(k) && g >= s.g[k]) {
+                return;
+            }
+            s.g[k] = g;
+            s.parent[k] = i;
+            s.seen[k] = s.stamp;
+            Push(s.open, g + h, k);
+        };
+
+        const Node& n = nodes[i];
+        if (n.cluster == cg) {
+            for (const std::pair<int, float>& e : to_goal) {
+                if (e.first == i) {
+                    relax(target, s.g[i] + e.second, 0.0f);
+                }
+            }
+        }
+        for (unsigned int e = n.first_edge; e < n.first_edge + n.num_edges; e++) {
+            int k = edges[e].to;
+            float g = s.g[i] + edges[e].cost;
+            // no point working out the bound for what's already been reached cheaper
+            if (!s.Seen(k) || g < s.g[k]) {
+                relax(k, g, heuristic(k));
+            }
+        }
+    }
+    return false;
+}
+
+float NavGrid::EdgeCost(int from, int to) const {
+    const Node& n = nodes[from];
+    for (unsigned int e = n.first_edge; e < n.first_edge + n.num_edges; e++) {
+        if (edges[e].to == to) {
+            return edges[e].cost;
+        }
+    }
+    return INF;
+}
+
+bool NavGrid::Search(unsigned int slot, const PathRequest& request, PathResult& result) {
+    Scratch& local = local_scratch[slot];
+    result.found = false;
+    result.cost = 0.0f;
+    result.cells.clear();
+    glm::ivec2 start = request.start, goal = request.goal;
+    if (!Walkable(start.x, start.y) || !Walkable(goal.x, goal.y)) {
+        return false;
+    }
+    result.cells.push_back(start);
+    if (start == goal) {
+        result.found = true;
+        return true;
+    }
+
+    // next door needs no graph, unless the way round leaves the cluster
+    int cs = ClusterOf(start), cg = ClusterOf(goal);
+    glm::ivec2 lo, hi;
+    if (cs == cg) {
+        ClusterBounds(cs, lo, hi);
+        float cost = LocalSearch(local, lo, hi, start, goal, request.refine ? &result.cells : nullptr);
+        if (cost < INF) {
+            if (!request.refine) {
+                result.cells.push_back(goal);
+            }
+            result.cost = cost;
+            result.found = true;
+            return true;
+        }
+    }
+
+    uint64_t key = (static_cast<uint64_t>(cs) << 32) | static_cast<uint32_t>(cg);
+    std::vector<int> route;
+    bool cached = LookupRoute(key, route);
+    for (int attempt = cached ? 0 : 1; attempt < 2; attempt++) {
+        if (attempt == 1 && (!AbstractSearch(slot, start, goal, route) || route.empty())) {
+            break;
+        }
+
+        // start, the route through the graph, then the goal
+        result.cells.resize(1);
+        result.cost = 0.0f;
+        glm::ivec2 cur = start;
+        bool ok = true;
+        for (size_t i = 0; i <= route.size() && ok; i++) {
+            glm::ivec2 next = i < route.size() ? nodes[route[i]].cell : goal;
+            int c = ClusterOf(cur);
+            if (c != ClusterOf(next)) {
+                // across a border, always next door
+                result.cost += EdgeCost(route[i - 1], route[i]);
+                result.cells.push_back(next);
+            } else if (request.refine) {
+                // one end is always a graph node, walk down its field from the other
+                bool towards = i < route.size();
+                float cost = Descend(towards ? route[i] : route[i - 1], towards ? cur : next, &result.cells, !towards);
+                ok = cost < INF;
+                result.cost += cost;
+            } else if (i == 0 || i == route.size()) {
+                // the two ends aren't graph nodes, they have to be checked even unrefined
+                float cost = i == 0 ? FieldCost(route[0], cur) : FieldCost(route[i - 1], next);
+                result.cells.push_back(next);
+                ok = cost < INF;
+                result.cost += cost;
+            } else {
+                result.cost += EdgeCost(route[i - 1], route[i]);
+                result.cells.push_back(next);
+            }
+            cur = next;
+        }
+        if (ok) {
+            if (attempt == 1) {
+                StoreRoute(key, route);
+            }
+            result.found = true;
+            return true;
+        }
+    }
+    result.cells.clear();
+    result.cost = 0.0f;
+    return false;
+}
+
+bool NavGrid::FindPath(const PathRequest& request, PathResult& result) {
+    if (Empty()) {
+        result = PathResult();
+        return false;
+    }
+    return Search(0, request, result);
+}
+
+void NavGrid::FindPaths(const PathRequest* requests, PathResult* results, size_t count) {
+    if (Empty()) {
+        std::fill(results, results + count, PathResult());
+        return;
+    }
+    ThreadPool::Get().ParallelFor(count, 4, [&](size_t begin, size_t end, unsigned worker) {
+        for (size_t i = begin; i < end; i++) {
+            Search(worker, requests[i], results[i]);
+        }
+    });
+}
+
+void NavGrid::SetCacheCapacity(size_t capacity) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    cache_capacity = capacity;
+    while (cache.size() > cache_capacity) {
+        cache.erase(cache_lru.back());
+        cache_lru.pop_back();
+    }
+}
+
+bool NavGrid::LookupRoute(uint64_t key, std::vector<int>& route) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto it = cache.find(key);
+    if (it == cache.end()) {
+        cache_misses++;
+        return false;
+    }
+    cache_hits++;
+    cache_lru.splice(cache_lru.begin(), cache_lru, it->second.lru);
+    route = it->second.nodes;
+    return true;
+}
+
+void NavGrid::StoreRoute(uint64_t key, const std::vector<int>& route) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    if (cache_capacity == 0) {
+        return;
+    }
+    auto it = cache.find(key);
+    if (it != cache.end()) {
+        it->second.nodes = route;
+        cache_lru.splice(cache_lru.begin(), cache_lru, it->second.lru);
+        return;
+    }
+    if (cache.size() >= cache_capacity) {
+        cache.erase(cache_lru.back());
+        cache_lru.pop_back();
+    }
+    cache_lru.push_front(key);
+    cache.emplace(key, CachedRoute{route, cache_lru.begin()});
+}
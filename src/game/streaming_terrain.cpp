@@ -0,0 +1,289 @@
+#include <glm/gtc/noise.hpp>
+#include <algorithm>
+#include <iostream>
+
+#include "streaming_terrain.h"
+#include "mesh.h"
+#include "defines.h"
+#include "thread_pool.h"
+
+StreamingTerrain::StreamingTerrain(const std::string name, const std::string& shader_id, const std::string& texture_id, StreamingTerrainSettings s)
+    : SceneNode(name, name + "_Tiles", shader_id, texture_id),
+      shared_settings(std::make_shared<const StreamingTerrainSettings>(std::move(s))),
+      settings(*shared_settings),
+      mailbox(std::make_shared<Mailbox>()) {
+}
+
+StreamingTerrain::~StreamingTerrain() {
+    // workers still running drop their tile on the floor
+    mailbox->cancelled = true;
+    for (auto& it : tiles) {
+        it.second.mesh->Release();
+    }
+}
+
+float StreamingTerrain::GeneratedHeight(float x, float z) const {
+    return GeneratedHeight(settings, x - transform.GetPosition().x, z - transform.GetPosition().z);
+}
+
+float StreamingTerrain::GeneratedHeight(const StreamingTerrainSettings& s, float x, float z) {
+    float height = 0.0f;
+
+    // the seed just moves us somewhere else in the noise
+    glm::vec2 offset = glm::vec2(static_cast<float>(s.seed % 1024) * 17.31f, static_cast<float>((s.seed / 1024) % 1024) * 23.17f);
+    float amplitude = 1.0f;
+    float frequency = 1.0f / s.noise_wavelength;
+    float total = 0.0f;
+    for (int i = 0; i < s.noise_octaves; i++) {
+        height += glm::perlin(glm::vec2(x, z) * frequency + offset) * amplitude;
+        total += amplitude;
+        amplitude *= 0.5f;
+        frequency *= 2.0f;
+    }
+    if (total > 0.0f) {
+        height = height / total * s.noise_height;
+    }
+
+    if (!s.heightmap.empty() && !s.heightmap[0].empty()) {
+        int rows = static_cast<int>(s.heightmap.size());
+        int cols = static_cast<int>(s.heightmap[0].size());
+        float u = x / s.heightmap_extent * rows;
+        float v = z / s.heightmap_extent * cols;
+        float fu = std::floor(u), fv = std::floor(v);
+        float su = u - fu, sv = v - fv;
+        // wrap both ways, the world goes on forever
+        int u0 = ((static_cast<int>(fu) % rows) + rows) % rows;
+        int v0 = ((static_cast<int>(fv) % cols) + cols) % cols;
+        int u1 = (u0 + 1) % rows;
+        int v1 = (v0 + 1) % cols;
+
+        float h0 = (1 - su) * s.heightmap[u0][v0] + su * s.heightmap[u1][v0];
+        float h1 = (1 - su) * s.heightmap[u0][v1] + su * s.heightmap[u1][v1];
+        height += ((1 - sv) * h0 + sv * h1) * s.heightmap_height;
+    }
+    return height;
+}
+
+std::unique_ptr<StreamingTerrain::TileData> StreamingTerrain::Generate(const StreamingTerrainSettings& s, TileKey key) {
+    std::unique_ptr<TileData> data = std::make_unique<TileData>();
+    data->key = key;
+
+    int n = s.tile_cells;
+    float cell = s.cell_size;
+    // positions come from global sample indices so both sides of a seam agree to the bit
+    int gx = key.x * n, gz = key.z * n;
+
+    // one extra sample all round so normals on the edges match the neighbours
+    int a = n + 3;
+    std::vector<float> apron(a * a);
+    for (int j = 0; j < a; j++) {
+        for (int i = 0; i < a; i++) {
+            apron[j * a + i] = GeneratedHeight(s, (gx + i - 1) * cell, (gz + j - 1) * cell);
+        }
+    }
+
+    data->field.Resize(n + 1, n + 1);
+    data->vertices.reserve(static_cast<size_t>(n + 1) * (n + 1) * 14);
+    const glm::vec3 right = {1.0, 0.0, 0.0};
+    const glm::vec3 color = {1.0, 1.0, 1.0};
+    for (int z = 0; z <= n; z++) {
+        for (int x = 0; x <= n; x++) {
+            const float* c = &apron[(z + 1) * a + x + 1];
+            float h = c[0];
+            glm::vec3 normal = glm::normalize(glm::vec3((c[-1] - c[1]) / (2 * cell), 1.0f, (c[-a] - c[a]) / (2 * cell)));
+            data->field.Height(x, z) = h;
+            data->field.Normal(x, z) = normal;
+
+            glm::vec3 pos = {(gx + x) * cell, h, (gz + z) * cell};
+            glm::vec3 estimate = glm::cross(right, normal);
+            glm::vec3 tangent = glm::cross(estimate, normal);
+            glm::vec2 uv = glm::vec2(pos.x, pos.z) / s.texture_extent;
+
+            APPEND_VEC3(data->vertices, pos);
+            APPEND_VEC3(data->vertices, normal);
+            APPEND_VEC3(data->vertices, color);
+            APPEND_VEC2(data->vertices, uv);
+            APPEND_VEC3(data->vertices, tangent);
+        }
+    }
+
+    // same triangulation as Terrain
+    unsigned int row = n + 1;
+    data->indices.reserve(static_cast<size_t>(n) * n * 6);
+    for (unsigned int z = 0; z < static_cast<unsigned int>(n); z++) {
+        for (unsigned int x = 0; x < static_cast<unsigned int>(n); x++) {
+            data->indices.push_back(z * row + x);
+            data->indices.push_back((z + 1) * row + x + 1);
+            data->indices.push_back(z * row + x + 1);
+
+            data->indices.push_back(z * row + x);
+            data->indices.push_back((z + 1) * row + x);
+            data->indices.push_back((z + 1) * row + x + 1);
+        }
+    }
+    return data;
+}
+
+StreamingTerrain::TileKey StreamingTerrain::KeyAt(float x, float z) const {
+    glm::vec3 local = glm::vec3(x, 0.0f, z) - transform.GetPosition();
+    return {static_cast<int>(std::floor(local.x / TileSize())), static_cast<int>(std::floor(local.z / TileSize()))};
+}
+
+bool StreamingTerrain::InRing(const TileKey& key, const TileKey& center) const {
+    return std::abs(key.x - center.x) <= settings.ring_radius && std::abs(key.z - center.z) <= settings.ring_radius;
+}
+
+bool StreamingTerrain::InHole(const TileKey& key) const {
+    glm::vec2 lo = glm::vec2(key.x, key.z) * TileSize();
+    glm::vec2 hi = lo + TileSize();
+    return glm::all(glm::greaterThanEqual(lo, settings.hole_min)) && glm::all(glm::lessThanEqual(hi, settings.hole_max));
+}
+
+void StreamingTerrain::Update(double dt) {
+    SceneNode::Update(dt);
+    if (!focus) {
+        return;
+    }
+    glm::vec3 p = focus->GetPosition();
+    TileKey center = KeyAt(p.x, p.z);
+
+    Receive(center);
+    Request(center);
+    Evict(center);
+}
+
+void StreamingTerrain::Receive(const TileKey& center) {
+    std::vector<std::unique_ptr<TileData>> arrived;
+    {
+        std::lock_guard<std::mutex> lock(mailbox->mutex);
+        size_t take = std::min(mailbox->done.size(), static_cast<size_t>(std::max(settings.uploads_per_frame, 1)));
+        std::move(mailbox->done.begin(), mailbox->done.begin() + take, std::back_inserter(arrived));
+        mailbox->done.erase(mailbox->done.begin(), mailbox->done.begin() + take);
+    }
+
+    // Positions stay whole, each tile quantized over its own bounds would
+    // crack along the seams. uvs are world space and too big for halves.
+    Layout layout({{FLOAT3, "vertex"},
+                   {PACKED_NORMAL, "normal"},
+                   {CONSTANT3, "color"},
+                   {FLOAT2, "uv"},
+                   {PACKED_NORMAL, "tangent"}
+                   });
+    for (std::unique_ptr<TileData>& data : arrived) {
+        requested.erase(data->key);
+        // the focus moved on while it was being made
+        if (!InRing(data->key, center) || tiles.count(data->key)) {
+            continue;
+        }
+
+        Tile tile;
+        tile.key = data->key;
+        tile.field = std::move(data->field);
+        tile.mesh = std::make_unique<Mesh>(std::move(data->vertices), std::move(data->indices), layout);
+        // the vertices only matter on the GPU from here on
+        size_t vertex_bytes = tile.mesh->vertices.size() / layout.floats * layout.size;
+        tile.mesh->vertices = std::vector<float>();
+        // indices stay on the CPU too, Draw counts them
+        size_t index_bytes = tile.mesh->indices.size() * (tile.mesh->IndexSize() + sizeof(unsigned int));
+        tile.bytes = tile.field.MemoryUsage() + vertex_bytes + index_bytes;
+
+        lru.push_front(tile.key);
+        tile.lru = lru.begin();
+        memory_used += tile.bytes;
+        tiles.emplace(tile.key, std::move(tile));
+    }
+}
+
+void StreamingTerrain::Request(const TileKey& center) {
+    std::vector<TileKey> missing;
+    int r = settings.ring_radius;
+    for (int z = center.z - r; z <= center.z + r; z++) {
+        for (int x = center.x - r; x <= center.x + r; x++) {
+            TileKey key = {x, z};
+            if (InHole(key)) {
+                continue;
+            }
+            auto it = tiles.find(key);
+            if (it != tiles.end()) {
+                lru.splice(lru.begin(), lru, it->second.lru);
+            } else if (!requested.count(key)) {
+                missing.push_back(key);
+            }
+        }
+    }
+
+    // closest first
+    auto dist = [&center](const TileKey& k) {
+        return (k.x - center.x) * (k.x - center.x) + (k.z - center.z) * (k.z - center.z);
+    };
+    std::sort(missing.begin(), missing.end(), [&dist](const TileKey& a, const TileKey& b) { return dist(a) < dist(b); });
+
+    for (const TileKey& key : missing) {
+        if (static_cast<int>(requested.size()) >= settings.max_in_flight) {
+            break;
+        }
+        requested.insert(key);
+        std::shared_ptr<const StreamingTerrainSettings> s = shared_settings;
+        std::shared_ptr<Mailbox> box = mailbox;
+        ThreadPool::Get().Enqueue([s, box, key]() {
+            if (box->cancelled) {
+                return;
+            }
+            std::unique_ptr<TileData> data = Generate(*s, key);
+            std::lock_guard<std::mutex> lock(box->mutex);
+            box->done.push_back(std::move(data));
+        });
+    }
+}
+
+void StreamingTerrain::Evict(const TileKey& center) {
+    auto it = lru.end();
+    while (memory_used > settings.memory_budget && it != lru.begin()) {
+        --it;
+        // the ring itself is never up for eviction
+        if (InRing(*it, center)) {
+            continue;
+        }
+        auto tile = tiles.find(*it);
+        memory_used -= tile->second.bytes;
+        tile->second.mesh->Release();
+        tiles.erase(tile);
+        it = lru.erase(it);
+    }
+    if (memory_used > settings.memory_budget && !over_budget_reported) {
+        std::cout << "StreamingTerrain " << name << ": ring alone needs " << memory_used << " bytes, over the budget" << std::endl;
+        over_budget_reported = true;
+    }
+}
+
+bool StreamingTerrain::SampleHeight(float x, float z, float& height) const {
+    TileKey key = KeyAt(x, z);
+    auto it = tiles.find(key);
+    if (it == tiles.end()) {
+        return false;
+    }
+    const Heightfield& field = it->second.field;
+    glm::vec3 local = glm::vec3(x, 0.0f, z) - transform.GetPosition();
+    float tx = local.x / settings.cell_size - key.x * settings.tile_cells;
+    float tz = local.z / settings.cell_size - key.z * settings.tile_cells;
+    int x0 = glm::clamp(static_cast<int>(std::floor(tx)), 0, settings.tile_cells - 1);
+    int z0 = glm::clamp(static_cast<int>(std::floor(tz)), 0, settings.tile_cells - 1);
+    float sx = tx - x0;
+    float sz = tz - z0;
+
+    float h0 = (1 - sx) * field.Height(x0, z0) + sx * field.Height(x0 + 1, z0);
+    float h1 = (1 - sx) * field.Height(x0, z0 + 1) + sx * field.Height(x0 + 1, z0 + 1);
+    height = (1 - sz) * h0 + sz * h1 + transform.GetPosition().y;
+    return true;
+}
+
+bool StreamingTerrain::CustomDraw(Shader* shd, const glm::mat4& view_proj, const glm::vec3&, RenderPass pass) {
+    if (pass == RenderPass::DEPTH) {
+        shd->SetUniform4m(transform.GetWorldMatrix(), "world_mat");
+        shd->SetUniform4m(view_proj, "light_mat");
+    }
+    for (auto& it : tiles) {
+        it.second.mesh->Draw();
+    }
+    return true;
+}
@@ -1,17 +1,121 @@
 #include <glm/gtc/noise.hpp>
+#include <cfloat>
+#include <iostream>
 
 #include "terrain.h"
 #include "defines.h"
 #include "game.h"
 #include "colliders/colliders.h"
+#include "thread_pool.h"
+#include "terrain_cache.h"
+#include "cache_file.h"
+
+// terrain.h decides whether there's SIMD at all
+#ifdef TERRAIN_SIMD
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
 
 // index into a 1D array as if it was 2D
 #define GIX(x, z, width) ((x) + (z) * width)
+// heightfield rows handed to a worker at a time
+#define TERRAIN_ROW_GRAIN 8
 
 float MAX_PASSABLE_SLOPE = 0.5f;
 
-Terrain::Terrain(const std::string name, const std::string& mesh_id, const std::string shader_id, const std::string& texture_id, TerrainType t, const std::vector<std::vector<float>> image, float xwidth, float zwidth, float density, Game* game)
-    : SceneNode(name, mesh_id, shader_id, texture_id), xwidth(xwidth), zwidth(zwidth), density(density), type(t), game(game) {
+namespace {
+    // moon layout
+    const int min_craters = 40;
+    const int max_craters = 60;
+    const float min_crater_radius = 2;
+    const float max_crater_radius = 20;
+    const float inner_crater_noise = 10;
+    const float min_crater_depth = 5.0f;
+    const float max_crater_depth = 20.0f;
+    const float bottom_crater_noise = -20.0f;
+    const float crater_ridge_size = 0.2f;
+
+    const float item_crater_radius = 20.0f;
+    const float item_crater_inner_radius = 6.0f;
+    const float spawn_canyon_radius = 40.0f;
+    const float item_crater_depth = 30.0f;
+    const float item_crater_spire_height = 18.0f;
+    const float min_spawn_canyon_depth = 80.0f;
+    const float player_platform_radius = 15.0f;
+    const float player_platform_depth = 8.0f;
+
+    bool OnMoonPlatform(float distance) {
+        return !(distance < spawn_canyon_radius && distance > player_platform_radius) && distance < player_platform_radius + 1;
+    }
+
+#ifdef TERRAIN_SIMD
+    // MSVC hands out every intrinsic anyway, gcc and clang need telling per function
+#if defined(__GNUC__) || defined(__clang__)
+#define TERRAIN_AVX2 __attribute__((target("avx2")))
+#else
+#define TERRAIN_AVX2
+#endif
+
+    bool HasAVX2() {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) {
+            return false;
+        }
+        // the os has to save the ymm registers too
+        __cpuid(info, 1);
+        if (!(info[2] & (1 << 27)) || (_xgetbv(0) & 6) != 6) {
+            return false;
+        }
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        return __builtin_cpu_supports("avx2");
+#endif
+    }
+
+    const bool has_avx2 = HasAVX2();
+
+    // what Terrain::LoadCells does, eight wide
+    TERRAIN_AVX2 __m256 ToGrid8(__m256 p, float cell, double half) {
+        __m256 q = _mm256_div_ps(p, _mm256_set1_ps(cell));
+        __m128 lo = _mm256_cvtpd_ps(_mm256_add_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(q)), _mm256_set1_pd(half)));
+        __m128 hi = _mm256_cvtpd_ps(_mm256_add_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(q, 1)), _mm256_set1_pd(half)));
+        return _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+    }
+
+    // truncate and step down like the SSE2 path, _mm256_floor_ps would differ out of int range
+    TERRAIN_AVX2 __m256 Cell8(__m256 t, int last) {
+        __m256i i = _mm256_cvttps_epi32(t);
+        __m256 f = _mm256_cvtepi32_ps(i);
+        i = _mm256_add_epi32(i, _mm256_castps_si256(_mm256_cmp_ps(f, t, _CMP_GT_OS)));
+        f = _mm256_cvtepi32_ps(i);
+        return _mm256_min_ps(_mm256_max_ps(f, _mm256_setzero_ps()), _mm256_set1_ps(static_cast<float>(last)));
+    }
+
+    // eight (x, z) pairs into x and z lanes, in order
+    TERRAIN_AVX2 void Split8(const glm::vec2* xz, __m256& px, __m256& pz) {
+        __m256 a = _mm256_loadu_ps(&xz[0].x);
+        __m256 b = _mm256_loadu_ps(&xz[4].x);
+        // the shuffle works per 128 bit half, the permute puts the halves back in order
+        px = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))), _MM_SHUFFLE(3, 1, 2, 0)));
+        pz = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))), _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+#endif
+
+    glm::vec3 BlendNormals(const glm::vec3& n00, const glm::vec3& n10, const glm::vec3& n01, const glm::vec3& n11, float sx, float sz) {
+        glm::vec3 n0 = (1 - sx) * n00 + sx * n10;
+        glm::vec3 n1 = (1 - sx) * n01 + sx * n11;
+        glm::vec3 interp = glm::normalize((1 - sz) * n0 + sz * n1);
+        return interp;
+    }
+}
+
+Terrain::Terrain(const std::string name, const std::string& mesh_id, const std::string shader_id, const std::string& texture_id, TerrainType t, const HeightmapView& image, float xwidth, float zwidth, float density, Game* game, bool chunked)
+    : SceneNode(name, mesh_id, shader_id, texture_id), xwidth(xwidth), zwidth(zwidth), density(density), type(t), chunked(chunked), game(game) {
 
     // generate uniform grid
     num_xsteps = xwidth * density;
@@ -20,29 +124,55 @@ Terrain::Terrain(const std::string name, const std::string& mesh_id, const std::
     zstep = zwidth / num_zsteps;
 
     // allocate space for attributes
-    heights.resize(num_xsteps, std::vector<float>(num_zsteps, 0.0));
-    normals.resize(num_xsteps, std::vector<glm::vec3>(num_zsteps, {0.0, 1.0, 0.0}));
-    obstacles.resize(num_xsteps - 1, std::vector<bool>(num_zsteps - 1, true));
-    impassable.resize(num_xsteps, std::vector<bool>(num_zsteps, false));
-    tangents.resize(num_xsteps, std::vector<glm::vec3>(num_zsteps, {1.0, 0.0, 0.0}));
-    uvs.resize(num_xsteps, std::vector<glm::vec2>(num_zsteps, {0.0, 0.0}));
-
-    GenerateHeightmap(type, image);
-    GenerateNormals();
-    GenerateTangents();
-    GenerateObstacles();
-    GenerateImPassable();
-    GenerateUV();
-    GenerateMesh();
+    field.Resize(static_cast<int>(num_xsteps), static_cast<int>(num_zsteps));
+
+    // the moon's random numbers get drawn either way so everything drawing
+    // after it sees the same sequence as when it was generated
+    MoonDraws moon;
+    if (type == TerrainType::MOON) {
+        DrawQMoon(moon);
+    }
+    uint64_t key = CacheKey(image, moon);
+    if (!TerrainCache::Load(key, field.Width(), field.Depth(), field)) {
+        GenerateHeightmap(type, image, moon);
+        GenerateSurface();
+        GenerateImPassable();
+        TerrainCache::Save(key, field);
+    }
+    GenerateHeightBounds();
+    if (chunked) {
+        GenerateChunks();
+    } else {
+        GenerateMesh();
+    }
 
     SetCollider(new TerrainCollider(*this));
 }
 
-void Terrain::GenerateHeightmap(TerrainType type, const std::vector<std::vector<float>>& image) {
+uint64_t Terrain::CacheKey(const HeightmapView& image, const MoonDraws& moon) {
+    using namespace CacheFile;
+    uint64_t key = HashValue(TerrainCache::VERSION, Hash(nullptr, 0));
+    key = HashValue(type, key);
+    key = HashValue(field.Width(), key);
+    key = HashValue(field.Depth(), key);
+    key = HashValue(xwidth, key);
+    key = HashValue(zwidth, key);
+    key = HashValue(density, key);
+    key = HashValue(image.Rows(), key);
+    key = HashValue(image.Cols(), key);
+    key = HashValue(image.GetFormat(), key);
+    key = Hash(image.Data(), image.SizeBytes(), key);
+    // the draws are the seed, hashing them catches whatever state the generator was in
+    key = Hash(moon.craters.data(), moon.craters.size() * sizeof(MoonDraws::Crater), key);
+    key = Hash(moon.platform.data(), moon.platform.size() * sizeof(float), key);
+    return key;
+}
+
+void Terrain::GenerateHeightmap(TerrainType type, const HeightmapView& image, const MoonDraws& moon) {
     switch(type) {
         case TerrainType::MOON:
             SampleTerrainForHeight(image, 10);
-            GenerateQMoon();
+            GenerateQMoon(moon);
             break;
         case TerrainType::FOREST:
             SampleTerrainForHeight(image, 50);
@@ -58,144 +188,185 @@ void Terrain::GenerateHeightmap(TerrainType type, const std::vector<std::vector<
     }
 }
 
-void Terrain::SampleTerrainForHeight(const std::vector<std::vector<float>>& terrainArray, float heightMultiplier, int tileX, int tileZ) {
-    float image_xstep = terrainArray[0].size() / num_xsteps;
-    float image_zstep = terrainArray.size() / num_zsteps;
-    for (int z = 0; z < num_zsteps; z++) {
-        for (int x = 0; x < num_xsteps; x++) {
-            // Calculate the tiled sample coordinates
-            float sampleX = fmod(x * image_xstep * tileX, terrainArray[0].size());
-            float sampleZ = fmod(z * image_zstep * tileZ, terrainArray.size());
-
-            int x0 = static_cast<int>(sampleX);
-            int z0 = static_cast<int>(sampleZ);
-
-            // Wrap the coordinates within valid range
-            x0 = (x0 + terrainArray[0].size()) % terrainArray[0].size();
-            z0 = (z0 + terrainArray.size()) % terrainArray.size();
-
-            // Get the fractional part of the coordinates
-            float sx = sampleX - static_cast<float>(x0);
-            float sz = sampleZ - static_cast<float>(z0);
-
-            // Perform bilinear interpolation on the terrain heights
-            float h00 = terrainArray[x0][z0] * heightMultiplier;
-            float h10 = terrainArray[(x0 + 1) % terrainArray[0].size()][z0] * heightMultiplier;
-            float h01 = terrainArray[x0][(z0 + 1) % terrainArray.size()] * heightMultiplier;
-            float h11 = terrainArray[(x0 + 1) % terrainArray[0].size()][(z0 + 1) % terrainArray.size()] * heightMultiplier;
-
-            float h0 = (1 - sx) * h00 + sx * h10;
-            float h1 = (1 - sx) * h01 + sx * h11;
-
-            heights[x][z] = (1 - sz) * h0 + sz * h1;
+void Terrain::SampleTerrainForHeight(const HeightmapView& image, float heightMultiplier, int tileX, int tileZ) {
+    float image_xstep = image.Cols() / num_xsteps;
+    float image_zstep = image.Rows() / num_zsteps;
+    int nz = static_cast<int>(std::ceil(num_zsteps));
+    ThreadPool::Get().ParallelFor(nz, TERRAIN_ROW_GRAIN, [&](size_t begin, size_t end, unsigned) {
+        for (int z = static_cast<int>(begin); z < static_cast<int>(end); z++) {
+            for (int x = 0; x < num_xsteps; x++) {
+                // Calculate the tiled sample coordinates
+                float sampleX = fmod(x * image_xstep * tileX, image.Cols());
+                float sampleZ = fmod(z * image_zstep * tileZ, image.Rows());
+
+                int x0 = static_cast<int>(sampleX);
+                int z0 = static_cast<int>(sampleZ);
+
+                // Wrap the coordinates within valid range
+                x0 = (x0 + image.Cols()) % image.Cols();
+                z0 = (z0 + image.Rows()) % image.Rows();
+
+                // Get the fractional part of the coordinates
+                float sx = sampleX - static_cast<float>(x0);
+                float sz = sampleZ - static_cast<float>(z0);
+
+                // Perform bilinear interpolation on the terrain heights
+                float h00 = image.At(x0, z0) * heightMultiplier;
+                float h10 = image.At((x0 + 1) % image.Cols(), z0) * heightMultiplier;
+                float h01 = image.At(x0, (z0 + 1) % image.Rows()) * heightMultiplier;
+                float h11 = image.At((x0 + 1) % image.Cols(), (z0 + 1) % image.Rows()) * heightMultiplier;
+
+                float h0 = (1 - sx) * h00 + sx * h10;
+                float h1 = (1 - sx) * h01 + sx * h11;
+
+                field.Height(x, z) = (1 - sz) * h0 + sz * h1;
+            }
         }
-    }
+    });
 }
 
-void Terrain::GenerateQMoon() {
-
-    int min_craters = 40;
-    int max_craters = 60;
-    float min_crater_radius = 2;
-    float max_crater_radius = 20;
-    float inner_crater_noise = 10;
-    float min_crater_depth = 5.0f;
-    float max_crater_depth = 20.0f;
-    float bottom_crater_noise = -20.0f;
-    float crater_ridge_size = 0.2f;
-
+void Terrain::DrawQMoon(MoonDraws& draws) {
     int num_craters = glm::linearRand(min_craters, max_craters);
 
-    for (int i = 0; i < num_craters; ++i) {
-        glm::vec2 position = glm::linearRand(glm::vec2(0.0f), glm::vec2(num_xsteps, num_xsteps));
-        float radius = glm::linearRand(min_crater_radius, max_crater_radius);
-        float base_height = glm::linearRand(-max_crater_depth, -min_crater_depth);
-
-        for (int y = 0; y < num_xsteps; ++y) {
-            for (int x = 0; x < num_xsteps; ++x) {
-                float distance = glm::distance(glm::vec2(x, y), position);
-
-                if (distance < radius) {
-                    float bottom_perlin = glm::perlin(glm::vec2(x * xstep, y * zstep) / 100.0f);
-                    float bottom_noise = bottom_perlin * bottom_crater_noise;
-                    float perlin_value = glm::perlin(glm::vec2(x, y) * inner_crater_noise);
-                    float height_variation = perlin_value * inner_crater_noise;
-                    heights[y][x] = base_height + height_variation;
+    draws.craters.resize(num_craters);
+    for (MoonDraws::Crater& c : draws.craters) {
+        c.position = glm::linearRand(glm::vec2(0.0f), glm::vec2(num_xsteps, num_xsteps));
+        c.radius = glm::linearRand(min_crater_radius, max_crater_radius);
+        c.base_height = glm::linearRand(-max_crater_depth, -min_crater_depth);
+    }
 
-                    float depth = 0.5f * (1.0f - (distance / radius));
-                    if (depth > 0.0f) {
-                        heights[y][x] -= depth;
+    // the platform draws one per cell, in the original z then x order
+    glm::vec2 spawn_position = glm::vec2(num_xsteps/2, num_zsteps/2);
+    int nx = static_cast<int>(std::ceil(num_xsteps));
+    int nz = static_cast<int>(std::ceil(num_zsteps));
+    draws.platform_box = {glm::max(static_cast<int>(std::floor(spawn_position.x - player_platform_radius)) - 2, 0),
+                          glm::max(static_cast<int>(std::floor(spawn_position.y - player_platform_radius)) - 2, 0),
+                          glm::min(static_cast<int>(std::ceil(spawn_position.x + player_platform_radius)) + 2, nx - 1),
+                          glm::min(static_cast<int>(std::ceil(spawn_position.y + player_platform_radius)) + 2, nz - 1)};
+    draws.platform.clear();
+    for (int z = draws.platform_box.y; z <= draws.platform_box.w; ++z) {
+        for (int x = draws.platform_box.x; x <= draws.platform_box.z; ++x) {
+            if (OnMoonPlatform(glm::distance(glm::vec2(x, z), spawn_position))) {
+                float perlin_value = glm::perlin(glm::vec2(x, z) * 0.01f);
+                float height_variation = perlin_value * glm::linearRand(perlin_value * 10.0f, perlin_value * 10.0f + 2.5f);
+                draws.platform.push_back(-player_platform_depth + height_variation);
+            }
+        }
+    }
+}
 
-                        if (depth < crater_ridge_size) {
-                            heights[y][x] -= bottom_noise;
+void Terrain::GenerateQMoon(const MoonDraws& draws) {
+    // x walks the rows of the heightfield here, y the columns
+    int nx = static_cast<int>(std::ceil(num_xsteps));
+    ThreadPool::Get().ParallelFor(nx, TERRAIN_ROW_GRAIN, [&](size_t begin, size_t end, unsigned) {
+        for (int x = static_cast<int>(begin); x < static_cast<int>(end); ++x) {
+            // craters overwrite each other, so every row applies them in order
+            for (const MoonDraws::Crater& c : draws.craters) {
+                // a cell of slack either side, the distance test below decides
+                if (glm::abs(x - c.position.x) > c.radius + 1.0f) {
+                    continue;
+                }
+                int y0 = glm::max(static_cast<int>(std::floor(c.position.y - c.radius)) - 1, 0);
+                int y1 = glm::min(static_cast<int>(std::ceil(c.position.y + c.radius)) + 1, nx - 1);
+                for (int y = y0; y <= y1; ++y) {
+                    float distance = glm::distance(glm::vec2(x, y), c.position);
+
+                    if (distance < c.radius) {
+                        float bottom_perlin = glm::perlin(glm::vec2(x * xstep, y * zstep) / 100.0f);
+                        float bottom_noise = bottom_perlin * bottom_crater_noise;
+                        float perlin_value = glm::perlin(glm::vec2(x, y) * inner_crater_noise);
+                        float height_variation = perlin_value * inner_crater_noise;
+                        field.Height(y, x) = c.base_height + height_variation;
+
+                        float depth = 0.5f * (1.0f - (distance / c.radius));
+                        if (depth > 0.0f) {
+                            field.Height(y, x) -= depth;
+
+                            if (depth < crater_ridge_size) {
+                                field.Height(y, x) -= bottom_noise;
+                            }
                         }
                     }
                 }
             }
         }
-    }
-
-    float item_crater_radius = 20.0f;
-    float item_crater_inner_radius = 6.0f;
-    float spawn_canyon_radius = 40.0f;
-    float item_crater_depth = 30.0f;
-    float item_crater_spire_height = 18.0f;
-    float min_spawn_canyon_depth = 80.0f;
-    float player_platform_radius = 15.0f;
-    float player_platform_depth = 8.0f;
+    });
 
     glm::vec2 spawn_position = glm::vec2(num_xsteps/2, num_zsteps/2);
     glm::vec2 item_position = glm::vec2((spawn_canyon_radius/2) + 10, (spawn_canyon_radius/2) + 10);
+    int nz = static_cast<int>(std::ceil(num_zsteps));
+
+    // the platform heights were worked out along with the draws
+    size_t next = 0;
+    for (int z = draws.platform_box.y; z <= draws.platform_box.w; ++z) {
+        for (int x = draws.platform_box.x; x <= draws.platform_box.z; ++x) {
+            if (OnMoonPlatform(glm::distance(glm::vec2(x, z), spawn_position))) {
+                field.Height(z, x) = draws.platform[next++];
+            }
+        }
+    }
 
-    for (int z = 0; z < num_zsteps; ++z) {
-        for (int x = 0; x < num_xsteps; ++x) {
-            float distance = glm::distance(glm::vec2(x, z), spawn_position);
-            if (distance < spawn_canyon_radius && distance > player_platform_radius) {
-                float spawn_canyon_depth = min_spawn_canyon_depth;
-                heights[z][x] -= spawn_canyon_depth;
-                continue;
-            } else if ( distance < player_platform_radius + 1) {
-                float perlin_value = glm::perlin(glm::vec2(x, z) * 0.01f);
-                float height_variation = perlin_value * glm::linearRand(perlin_value * 10.0f, perlin_value * 10.0f + 2.5f);
-                heights[z][x] = -player_platform_depth + height_variation;
-                continue;
+    // nothing outside the canyon and the item crater changes
+    ThreadPool::Get().ParallelFor(nx, TERRAIN_ROW_GRAIN, [&](size_t begin, size_t end, unsigned) {
+        for (int x = static_cast<int>(begin); x < static_cast<int>(end); ++x) {
+            int z0 = nz, z1 = -1;
+            if (glm::abs(x - spawn_position.x) <= spawn_canyon_radius + 1.0f) {
+                z0 = glm::min(z0, static_cast<int>(std::floor(spawn_position.y - spawn_canyon_radius)) - 1);
+                z1 = glm::max(z1, static_cast<int>(std::ceil(spawn_position.y + spawn_canyon_radius)) + 1);
+            }
+            if (glm::abs(x - item_position.x) <= item_crater_radius + 1.0f) {
+                z0 = glm::min(z0, static_cast<int>(std::floor(item_position.y - item_crater_radius)) - 1);
+                z1 = glm::max(z1, static_cast<int>(std::ceil(item_position.y + item_crater_radius)) + 1);
             }
+            z0 = glm::max(z0, 0);
+            z1 = glm::min(z1, nz - 1);
+
+            for (int z = z0; z <= z1; ++z) {
+                float distance = glm::distance(glm::vec2(x, z), spawn_position);
+                if (distance < spawn_canyon_radius && distance > player_platform_radius) {
+                    float spawn_canyon_depth = min_spawn_canyon_depth;
+                    field.Height(z, x) -= spawn_canyon_depth;
+                    continue;
+                } else if (OnMoonPlatform(distance)) {
+                    // done above
+                    continue;
+                }
 
-            float item_distance = glm::distance(glm::vec2(x, z), item_position);
-            if (item_distance < item_crater_radius) {
-                float bottom_perlin = glm::perlin(glm::vec2(x * xstep, z * zstep) / 100.0f);
-                float bottom_noise = bottom_perlin * bottom_crater_noise;
-                float perlin_value = glm::perlin(glm::vec2(x, z) * inner_crater_noise);
-                float height_variation = perlin_value * inner_crater_noise;
-                heights[z][x] -= item_crater_depth + height_variation;
+                float item_distance = glm::distance(glm::vec2(x, z), item_position);
+                if (item_distance < item_crater_radius) {
+                    float bottom_perlin = glm::perlin(glm::vec2(x * xstep, z * zstep) / 100.0f);
+                    float bottom_noise = bottom_perlin * bottom_crater_noise;
+                    float perlin_value = glm::perlin(glm::vec2(x, z) * inner_crater_noise);
+                    float height_variation = perlin_value * inner_crater_noise;
+                    field.Height(z, x) -= item_crater_depth + height_variation;
 
-                float depth = 0.5f * (1.0f - (distance / item_crater_radius));
-                if (depth > 0.0f) {
-                    heights[z][x] -= depth;
+                    float depth = 0.5f * (1.0f - (distance / item_crater_radius));
+                    if (depth > 0.0f) {
+                        field.Height(z, x) -= depth;
 
-                    if (depth < crater_ridge_size) {
-                        heights[z][x] -= bottom_noise;
+                        if (depth < crater_ridge_size) {
+                            field.Height(z, x) -= bottom_noise;
+                        }
                     }
                 }
-            }
 
-            if (item_distance < item_crater_inner_radius) {
-                float depth = 0.5f * (1.0f - (distance / item_crater_radius));
-                if (depth < crater_ridge_size) {
-                    float bottom_perlin = glm::perlin(glm::vec2(x * xstep, z * zstep) / 100.0f);
-                    float bottom_noise = bottom_perlin * bottom_crater_noise;
-                    heights[z][x] -= bottom_noise;
-                } 
-                
-                heights[z][x] += item_crater_depth * 0.5;
-            }
+                if (item_distance < item_crater_inner_radius) {
+                    float depth = 0.5f * (1.0f - (distance / item_crater_radius));
+                    if (depth < crater_ridge_size) {
+                        float bottom_perlin = glm::perlin(glm::vec2(x * xstep, z * zstep) / 100.0f);
+                        float bottom_noise = bottom_perlin * bottom_crater_noise;
+                        field.Height(z, x) -= bottom_noise;
+                    } 
+                    
+                    field.Height(z, x) += item_crater_depth * 0.5;
+                }
 
-            if (item_distance < 2) {
-                heights[z][x] += item_crater_spire_height;
+                if (item_distance < 2) {
+                    field.Height(z, x) += item_crater_spire_height;
+                }
             }
-
         }
-    }
+    });
 }
 
 void Terrain::GenerateForest() {
@@ -241,112 +412,144 @@ void Terrain::GenerateForest() {
 }
 
 void Terrain::GenerateLava() {
-    for (int z = 0; z < num_zsteps; z++) {
-        for (int x = 0; x < num_xsteps; x++) {
-                glm::vec2 sample = glm::vec2(x * 0.5f, z * 0.5f) ;
-                float height = glm::perlin(sample) * 5.0f;
-                heights[z][x] = height;
+    int nx = static_cast<int>(std::ceil(num_xsteps));
+    ThreadPool::Get().ParallelFor(nx, TERRAIN_ROW_GRAIN, [&](size_t begin, size_t end, unsigned) {
+        for (int x = static_cast<int>(begin); x < static_cast<int>(end); x++) {
+            for (int z = 0; z < num_zsteps; z++) {
+                    glm::vec2 sample = glm::vec2(x * 0.5f, z * 0.5f) ;
+                    float height = glm::perlin(sample) * 5.0f;
+                    field.Height(z, x) = height;
+            }
         }
-    }
+    });
 }
 
-void Terrain::GenerateNormals() {
+void Terrain::GenerateSurface() {
+    GenerateSurface(0, 0, field.Width() - 1, field.Depth() - 1);
+}
+
+void Terrain::GenerateSurface(int x0, int z0, int x1, int z1) {
+    int nx = field.Width(), nz = field.Depth();
+    // normals over the box, the obstacle test reads the normal after it so it reaches one more back
+    int nz0 = glm::max(z0, 1);
+    int nz1 = glm::min(z1, static_cast<int>(std::ceil(num_zsteps)) - 2);
+    int nx0 = glm::max(x0, 1);
+    int oz0 = glm::max(z0 - 1, 0), oz1 = glm::min(z1, nz - 1);
+    int ox0 = glm::max(x0 - 1, 0), ox1 = glm::min(x1, nx - 1);
+    if (oz0 > oz1) {
+        return;
+    }
+
     // method from: https://stackoverflow.com/a/21660173
     // for now ignore the outer edge ring
-    for (int z = 1; z < num_zsteps-1; z++) {
-        for (int x = 1; x < num_xsteps-1; x++) {
-            float hl =  heights[x-1][z];
-            float hr =  heights[x+1][z];
-            float hu =  heights[x][z+1];
-            float hd =  heights[x][z-1];
-            float hul = heights[x-1][z+1];
-            float hur = heights[x+1][z+1];
-            float hdl = heights[x-1][z-1];
-            float hdr = heights[x+1][z-1];
-
-            glm::vec3 norm = {(2*(hl - hr) - hur + hdl + hu - hd) / xstep,
-                              6,
-                              (2*(hd - hu) + hur + hdl - hu - hl) / zstep};
-            norm = glm::normalize(norm);
-            normals[x][z] = norm;
-        }
-    }
-}
-void Terrain::GenerateObstacles() {
-    for (int z = 1; z < num_zsteps-2; z++) {
-        for (int x = 1; x < num_xsteps-2; x++) {
-            glm::vec3 norm = InterpNormals(x, z, 0.5, 0.5);
-            float slopeX = glm::abs(glm::dot(norm, {1.0, 0.0, 0.0}));
-            float slopeY = glm::abs(glm::dot(norm, {0.0, 0.0, 1.0})); 
-            float slope = glm::max(slopeX, slopeY);
-
-            if(slope > MAX_PASSABLE_SLOPE) {
-                obstacles[x][z] = true;
+    auto normal = [&](int x, int z) {
+        float hl =  field.Height(x-1, z);
+        float hr =  field.Height(x+1, z);
+        float hu =  field.Height(x, z+1);
+        float hd =  field.Height(x, z-1);
+        float hur = field.Height(x+1, z+1);
+        float hdl = field.Height(x-1, z-1);
+
+        glm::vec3 norm = {(2*(hl - hr) - hur + hdl + hu - hd) / xstep,
+                          6,
+                          (2*(hd - hu) + hur + hdl - hu - hl) / zstep};
+        return glm::normalize(norm);
+    };
+
+    // Each worker keeps the normals of the row it's on and the one after. The
+    // row after belongs to the next worker, so it's worked out again here rather
+    // than read back, and only stored by whoever owns it.
+    auto load_row = [&](int z, glm::vec3* row, bool store) {
+        bool inside = z >= nz0 && z <= nz1;
+        for (int x = 0; x < nx; x++) {
+            if (inside && x >= nx0 && x <= x1 && x < num_xsteps-1) {
+                row[x] = normal(x, z);
+                if (store) {
+                    field.Normal(x, z) = row[x];
+                }
             } else {
-                obstacles[x][z] = false;
+                row[x] = field.Normal(x, z);
             }
         }
-    }
+    };
+
+    // rows share words of obstacle bits until they are 64 samples apart
+    size_t rows = oz1 - oz0 + 1;
+    size_t grain = field.Stride() >= 64 ? TERRAIN_ROW_GRAIN : rows;
+    ThreadPool::Get().ParallelFor(rows, grain, [&](size_t begin, size_t end, unsigned) {
+        std::vector<glm::vec3> cur(nx), next(nx);
+        int zb = oz0 + static_cast<int>(begin), ze = oz0 + static_cast<int>(end);
+        load_row(zb, cur.data(), true);
+        for (int z = zb; z < ze; z++) {
+            if (z + 1 < nz) {
+                load_row(z + 1, next.data(), z + 1 < ze);
+            }
+            for (int x = ox0; x <= ox1; x++) {
+                // the outer ring of cells has no normals to go off, keep it blocked
+                bool blocked = true;
+                if (x >= 1 && x < nx - 2 && z >= 1 && z < nz - 2) {
+                    glm::vec3 norm = BlendNormals(cur[x], cur[x + 1], next[x], next[x + 1], 0.5, 0.5);
+                    float slopeX = glm::abs(glm::dot(norm, {1.0, 0.0, 0.0}));
+                    float slopeY = glm::abs(glm::dot(norm, {0.0, 0.0, 1.0}));
+                    float slope = glm::max(slopeX, slopeY);
+                    blocked = slope > MAX_PASSABLE_SLOPE;
+                }
+                field.SetObstacle(x, z, blocked);
+            }
+            cur.swap(next);
+        }
+    });
 }
+
 void Terrain::GenerateImPassable() {
     for (int x = 0; x <= num_xsteps-1; ++x) {
-        impassable[x][0] = true; // bottom edge
-        impassable[x][num_zsteps - 2] = true; // top edge
+        field.SetImpassable(x, 0, true); // bottom edge
+        field.SetImpassable(x, num_zsteps - 2, true); // top edge
     }
     for (int z = 0; z <= num_zsteps-1; ++z) {
-        impassable[0][z] = true; // left edge
-        impassable[num_xsteps - 2][z] = true; // right edge
-    }
-}
-
-void Terrain::GenerateTangents() {
-    for (int z = 0; z < num_zsteps-1; z++) {
-        for (int x = 0; x < num_xsteps-1; x++) {
-            const glm::vec3 right = {1.0, 0.0, 0.0};
-            glm::vec3 norm = normals[x][z];
-            glm::vec3 estimate = glm::cross(right, norm); //original estimate of tangent
-            glm::vec3 tan = glm::cross(estimate, norm); // get closer to the true tangent
-            tangents[x][z] = tan;
-        }
-    }
-}
-
-void Terrain::GenerateUV() {
-    for (int z = 0; z < num_zsteps; z++) {
-        for (int x = 0; x < num_xsteps; x++) {
-            glm::vec2 uv = {
-                (x*xstep)/xwidth,
-                (z*zstep)/zwidth
-            };
-            uvs[x][z] = uv;
-        }
+        field.SetImpassable(0, z, true); // left edge
+        field.SetImpassable(num_xsteps - 2, z, true); // right edge
     }
 }
 
 void Terrain::GenerateMesh() {
-    Layout layout({{FLOAT3, "vertex"},
-                   {FLOAT3, "normal"},
-                   {FLOAT3, "color"},
-                   {FLOAT2, "uv"},
-                   {FLOAT3, "tangent"}
+    // uv runs 0 to 1 across the whole terrain
+    Layout layout({{QUANTIZED3, "vertex"},
+                   {PACKED_NORMAL, "normal"},
+                   {PACKED_COLOR, "color"},
+                   {UNORM16x2, "uv"},
+                   {PACKED_NORMAL, "tangent"}
                    });
 
-    assert(heights.size() == normals.size() && normals.size() == tangents.size());
-    for(int x = 0; x < heights.size(); x++){ 
-        for(int z = 0; z < heights[0].size(); z++) {
-            glm::vec3 pos = {x * xstep, heights[x][z], z * zstep};
-            glm::vec3 normal = normals[x][z];
-            glm::vec3 tangent = tangents[x][z];
+    int nx = field.Width(), nz = field.Depth();
+    std::vector<float> vertices;
+    std::vector<unsigned int> indices;
+    vertices.reserve(static_cast<size_t>(nx) * nz * 14);
+    indices.reserve(static_cast<size_t>(nx - 1) * (nz - 1) * 6);
+
+    const glm::vec3 right = {1.0, 0.0, 0.0};
+    for (int z = 0; z < nz; z++) {
+        for (int x = 0; x < nx; x++) {
+            glm::vec3 pos = {x * xstep, field.Height(x, z), z * zstep};
+            glm::vec3 normal = field.Normal(x, z);
+            // the last row and column never got a tangent worked out
+            glm::vec3 tangent = right;
+            if (x < nx - 1 && z < nz - 1) {
+                glm::vec3 estimate = glm::cross(right, normal); //original estimate of tangent
+                tangent = glm::cross(estimate, normal); // get closer to the true tangent
+            }
             // color impassable regions magenta
             glm::vec3 color = {Colors::SeaBlue};
-            if(obstacles[glm::clamp(x-1, 0, (int)obstacles.size())][glm::clamp(z-1, 0, (int)obstacles[0].size())]) {
+            if(field.Obstacle(glm::max(x-1, 0), glm::max(z-1, 0))) {
                 color = Colors::Magenta;
             }
-            if(impassable[glm::clamp(x-1, 0, (int)impassable.size())][glm::clamp(z-1, 0, (int)impassable[0].size())]) {
-                
+            if(field.Impassable(glm::max(x-1, 0), glm::max(z-1, 0))) {
                 color = Colors::Yellow;
             }
-            glm::vec2 uv = uvs[x][z];
+            glm::vec2 uv = {
+                (x*xstep)/xwidth,
+                (z*zstep)/zwidth
+            };
 
             APPEND_VEC3(vertices, pos);
             APPEND_VEC3(vertices, normal);
@@ -356,42 +559,68 @@ void Terrain::GenerateMesh() {
         }
     }
 
-// triangulate the grid of points
-    for (int z = 0; z < num_zsteps - 1; z++) {
-        for (int x = 0; x < num_xsteps - 1; x++) {
-            indices.push_back(GIX(x, z, num_xsteps));
-            indices.push_back(GIX(x + 1, z + 1, num_xsteps));
-            indices.push_back(GIX(x, z + 1, num_xsteps));
+// triangulate the grid of points, vertices are row major now
+    for (int z = 0; z < nz - 1; z++) {
+        for (int x = 0; x < nx - 1; x++) {
+            indices.push_back(GIX(x, z, nx));
+            indices.push_back(GIX(x + 1, z + 1, nx));
+            indices.push_back(GIX(x + 1, z, nx));
 
-            indices.push_back(GIX(x, z, num_xsteps));
-            indices.push_back(GIX(x + 1, z, num_xsteps));
-            indices.push_back(GIX(x + 1, z + 1, num_xsteps));
+            indices.push_back(GIX(x, z, nx));
+            indices.push_back(GIX(x, z + 1, nx));
+            indices.push_back(GIX(x + 1, z + 1, nx));
         }
     }
 
-    game->resman.AddMesh(mesh_id, vertices, indices, layout);
+    game->resman.AddMesh(mesh_id, std::move(vertices), std::move(indices), layout);
+}
+
+void Terrain::GenerateChunks() {
+    lod.Build(game->resman, mesh_id, field, xstep, zstep, height_bounds, height_bounds_dims);
+}
+
+bool Terrain::CustomDraw(Shader* shd, const glm::mat4& view_proj, const glm::vec3& eye, RenderPass pass) {
+    if (!chunked || lod.Empty()) {
+        return false;
+    }
+    const glm::mat4& world = transform.GetWorldMatrixNoScale();
+    glm::vec3 local_eye = glm::vec3(glm::inverse(world) * glm::vec4(eye, 1.0f));
+
+    if (pass == RenderPass::DEPTH) {
+        // the plain depth shader doesn't morph, the shadows have to match what's drawn
+        shd = game->resman.GetShader("S_TerrainDepth");
+        if (!shd) {
+            return true;
+        }
+        shd->Use();
+        shd->SetUniform4m(world, "world_mat");
+        shd->SetUniform4m(view_proj, "light_mat");
+    }
+    shd->SetUniform2f(glm::vec2(xwidth, zwidth), "terrain_size");
+    lod.Draw(game->resman, shd, view_proj * world, local_eye);
+    return true;
 }
 
 float Terrain::SampleHeight(float x, float z) {
-    float terrainX = x / (xwidth / (heights.size() - 1)) + (num_xsteps / 2.0);
-    float terrainZ = z / (zwidth / (heights[0].size() - 1)) + (num_zsteps / 2.0);
+    float terrainX = x / (xwidth / (field.Width() - 1)) + (num_xsteps / 2.0);
+    float terrainZ = z / (zwidth / (field.Depth() - 1)) + (num_zsteps / 2.0);
 
     // Get the integer coordinates of the cell
     int x0 = static_cast<int>(std::floor(terrainX));
     int z0 = static_cast<int>(std::floor(terrainZ));
 
     // Clamp the coordinates to be within valid range
-    x0 = glm::clamp(x0, 0, static_cast<int>(heights.size()) - 2);
-    z0 = glm::clamp(z0, 0, static_cast<int>(heights[0].size()) - 2);
+    x0 = glm::clamp(x0, 0, field.Width() - 2);
+    z0 = glm::clamp(z0, 0, field.Depth() - 2);
 
     // Get the fractional part of the coordinates
     float sx = terrainX - static_cast<float>(x0);
     float sz = terrainZ - static_cast<float>(z0);
 
-    float h00 = heights[x0][z0];
-    float h10 = heights[x0 + 1][z0];
-    float h01 = heights[x0][z0 + 1];
-    float h11 = heights[x0 + 1][z0 + 1];
+    float h00 = field.Height(x0, z0);
+    float h10 = field.Height(x0 + 1, z0);
+    float h01 = field.Height(x0, z0 + 1);
+    float h11 = field.Height(x0 + 1, z0 + 1);
 
     float h0 = (1 - sx) * h00 + sx * h10;
     float h1 = (1 - sx) * h01 + sx * h11;
@@ -400,43 +629,287 @@ float Terrain::SampleHeight(float x, float z) {
     return interp + transform.GetPosition().y;
 }
 
+void Terrain::LoadCell(float x, float z, CellCache& cache, float& sx, float& sz) {
+    float terrainX = x / (xwidth / (field.Width() - 1)) + (num_xsteps / 2.0);
+    float terrainZ = z / (zwidth / (field.Depth() - 1)) + (num_zsteps / 2.0);
+
+    int x0 = static_cast<int>(std::floor(terrainX));
+    int z0 = static_cast<int>(std::floor(terrainZ));
+    x0 = glm::clamp(x0, 0, field.Width() - 2);
+    z0 = glm::clamp(z0, 0, field.Depth() - 2);
+
+    sx = terrainX - static_cast<float>(x0);
+    sz = terrainZ - static_cast<float>(z0);
+
+    if (x0 == cache.x0 && z0 == cache.z0 && cache.revision == revision) {
+        return;
+    }
+    cache.x0 = x0;
+    cache.z0 = z0;
+    cache.revision = revision;
+    cache.h[0] = field.Height(x0, z0);
+    cache.h[1] = field.Height(x0 + 1, z0);
+    cache.h[2] = field.Height(x0, z0 + 1);
+    cache.h[3] = field.Height(x0 + 1, z0 + 1);
+    cache.n[0] = field.Normal(x0, z0);
+    cache.n[1] = field.Normal(x0 + 1, z0);
+    cache.n[2] = field.Normal(x0, z0 + 1);
+    cache.n[3] = field.Normal(x0 + 1, z0 + 1);
+}
+
+float Terrain::SampleHeight(float x, float z, CellCache& cache) {
+    float sx, sz;
+    LoadCell(x, z, cache, sx, sz);
+    float h0 = (1 - sx) * cache.h[0] + sx * cache.h[1];
+    float h1 = (1 - sx) * cache.h[2] + sx * cache.h[3];
+    float interp = (1 - sz) * h0 + sz * h1;
+    return interp + transform.GetPosition().y;
+}
+
+glm::vec3 Terrain::SampleNormal(float x, float z, CellCache& cache) {
+    float sx, sz;
+    LoadCell(x, z, cache, sx, sz);
+    glm::vec3 n0 = (1 - sx) * cache.n[0] + sx * cache.n[1];
+    glm::vec3 n1 = (1 - sx) * cache.n[2] + sx * cache.n[3];
+    return glm::normalize((1 - sz) * n0 + sz * n1);
+}
+
+#ifdef TERRAIN_SIMD
+void Terrain::LoadCells(const glm::vec2* xz, int x0[4], int z0[4], __m128& sx, __m128& sz) {
+    // split four (x, z) pairs into x and z lanes
+    __m128 a = _mm_loadu_ps(&xz[0].x);
+    __m128 b = _mm_loadu_ps(&xz[2].x);
+    __m128 px = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+    __m128 pz = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+
+    // the scalar path adds the half grid in double, do the same to get the same bits
+    auto to_grid = [](__m128 p, float cell, double half) {
+        __m128 q = _mm_div_ps(p, _mm_set1_ps(cell));
+        __m128d lo = _mm_add_pd(_mm_cvtps_pd(q), _mm_set1_pd(half));
+        __m128d hi = _mm_add_pd(_mm_cvtps_pd(_mm_movehl_ps(q, q)), _mm_set1_pd(half));
+        return _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi));
+    };
+    __m128 tx = to_grid(px, xwidth / (field.Width() - 1), num_xsteps / 2.0);
+    __m128 tz = to_grid(pz, zwidth / (field.Depth() - 1), num_zsteps / 2.0);
+
+    // floor without SSE4.1, then clamp while the cells are still exact floats
+    auto cell = [](__m128 t, int last) {
+        __m128i i = _mm_cvttps_epi32(t);
+        __m128 f = _mm_cvtepi32_ps(i);
+        i = _mm_add_epi32(i, _mm_castps_si128(_mm_cmpgt_ps(f, t)));
+        f = _mm_cvtepi32_ps(i);
+        return _mm_min_ps(_mm_max_ps(f, _mm_setzero_ps()), _mm_set1_ps(static_cast<float>(last)));
+    };
+    __m128 cx = cell(tx, field.Width() - 2);
+    __m128 cz = cell(tz, field.Depth() - 2);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(x0), _mm_cvttps_epi32(cx));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(z0), _mm_cvttps_epi32(cz));
+
+    sx = _mm_sub_ps(tx, cx);
+    sz = _mm_sub_ps(tz, cz);
+}
+
+TERRAIN_AVX2 size_t Terrain::SampleHeightsAVX2(const glm::vec2* xz, float* heights, size_t count) {
+    const float* base = field.HeightRow(0);
+    const __m256i stride = _mm256_set1_epi32(field.Stride());
+    const __m256i right = _mm256_set1_epi32(1);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 offset = _mm256_set1_ps(transform.GetPosition().y);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 px, pz;
+        Split8(&xz[i], px, pz);
+        __m256 tx = ToGrid8(px, xwidth / (field.Width() - 1), num_xsteps / 2.0);
+        __m256 tz = ToGrid8(pz, zwidth / (field.Depth() - 1), num_zsteps / 2.0);
+        __m256 cx = Cell8(tx, field.Width() - 2);
+        __m256 cz = Cell8(tz, field.Depth() - 2);
+        __m256 sx = _mm256_sub_ps(tx, cx);
+        __m256 sz = _mm256_sub_ps(tz, cz);
+
+        __m256i i00 = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_cvttps_epi32(cz), stride), _mm256_cvttps_epi32(cx));
+        __m256i i01 = _mm256_add_epi32(i00, stride);
+        __m256 h00 = _mm256_i32gather_ps(base, i00, 4);
+        __m256 h10 = _mm256_i32gather_ps(base, _mm256_add_epi32(i00, right), 4);
+        __m256 h01 = _mm256_i32gather_ps(base, i01, 4);
+        __m256 h11 = _mm256_i32gather_ps(base, _mm256_add_epi32(i01, right), 4);
+
+        // same operations in the same order as SampleHeight, and no fma
+        __m256 rx = _mm256_sub_ps(one, sx);
+        __m256 h0 = _mm256_add_ps(_mm256_mul_ps(rx, h00), _mm256_mul_ps(sx, h10));
+        __m256 h1 = _mm256_add_ps(_mm256_mul_ps(rx, h01), _mm256_mul_ps(sx, h11));
+        __m256 interp = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(one, sz), h0), _mm256_mul_ps(sz, h1));
+        _mm256_storeu_ps(&heights[i], _mm256_add_ps(interp, offset));
+    }
+    return i;
+}
+
+TERRAIN_AVX2 size_t Terrain::SampleNormalsAVX2(const glm::vec2* xz, glm::vec3* normals, size_t count) {
+    // normals are three floats each, gathered a component at a time
+    const float* base = &field.NormalRow(0)->x;
+    const __m256i stride = _mm256_set1_epi32(field.Stride());
+    const __m256i right = _mm256_set1_epi32(1);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 px, pz;
+        Split8(&xz[i], px, pz);
+        __m256 tx = ToGrid8(px, xwidth / (field.Width() - 1), num_xsteps / 2.0);
+        __m256 tz = ToGrid8(pz, zwidth / (field.Depth() - 1), num_zsteps / 2.0);
+        __m256 cx = Cell8(tx, field.Width() - 2);
+        __m256 cz = Cell8(tz, field.Depth() - 2);
+        __m256 sx = _mm256_sub_ps(tx, cx);
+        __m256 sz = _mm256_sub_ps(tz, cz);
+        __m256 rx = _mm256_sub_ps(one, sx);
+        __m256 rz = _mm256_sub_ps(one, sz);
+
+        __m256i i00 = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_cvttps_epi32(cz), stride), _mm256_cvttps_epi32(cx));
+        __m256i i01 = _mm256_add_epi32(i00, stride);
+        __m256i corner[4] = {i00, _mm256_add_epi32(i00, right), i01, _mm256_add_epi32(i01, right)};
+        for (int k = 0; k < 4; k++) {
+            corner[k] = _mm256_add_epi32(corner[k], _mm256_add_epi32(corner[k], corner[k]));
+        }
+
+        __m256 n[3];
+        for (int c = 0; c < 3; c++) {
+            __m256i comp = _mm256_set1_epi32(c);
+            __m256 n00 = _mm256_i32gather_ps(base, _mm256_add_epi32(corner[0], comp), 4);
+            __m256 n10 = _mm256_i32gather_ps(base, _mm256_add_epi32(corner[1], comp), 4);
+            __m256 n01 = _mm256_i32gather_ps(base, _mm256_add_epi32(corner[2], comp), 4);
+            __m256 n11 = _mm256_i32gather_ps(base, _mm256_add_epi32(corner[3], comp), 4);
+            __m256 n0 = _mm256_add_ps(_mm256_mul_ps(rx, n00), _mm256_mul_ps(sx, n10));
+            __m256 n1 = _mm256_add_ps(_mm256_mul_ps(rx, n01), _mm256_mul_ps(sx, n11));
+            n[c] = _mm256_add_ps(_mm256_mul_ps(rz, n0), _mm256_mul_ps(sz, n1));
+        }
+        // glm::normalize is v * (1 / sqrt(dot(v, v)))
+        __m256 len2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(n[0], n[0]), _mm256_mul_ps(n[1], n[1])), _mm256_mul_ps(n[2], n[2]));
+        __m256 inv = _mm256_div_ps(one, _mm256_sqrt_ps(len2));
+        float out[3][8];
+        for (int c = 0; c < 3; c++) {
+            _mm256_storeu_ps(out[c], _mm256_mul_ps(n[c], inv));
+        }
+        for (int k = 0; k < 8; k++) {
+            normals[i + k] = {out[0][k], out[1][k], out[2][k]};
+        }
+    }
+    return i;
+}
+#endif
+
+void Terrain::SampleHeights(const glm::vec2* xz, float* heights, size_t count) {
+    size_t i = 0;
+#ifdef TERRAIN_SIMD
+    if (has_avx2) {
+        i = SampleHeightsAVX2(xz, heights, count);
+    }
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 offset = _mm_set1_ps(transform.GetPosition().y);
+    for (; i + 4 <= count; i += 4) {
+        int x0[4], z0[4];
+        __m128 sx, sz;
+        LoadCells(&xz[i], x0, z0, sx, sz);
+
+        float h[4][4];
+        for (int k = 0; k < 4; k++) {
+            h[0][k] = field.Height(x0[k], z0[k]);
+            h[1][k] = field.Height(x0[k] + 1, z0[k]);
+            h[2][k] = field.Height(x0[k], z0[k] + 1);
+            h[3][k] = field.Height(x0[k] + 1, z0[k] + 1);
+        }
+        // same operations in the same order as SampleHeight
+        __m128 rx = _mm_sub_ps(one, sx);
+        __m128 h0 = _mm_add_ps(_mm_mul_ps(rx, _mm_loadu_ps(h[0])), _mm_mul_ps(sx, _mm_loadu_ps(h[1])));
+        __m128 h1 = _mm_add_ps(_mm_mul_ps(rx, _mm_loadu_ps(h[2])), _mm_mul_ps(sx, _mm_loadu_ps(h[3])));
+        __m128 interp = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(one, sz), h0), _mm_mul_ps(sz, h1));
+        _mm_storeu_ps(&heights[i], _mm_add_ps(interp, offset));
+    }
+#endif
+    for (; i < count; i++) {
+        heights[i] = SampleHeight(xz[i].x, xz[i].y);
+    }
+}
+
+void Terrain::SampleNormals(const glm::vec2* xz, glm::vec3* normals, size_t count) {
+    size_t i = 0;
+#ifdef TERRAIN_SIMD
+    if (has_avx2) {
+        i = SampleNormalsAVX2(xz, normals, count);
+    }
+    const __m128 one = _mm_set1_ps(1.0f);
+    for (; i + 4 <= count; i += 4) {
+        int x0[4], z0[4];
+        __m128 sx, sz;
+        LoadCells(&xz[i], x0, z0, sx, sz);
+        __m128 rx = _mm_sub_ps(one, sx);
+        __m128 rz = _mm_sub_ps(one, sz);
+
+        // one component of all four normals at a time
+        __m128 n[3];
+        for (int c = 0; c < 3; c++) {
+            float corner[4][4];
+            for (int k = 0; k < 4; k++) {
+                corner[0][k] = field.Normal(x0[k], z0[k])[c];
+                corner[1][k] = field.Normal(x0[k] + 1, z0[k])[c];
+                corner[2][k] = field.Normal(x0[k], z0[k] + 1)[c];
+                corner[3][k] = field.Normal(x0[k] + 1, z0[k] + 1)[c];
+            }
+            __m128 n0 = _mm_add_ps(_mm_mul_ps(rx, _mm_loadu_ps(corner[0])), _mm_mul_ps(sx, _mm_loadu_ps(corner[1])));
+            __m128 n1 = _mm_add_ps(_mm_mul_ps(rx, _mm_loadu_ps(corner[2])), _mm_mul_ps(sx, _mm_loadu_ps(corner[3])));
+            n[c] = _mm_add_ps(_mm_mul_ps(rz, n0), _mm_mul_ps(sz, n1));
+        }
+        // glm::normalize is v * (1 / sqrt(dot(v, v)))
+        __m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(n[0], n[0]), _mm_mul_ps(n[1], n[1])), _mm_mul_ps(n[2], n[2]));
+        __m128 inv = _mm_div_ps(one, _mm_sqrt_ps(len2));
+        float out[3][4];
+        for (int c = 0; c < 3; c++) {
+            _mm_storeu_ps(out[c], _mm_mul_ps(n[c], inv));
+        }
+        for (int k = 0; k < 4; k++) {
+            normals[i + k] = {out[0][k], out[1][k], out[2][k]};
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        normals[i] = SampleNormal(xz[i].x, xz[i].y);
+    }
+}
+
 bool Terrain::SamplePassable(float x, float z) {
-    float terrainX = x / (xwidth / (impassable.size() - 1)) + (num_xsteps / 2.0);
-    float terrainZ = z / (zwidth / (impassable[0].size() - 1)) + (num_zsteps / 2.0);
+    float terrainX = x / (xwidth / (field.Width() - 1)) + (num_xsteps / 2.0);
+    float terrainZ = z / (zwidth / (field.Depth() - 1)) + (num_zsteps / 2.0);
 
     // Get the integer coordinates of the cell
     int x0 = static_cast<int>(std::floor(terrainX));
     int z0 = static_cast<int>(std::floor(terrainZ));
 
     // Clamp the coordinates to be within valid range
-    x0 = glm::clamp(x0, 0, static_cast<int>(impassable.size() - 1));
-    z0 = glm::clamp(z0, 0, static_cast<int>(impassable[0].size() - 1));
+    x0 = glm::clamp(x0, 0, static_cast<int>(field.Width() - 1));
+    z0 = glm::clamp(z0, 0, static_cast<int>(field.Depth() - 1));
 
-    return impassable[x0][z0];
+    return field.Impassable(x0, z0);
 }
 
 
 float Terrain::SampleSlope(float x, float z, glm::vec3 dir) {
-    float terrainX = x / (xwidth / (heights.size() - 1)) + (num_xsteps / 2.0);
-    float terrainZ = z / (zwidth / (heights[0].size() - 1)) + (num_zsteps / 2.0);
+    float terrainX = x / (xwidth / (field.Width() - 1)) + (num_xsteps / 2.0);
+    float terrainZ = z / (zwidth / (field.Depth() - 1)) + (num_zsteps / 2.0);
 
     // Get the integer coordinates of the cell
     int x0 = static_cast<int>(std::floor(terrainX));
     int z0 = static_cast<int>(std::floor(terrainZ));
 
     // Clamp the coordinates to be within valid range
-    x0 = glm::clamp(x0, 0, static_cast<int>(heights.size()) - 2);
-    z0 = glm::clamp(z0, 0, static_cast<int>(heights[0].size()) - 2);
+    x0 = glm::clamp(x0, 0, field.Width() - 2);
+    z0 = glm::clamp(z0, 0, field.Depth() - 2);
 
     // Get the fractional part of the coordinates
     float sx = terrainX - static_cast<float>(x0);
     float sz = terrainZ - static_cast<float>(z0);
 
     // Perform bilinear interpolation
-    glm::vec3 n00 = normals[x0][z0];
-    glm::vec3 n10 = normals[x0 + 1][z0];
-    glm::vec3 n01 = normals[x0][z0 + 1];
-    glm::vec3 n11 = normals[x0 + 1][z0 + 1];
+    glm::vec3 n00 = field.Normal(x0, z0);
+    glm::vec3 n10 = field.Normal(x0 + 1, z0);
+    glm::vec3 n01 = field.Normal(x0, z0 + 1);
+    glm::vec3 n11 = field.Normal(x0 + 1, z0 + 1);
 
     glm::vec3 n0 = (1 - sx) * n00 + sx * n10;
     glm::vec3 n1 = (1 - sx) * n01 + sx * n11;
@@ -455,26 +928,26 @@ float Terrain::SampleSlope(float x, float z, glm::vec3 dir) {
 }
 
 glm::vec3 Terrain::SampleNormal(float x, float z) {
-    float terrainX = x / (xwidth / (heights.size() - 1)) + (num_xsteps / 2.0);
-    float terrainZ = z / (zwidth / (heights[0].size() - 1)) + (num_zsteps / 2.0);
+    float terrainX = x / (xwidth / (field.Width() - 1)) + (num_xsteps / 2.0);
+    float terrainZ = z / (zwidth / (field.Depth() - 1)) + (num_zsteps / 2.0);
 
     // Get the integer coordinates of the cell
     int x0 = static_cast<int>(std::floor(terrainX));
     int z0 = static_cast<int>(std::floor(terrainZ));
 
     // Clamp the coordinates to be within valid range
-    x0 = glm::clamp(x0, 0, static_cast<int>(heights.size()) - 2);
-    z0 = glm::clamp(z0, 0, static_cast<int>(heights[0].size()) - 2);
+    x0 = glm::clamp(x0, 0, field.Width() - 2);
+    z0 = glm::clamp(z0, 0, field.Depth() - 2);
 
     // Get the fractional part of the coordinates
     float sx = terrainX - static_cast<float>(x0);
     float sz = terrainZ - static_cast<float>(z0);
 
     // Perform bilinear interpolation
-    glm::vec3 n00 = normals[x0][z0];
-    glm::vec3 n10 = normals[x0 + 1][z0];
-    glm::vec3 n01 = normals[x0][z0 + 1];
-    glm::vec3 n11 = normals[x0 + 1][z0 + 1];
+    glm::vec3 n00 = field.Normal(x0, z0);
+    glm::vec3 n10 = field.Normal(x0 + 1, z0);
+    glm::vec3 n01 = field.Normal(x0, z0 + 1);
+    glm::vec3 n11 = field.Normal(x0 + 1, z0 + 1);
 
     glm::vec3 n0 = (1 - sx) * n00 + sx * n10;
     glm::vec3 n1 = (1 - sx) * n01 + sx * n11;
@@ -482,26 +955,336 @@ glm::vec3 Terrain::SampleNormal(float x, float z) {
 }
 
 glm::vec3 Terrain::InterpNormals(int x0, int z0, float sx, float sz) {
-    glm::vec3 n00 = normals[x0][z0];
-    glm::vec3 n10 = normals[x0 + 1][z0];
-    glm::vec3 n01 = normals[x0][z0 + 1];
-    glm::vec3 n11 = normals[x0 + 1][z0 + 1];
+    return BlendNormals(field.Normal(x0, z0), field.Normal(x0 + 1, z0), field.Normal(x0, z0 + 1), field.Normal(x0 + 1, z0 + 1), sx, sz);
+}
 
-    glm::vec3 n0 = (1 - sx) * n00 + sx * n10;
-    glm::vec3 n1 = (1 - sx) * n01 + sx * n11;
-    glm::vec3 interp = glm::normalize((1 - sz) * n0 + sz * n1);
-    return interp;
+
+void Terrain::GenerateHeightBounds() {
+    height_bounds.clear();
+    height_bounds_dims.clear();
+    int cx = field.Width() - 1;
+    int cz = field.Depth() - 1;
+    if (cx < 1 || cz < 1) {
+        return;
+    }
+
+    // a bilinear cell never leaves the range of its 4 corners
+    std::vector<glm::vec2> level(cx * cz);
+    ThreadPool::Get().ParallelFor(cz, TERRAIN_ROW_GRAIN * 4, [&](size_t begin, size_t end, unsigned) {
+        for (int z = static_cast<int>(begin); z < static_cast<int>(end); z++) {
+            const float* row0 = field.HeightRow(z);
+            const float* row1 = field.HeightRow(z + 1);
+            for (int x = 0; x < cx; x++) {
+                float a = row0[x], b = row0[x + 1], c = row1[x], d = row1[x + 1];
+                level[z * cx + x] = {glm::min(glm::min(a, b), glm::min(c, d)), glm::max(glm::max(a, b), glm::max(c, d))};
+            }
+        }
+    });
+    height_bounds.push_back(std::move(level));
+    height_bounds_dims.push_back({cx, cz});
+
+    while (height_bounds_dims.back().x > 1 || height_bounds_dims.back().y > 1) {
+        const std::vector<glm::vec2>& below = height_bounds.back();
+        glm::ivec2 bd = height_bounds_dims.back();
+        glm::ivec2 dims = {(bd.x + 1) / 2, (bd.y + 1) / 2};
+        std::vector<glm::vec2> up(dims.x * dims.y, glm::vec2(FLT_MAX, -FLT_MAX));
+        for (int z = 0; z < bd.y; z++) {
+            for (int x = 0; x < bd.x; x++) {
+                glm::vec2& n = up[(z / 2) * dims.x + x / 2];
+                const glm::vec2& c = below[z * bd.x + x];
+                n.x = glm::min(n.x, c.x);
+                n.y = glm::max(n.y, c.y);
+            }
+        }
+        height_bounds.push_back(std::move(up));
+        height_bounds_dims.push_back(dims);
+    }
+}
+
+void Terrain::UpdateHeightBounds(int x0, int z0, int x1, int z1) {
+    if (height_bounds.empty()) {
+        return;
+    }
+    // cells touching a changed sample, then their parents up the tree
+    glm::ivec2 lo = {glm::max(x0 - 1, 0), glm::max(z0 - 1, 0)};
+    glm::ivec2 hi = glm::min(glm::ivec2(x1, z1), height_bounds_dims[0] - 1);
+    std::vector<glm::vec2>& level = height_bounds[0];
+    int cx = height_bounds_dims[0].x;
+    for (int z = lo.y; z <= hi.y; z++) {
+        const float* row0 = field.HeightRow(z);
+        const float* row1 = field.HeightRow(z + 1);
+        for (int x = lo.x; x <= hi.x; x++) {
+            float a = row0[x], b = row0[x + 1], c = row1[x], d = row1[x + 1];
+            level[z * cx + x] = {glm::min(glm::min(a, b), glm::min(c, d)), glm::max(glm::max(a, b), glm::max(c, d))};
+        }
+    }
+
+    for (size_t l = 1; l < height_bounds.size(); l++) {
+        const std::vector<glm::vec2>& below = height_bounds[l - 1];
+        glm::ivec2 bd = height_bounds_dims[l - 1];
+        glm::ivec2 dims = height_bounds_dims[l];
+        lo /= 2;
+        hi /= 2;
+        for (int z = lo.y; z <= hi.y; z++) {
+            for (int x = lo.x; x <= hi.x; x++) {
+                glm::vec2 n = glm::vec2(FLT_MAX, -FLT_MAX);
+                for (int cz = z * 2; cz < glm::min(z * 2 + 2, bd.y); cz++) {
+                    for (int cx = x * 2; cx < glm::min(x * 2 + 2, bd.x); cx++) {
+                        const glm::vec2& c = below[cz * bd.x + cx];
+                        n.x = glm::min(n.x, c.x);
+                        n.y = glm::max(n.y, c.y);
+                    }
+                }
+                height_bounds[l][z * dims.x + x] = n;
+            }
+        }
+    }
 }
 
+void Terrain::Deform(const glm::vec3& center, float radius, float depth) {
+    if (radius <= 0.0f || field.Empty()) {
+        return;
+    }
+    float terrainX = center.x / (xwidth / (field.Width() - 1)) + (num_xsteps / 2.0);
+    float terrainZ = center.z / (zwidth / (field.Depth() - 1)) + (num_zsteps / 2.0);
+    float rx = radius / xstep, rz = radius / zstep;
+    int x0 = glm::max(static_cast<int>(std::floor(terrainX - rx)), 0);
+    int z0 = glm::max(static_cast<int>(std::floor(terrainZ - rz)), 0);
+    int x1 = glm::min(static_cast<int>(std::ceil(terrainX + rx)), field.Width() - 1);
+    int z1 = glm::min(static_cast<int>(std::ceil(terrainZ + rz)), field.Depth() - 1);
+    if (x0 > x1 || z0 > z1) {
+        return;
+    }
+
+    for (int z = z0; z <= z1; z++) {
+        for (int x = x0; x <= x1; x++) {
+            float d = glm::length(glm::vec2((x - terrainX) * xstep, (z - terrainZ) * zstep)) / radius;
+            if (d < 1.0f) {
+                float falloff = 1.0f - d * d;
+                field.Height(x, z) -= depth * falloff * falloff;
+            }
+        }
+    }
+
+    // normals reach one sample out, the obstacle test one more
+    GenerateSurface(x0 - 1, z0 - 1, x1 + 1, z1 + 1);
+    UpdateHeightBounds(x0, z0, x1, z1);
+    nav_dirty = true;
+    revision++;
+    if (chunked) {
+        lod.UpdateRegion(field, x0 - 1, z0 - 1, x1 + 1, z1 + 1, height_bounds, height_bounds_dims);
+    } else {
+        GenerateMesh();
+    }
+}
+
+NavGrid& Terrain::GetNavGrid() {
+    if (nav_dirty) {
+        nav.Build(field);
+        nav_dirty = false;
+        // the per entrance cost fields make this tens of MB on big maps, say so
+        std::cout << "Nav grid " << name << ": " << nav.NumNodes() << " nodes, " << nav.NumEdges() << " edges, "
+                  << nav.MemoryUsage() / 1024 << " KB" << std::endl;
+    }
+    return nav;
+}
+
+glm::ivec2 Terrain::NavCell(float x, float z) {
+    float terrainX = x / (xwidth / (field.Width() - 1)) + (num_xsteps / 2.0);
+    float terrainZ = z / (zwidth / (field.Depth() - 1)) + (num_zsteps / 2.0);
+    return glm::ivec2(static_cast<int>(std::floor(terrainX)), static_cast<int>(std::floor(terrainZ)));
+}
+
+glm::vec3 Terrain::NavPoint(glm::ivec2 cell) {
+    float x = (cell.x + 0.5f - num_xsteps / 2.0f) * (xwidth / (field.Width() - 1));
+    float z = (cell.y + 0.5f - num_zsteps / 2.0f) * (zwidth / (field.Depth() - 1));
+    return glm::vec3(x, SampleHeight(x, z), z);
+}
+
+bool Terrain::RaycastCell(int x, int z, const glm::vec3& o, const glm::vec3& d, float t0, float t1, float& t) {
+    // along the ray the bilinear patch is a quadratic in t, solve it exactly
+    float h00 = field.Height(x, z);
+    float h10 = field.Height(x + 1, z);
+    float h01 = field.Height(x, z + 1);
+    float h11 = field.Height(x + 1, z + 1);
+    float B = h10 - h00, C = h01 - h00, D = h00 - h10 - h01 + h11;
+    float ax = o.x - x, az = o.z - z;
+
+    float c0 = o.y - h00 - B * ax - C * az - D * ax * az;
+    float c1 = d.y - B * d.x - C * d.z - D * (ax * d.z + az * d.x);
+    float c2 = -D * d.x * d.z;
+    auto f = [&](float s) { return c0 + (c1 + c2 * s) * s; };
+
+    if (f(t0) <= 0.0f) {
+        t = t0;
+        return true;
+    }
+    float roots[2];
+    int n = 0;
+    if (glm::abs(c2) < 1e-9f) {
+        if (c1 != 0.0f) {
+            roots[n++] = -c0 / c1;
+        }
+    } else {
+        float disc = c1 * c1 - 4.0f * c2 * c0;
+        if (disc >= 0.0f) {
+            float sq = glm::sqrt(disc);
+            float r0 = (-c1 - sq) / (2.0f * c2);
+            float r1 = (-c1 + sq) / (2.0f * c2);
+            roots[n++] = glm::min(r0, r1);
+            roots[n++] = glm::max(r0, r1);
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        if (roots[i] >= t0 && roots[i] <= t1) {
+            t = roots[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Terrain::Raycast(const glm::vec3& origin, const glm::vec3& dir, float max_t, float& t) {
+    if (height_bounds.empty()) {
+        return false;
+    }
+    // same mapping SampleHeight uses, t is unchanged by it
+    float cellx = xwidth / (field.Width() - 1);
+    float cellz = zwidth / (field.Depth() - 1);
+    float ox = origin.x / cellx + (num_xsteps / 2.0);
+    float oz = origin.z / cellz + (num_zsteps / 2.0);
+    glm::vec3 o = {ox, origin.y - transform.GetPosition().y, oz};
+    glm::vec3 d = {dir.x / cellx, dir.y, dir.z / cellz};
+    for (int i = 0; i < 3; i++) {
+        if (glm::abs(d[i]) < 1e-12f) {
+            d[i] = d[i] < 0.0f ? -1e-12f : 1e-12f;
+        }
+    }
+    glm::vec3 inv = 1.0f / d;
+
+    const glm::ivec2 cells = height_bounds_dims[0];
+    auto box = [&](int level, int i, int j, float& tn, float& tf) {
+        int x0 = i << level, z0 = j << level;
+        int x1 = glm::min((i + 1) << level, cells.x), z1 = glm::min((j + 1) << level, cells.y);
+        const glm::vec2& mm = height_bounds[level][j * height_bounds_dims[level].x + i];
+        glm::vec3 ta = (glm::vec3(x0, mm.x, z0) - o) * inv;
+        glm::vec3 tb = (glm::vec3(x1, mm.y, z1) - o) * inv;
+        glm::vec3 lo = glm::min(ta, tb), hi = glm::max(ta, tb);
+        tn = glm::max(glm::max(lo.x, lo.y), glm::max(lo.z, 0.0f));
+        tf = glm::min(glm::min(hi.x, hi.y), glm::min(hi.z, max_t));
+        return tn <= tf;
+    };
+
+    struct Item { int level, i, j; };
+    std::vector<Item> stack;
+    stack.push_back({static_cast<int>(height_bounds.size()) - 1, 0, 0});
+    float best = max_t;
+    bool found = false;
+    // visit children nearest first along the ray's xz direction
+    int fx = d.x < 0.0f ? 1 : 0, fz = d.z < 0.0f ? 1 : 0;
+    while (!stack.empty()) {
+        Item it = stack.back();
+        stack.pop_back();
+        float tn, tf;
+        if (!box(it.level, it.i, it.j, tn, tf) || tn > best) {
+            continue;
+        }
+        if (it.level == 0) {
+            float th;
+            if (RaycastCell(it.i, it.j, o, d, tn, glm::min(tf, best), th) && th < best) {
+                best = th;
+                found = true;
+            }
+            continue;
+        }
+        glm::ivec2 dims = height_bounds_dims[it.level - 1];
+        // pushed far to near so the near child is popped first
+        static const int order[4][2] = {{1, 1}, {1, 0}, {0, 1}, {0, 0}};
+        for (const auto& c : order) {
+            int ci = it.i * 2 + (c[0] ^ fx), cj = it.j * 2 + (c[1] ^ fz);
+            if (ci < dims.x && cj < dims.y) {
+                stack.push_back({it.level - 1, ci, cj});
+            }
+        }
+    }
+    if (found) {
+        t = best;
+    }
+    return found;
+}
+
+bool Terrain::SweepSphere(const glm::vec3& origin, const glm::vec3& dir, float radius, float max_t, float& t, glm::vec3& point, glm::vec3& normal) {
+    if (height_bounds.empty()) {
+        return false;
+    }
+    CellCache cache;
+    // distance from the centre at s to the plane tangent under it, less the radius
+    auto gap = [&](float s, glm::vec3& n) {
+        glm::vec3 c = origin + dir * s;
+        if (!SampleOn(c.x, c.z)) {
+            return FLT_MAX;
+        }
+        n = SampleNormal(c.x, c.z, cache);
+        return (c.y - SampleHeight(c.x, c.z, cache)) * n.y - radius;
+    };
+
+    // nothing to touch until the bottom of the sphere comes down to the highest sample
+    float s = 0.0f;
+    float top = height_bounds.back()[0].y + transform.GetPosition().y;
+    if (origin.y - radius > top) {
+        if (dir.y >= 0.0f) {
+            return false;
+        }
+        s = (origin.y - radius - top) / -dir.y;
+    }
+    float cell = glm::min(xwidth / (field.Width() - 1), zwidth / (field.Depth() - 1));
+    float step = glm::max(glm::min(cell, radius) * 0.5f, 1e-3f);
+
+    glm::vec3 n;
+    if (s > max_t) {
+        return false;
+    }
+    if (gap(s, n) > 0.0f) {
+        bool crossed = false;
+        while (s < max_t) {
+            float next = glm::min(s + step, max_t);
+            if (gap(next, n) <= 0.0f) {
+                // the gap shrinks smoothly across one short step, bisect down to the contact
+                float lo = s, hi = next;
+                for (int i = 0; i < 16; i++) {
+                    float mid = (lo + hi) * 0.5f;
+                    glm::vec3 nm;
+                    if (gap(mid, nm) <= 0.0f) {
+                        hi = mid;
+                    } else {
+                        lo = mid;
+                    }
+                }
+                s = hi;
+                gap(s, n);
+                crossed = true;
+                break;
+            }
+            s = next;
+        }
+        if (!crossed) {
+            return false;
+        }
+    }
+    t = s;
+    normal = n;
+    point = origin + dir * s - n * radius;
+    return true;
+}
 
 bool Terrain::SampleOn(float x , float z)
 {
-    float terrainX = x / (xwidth / (heights.size() - 1)) + (num_xsteps / 2.0);
-    float terrainZ = z / (zwidth / (heights[0].size() - 1)) + (num_zsteps / 2.0);
+    float terrainX = x / (xwidth / (field.Width() - 1)) + (num_xsteps / 2.0);
+    float terrainZ = z / (zwidth / (field.Depth() - 1)) + (num_zsteps / 2.0);
 
     // Get the integer coordinates of the cell
     int x0 = static_cast<int>(std::floor(terrainX));
     int z0 = static_cast<int>(std::floor(terrainZ));
-    return x0 > 0 && x0 < static_cast<int>(heights.size()) && z0 > 0 && z0  < static_cast<int>(heights[0].size());
+    return x0 > 0 && x0 < field.Width() && z0 > 0 && z0  < field.Depth();
 
 }
\ No newline at end of file
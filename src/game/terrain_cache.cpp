@@ -0,0 +1,59 @@
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "terrain_cache.h"
+#include "heightfield.h"
+#include "cache_file.h"
+#include "mapped_file.h"
+
+namespace {
+    struct Header {
+        CacheFile::Prefix prefix;
+        int32_t width;
+        int32_t depth;
+        uint64_t payload_size;
+        uint64_t checksum;
+    };
+
+    const char MAGIC[4] = {'D', 'N', 'A', 'H'};
+}
+
+namespace TerrainCache {
+
+std::string PathFor(uint64_t key) {
+    return CacheFile::PathFor("terrain", key, "bin");
+}
+
+bool Load(uint64_t key, int width, int depth, Heightfield& field) {
+    MappedFile file;
+    Header header;
+    if (!CacheFile::Open(file, PathFor(key), CacheFile::MakePrefix(MAGIC, VERSION, key), header, "Terrain")) {
+        return false;
+    }
+    const unsigned char* payload = file.Data() + sizeof(Header);
+    if (header.width != width || header.depth != depth || header.payload_size != file.Size() - sizeof(Header)) {
+        std::cout << "Terrain cache: stale entry " << PathFor(key) << std::endl;
+        return false;
+    }
+    if (!CacheFile::Verify(payload, header.payload_size, header.checksum, PathFor(key), "Terrain")) {
+        return false;
+    }
+    return field.ReadRaw(width, depth, payload, header.payload_size);
+}
+
+bool Save(uint64_t key, const Heightfield& field) {
+    std::vector<unsigned char> payload;
+    payload.reserve(field.RawSize());
+    field.WriteRaw(payload);
+
+    Header header;
+    header.prefix = CacheFile::MakePrefix(MAGIC, VERSION, key);
+    header.width = field.Width();
+    header.depth = field.Depth();
+    header.payload_size = payload.size();
+    header.checksum = CacheFile::Hash(payload.data(), payload.size());
+    return CacheFile::Write(PathFor(key), &header, sizeof(header), payload.data(), payload.size(), "Terrain");
+}
+
+}
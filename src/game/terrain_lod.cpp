@@ -0,0 +1,237 @@
+#include "terrain_lod.h"
+#include "resource_manager.h"
+#include "frustum.h"
+
+#include <algorithm>
+
+// cells along one side of a level 0 chunk, power of two so chunks line up with height_bounds
+#define TERRAIN_CHUNK_CELLS 16
+#define TERRAIN_CHUNK_SHIFT 4
+// how far a level reaches in its own chunk widths, has to stay over 1 + sqrt(2)
+// so neighbouring chunks never end up more than one level apart
+#define TERRAIN_LOD_RANGE 3.0f
+// fraction of the range where the morph to the next level starts
+#define TERRAIN_MORPH_START 0.7f
+// both have to match the array sizes in terrain_vp and terrain_depth_vp,
+// 128 chunks keeps under the 1024 uniform components GL 3.3 promises
+#define TERRAIN_MAX_LEVELS 16
+#define TERRAIN_CHUNKS_PER_DRAW 128
+#define TERRAIN_HEIGHT_UNIT 3
+#define TERRAIN_NORMAL_UNIT 4
+
+namespace {
+    unsigned int MakeTexture(GLint internal_format, int width, int height, GLenum format, GLenum type) {
+        unsigned int id;
+        glGenTextures(1, &id);
+        // keep off the units the material textures use
+        glActiveTexture(GL_TEXTURE0 + TERRAIN_HEIGHT_UNIT);
+        glBindTexture(GL_TEXTURE_2D, id);
+        glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, type, nullptr);
+        // only ever read with texelFetch
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        return id;
+    }
+}
+
+void TerrainLOD::Build(ResourceManager& resman, const std::string& prefix, const Heightfield& field, float xstep, float zstep,
+                       const std::vector<std::vector<glm::vec2>>& height_bounds, const std::vector<glm::ivec2>& bounds_dims) {
+    levels.clear();
+    int nx = field.Width(), nz = field.Depth();
+    if (nx < 2 || nz < 2 || height_bounds.empty()) {
+        return;
+    }
+    grid_dims = {nx, nz};
+    cell_size = {xstep, zstep};
+
+    int top = 0;
+    while ((TERRAIN_CHUNK_CELLS << top) < std::max(nx, nz) - 1 && top < TERRAIN_MAX_LEVELS - 1) {
+        top++;
+    }
+    float chunk_size = TERRAIN_CHUNK_CELLS * std::max(xstep, zstep);
+
+    for (int l = 0; l <= top; l++) {
+        Level level;
+        level.range = TERRAIN_LOD_RANGE * chunk_size * (1 << l);
+        // nothing above the top level to morph into
+        level.morph = l < top ? glm::vec2(TERRAIN_MORPH_START * level.range, level.range) : glm::vec2(1e30f, 2e30f);
+
+        int span = TERRAIN_CHUNK_CELLS << l;
+        level.dims = {(nx - 1 + span - 1) / span, (nz - 1 + span - 1) / span};
+        for (int j = 0; j < level.dims.y; j++) {
+            for (int i = 0; i < level.dims.x; i++) {
+                Chunk c;
+                c.origin = {i * span, j * span};
+                int x1 = std::min(c.origin.x + span, nx - 1), z1 = std::min(c.origin.y + span, nz - 1);
+                c.lo = {c.origin.x * xstep, 0.0f, c.origin.y * zstep};
+                c.hi = {x1 * xstep, 0.0f, z1 * zstep};
+                level.chunks.push_back(c);
+            }
+        }
+        levels.push_back(std::move(level));
+    }
+    UpdateBounds(height_bounds, bounds_dims);
+
+    // the one patch every chunk is drawn with, grid coordinates only
+    std::vector<float> vertices;
+    std::vector<unsigned int> indices;
+    const unsigned int row = TERRAIN_CHUNK_CELLS + 1;
+    for (unsigned int b = 0; b < row; b++) {
+        for (unsigned int a = 0; a < row; a++) {
+            vertices.insert(vertices.end(), {float(a), float(b)});
+        }
+    }
+    // same diagonal as the full mesh so the morph targets line up
+    for (unsigned int b = 0; b < TERRAIN_CHUNK_CELLS; b++) {
+        for (unsigned int a = 0; a < TERRAIN_CHUNK_CELLS; a++) {
+            indices.push_back(b * row + a);
+            indices.push_back((b + 1) * row + a + 1);
+            indices.push_back(b * row + a + 1);
+
+            indices.push_back(b * row + a);
+            indices.push_back((b + 1) * row + a);
+            indices.push_back((b + 1) * row + a + 1);
+        }
+    }
+    patch_id = prefix + "_Patch";
+    resman.AddMesh(patch_id, std::move(vertices), std::move(indices), Layout({{FLOAT2, "grid"}}));
+
+    height_tex = Texture(MakeTexture(GL_R32F, nx, nz, GL_RED, GL_FLOAT));
+    height_tex.gl_texture_type = GL_TEXTURE_2D;
+    normal_tex = Texture(MakeTexture(GL_RGBA8_SNORM, nx, nz, GL_RGBA, GL_BYTE));
+    normal_tex.gl_texture_type = GL_TEXTURE_2D;
+    UpdateRegion(field, 0, 0, nx - 1, nz - 1, height_bounds, bounds_dims);
+}
+
+void TerrainLOD::UpdateRegion(const Heightfield& field, int x0, int z0, int x1, int z1,
+                              const std::vector<std::vector<glm::vec2>>& height_bounds, const std::vector<glm::ivec2>& bounds_dims) {
+    if (levels.empty()) {
+        return;
+    }
+    x0 = std::max(x0, 0);
+    z0 = std::max(z0, 0);
+    x1 = std::min(x1, grid_dims.x - 1);
+    z1 = std::min(z1, grid_dims.y - 1);
+    if (x0 > x1 || z0 > z1) {
+        return;
+    }
+
+    // heights go up straight out of the padded rows
+    glActiveTexture(GL_TEXTURE0 + TERRAIN_HEIGHT_UNIT);
+    glBindTexture(GL_TEXTURE_2D, height_tex.id);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, field.Stride());
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x0, z0, x1 - x0 + 1, z1 - z0 + 1, GL_RED, GL_FLOAT, field.HeightRow(z0) + x0);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+    UploadNormals(field, x0, z0, x1, z1);
+    UpdateBounds(height_bounds, bounds_dims);
+}
+
+void TerrainLOD::UploadNormals(const Heightfield& field, int x0, int z0, int x1, int z1) {
+    int w = x1 - x0 + 1, h = z1 - z0 + 1;
+    std::vector<signed char> packed(static_cast<size_t>(w) * h * 4);
+    signed char* out = packed.data();
+    for (int z = z0; z <= z1; z++) {
+        const glm::vec3* row = field.NormalRow(z);
+        for (int x = x0; x <= x1; x++) {
+            glm::vec3 n = glm::clamp(row[x], -1.0f, 1.0f) * 127.0f;
+            *out++ = static_cast<signed char>(glm::round(n.x));
+            *out++ = static_cast<signed char>(glm::round(n.y));
+            *out++ = static_cast<signed char>(glm::round(n.z));
+            *out++ = 0;
+        }
+    }
+    glActiveTexture(GL_TEXTURE0 + TERRAIN_NORMAL_UNIT);
+    glBindTexture(GL_TEXTURE_2D, normal_tex.id);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x0, z0, w, h, GL_RGBA, GL_BYTE, packed.data());
+}
+
+void TerrainLOD::UpdateBounds(const std::vector<std::vector<glm::vec2>>& height_bounds, const std::vector<glm::ivec2>& bounds_dims) {
+    for (int l = 0; l < NumLevels(); l++) {
+        Level& level = levels[l];
+        int k = std::min(l + TERRAIN_CHUNK_SHIFT, static_cast<int>(height_bounds.size()) - 1);
+        const std::vector<glm::vec2>& bounds = height_bounds[k];
+        glm::ivec2 bdims = bounds_dims[k];
+        for (int j = 0; j < level.dims.y; j++) {
+            for (int i = 0; i < level.dims.x; i++) {
+                Chunk& c = level.chunks[j * level.dims.x + i];
+                const glm::vec2& mm = bounds[std::min(j, bdims.y - 1) * bdims.x + std::min(i, bdims.x - 1)];
+                c.lo.y = mm.x;
+                c.hi.y = mm.y;
+            }
+        }
+    }
+}
+
+void TerrainLOD::Select(int l, int i, int j, const glm::vec3& eye, std::vector<Selected>& out) const {
+    const Level& level = levels[l];
+    if (i >= level.dims.x || j >= level.dims.y) {
+        return;
+    }
+    unsigned int index = j * level.dims.x + i;
+    const Chunk& c = level.chunks[index];
+
+    // distance on the ground only, the shader morphs by the same measure
+    float dx = std::max(std::max(c.lo.x - eye.x, eye.x - c.hi.x), 0.0f);
+    float dz = std::max(std::max(c.lo.z - eye.z, eye.z - c.hi.z), 0.0f);
+    if (l == 0 || glm::length(glm::vec2(dx, dz)) >= levels[l - 1].range) {
+        out.push_back({l, index});
+        return;
+    }
+    for (int cj = 0; cj < 2; cj++) {
+        for (int ci = 0; ci < 2; ci++) {
+            Select(l - 1, i * 2 + ci, j * 2 + cj, eye, out);
+        }
+    }
+}
+
+void TerrainLOD::Draw(ResourceManager& resman, Shader* shd, const glm::mat4& view_proj, const glm::vec3& eye) {
+    chunks_drawn = 0;
+    triangles_drawn = 0;
+    Mesh* patch = resman.GetMesh(patch_id);
+    if (levels.empty() || !patch) {
+        return;
+    }
+
+    selection.clear();
+    const Level& top = levels.back();
+    for (int j = 0; j < top.dims.y; j++) {
+        for (int i = 0; i < top.dims.x; i++) {
+            Select(NumLevels() - 1, i, j, eye, selection);
+        }
+    }
+
+    Frustum frustum(view_proj);
+    instances.clear();
+    for (const Selected& s : selection) {
+        const Chunk& c = levels[s.level].chunks[s.chunk];
+        if (frustum.Visible(c.lo, c.hi)) {
+            instances.push_back({float(c.origin.x), float(c.origin.y), float(s.level), 0.0f});
+        }
+    }
+    if (instances.empty()) {
+        return;
+    }
+
+    shd->SetUniform3f(eye, "lod_eye");
+    for (int l = 0; l < NumLevels(); l++) {
+        shd->SetUniform2f(levels[l].morph, "lod_morph[" + std::to_string(l) + "]");
+    }
+    shd->SetUniform2f(glm::vec2(grid_dims), "grid_dims");
+    shd->SetUniform2f(cell_size, "cell_size");
+    height_tex.Bind(shd, TERRAIN_HEIGHT_UNIT, "height_map");
+    normal_tex.Bind(shd, TERRAIN_NORMAL_UNIT, "terrain_normals");
+
+    const size_t patch_triangles = TERRAIN_CHUNK_CELLS * TERRAIN_CHUNK_CELLS * 2;
+    for (size_t first = 0; first < instances.size(); first += TERRAIN_CHUNKS_PER_DRAW) {
+        int count = static_cast<int>(std::min<size_t>(TERRAIN_CHUNKS_PER_DRAW, instances.size() - first));
+        shd->SetUniform4fv(&instances[first], count, "chunks");
+        patch->DrawRange(0, patch_triangles * 3, count);
+    }
+    chunks_drawn = instances.size();
+    triangles_drawn = instances.size() * patch_triangles;
+}